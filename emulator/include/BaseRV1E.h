@@ -9,6 +9,263 @@
 #ifndef EMULATOR_H
 #define EMULATOR_H
 
-void BRV1E_Run(const char *mem_image);
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* RAM is a whole number of 1 KB pages, up to 256 MB where the boot ROM
+ * starts */
+#define BRV1E_RAM_PAGE_SIZE     (0x400U)
+#define BRV1E_RAM_MAX_SIZE      (0x10000000U)
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+/* An emulated SoC. Contexts are independent and can run on separate threads. */
+typedef struct brv1e_ctx brv1e_ctx_t;
+
+typedef enum {
+    BRV1E_STATUS_RUNNING,   /* The instruction budget ran out or the context was stopped */
+    BRV1E_STATUS_HALTED     /* The guest exited or raised an exception */
+} brv1e_status_t;
+
+/* Why the guest halted. The core has no exception traps, so an exception
+ * halts the guest at the instruction that raised it. */
+typedef enum {
+    BRV1E_HALT_NONE,                /* The guest has not halted */
+    BRV1E_HALT_EXIT,                /* The guest wrote the exit register or made an exit ecall */
+    BRV1E_HALT_FETCH_FAULT,         /* The PC left RAM and the boot ROM or became odd */
+    BRV1E_HALT_ILLEGAL_INSTRUCTION,
+    BRV1E_HALT_LOAD_FAULT,          /* A load from unmapped or write-only memory */
+    BRV1E_HALT_STORE_FAULT          /* A store to unmapped or read-only memory */
+} brv1e_halt_reason_t;
+
+typedef struct {
+    brv1e_halt_reason_t reason;
+
+    /* The guest's exit code when it exited */
+    uint32_t            exit_code;
+
+    /* The instruction that exited or raised the exception */
+    uint32_t            pc;
+
+    /* The faulting address, or the instruction for an illegal instruction */
+    uint32_t            tval;
+} brv1e_halt_t;
+
+/* Emulator options */
+typedef struct {
+    /* Binary trace output file. Tracing is disabled when NULL. */
+    const char *trace_file;
+
+    /* Frequency of the virtual clock driving the core and the timer. The
+     * Basys3 100 MHz clock is used when 0. */
+    unsigned int clk_freq_hz;
+
+    /* Non-zero to pace execution to the wall clock instead of running as
+     * fast as the host allows. */
+    int realtime;
+
+    /* Non-zero to translate guest code into host code. Ignored when the
+     * translator was not compiled in. Tracing and profiling run on the
+     * interpreter. */
+    int jit;
+
+    /* File the UART transmits to. stdout is used when NULL. */
+    const char *uart_tx_file;
+
+    /* Non-zero to discard UART output instead */
+    int uart_tx_discard;
+
+    /* Non-zero to feed stdin to the UART receiver. Only one context can
+     * receive from stdin at a time. */
+    int uart_stdin;
+
+    /* File, named pipe or, prefixed with "unix:", Unix socket path the UART
+     * receives from. Takes the place of stdin when set. */
+    const char *uart_rx_file;
+
+    /* Baud rate the UART receives at, in 10-bit frames of the virtual clock.
+     * Bytes arrive as fast as they are read when 0. */
+    unsigned int uart_baud;
+
+    /* Non-zero to start executing the loaded program at its entry point
+     * instead of in the boot ROM, for images that are not sent over the
+     * UART */
+    int direct_boot;
+
+    /* Flat profile output file. Profiling is enabled when this or
+     * profile_folded_file is set, and runs on the interpreter. */
+    const char *profile_file;
+
+    /* Folded call stack output file for flame graphs */
+    const char *profile_folded_file;
+
+    /* Instructions between profile samples. 1000 is used when 0. */
+    unsigned int profile_period;
+
+    /* ELF file to name profiled functions from when the program is not
+     * loaded from one, e.g. when it is sent over the UART. The loaded
+     * program is used when NULL. */
+    const char *profile_symbols;
+
+    /* Size of RAM in bytes, a multiple of BRV1E_RAM_PAGE_SIZE up to
+     * BRV1E_RAM_MAX_SIZE. 2 KB, as on the SoC, when 0. Host memory is only
+     * committed for the parts the guest touches. */
+    unsigned int ram_size;
+} brv1e_opts_t;
+
+/* ----------------------------------------------------------------------------
+ * Public Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Run the emulator until the guest halts. The
+ *              UART is connected to stdin and stdout unless opts names other
+ *              files.
+ * @param[in]   mem_image The program image to load into RAM. When NULL,
+ *              "program.txt" is used, or nothing is loaded if the UART
+ *              receives from a file.
+ * @param[in]   opts The emulator options. Defaults are used when NULL.
+*/
+void BRV1E_Run(const char *mem_image, const brv1e_opts_t *opts);
+
+/**
+ * @brief       Create an emulator context.
+ * @param[in]   opts The emulator options. Defaults are used when NULL. The
+ *              strings must outlive the context.
+ * @return      The context, or NULL if it could not be allocated or the RAM
+ *              size is invalid.
+*/
+brv1e_ctx_t *BRV1E_Create(const brv1e_opts_t *opts);
+
+/**
+ * @brief       Load a program into RAM. When direct booting, the PC is set to
+ *              the program's entry point: the __reset symbol of an ELF
+ *              executable or the start of RAM for a raw image.
+ * @param[in]   ctx The context.
+ * @param[in]   mem_image An ELF32 executable or a raw program image.
+ * @return      0 on success, -1 if the image could not be read or does not fit
+ *              in RAM.
+*/
+int BRV1E_Load(brv1e_ctx_t *ctx, const char *mem_image);
+
+/**
+ * @brief       Execute the boot ROM until it jumps to the program it received
+ *              over the UART. Returns straight away for direct-booted
+ *              contexts.
+ * @param[in]   ctx The context.
+ * @return      BRV1E_STATUS_HALTED if the guest halted, otherwise
+ *              BRV1E_STATUS_RUNNING.
+*/
+brv1e_status_t BRV1E_Boot(brv1e_ctx_t *ctx);
+
+/**
+ * @brief       Save the machine state (registers, PC, counters, CSRs, RAM,
+ *              timer, UART and DMA registers, and the bytes waiting in the
+ *              UART FIFOs) to a snapshot file. All-zero RAM is left as holes
+ *              in the file.
+ * @param[in]   ctx The context.
+ * @param[in]   snapshot The snapshot file.
+ * @return      0 on success, -1 if the file could not be written.
+*/
+int BRV1E_Save(const brv1e_ctx_t *ctx, const char *snapshot);
+
+/**
+ * @brief       Restore the machine state from a snapshot file. RAM is mapped
+ *              copy-on-write from the file rather than read. Received bytes
+ *              from the snapshot are read before the context's own input.
+ * @param[in]   ctx The context.
+ * @param[in]   snapshot A snapshot saved by the same emulator build with the
+ *              same RAM size.
+ * @return      0 on success, -1 if the file could not be read or is not a
+ *              compatible snapshot.
+*/
+int BRV1E_Restore(brv1e_ctx_t *ctx, const char *snapshot);
+
+/**
+ * @brief       Create a context that continues from the current state of
+ *              another. Forks taken without running the parent in between
+ *              share RAM copy-on-write. The parent must not run while it is
+ *              being forked.
+ * @param[in]   ctx The parent context.
+ * @param[in]   opts Options for the new context, as for BRV1E_Create(). The
+ *              RAM size is always the parent's.
+ * @return      The new context, or NULL if it could not be created.
+*/
+brv1e_ctx_t *BRV1E_Fork(brv1e_ctx_t *ctx, const brv1e_opts_t *opts);
+
+/**
+ * @brief       Execute instructions.
+ * @param[in]   ctx The context.
+ * @param[in]   num_insts The number of instructions to execute. Fewer
+ *              execute only if the guest halts or the context is stopped,
+ *              with or without the JIT.
+ * @return      BRV1E_STATUS_HALTED if the guest halted, otherwise
+ *              BRV1E_STATUS_RUNNING.
+*/
+brv1e_status_t BRV1E_Step(brv1e_ctx_t *ctx, uint64_t num_insts);
+
+/**
+ * @brief       Execute instructions until the guest halts or the context is
+ *              stopped.
+ * @param[in]   ctx The context.
+ * @return      BRV1E_STATUS_HALTED if the guest halted, otherwise
+ *              BRV1E_STATUS_RUNNING.
+*/
+brv1e_status_t BRV1E_RunContext(brv1e_ctx_t *ctx);
+
+/**
+ * @brief       Stop a context from another thread or a signal handler. A
+ *              running BRV1E_Step() or BRV1E_RunContext() returns within
+ *              65536 instructions, or within a millisecond while the guest
+ *              waits in wfi, and later calls return straight away.
+ * @param[in]   ctx The context.
+*/
+void BRV1E_Stop(brv1e_ctx_t *ctx);
+
+/**
+ * @brief       Get why the guest halted.
+ * @param[in]   ctx The context.
+ * @param[out]  halt The reason and where it happened. The reason is
+ *              BRV1E_HALT_NONE while the guest has not halted.
+*/
+void BRV1E_GetHalt(const brv1e_ctx_t *ctx, brv1e_halt_t *halt);
+
+/**
+ * @brief       Get the number of instructions executed.
+ * @param[in]   ctx The context.
+*/
+uint64_t BRV1E_GetInstCount(const brv1e_ctx_t *ctx);
+
+/**
+ * @brief       Get the number of virtual clock cycles elapsed.
+ * @param[in]   ctx The context.
+*/
+uint64_t BRV1E_GetCycleCount(const brv1e_ctx_t *ctx);
+
+/**
+ * @brief       Parse a RAM size given on the command line: a number of bytes,
+ *              optionally followed by K or M.
+ * @param[in]   arg The option's argument.
+ * @param[out]  ram_size The size in bytes, for brv1e_opts_t.
+ * @return      NULL on success, otherwise why the size is not valid: it is
+ *              not a number, has another suffix, is 0, is not a whole number
+ *              of pages or is over the maximum.
+*/
+const char *BRV1E_ParseRAMSize(const char *arg, unsigned int *ram_size);
+
+/**
+ * @brief       Destroy a context, flushing its UART output and trace.
+ * @param[in]   ctx The context. Nothing is done when NULL.
+*/
+void BRV1E_Destroy(brv1e_ctx_t *ctx);
 
 #endif /* EMULATOR_H */
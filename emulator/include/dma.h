@@ -0,0 +1,124 @@
+/**
+ * @file    dma.h
+ * @brief   Header file for the DMA engine
+ *
+ * Fills and copies happen as soon as they are started, and the engine then
+ * reports busy for as many cycles as the SoC's DMA would take, so guests see
+ * the same completion times. UART transfers move each byte into RAM once it
+ * has arrived, whenever the guest touches the DMA registers.
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef DMA_H
+#define DMA_H
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdint.h>
+
+#include "mem.h"
+#include "uart.h"
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Location of the DMA registers */
+#define RV_DMA_BASE             (0x40000000U)
+#define RV_DMA_SIZE             (0x20U)
+
+/* DMA register offsets */
+#define RV_DMA_SRC              (0x00U)
+#define RV_DMA_DST              (0x04U)
+#define RV_DMA_LEN              (0x08U)
+#define RV_DMA_FILL             (0x0CU)
+#define RV_DMA_CTRL             (0x10U)
+
+/* Commands written to the control register */
+#define RV_DMA_CMD_FILL         (1U)
+#define RV_DMA_CMD_COPY         (2U)
+#define RV_DMA_CMD_UART_RX      (3U)
+
+/* Status bits read from the control register */
+#define RV_DMA_STATUS_BUSY      (1U << 0)
+#define RV_DMA_STATUS_ERROR     (1U << 1)
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Called after the DMA writes guest RAM, so predecoded and
+ *              translated code there can be dropped.
+ * @param[in]   ctx The context passed to rv_InitDMA().
+ * @param[in]   addr The first address written.
+ * @param[in]   len The number of bytes written.
+*/
+typedef void (*rv_dma_written_fn_t)(void *ctx, uint32_t addr, uint32_t len);
+
+typedef struct {
+    /* Registers */
+    uint32_t            src;
+    uint32_t            dst;
+    uint32_t            len;
+    uint32_t            fill;
+    int                 error;
+
+    /* The UART transfer in progress, if any */
+    int                 receiving;
+
+    /* Virtual cycle count when the fill or copy in progress completes */
+    uint64_t            done_cycles;
+
+    uint8_t             *ram;
+    uint32_t            ram_size;
+    rv_uart_t           *uart;
+
+    rv_dma_written_fn_t written;
+    void                *written_ctx;
+} rv_dma_t;
+
+/* ----------------------------------------------------------------------------
+ * Public Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Initialize the DMA engine and map its registers.
+ * @param[in]   dma The DMA engine.
+ * @param[in]   mem The memory map to map the registers into.
+ * @param[in]   ram Guest RAM, starting at address 0.
+ * @param[in]   ram_size The size of guest RAM in bytes.
+ * @param[in]   uart The UART that UART transfers receive from.
+ * @param[in]   written Called after each write to RAM.
+ * @param[in]   written_ctx Passed to written.
+*/
+void rv_InitDMA(rv_dma_t *dma, rv_mem_t *mem, uint8_t *ram, uint32_t ram_size, rv_uart_t *uart,
+                rv_dma_written_fn_t written, void *written_ctx);
+
+/**
+ * @brief       Read from the DMA engine.
+ * @param[in]   dev The DMA engine.
+ * @param[in]   offset The offset of the register to read.
+ * @param[in]   cycles The current virtual cycle count.
+ * @return      The 32-bit register containing offset, shifted so that the
+ *              byte at offset is the least significant byte. 0 is returned if
+ *              the offset was invalid.
+*/
+uint32_t rv_DMARead(void *dev, uint32_t offset, uint64_t cycles);
+
+/**
+ * @brief       Write to the DMA engine. Writing a command to the control
+ *              register starts a transfer. Writes while busy are ignored.
+ * @param[in]   dev The DMA engine.
+ * @param[in]   offset The offset of the register to write.
+ * @param[in]   write_data The data to write.
+ * @param[in]   width The access width in bytes.
+ * @param[in]   cycles The current virtual cycle count.
+*/
+void rv_DMAWrite(void *dev, uint32_t offset, uint32_t write_data, uint32_t width, uint64_t cycles);
+
+#endif /* DMA_H */
@@ -0,0 +1,112 @@
+/**
+ * @file    jit.h
+ * @brief   Header file for the rv32i to x86-64 basic block translator
+ *
+ * Basic blocks of guest code in RAM and the boot ROM are translated into
+ * host code the first time they run. Translated code handles RAM accesses
+ * inline and returns to the interpreter for anything else (MMIO, faults,
+ * stores to code), which executes that one instruction before translated
+ * code resumes. Counted loops (see loop.h) are retired in closed form
+ * before their block runs, and run as translated code once the closed form
+ * declines them.
+ *
+ * RAM is divided into code pages. A page is marked once anything in it has
+ * been translated or predecoded, and stores to marked pages go through the
+ * interpreter so that stale code can be dropped.
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef JIT_H
+#define JIT_H
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdint.h>
+
+#include "rv_core.h"
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Code pages are 64 bytes so that data next to code rarely shares a page */
+#define RV_JIT_PAGE_SHIFT       (6U)
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+/* Translator state for one emulator context */
+typedef struct rv_jit rv_jit_t;
+
+/* ----------------------------------------------------------------------------
+ * Public Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Initialize the translator.
+ * @param[in]   cpu The guest state translated code operates on.
+ * @param[in]   ram Guest RAM, starting at address 0.
+ * @param[in]   ram_size The size of guest RAM in bytes.
+ * @param[in]   rom The boot ROM.
+ * @param[in]   rom_base The address of the boot ROM.
+ * @param[in]   rom_size The size of the boot ROM in bytes.
+ * @return      The translator, or NULL if memory for translated code could
+ *              not be allocated or the translator was not compiled in.
+*/
+rv_jit_t *rv_InitJIT(rv_cpu_t *cpu, uint8_t *ram, uint32_t ram_size,
+                     const uint32_t *rom, uint32_t rom_base, uint32_t rom_size);
+
+/**
+ * @brief       Free the translator and all translated code.
+ * @param[in]   jit The translator. Nothing is done when NULL.
+*/
+void rv_UninitJIT(rv_jit_t *jit);
+
+/**
+ * @brief       Run translated code until the instruction count reaches
+ *              inst_limit or an instruction needs the interpreter.
+ * @param[in]   jit The translator.
+ * @param[in]   inst_limit The instruction count to stop at. A block is only
+ *              run if it cannot overshoot it.
+ * @return      0 if inst_limit was reached, 1 if the interpreter must
+ *              execute the instruction at the PC, because it needs the
+ *              interpreter or the next block would run past inst_limit.
+ *              Counted loops are retired in closed form here.
+*/
+int rv_JITExecute(rv_jit_t *jit, uint64_t inst_limit);
+
+/**
+ * @brief       Mark the code page containing a RAM address as holding code.
+ * @param[in]   jit The translator.
+ * @param[in]   addr The RAM address.
+*/
+void rv_JITMarkCode(rv_jit_t *jit, uint32_t addr);
+
+/**
+ * @brief       Check whether a RAM address is in a code page.
+ * @param[in]   jit The translator.
+ * @param[in]   addr The RAM address.
+ * @return      Non-zero if the page is marked as holding code.
+*/
+int rv_JITIsCode(const rv_jit_t *jit, uint32_t addr);
+
+/**
+ * @brief       Drop translated blocks overlapping the code page containing a
+ *              RAM address and unmark the page.
+ * @param[in]   jit The translator.
+ * @param[in]   addr The RAM address.
+*/
+void rv_JITInvalidate(rv_jit_t *jit, uint32_t addr);
+
+/**
+ * @brief       Drop all translated blocks and unmark every code page.
+ * @param[in]   jit The translator.
+*/
+void rv_JITInvalidateAll(rv_jit_t *jit);
+
+#endif /* JIT_H */
@@ -0,0 +1,88 @@
+/**
+ * @file    loader.h
+ * @brief   Header file for the program image loader
+ *
+ * Programs are loaded into RAM either from an ELF32 executable linked with
+ * software/system/ram.ld or from a raw binary image copied to the start of
+ * RAM. The function symbols of an ELF executable can be read separately to
+ * symbolize guest addresses.
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef LOADER_H
+#define LOADER_H
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* The symbol firmware starts at */
+#define RV_LOADER_ENTRY_SYMBOL  "__reset"
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+/* A function symbol */
+typedef struct {
+    uint32_t    addr;
+    uint32_t    size;   /* Extends to the next symbol when the ELF gives 0 */
+    char        *name;
+} rv_symbol_t;
+
+/* ----------------------------------------------------------------------------
+ * Public Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Load a program into RAM. ELF files have their PT_LOAD segments
+ *              copied to their physical addresses and the rest of each
+ *              segment (.bss) zero-filled. Any other file is a raw image
+ *              copied to the start of RAM.
+ * @param[in]   path The program file.
+ * @param[in]   ram Guest RAM, starting at address 0.
+ * @param[in]   ram_size The size of guest RAM in bytes.
+ * @param[out]  entry The address of the __reset symbol, or the ELF entry
+ *              point if there is no such symbol. 0 for raw images.
+ * @return      0 on success, -1 if the file could not be read, is not a
+ *              little-endian RV32 executable or does not fit in RAM.
+*/
+int rv_LoadProgram(const char *path, uint8_t *ram, uint32_t ram_size, uint32_t *entry);
+
+/**
+ * @brief       Read the function symbols of an ELF executable: STT_FUNC
+ *              symbols and global labels in executable sections.
+ * @param[in]   path The ELF file.
+ * @param[out]  symbols The symbols sorted by address, without duplicate
+ *              addresses. Free with rv_FreeSymbols().
+ * @param[out]  num_symbols The number of symbols.
+ * @return      0 on success, -1 if the file could not be read, is not an ELF32
+ *              file or has no symbol table.
+*/
+int rv_LoadSymbols(const char *path, rv_symbol_t **symbols, uint32_t *num_symbols);
+
+/**
+ * @brief       Free symbols read by rv_LoadSymbols().
+ * @param[in]   symbols The symbols. Nothing is done when NULL.
+ * @param[in]   num_symbols The number of symbols.
+*/
+void rv_FreeSymbols(rv_symbol_t *symbols, uint32_t num_symbols);
+
+/**
+ * @brief       Find the symbol containing an address.
+ * @param[in]   symbols Symbols sorted by address.
+ * @param[in]   num_symbols The number of symbols.
+ * @param[in]   addr The address.
+ * @return      The symbol, or NULL if no symbol contains addr.
+*/
+const rv_symbol_t *rv_FindSymbolByAddr(const rv_symbol_t *symbols, uint32_t num_symbols, uint32_t addr);
+
+#endif /* LOADER_H */
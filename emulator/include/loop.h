@@ -0,0 +1,93 @@
+/**
+ * @file    loop.h
+ * @brief   Header file for closed-form execution of counted loops
+ *
+ * A counted loop is a run of addi instructions that each step a register by
+ * a constant, and nops, closed by a branch back to its first instruction
+ * that compares one stepped register against one the loop does not write:
+ *
+ *     delay:  addi    t0, t0, -1
+ *             bnez    t0, delay
+ *
+ * Such a loop has no effect besides its registers and the time it takes, so
+ * the number of iterations until the branch falls through can be solved for
+ * and any number of them retired at once. The interpreter and the JIT find
+ * loops while decoding and leave them to rv_LoopRun().
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef LOOP_H
+#define LOOP_H
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdint.h>
+
+#include "rv_core.h"
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Most instructions in a loop, including the branch */
+#define RV_LOOP_MAX_INSTS       (8U)
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+/* A counted loop, built an instruction at a time by rv_LoopAppend() */
+typedef struct {
+    uint32_t    start;                      /* Address of the first instruction */
+    uint32_t    end;                        /* Address after the branch */
+    uint32_t    insts;                      /* Instructions per iteration */
+    uint32_t    cycles;                     /* Cycles per iteration */
+    uint32_t    num_steps;
+    uint8_t     step_reg[RV_LOOP_MAX_INSTS];
+    word_t      step[RV_LOOP_MAX_INSTS];    /* Added to step_reg each iteration */
+    uint8_t     op;                         /* The branch */
+    uint8_t     rs1;
+    uint8_t     rs2;
+} rv_loop_t;
+
+/* ----------------------------------------------------------------------------
+ * Public Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Start looking for a counted loop.
+ * @param[out]  loop The loop to build.
+ * @param[in]   start The address of the first instruction.
+*/
+void rv_LoopBegin(rv_loop_t *loop, uint32_t start);
+
+/**
+ * @brief       Add the next instruction to a loop.
+ * @param[in]   loop The loop being built.
+ * @param[in]   pc The address of the instruction, following the previous
+ *              one.
+ * @param[in]   decoded The instruction.
+ * @return      1 if the instruction is the branch that closes a counted loop,
+ *              0 if the loop may carry on, -1 if this is not a counted loop.
+*/
+int rv_LoopAppend(rv_loop_t *loop, uint32_t pc, const rv_decoded_t *decoded);
+
+/**
+ * @brief       Retire as many iterations of a loop as run before it exits
+ *              or the instruction count reaches a limit. Only whole
+ *              iterations are retired, so the count may stop short of the
+ *              limit by less than one.
+ * @param[in]   loop A loop rv_LoopAppend() closed.
+ * @param[in]   cpu The guest state, with the PC at the start of the loop.
+ * @param[in]   inst_limit The instruction count to stop at.
+ * @return      The number of instructions retired. 0 if not even one
+ *              iteration fits, or if the counter wraps around before the
+ *              loop exits and the loop should be run normally.
+*/
+uint64_t rv_LoopRun(const rv_loop_t *loop, rv_cpu_t *cpu, uint64_t inst_limit);
+
+#endif /* LOOP_H */
@@ -0,0 +1,242 @@
+/**
+ * @file    mem.h
+ * @brief   Header file for the guest memory map
+ *
+ * The guest address space is split into pages. Each page points to the
+ * region mapped there: host memory (RAM, ROM), which is accessed directly, or
+ * a device, whose callbacks handle the access. Unmapped pages point to an
+ * empty region so lookups never need a NULL check. A page holds at most one
+ * region, and regions may be smaller than a page. Each emulator context has
+ * its own memory map.
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef MEM_H
+#define MEM_H
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <string.h>
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+#define RV_MEM_PAGE_SHIFT       (16U)
+#define RV_MEM_NUM_PAGES        (1U << (32U - RV_MEM_PAGE_SHIFT))
+
+/* Maximum number of mapped regions */
+#define RV_MEM_MAX_REGIONS      (16U)
+
+/* Region flags */
+#define RV_MEM_WRITE            (1U << 0)   /* Host memory can be written */
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Read a device register.
+ * @param[in]   dev The device the region was mapped with.
+ * @param[in]   offset The offset of the access into the device's region.
+ * @param[in]   cycles The current virtual cycle count.
+ * @return      The data at offset, least significant byte first. Bits beyond
+ *              the access width are ignored.
+*/
+typedef uint32_t (*rv_mem_read_fn_t)(void *dev, uint32_t offset, uint64_t cycles);
+
+/**
+ * @brief       Write a device register.
+ * @param[in]   dev The device the region was mapped with.
+ * @param[in]   offset The offset of the access into the device's region.
+ * @param[in]   write_data The data to write, least significant byte first.
+ * @param[in]   width The access width in bytes.
+ * @param[in]   cycles The current virtual cycle count.
+*/
+typedef void (*rv_mem_write_fn_t)(void *dev, uint32_t offset, uint32_t write_data, uint32_t width, uint64_t cycles);
+
+typedef struct {
+    const char          *name;
+    uint32_t            base;
+    uint32_t            size;
+    uint32_t            flags;  /* RV_MEM_* */
+    uint8_t             *host;  /* Host memory, NULL for devices */
+    rv_mem_read_fn_t    read;
+    rv_mem_write_fn_t   write;
+    void                *dev;   /* Passed to read and write */
+} rv_mem_region_t;
+
+typedef struct {
+    /* The region mapped in each page */
+    const rv_mem_region_t   *page_table[RV_MEM_NUM_PAGES];
+
+    rv_mem_region_t         regions[RV_MEM_MAX_REGIONS];
+    uint32_t                num_regions;
+} rv_mem_t;
+
+/* ----------------------------------------------------------------------------
+ * Public Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Unmap all regions.
+ * @param[in]   mem The memory map.
+*/
+void rv_InitMem(rv_mem_t *mem);
+
+/**
+ * @brief       Map host memory into the guest address space. Host memory can
+ *              be read and executed.
+ * @param[in]   mem The memory map.
+ * @param[in]   name The name of the region.
+ * @param[in]   base The guest address of the region.
+ * @param[in]   size The size of the region in bytes. Must be at least 4.
+ * @param[in]   host The host memory backing the region.
+ * @param[in]   flags RV_MEM_WRITE if the guest can write the region.
+ * @return      0 on success, -1 if the region overlaps a mapped page or too
+ *              many regions are mapped.
+*/
+int rv_MemMapHost(rv_mem_t *mem, const char *name, uint32_t base, uint32_t size, void *host, uint32_t flags);
+
+/**
+ * @brief       Map a device into the guest address space.
+ * @param[in]   mem The memory map.
+ * @param[in]   name The name of the device.
+ * @param[in]   base The guest address of the device's registers.
+ * @param[in]   size The size of the device's registers in bytes.
+ * @param[in]   read Called for loads. Loads fault when NULL.
+ * @param[in]   write Called for stores. Stores fault when NULL.
+ * @param[in]   dev Passed to read and write.
+ * @return      0 on success, -1 if the region overlaps a mapped page or too
+ *              many regions are mapped.
+*/
+int rv_MemMapDevice(rv_mem_t *mem, const char *name, uint32_t base, uint32_t size,
+                    rv_mem_read_fn_t read, rv_mem_write_fn_t write, void *dev);
+
+/**
+ * @brief       Load from a device. Use rv_MemLoad() instead.
+*/
+int rv_MemLoadDevice(const rv_mem_region_t *region, uint32_t offset, uint32_t width,
+                     uint32_t *read_data, uint64_t cycles);
+
+/**
+ * @brief       Store to a device. Use rv_MemStore() instead.
+*/
+int rv_MemStoreDevice(const rv_mem_region_t *region, uint32_t offset, uint32_t width,
+                      uint32_t write_data, uint64_t cycles);
+
+/* ----------------------------------------------------------------------------
+ * Public Inline Function Definitions
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Fetch an instruction from host memory.
+ * @param[in]   mem The memory map.
+ * @param[in]   addr The address to fetch from. Must be halfword aligned.
+ * @param[out]  instr The instruction. Compressed instructions are
+ *              zero-extended from 16 bits.
+ * @return      0 on success, -1 on an access fault.
+*/
+static inline int rv_MemFetch(const rv_mem_t *mem, uint32_t addr, uint32_t *instr) {
+    const rv_mem_region_t *region = mem->page_table[addr >> RV_MEM_PAGE_SHIFT];
+    uint32_t offset = addr - region->base;
+    uint16_t low;
+
+    if ((region->host == NULL) || (offset > region->size - 2U)) {
+        return -1;
+    }
+
+    /* A compressed instruction may be the last halfword of the region */
+    memcpy(&low, region->host + offset, 2U);
+    if ((low & 0b11U) != 0b11U) {
+        *instr = low;
+        return 0;
+    }
+
+    if (offset > region->size - 4U) {
+        return -1;
+    }
+
+    memcpy(instr, region->host + offset, 4U);
+    return 0;
+}
+
+/**
+ * @brief       Load from the guest address space.
+ * @param[in]   mem The memory map.
+ * @param[in]   addr The address to load from.
+ * @param[in]   width The access width in bytes: 1, 2 or 4.
+ * @param[out]  read_data The zero-extended data.
+ * @param[in]   cycles The current virtual cycle count.
+ * @return      0 on success, -1 on an access fault.
+*/
+static inline int rv_MemLoad(const rv_mem_t *mem, uint32_t addr, uint32_t width,
+                             uint32_t *read_data, uint64_t cycles) {
+    const rv_mem_region_t *region = mem->page_table[addr >> RV_MEM_PAGE_SHIFT];
+    uint32_t offset = addr - region->base;
+
+    if ((region->host == NULL) || (offset > region->size - width)) {
+        return rv_MemLoadDevice(region, offset, width, read_data, cycles);
+    }
+
+    switch (width) {
+        case 1U: {
+            *read_data = region->host[offset];
+            break;
+        }
+        case 2U: {
+            uint16_t half;
+            memcpy(&half, region->host + offset, 2U);
+            *read_data = half;
+            break;
+        }
+        default:
+            memcpy(read_data, region->host + offset, 4U);
+            break;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief       Store to the guest address space.
+ * @param[in]   mem The memory map.
+ * @param[in]   addr The address to store to.
+ * @param[in]   width The access width in bytes: 1, 2 or 4.
+ * @param[in]   write_data The data to store. Bits beyond width are ignored.
+ * @param[in]   cycles The current virtual cycle count.
+ * @return      0 on success, -1 on an access fault.
+*/
+static inline int rv_MemStore(const rv_mem_t *mem, uint32_t addr, uint32_t width,
+                              uint32_t write_data, uint64_t cycles) {
+    const rv_mem_region_t *region = mem->page_table[addr >> RV_MEM_PAGE_SHIFT];
+    uint32_t offset = addr - region->base;
+
+    if (!(region->flags & RV_MEM_WRITE) || (offset > region->size - width)) {
+        return rv_MemStoreDevice(region, offset, width, write_data, cycles);
+    }
+
+    switch (width) {
+        case 1U: {
+            region->host[offset] = (uint8_t)write_data;
+            break;
+        }
+        case 2U: {
+            uint16_t half = (uint16_t)write_data;
+            memcpy(region->host + offset, &half, 2U);
+            break;
+        }
+        default:
+            memcpy(region->host + offset, &write_data, 4U);
+            break;
+    }
+
+    return 0;
+}
+
+#endif /* MEM_H */
@@ -0,0 +1,189 @@
+/**
+ * @file    profile.h
+ * @brief   Header file for the sampling guest profiler
+ *
+ * The profiler samples the guest PC every fixed number of retired
+ * instructions. A shadow call stack is kept from calls (jal/jalr writing ra
+ * or t0) and returns (jalr x0 through ra or t0), so each sample records the
+ * chain of functions that led to it. Addresses are mapped to functions with
+ * the symbol table of the ELF executable. Calls without a symbol are named
+ * by their target address.
+ *
+ * When the context is destroyed a flat profile (self and total samples per
+ * function) and folded stacks, one "caller;callee count" line per distinct
+ * stack as read by flamegraph.pl, are written out.
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdint.h>
+
+#include "loader.h"
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Sample period used when none is given, in instructions */
+#define RV_PROFILE_DEFAULT_PERIOD   (1000U)
+
+/* Deepest call stack recorded. Deeper calls are still matched with their
+ * returns but are left out of samples. */
+#define RV_PROFILE_MAX_DEPTH        (64U)
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+/* A frame of the shadow call stack */
+typedef struct {
+    uint32_t    target;     /* Address the call jumped to */
+    uint32_t    ret_addr;   /* Address the call returns to */
+} rv_profile_frame_t;
+
+/* A distinct call stack and how many samples landed in it */
+typedef struct {
+    uint64_t    count;
+    uint32_t    hash;
+    uint32_t    depth;
+    uint32_t    offset;     /* Index of the outermost function in the pool */
+} rv_profile_stack_t;
+
+typedef struct {
+    /* Non-zero while samples are taken */
+    int                 enabled;
+
+    uint32_t            period;
+    uint64_t            next_sample;
+    uint64_t            num_samples;
+
+    /* Shadow call stack */
+    rv_profile_frame_t  frames[RV_PROFILE_MAX_DEPTH];
+    uint32_t            depth;
+
+    /* Calls made beyond RV_PROFILE_MAX_DEPTH that have not returned */
+    uint32_t            overflow;
+
+    /* Open-addressed table of the distinct stacks seen */
+    rv_profile_stack_t  *stacks;
+    uint32_t            stacks_size;
+    uint32_t            num_stacks;
+
+    /* Function addresses of every stack, outermost first */
+    uint32_t            *pool;
+    uint32_t            pool_size;
+    uint32_t            pool_used;
+
+    rv_symbol_t         *symbols;
+    uint32_t            num_symbols;
+
+    /* Output files, NULL to skip */
+    const char          *report_file;
+    const char          *folded_file;
+} rv_profile_t;
+
+/* ----------------------------------------------------------------------------
+ * Public Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Start profiling.
+ * @param[in]   profile The profiler. Must be zeroed before the first call.
+ * @param[in]   report_file The flat profile output file, or NULL.
+ * @param[in]   folded_file The folded stack output file, or NULL.
+ * @param[in]   period The sample period in instructions.
+ *              RV_PROFILE_DEFAULT_PERIOD is used when 0. A period of 1 counts
+ *              every instruction.
+ * @param[in]   inst_cnt The current instruction count.
+ * @return      0 on success, -1 if memory could not be allocated.
+*/
+int rv_InitProfile(rv_profile_t *profile, const char *report_file, const char *folded_file,
+                   uint32_t period, uint64_t inst_cnt);
+
+/**
+ * @brief       Write the output files and free the profiler.
+ * @param[in]   profile The profiler. Nothing is written if it was never
+ *              started.
+*/
+void rv_UninitProfile(rv_profile_t *profile);
+
+/**
+ * @brief       Replace the symbols used to name functions.
+ * @param[in]   profile The profiler.
+ * @param[in]   path An ELF executable. Addresses are left unnamed if it has
+ *              no symbols.
+*/
+void rv_ProfileLoadSymbols(rv_profile_t *profile, const char *path);
+
+/**
+ * @brief       Forget the shadow call stack and restart the sample period, for
+ *              when the guest state is replaced.
+ * @param[in]   profile The profiler.
+ * @param[in]   inst_cnt The new instruction count.
+*/
+void rv_ProfileReset(rv_profile_t *profile, uint64_t inst_cnt);
+
+/**
+ * @brief       Record a sample.
+ * @param[in]   profile The profiler.
+ * @param[in]   pc The address of the next instruction to execute.
+ * @param[in]   inst_cnt The current instruction count.
+*/
+void rv_ProfileSample(rv_profile_t *profile, uint32_t pc, uint64_t inst_cnt);
+
+/**
+ * @brief       Push a call onto the shadow call stack. Use rv_ProfileJump().
+*/
+void rv_ProfileCall(rv_profile_t *profile, uint32_t target, uint32_t ret_addr);
+
+/**
+ * @brief       Pop a return off the shadow call stack. Use rv_ProfileJump().
+*/
+void rv_ProfileReturn(rv_profile_t *profile, uint32_t target);
+
+/* ----------------------------------------------------------------------------
+ * Public Inline Function Definitions
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Track a jal or jalr in the shadow call stack.
+ * @param[in]   profile The profiler.
+ * @param[in]   rd The link register.
+ * @param[in]   rs1 The base register of a jalr, 0 for jal.
+ * @param[in]   ret_addr The address after the jump.
+ * @param[in]   target The address jumped to.
+*/
+static inline void rv_ProfileJump(rv_profile_t *profile, uint32_t rd, uint32_t rs1,
+                                  uint32_t ret_addr, uint32_t target) {
+    if (!profile->enabled) {
+        return;
+    }
+
+    /* ra and t0 are the link registers of the standard calling convention */
+    if ((rd == 1U) || (rd == 5U)) {
+        rv_ProfileCall(profile, target, ret_addr);
+    }
+    else if ((rd == 0U) && ((rs1 == 1U) || (rs1 == 5U))) {
+        rv_ProfileReturn(profile, target);
+    }
+}
+
+/**
+ * @brief       Check whether a sample is due.
+ * @param[in]   profile The profiler.
+ * @param[in]   inst_cnt The current instruction count.
+ * @return      Non-zero if rv_ProfileSample() should be called.
+*/
+static inline int rv_ProfileDue(const rv_profile_t *profile, uint64_t inst_cnt) {
+    return profile->enabled && (inst_cnt >= profile->next_sample);
+}
+
+#endif /* PROFILE_H */
@@ -0,0 +1,117 @@
+/**
+ * @file    rv_core.h
+ * @brief   Definitions shared by the interpreter and the JIT
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef RV_CORE_H
+#define RV_CORE_H
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdint.h>
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Cycles taken by a divide or remainder. The core's divider produces one
+ * quotient bit per cycle, plus a cycle to load the operands and one to write
+ * the result. */
+#define RV_DIV_CYCLES           (34U)
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+typedef union {
+    int32_t     s;
+    uint32_t    u;
+} word_t;
+
+/* Architectural state of the guest. Translated code addresses the fields
+ * by offset, so keep the layout in sync with jit.c. */
+typedef struct {
+    word_t      rf[32];     /* rf[0] is x0 and is never written */
+    word_t      pc;
+    uint32_t    reserved;
+    uint64_t    inst_cnt;   /* Instructions retired */
+    uint64_t    cycle_cnt;  /* Virtual clock cycles elapsed */
+
+    /* Machine-mode trap CSRs */
+    uint32_t    mstatus;
+    uint32_t    mie;
+    uint32_t    mtvec;
+    uint32_t    mscratch;
+    uint32_t    mepc;
+    uint32_t    mcause;
+} rv_cpu_t;
+
+/* Concrete operations that instructions are decoded into */
+typedef enum {
+    RV_OP_ILLEGAL,
+    RV_OP_ADD, RV_OP_SUB, RV_OP_SLL, RV_OP_SLT, RV_OP_SLTU,
+    RV_OP_XOR, RV_OP_SRL, RV_OP_SRA, RV_OP_OR, RV_OP_AND,
+    RV_OP_ADDI, RV_OP_SLLI, RV_OP_SLTI, RV_OP_SLTIU,
+    RV_OP_XORI, RV_OP_SRLI, RV_OP_SRAI, RV_OP_ORI, RV_OP_ANDI,
+    RV_OP_LUI, RV_OP_AUIPC, RV_OP_JAL, RV_OP_JALR,
+    RV_OP_BEQ, RV_OP_BNE, RV_OP_BLT, RV_OP_BGE, RV_OP_BLTU, RV_OP_BGEU,
+    RV_OP_LB, RV_OP_LH, RV_OP_LW, RV_OP_LBU, RV_OP_LHU,
+    RV_OP_SB, RV_OP_SH, RV_OP_SW,
+    RV_OP_NOP,
+    RV_OP_CSR,      /* Any Zicsr instruction. imm holds the CSR number. */
+    RV_OP_MUL, RV_OP_MULH, RV_OP_MULHSU, RV_OP_MULHU,
+    RV_OP_DIV, RV_OP_DIVU, RV_OP_REM, RV_OP_REMU,
+    RV_OP_MRET, RV_OP_WFI, RV_OP_ECALL
+} rv_op_t;
+
+/* A predecoded instruction */
+typedef struct {
+    uint32_t    pc;             /* Tag: the address the instruction was fetched from */
+    uint32_t    instruction;    /* The raw instruction, 16 bits if compressed */
+    word_t      imm;            /* Sign-extended immediate */
+    uint8_t     op;             /* rv_op_t */
+    uint8_t     rd;
+    uint8_t     rs1;
+    uint8_t     rs2;
+#ifdef BRV1E_DISPATCH_THREADED
+    const void  *handler;       /* Label of the threaded-code handler */
+#else
+    uint8_t     loop;           /* Starts a counted loop (see loop.h) */
+#endif
+} rv_decoded_t;
+
+/* ----------------------------------------------------------------------------
+ * Public Macros
+ * ------------------------------------------------------------------------- */
+
+/* The size in bytes of a raw instruction. Compressed instructions are the
+ * ones without both low bits set. */
+#define RV_INSTR_SIZE(i)        ((((i) & 0b11U) == 0b11U) ? 4U : 2U)
+
+#define RV_OP_IS_LOAD(op)       (((op) >= RV_OP_LB) && ((op) <= RV_OP_LHU))
+#define RV_OP_IS_STORE(op)      (((op) >= RV_OP_SB) && ((op) <= RV_OP_SW))
+#define RV_OP_IS_BRANCH(op)     (((op) >= RV_OP_BEQ) && ((op) <= RV_OP_BGEU))
+#define RV_OP_IS_DIV(op)        (((op) >= RV_OP_DIV) && ((op) <= RV_OP_REMU))
+
+/* Cycles an operation takes on the core. Loads wait a cycle for data memory. */
+#define RV_OP_CYCLES(op)        (RV_OP_IS_LOAD(op) ? 2U : (RV_OP_IS_DIV(op) ? RV_DIV_CYCLES : 1U))
+
+/* ----------------------------------------------------------------------------
+ * Public Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Decode an instruction. Compressed instructions decode as the
+ *              instruction they expand to.
+ * @param[in]   instr The raw instruction. Only the low 16 bits are used if it
+ *              is compressed.
+ * @param[out]  decoded The decoded instruction. The pc tag is not written.
+*/
+void rv_Decode(uint32_t instr, rv_decoded_t *decoded);
+
+#endif /* RV_CORE_H */
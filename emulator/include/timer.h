@@ -0,0 +1,126 @@
+/**
+ * @file    timer.h
+ * @brief   Header file for the timer and the virtual clock
+ *
+ * The emulator counts the clock cycles the guest would take on the SoC
+ * (one per instruction, two for loads) and the timer derives its value from
+ * that count, so guest timing does not depend on how fast the host runs.
+ * Each emulator context has its own timer.
+ *
+ * The timer requests an interrupt while its value is at or above the compare
+ * register. Since the value is a function of the cycle count, the cycle at
+ * which that happens is known in advance, which lets wfi skip straight to it.
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "mem.h"
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* The Basys3 board clock */
+#define RV_DEFAULT_CLK_FREQ_HZ  (100000000U)
+
+/* Location of the timer registers */
+#define RV_TIMER_BASE           (0x20000000U)
+#define RV_TIMER_SIZE           (0xCU)
+
+/* Timer register offsets */
+#define RV_TIMER_TIME           (0x0U)
+#define RV_TIMER_RESET          (0x4U)
+#define RV_TIMER_COMPARE        (0x8U)
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+typedef struct {
+    uint32_t        clk_freq;
+    int             paced;
+
+    /* Virtual cycle count when the timer was last reset */
+    uint64_t        reset_cycles;
+
+    /* The interrupt is requested while the value is at least this */
+    uint32_t        compare;
+
+    /* Wall clock time when the emulator started */
+    struct timespec start_time;
+} rv_timer_t;
+
+/* ----------------------------------------------------------------------------
+ * Public Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Initialize the timer and map its registers.
+ * @param[in]   timer The timer.
+ * @param[in]   mem The memory map to map the registers into.
+ * @param[in]   clk_freq_hz The frequency of the virtual clock.
+ * @param[in]   realtime Non-zero to pace the virtual clock to the wall clock.
+*/
+void rv_InitTimer(rv_timer_t *timer, rv_mem_t *mem, uint32_t clk_freq_hz, int realtime);
+
+/**
+ * @brief       Read from the timer.
+ * @param[in]   dev The timer.
+ * @param[in]   offset The offset of the register to read.
+ * @param[in]   cycles The current virtual cycle count.
+ * @return      The 32-bit register containing offset, shifted so that the
+ *              byte at offset is the least significant byte. 0 is returned if
+ *              the offset was invalid.
+*/
+uint32_t rv_TimerRead(void *dev, uint32_t offset, uint64_t cycles);
+
+/**
+ * @brief       Write to the timer. Writing to the reset register restarts the
+ *              timer from 0. The compare register takes word writes only.
+ * @param[in]   dev The timer.
+ * @param[in]   offset The offset of the register to write.
+ * @param[in]   write_data The data to write.
+ * @param[in]   width The access width in bytes.
+ * @param[in]   cycles The current virtual cycle count.
+*/
+void rv_TimerWrite(void *dev, uint32_t offset, uint32_t write_data, uint32_t width, uint64_t cycles);
+
+/**
+ * @brief       Find when the timer's interrupt request is next raised.
+ * @param[in]   timer The timer.
+ * @param[in]   cycles The current virtual cycle count.
+ * @return      The virtual cycle count at which the value reaches the compare
+ *              register, or cycles if it already has.
+*/
+uint64_t rv_TimerDeadline(const rv_timer_t *timer, uint64_t cycles);
+
+/**
+ * @brief       Sleep until the wall clock catches up with the virtual clock.
+ *              Does nothing unless realtime pacing is enabled.
+ * @param[in]   timer The timer.
+ * @param[in]   cycles The current virtual cycle count.
+*/
+void rv_TimerPace(const rv_timer_t *timer, uint64_t cycles);
+
+/**
+ * @brief       Restore the timer from a snapshot and restart pacing from the
+ *              restored virtual cycle count.
+ * @param[in]   timer The timer.
+ * @param[in]   reset_cycles The virtual cycle count of the last timer reset.
+ * @param[in]   compare The compare register.
+ * @param[in]   cycles The current virtual cycle count.
+*/
+void rv_TimerRestore(rv_timer_t *timer, uint64_t reset_cycles, uint32_t compare, uint64_t cycles);
+
+#endif /* TIMER_H */
@@ -0,0 +1,198 @@
+/**
+ * @file    trace.h
+ * @brief   Header file for the binary instruction trace
+ *
+ * The emulator records one fixed-size binary record per retired instruction
+ * into an in-memory ring buffer. A background thread drains the ring buffer
+ * to the trace file so that the emulation thread never blocks on file I/O.
+ * Use the rv_trace_decode tool to convert a trace file into text.
+ *
+ * Each emulator context has its own trace. Tracing is compiled in when
+ * BRV1E_TRACE is defined (see the Makefile) and can be toggled at runtime
+ * with rv_TraceSetEnabled() or by sending SIGUSR1 to the emulator process,
+ * which toggles every trace the next time rv_TraceSync() is called.
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Trace file header magic */
+#define RV_TRACE_MAGIC          "BRV1TRC"
+#define RV_TRACE_VERSION        (1U)
+
+/* Trace record flags */
+#define RV_TRACE_FLAG_RD        (1U << 0)   /* rd was written */
+#define RV_TRACE_FLAG_LOAD      (1U << 1)   /* Memory was read */
+#define RV_TRACE_FLAG_STORE     (1U << 2)   /* Memory was written */
+#define RV_TRACE_FLAG_EXCEPTION (1U << 3)   /* The instruction raised an exception */
+#define RV_TRACE_FLAG_FETCH_EXCEPTION (1U << 4) /* The fetch raised an exception */
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+/* Trace file header */
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    record_size;
+} rv_trace_header_t;
+
+/* A single trace record. The layout is part of the trace file format. */
+typedef struct {
+    uint64_t    inst_cnt;   /* Instruction count before execution */
+    uint32_t    pc;         /* Address of the instruction */
+    uint32_t    next_pc;    /* PC after execution */
+    uint32_t    instruction;
+    uint32_t    rd_val;     /* Value written to rd */
+    uint32_t    mem_addr;   /* Address of the load or store */
+    uint32_t    mem_val;    /* Value loaded or stored */
+    uint8_t     rd;         /* Destination register */
+    uint8_t     flags;      /* RV_TRACE_FLAG_* */
+    uint8_t     reserved[6];
+} rv_trace_record_t;
+
+_Static_assert(sizeof(rv_trace_record_t) == 40, "Trace record layout changed");
+
+typedef struct {
+    /* The record of the instruction currently executing */
+    rv_trace_record_t   cur;
+
+    /* Non-zero while tracing is enabled */
+    int                 enabled;
+
+    /* Non-zero while the trace file is open */
+    int                 active;
+
+    /* Number of SIGUSR1 toggles already applied */
+    unsigned int        toggles_seen;
+
+    rv_trace_record_t   *ring;
+
+    /* Written only by the emulator thread */
+    atomic_size_t       ring_head;
+
+    /* Written only by the writer thread */
+    atomic_size_t       ring_tail;
+
+    atomic_int          stopping;
+
+    FILE                *file;
+
+    pthread_t           writer_thread_id;
+} rv_trace_t;
+
+/* ----------------------------------------------------------------------------
+ * Public Macros
+ * ------------------------------------------------------------------------- */
+
+#ifdef BRV1E_TRACE
+
+/* Non-zero while records are being produced */
+#define RV_TRACE_ACTIVE(t)              ((t)->enabled)
+
+#define RV_TRACE_BEGIN(t, cnt, addr) do { \
+    if ((t)->enabled) { \
+        memset(&(t)->cur, 0, sizeof((t)->cur)); \
+        (t)->cur.inst_cnt = (cnt); \
+        (t)->cur.pc = (addr); \
+    } \
+} while (0)
+
+#define RV_TRACE_INSTRUCTION(t, i) do { \
+    (t)->cur.instruction = (i); \
+} while (0)
+
+#define RV_TRACE_RD(t, sel, val) do { \
+    if ((t)->enabled) { \
+        (t)->cur.rd = (uint8_t)(sel); \
+        (t)->cur.rd_val = (val); \
+        (t)->cur.flags |= RV_TRACE_FLAG_RD; \
+    } \
+} while (0)
+
+#define RV_TRACE_MEM(t, flag, addr, val) do { \
+    if ((t)->enabled) { \
+        (t)->cur.mem_addr = (addr); \
+        (t)->cur.mem_val = (val); \
+        (t)->cur.flags |= (flag); \
+    } \
+} while (0)
+
+#define RV_TRACE_END(t, npc, end_flags) do { \
+    if ((t)->enabled) { \
+        (t)->cur.next_pc = (npc); \
+        (t)->cur.flags |= (end_flags); \
+        rv_TracePush((t), &(t)->cur); \
+    } \
+} while (0)
+
+#else
+
+#define RV_TRACE_ACTIVE(t)                  (0)
+#define RV_TRACE_BEGIN(t, cnt, addr)        do { } while (0)
+#define RV_TRACE_INSTRUCTION(t, i)          do { } while (0)
+#define RV_TRACE_RD(t, sel, val)            do { } while (0)
+#define RV_TRACE_MEM(t, flag, addr, val)    do { } while (0)
+#define RV_TRACE_END(t, npc, end_flags)     do { } while (0)
+
+#endif /* BRV1E_TRACE */
+
+/* ----------------------------------------------------------------------------
+ * Public Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief       Open the trace file and start the writer thread.
+ * @param[in]   trace The trace. Must be zeroed before the first call.
+ * @param[in]   fn The name of the trace file.
+ * @return      0 on success, -1 if the trace file could not be opened or
+ *              tracing was compiled out.
+*/
+int rv_InitTrace(rv_trace_t *trace, const char *fn);
+
+/**
+ * @brief       Drain the ring buffer, stop the writer thread and close the
+ *              trace file.
+ * @param[in]   trace The trace.
+*/
+void rv_UninitTrace(rv_trace_t *trace);
+
+/**
+ * @brief       Enable or disable tracing at runtime.
+ * @param[in]   trace The trace.
+ * @param[in]   enabled Non-zero to enable tracing.
+*/
+void rv_TraceSetEnabled(rv_trace_t *trace, int enabled);
+
+/**
+ * @brief       Apply SIGUSR1 toggles received since the last call.
+ * @param[in]   trace The trace.
+*/
+void rv_TraceSync(rv_trace_t *trace);
+
+/**
+ * @brief       Append a record to the ring buffer. Blocks only if the writer
+ *              thread has fallen a full ring buffer behind.
+ * @param[in]   trace The trace.
+ * @param[in]   rec The record to append.
+*/
+void rv_TracePush(rv_trace_t *trace, const rv_trace_record_t *rec);
+
+#endif /* TRACE_H */
@@ -5,37 +5,195 @@
  * Includes
  * ------------------------------------------------------------------------- */
 
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <termios.h>
+
+#include "mem.h"
+
+/* ----------------------------------------------------------------------------
+ * Public Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Location of the UART registers */
+#define RV_UART_BASE            (0x30000000U)
+#define RV_UART_SIZE            (0x8U)
+
+/* UART register offsets. The counts saturate at 255. */
+#define RV_UART_RX_DATA         (0x0U)
+#define RV_UART_RX_READY        (0x1U)
+#define RV_UART_TX_DATA         (0x2U)
+#define RV_UART_TX_BUSY         (0x3U)
+#define RV_UART_RX_COUNT        (0x4U)
+#define RV_UART_TX_FREE         (0x5U)
+#define RV_UART_TX_COUNT        (0x6U)
+
+/* Number of bytes in each FIFO. Must be a power of 2. */
+#define RV_UART_FIFO_SIZE       (1U << 12)
+
+/* ----------------------------------------------------------------------------
+ * Public Types
+ * ------------------------------------------------------------------------- */
+
+/* Single-producer, single-consumer byte FIFO */
+typedef struct {
+    uint8_t         data[RV_UART_FIFO_SIZE];
+
+    /* Written only by the producer */
+    atomic_uint     head;
+
+    /* Written only by the consumer */
+    atomic_uint     tail;
+} rv_uart_fifo_t;
+
+typedef struct {
+    /* Filled by the RX thread, drained by the guest */
+    rv_uart_fifo_t  rx_fifo;
+
+    /* Virtual cycles between received bytes, 0 to receive at full speed */
+    uint64_t        rx_byte_cycles;
+
+    /* Virtual cycle count when the next byte arrives */
+    uint64_t        rx_next_cycles;
+
+    /* Filled by the guest, drained by the TX thread */
+    rv_uart_fifo_t  tx_fifo;
+
+    /* The last byte the guest read */
+    uint8_t         rx_data;
+
+    /* Transmitted bytes go here. They are discarded when NULL. */
+    FILE            *tx_file;
+
+    /* The receiver's source, -1 when nothing is received */
+    int             rx_fd;
+
+    /* rx_fd is a regular file, read on the guest's thread as the FIFO
+     * drains rather than by the RX thread, so every run sees the same
+     * input at the same cycle */
+    int             rx_sync;
+    int             rx_eof;
+
+    atomic_int      stopping;
+
+    /* Set to park the RX thread while the RX FIFO is restored */
+    atomic_int      rx_pausing;
+
+    pthread_t       rx_thread_id;
+    pthread_t       tx_thread_id;
+
+    /* Written to wake the RX thread for shutdown */
+    int             rx_wake_pipe[2];
+
+    /* Terminal settings to restore on shutdown */
+    struct termios  saved_term;
+    int             term_saved;
+} rv_uart_t;
 
 /* ----------------------------------------------------------------------------
  * Public Function Prototypes
  * ------------------------------------------------------------------------- */
 
 /**
- * @brief       Initialize the UART.
+ * @brief       Initialize the UART, map its registers and start the threads
+ *              moving data to and from the host.
+ * @param[in]   uart The UART.
+ * @param[in]   mem The memory map to map the registers into.
+ * @param[in]   tx_file Where transmitted bytes are written. NULL discards
+ *              them.
+ * @param[in]   rx_fd Where received bytes are read from (stdin, a file, a
+ *              pipe or a socket), or -1 to receive nothing. Reception stops at
+ *              end of file. A terminal is switched to unbuffered input, and
+ *              only one UART can receive from it at a time. The descriptor
+ *              stays open. All of a regular file has arrived at cycle 0;
+ *              anything else arrives when the host receives it.
+ * @param[in]   rx_byte_cycles The virtual cycles each received byte takes to
+ *              arrive, to model a baud rate. 0 delivers bytes as soon as they
+ *              have arrived.
+*/
+void rv_InitUART(rv_uart_t *uart, rv_mem_t *mem, FILE *tx_file, int rx_fd, uint64_t rx_byte_cycles);
+
+/**
+ * @brief       Stop the UART threads, write out pending output and restore
+ *              the terminal.
+ * @param[in]   uart The UART.
+*/
+void rv_UninitUART(rv_uart_t *uart);
+
+/**
+ * @brief       Copy the bytes queued in the FIFOs to a snapshot, oldest first.
+ * @param[in]   uart The UART.
+ * @param[out]  rx Holds RV_UART_FIFO_SIZE bytes. Receives the bytes received
+ *              and not yet read by the guest.
+ * @param[out]  rx_count The number of bytes copied to rx.
+ * @param[out]  tx Holds RV_UART_FIFO_SIZE bytes. Receives the bytes
+ *              transmitted by the guest and not yet written out.
+ * @param[out]  tx_count The number of bytes copied to tx.
+*/
+void rv_UARTSave(const rv_uart_t *uart, uint8_t *rx, uint32_t *rx_count, uint8_t *tx, uint32_t *tx_count);
+
+/**
+ * @brief       Restore the UART from a snapshot. The restored received bytes
+ *              are read before anything the UART has received itself; the
+ *              restored transmitted bytes are written out after anything
+ *              still pending.
+ * @param[in]   uart The UART.
+ * @param[in]   rx_data The last byte the guest read.
+ * @param[in]   rx_next_cycles The virtual cycle count when the next byte
+ *              arrives.
+ * @param[in]   rx The received bytes, oldest first.
+ * @param[in]   rx_count The number of bytes in rx, RV_UART_FIFO_SIZE at most.
+ * @param[in]   tx The transmitted bytes, oldest first.
+ * @param[in]   tx_count The number of bytes in tx, RV_UART_FIFO_SIZE at most.
+*/
+void rv_UARTRestore(rv_uart_t *uart, uint8_t rx_data, uint64_t rx_next_cycles, const uint8_t *rx, uint32_t rx_count,
+                    const uint8_t *tx, uint32_t tx_count);
+
+/**
+ * @brief       Pop the oldest received byte, as a read of rx_data does. Used
+ *              by the DMA.
+ * @param[in]   uart The UART.
+ * @param[in]   cycles The current virtual cycle count.
+ * @param[out]  byte The byte, if one has arrived.
+ * @return      1 if a byte was popped, 0 if none has arrived.
 */
-void rv_InitUART(void);
+int rv_UARTReceive(rv_uart_t *uart, uint64_t cycles, uint8_t *byte);
 
 /**
- * @brief       Un-initialize the UART.
+ * @brief       Find when the oldest unread byte arrives at the line rate. The
+ *              receive interrupt is requested from then until it is read.
+ * @param[in]   uart The UART.
+ * @param[in]   cycles The current virtual cycle count.
+ * @param[out]  arrival The virtual cycle count when the byte arrives, or
+ *              cycles if it already has.
+ * @return      1 if the host has received a byte the guest has not read, 0
+ *              otherwise.
 */
-void rv_UninitUART(void);
+int rv_UARTNextArrival(const rv_uart_t *uart, uint64_t cycles, uint64_t *arrival);
 
 /**
  * @brief       Read from the UART.
- * @param[in]   addr The address to read from. Valid addresses are 0b00 to 0b11
+ * @param[in]   dev The UART.
+ * @param[in]   offset The offset to read from. Valid offsets are 0b000 to 0b111
  *              inclusive.
- * @return      The value that was read. 0 is returned if the address was
+ * @param[in]   cycles The current virtual cycle count.
+ * @return      The value that was read. 0 is returned if the offset was
  *              invalid.
 */
-uint8_t rv_UARTRead(uint8_t addr);
+uint32_t rv_UARTRead(void *dev, uint32_t offset, uint64_t cycles);
 
 /**
  * @brief       Write to the UART.
- * @param[in]   addr The address to write to. Valid addresses are 0b00 to 0b11
+ * @param[in]   dev The UART.
+ * @param[in]   offset The offset to write to. Valid offsets are 0b000 to 0b111
  *              inclusive.
  * @param[in]   write_data The data to write.
+ * @param[in]   width The access width in bytes.
+ * @param[in]   cycles The current virtual cycle count.
 */
-void rv_UARTWrite(uint8_t addr, uint8_t write_data);
+void rv_UARTWrite(void *dev, uint32_t offset, uint32_t write_data, uint32_t width, uint64_t cycles);
 
 #endif /* UART_H */
@@ -11,13 +11,32 @@
  * ------------------------------------------------------------------------- */
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <stdatomic.h>
+#include <ctype.h>
+#include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "BaseRV1E.h"
+#include "jit.h"
+#include "loader.h"
+#include "loop.h"
+#include "mem.h"
+#include "profile.h"
+#include "rv_core.h"
+#include "timer.h"
+#include "trace.h"
 #include "uart.h"
+#include "dma.h"
 
 /* ----------------------------------------------------------------------------
  * Private Symbolic Constants
@@ -26,18 +45,112 @@
 /* The system starts by executing code from the Boot ROM */
 #define PC_START_ADDRESS        (MREGION_START_BOOT_ROM)
 
-#define RAM_SIZE                (0x800U)
-
 #define MREGION_START_RAM       (0x00000000U)
-#define MREGION_END_RAM         (MREGION_START_RAM + RAM_SIZE - 1)
-
 #define MREGION_START_BOOT_ROM  (0x10000000U)
-#define MREGION_END_BOOT_ROM    (0x1000003FU)
 
-#define MREGION_START_UART      (0x30000000U)
-#define MREGION_END_UART        (0x30000003U)
-
-#define MREGION_TIMER           (0x20000000U)
+/* RAM is 2 KB, as on the SoC, unless configured. It can grow up to the boot
+ * ROM. */
+#define RAM_DEFAULT_SIZE        (0x800U)
+#define RAM_MAX_SIZE            (BRV1E_RAM_MAX_SIZE)
+
+_Static_assert(RAM_MAX_SIZE == MREGION_START_BOOT_ROM - MREGION_START_RAM, "RAM must end at the boot ROM");
+
+/* RAM is mapped in whole 64KB units, a multiple of any host page size, so a
+ * snapshot can be mapped over it */
+#define RAM_MAP_SIZE(size)      (((size_t)(size) + 0xFFFFU) & ~(size_t)0xFFFFU)
+
+/* Snapshot files hold a header followed by RAM at a page-aligned offset */
+#define SNAPSHOT_MAGIC          "BRV1SNAP"
+#define SNAPSHOT_VERSION        (4U)
+#define SNAPSHOT_RAM_OFFSET     (0x10000U)
+
+/* All-zero blocks of RAM are left as holes in snapshot files */
+#define SNAPSHOT_BLOCK_SIZE     (0x1000U)
+
+/* UART frames are a start bit, 8 data bits and a stop bit */
+#define UART_FRAME_BITS         (10U)
+
+/* Prefix of UART RX paths that name a Unix socket */
+#define UART_RX_SOCKET_PREFIX   "unix:"
+
+/* Emulator-only exit register. Storing to it halts the guest with the
+ * stored value as its exit code. The SoC has nothing here and drops the
+ * store. */
+#define EXIT_REG_ADDR           (0x50000000U)
+#define EXIT_REG_SIZE           (0x4U)
+
+
+/* Number of entries in the predecoded instruction cache. Must be a power of 2. */
+#define DECODE_CACHE_SIZE       (1U << 14)
+#define DECODE_CACHE_MASK       (DECODE_CACHE_SIZE - 1U)
+
+/* The guest is paced to the wall clock every this many instructions. This is
+ * also the longest stretch translated code runs without returning. */
+#define PACE_INTERVAL_MASK      (0xFFFFU)
+
+/* Counter CSRs. The time counter runs off the core clock, as the timer
+ * peripheral does. The machine-mode aliases read the same counters. */
+#define CSR_CYCLE               (0xC00U)
+#define CSR_TIME                (0xC01U)
+#define CSR_INSTRET             (0xC02U)
+#define CSR_CYCLEH              (0xC80U)
+#define CSR_TIMEH               (0xC81U)
+#define CSR_INSTRETH            (0xC82U)
+#define CSR_MCYCLE              (0xB00U)
+#define CSR_MINSTRET            (0xB02U)
+#define CSR_MCYCLEH             (0xB80U)
+#define CSR_MINSTRETH           (0xB82U)
+
+/* Machine-mode trap CSRs */
+#define CSR_MSTATUS             (0x300U)
+#define CSR_MIE                 (0x304U)
+#define CSR_MTVEC               (0x305U)
+#define CSR_MSCRATCH            (0x340U)
+#define CSR_MEPC                (0x341U)
+#define CSR_MCAUSE              (0x342U)
+#define CSR_MIP                 (0x344U)
+
+/* mstatus fields. The core only runs in machine mode, so MPP always reads
+ * as machine mode. */
+#define MSTATUS_MIE             (1U << 3)
+#define MSTATUS_MPIE            (1U << 7)
+#define MSTATUS_MPP             (0b11U << 11)
+
+/* Interrupt causes, which are also the bits in mie and mip */
+#define IRQ_TIMER               (7U)
+#define IRQ_EXTERNAL            (11U)
+#define MIP_MTIP                (1U << IRQ_TIMER)
+#define MIP_MEIP                (1U << IRQ_EXTERNAL)
+
+#define MCAUSE_INTERRUPT        (1U << 31)
+
+/* Interrupts jump to base + 4 * cause when the low bit of mtvec is set */
+#define MTVEC_VECTORED          (0b01U)
+
+/* Low bits of funct3 in CSR instructions. The high bit selects the
+ * immediate forms, which take rs1 as a 5-bit immediate. */
+#define CSR_FUNCT3_WRITE        (0b01U)
+#define CSR_FUNCT3_SET          (0b10U)
+#define CSR_FUNCT3_CLEAR        (0b11U)
+#define CSR_FUNCT3_IMM          (0b100U)
+
+/* System instructions besides CSR accesses */
+#define INSTR_ECALL             (0x00000073U)
+#define INSTR_MRET              (0x30200073U)
+#define INSTR_WFI               (0x10500073U)
+
+/* An ecall with the newlib and Linux exit call number in a7 halts the guest
+ * with a0 as its exit code. Other ecalls do nothing. */
+#define ECALL_EXIT              (93U)
+#define REG_A0                  (10U)
+#define REG_A7                  (17U)
+
+/* Instructions between checks for a UART interrupt while none of the
+ * received bytes has been read in by the host yet */
+#define IRQ_POLL_INTERVAL       (0x400U)
+
+/* How long wfi sleeps between checks while only UART input can wake it */
+#define WFI_IDLE_NS             (1000000L)
 
 /* The position of the funct3 field in RISC-V instructions */
 #define FUNCT3_Pos              (12U)
@@ -46,13 +159,6 @@
  * Private Macros
  * ------------------------------------------------------------------------- */
 
-#define rv_Log(...) do { \
-    FILE *fd = fopen("rv_log.txt", "a"); \
-    fseek(fd, 0, SEEK_END); \
-    fprintf(logfile, __VA_ARGS__); \
-    fclose(fd); \
-} while (0);
-
 #define STORE_MISALIGNED(addr, funct3) \
     ( (((funct3) == ) && ((addr) & 0b1)) || \
       (((funct3) == DT_WORD) && ((addr) & 0b11)) )
@@ -67,11 +173,35 @@
 #define FIELD_FUNCT3_BRANCH(i)  ((rv_funct3_branch_t)FIELD_FUNCT3(i))
 #define FIELD_FUNCT3_LOAD(i)    ((rv_funct3_load_t)FIELD_FUNCT3(i))
 #define FIELD_FUNCT3_STORE(i)   ((rv_funct3_store_t)FIELD_FUNCT3(i))
+#define FIELD_FUNCT3_CSR(i)     (((i) >> FUNCT3_Pos) & 0b111U)
+
+/* Whether a CSR instruction writes its CSR. Set and clear with x0 or an
+ * immediate of 0 only read. */
+#define CSR_WRITES(i)           (((FIELD_FUNCT3_CSR(i) & 0b11U) == CSR_FUNCT3_WRITE) || (FIELD_RS1(i) != 0))
+
+/* The access width in bytes of a load or store funct3 */
+#define FUNCT3_WIDTH(funct3)    (1U << (((uint32_t)(funct3) >> FUNCT3_Pos) & 0b11U))
 
 /* For instructions with the OP or OP-IMM opcodes, bit 30 of the instruction
  * sometimes encodes a special operation */
 #define SPECIAL_OP(i)           ((i) & 0x40000000)
 
+/* OP instructions with a funct7 of 0b0000001 are RV32M multiplies and divides */
+#define MULDIV_OP(i)            (((i) >> 25) == 0b0000001U)
+
+/* The funct3 of a load or store operation. The raw bits of a compressed
+ * instruction hold no funct3. */
+#define LOAD_FUNCT3(op)         ((rv_funct3_load_t)((((op) - RV_OP_LB) + ((op) >= RV_OP_LBU)) << FUNCT3_Pos))
+#define STORE_FUNCT3(op)        ((rv_funct3_store_t)(((op) - RV_OP_SB) << FUNCT3_Pos))
+
+/* The index of an address in the predecoded instruction cache. Instructions
+ * may start at any halfword. */
+#define DECODE_CACHE_IDX(addr)  (((addr) >> 1) & DECODE_CACHE_MASK)
+
+/* An odd tag that can never match a PC: a PC with these bits would index
+ * the neighbouring entry, not this one */
+#define DECODE_CACHE_INVALID_TAG(idx)   ((((idx) ^ 1U) << 1) | 0b1U)
+
 /* Immediate value for I-type instructions */
 #define IMMEDIATE_I(i)  ((word_t)( (int32_t)(i) >> 20 ))
 
@@ -92,21 +222,65 @@
                                    ((i) & 0xFF000) | \
                                    (((i) >> 9) & 0x800) ))
 
+/* Fields of compressed instructions. Primed registers are x8 to x15. */
+#define CFIELD_QUADRANT(i)      ((i) & 0b11U)
+#define CFIELD_FUNCT3(i)        (((i) >> 13) & 0b111U)
+#define CFIELD_RD(i)            (((i) >> 7) & 0b11111U)
+#define CFIELD_RS2(i)           (((i) >> 2) & 0b11111U)
+#define CFIELD_RS1_P(i)         (8U + (((i) >> 7) & 0b111U))
+#define CFIELD_RS2_P(i)         (8U + (((i) >> 2) & 0b111U))
+
+/* Sign-extend the low bits of x, with the sign at bit (32 - shift) */
+#define SIGN_EXTEND(x, shift)   ((uint32_t)((int32_t)((x) << (shift)) >> (shift)))
+
+/* 6-bit immediate of CI and CB-type ALU instructions */
+#define CIMMEDIATE_6(i)         SIGN_EXTEND((((i) >> 2) & 0x1FU) | (((i) >> 7) & 0x20U), 26)
+
+/* Offset of c.j and c.jal */
+#define CIMMEDIATE_J(i)         SIGN_EXTEND((((i) >> 1) & 0x800U) | (((i) >> 7) & 0x10U) | \
+                                            (((i) >> 1) & 0x300U) | (((i) << 2) & 0x400U) | \
+                                            (((i) >> 1) & 0x40U) | (((i) << 1) & 0x80U) | \
+                                            (((i) >> 2) & 0xEU) | (((i) << 3) & 0x20U), 20)
+
+/* Offset of c.beqz and c.bnez */
+#define CIMMEDIATE_B(i)         SIGN_EXTEND((((i) >> 4) & 0x100U) | (((i) >> 7) & 0x18U) | \
+                                            (((i) << 1) & 0xC0U) | (((i) >> 2) & 0x6U) | \
+                                            (((i) << 3) & 0x20U), 23)
+
+/* Encodings of the instructions compressed ones expand to. funct3 is an
+ * rv_funct3_*_t. */
+#define ENCODE_R(rd, funct3, rs1, rs2, funct7) \
+    (((uint32_t)(funct7) << 25) | ((rs2) << 20) | ((rs1) << 15) | (uint32_t)(funct3) | \
+     ((rd) << 7) | OPCODE_OP)
+#define ENCODE_I(opcode, rd, funct3, rs1, imm) \
+    ((((imm) & 0xFFFU) << 20) | ((rs1) << 15) | (uint32_t)(funct3) | ((rd) << 7) | (opcode))
+#define ENCODE_S(funct3, rs1, rs2, imm) \
+    ((((imm) & 0xFE0U) << 20) | ((rs2) << 20) | ((rs1) << 15) | (uint32_t)(funct3) | \
+     (((imm) & 0x1FU) << 7) | OPCODE_STORE)
+#define ENCODE_B(funct3, rs1, rs2, imm) \
+    ((((imm) & 0x1000U) << 19) | (((imm) & 0x7E0U) << 20) | ((rs2) << 20) | ((rs1) << 15) | \
+     (uint32_t)(funct3) | (((imm) & 0x1EU) << 7) | (((imm) & 0x800U) >> 4) | OPCODE_BRANCH)
+#define ENCODE_U(opcode, rd, imm) \
+    (((imm) & 0xFFFFF000U) | ((rd) << 7) | (opcode))
+#define ENCODE_J(rd, imm) \
+    ((((imm) & 0x100000U) << 11) | (((imm) & 0x7FEU) << 20) | (((imm) & 0x800U) << 9) | \
+     ((imm) & 0xFF000U) | ((rd) << 7) | OPCODE_JAL)
+
+/* Case label for a compressed instruction's quadrant and funct3 */
+#define C_OP(quadrant, funct3)  (((quadrant) << 3) | (funct3))
+
 /* ----------------------------------------------------------------------------
  * Private Types
  * ------------------------------------------------------------------------- */
 
-typedef union {
-    int32_t     s;
-    uint32_t    u;
-} word_t;
-
 typedef enum {
     RV_EXCEPTION_NONE,
     RV_EXCEPTION_MISALIGNED,
     RV_EXCEPTION_ADDRESS_MISALIGNED,
     RV_EXCEPTION_INSTRUCTION_ADDRESS_MISALIGNED,
-    RV_EXCEPTION_ACCESS_FAULT,
+    RV_EXCEPTION_INSTRUCTION_ACCESS_FAULT,
+    RV_EXCEPTION_LOAD_ACCESS_FAULT,
+    RV_EXCEPTION_STORE_ACCESS_FAULT,
     RV_EXCEPTION_ILLEGAL_INSTRUCTION
 } rv_exception_t;
 
@@ -155,396 +329,1985 @@ typedef enum {
 
 typedef uint32_t reg_sel_t;
 
+/* The header of a snapshot file. The layout is that of the host that wrote
+ * it, so snapshots only restore on the same build. */
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    header_size;
+    uint32_t    ram_size;
+    brv1e_halt_t halt;
+    rv_cpu_t    cpu;
+    uint64_t    timer_reset_cycles;
+    uint32_t    timer_compare;
+    uint8_t     uart_rx_data;
+    uint64_t    uart_rx_next_cycles;
+    uint32_t    uart_rx_count;
+    uint32_t    uart_tx_count;
+    uint8_t     uart_rx_fifo[RV_UART_FIFO_SIZE];
+    uint8_t     uart_tx_fifo[RV_UART_FIFO_SIZE];
+    uint32_t    dma_src;
+    uint32_t    dma_dst;
+    uint32_t    dma_len;
+    uint32_t    dma_fill;
+    int         dma_error;
+    int         dma_receiving;
+    uint64_t    dma_done_cycles;
+} rv_snapshot_t;
+
+_Static_assert(sizeof(rv_snapshot_t) <= SNAPSHOT_RAM_OFFSET, "Snapshot header overlaps RAM");
+
+struct brv1e_ctx {
+    rv_cpu_t        cpu;
+    uint32_t        instruction;
+    word_t          loaded;
+    uint8_t         *memory;
+
+    /* Size of RAM, and of the mapping backing it */
+    uint32_t        ram_size;
+    size_t          ram_map_size;
+
+    /* Why the guest halted, BRV1E_HALT_NONE while it has not */
+    brv1e_halt_t    halt;
+
+    /* Set by BRV1E_Stop(), possibly from another thread or a signal
+     * handler */
+    atomic_int      stopped;
+
+    /* Non-zero to start loaded programs at their entry point rather than in
+     * the boot ROM */
+    int             direct_boot;
+
+    rv_decoded_t    decode_cache[DECODE_CACHE_SIZE];
+
+    /* NULL when the translator is off */
+    rv_jit_t        *jit;
+
+    rv_mem_t        mem;
+    rv_timer_t      timer;
+    rv_uart_t       uart;
+    rv_dma_t        dma;
+    rv_trace_t      trace;
+    rv_profile_t    profile;
+
+    /* UART output file opened for the context */
+    FILE            *uart_tx_file;
+
+    /* UART input opened for the context, -1 if none */
+    int             uart_rx_fd;
+
+    /* ELF file profiled functions are named from, NULL to use the loaded
+     * program */
+    const char      *profile_symbols;
+
+    /* Snapshot that forks map their RAM from. Dropped once the context runs
+     * again. */
+    FILE            *fork_snapshot;
+};
+
 /* ----------------------------------------------------------------------------
  * Private Function Declarations
  * ------------------------------------------------------------------------- */
 
-static void rv_MainLoop(void);
+static brv1e_status_t rv_MainLoop(brv1e_ctx_t *ctx, uint64_t inst_limit);
+
+static rv_exception_t rv_Interpret(brv1e_ctx_t *ctx, uint64_t inst_limit);
+
+#ifndef BRV1E_DISPATCH_THREADED
+static rv_exception_t rv_Execute(brv1e_ctx_t *ctx, const rv_decoded_t *decoded);
+#endif
+
+static int rv_OpenUARTInput(const char *path);
+
+static void rv_InvalidateDecodeCache(brv1e_ctx_t *ctx);
+
+static void rv_InvalidateCode(brv1e_ctx_t *ctx);
+
+static void rv_DropForkSnapshot(brv1e_ctx_t *ctx);
+
+static int rv_SaveSnapshot(const brv1e_ctx_t *ctx, int fd);
+
+static int rv_RestoreSnapshot(brv1e_ctx_t *ctx, int fd);
+
+static void rv_InvalidateCodePage(brv1e_ctx_t *ctx, uint32_t addr);
+
+static void rv_DMAWritten(void *dev, uint32_t addr, uint32_t len);
+
+static void rv_ExitWrite(void *dev, uint32_t offset, uint32_t write_data, uint32_t width, uint64_t cycles);
+
+static void rv_Exit(brv1e_ctx_t *ctx, uint32_t exit_code);
+
+static void rv_Ecall(brv1e_ctx_t *ctx);
+
+static void rv_Halt(brv1e_ctx_t *ctx, rv_exception_t exception);
 
-static void rv_LoadProgram(const char *fn);
+static rv_exception_t rv_Fetch(brv1e_ctx_t *ctx, word_t addr);
 
-static rv_exception_t rv_DecodeAndExecute(void);
+static int rv_FindLoop(const brv1e_ctx_t *ctx, uint32_t pc, rv_loop_t *loop);
 
-static rv_exception_t rv_Fetch(word_t addr);
+static int rv_SkipLoop(brv1e_ctx_t *ctx, uint64_t inst_limit);
 
-static rv_exception_t rv_Load(uint32_t addr, rv_funct3_load_t funct3);
+static uint32_t rv_CSRRead(const brv1e_ctx_t *ctx, uint32_t csr);
 
-static rv_exception_t rv_Store(uint32_t addr, rv_funct3_store_t funct3, word_t write_data);
+static void rv_CSRWrite(brv1e_ctx_t *ctx, uint32_t csr, uint32_t write_data);
 
-static word_t rv_GetRegVal(reg_sel_t reg_sel);
+static uint32_t rv_CSRAccess(brv1e_ctx_t *ctx, const rv_decoded_t *decoded);
 
-static void rv_SetRegVal(reg_sel_t reg_sel, word_t write_data);
+static uint32_t rv_PendingInterrupts(const brv1e_ctx_t *ctx);
+
+static void rv_TakeInterrupt(brv1e_ctx_t *ctx);
+
+static uint64_t rv_InterruptLimit(const brv1e_ctx_t *ctx, uint64_t chunk_limit);
+
+static void rv_Mret(brv1e_ctx_t *ctx);
+
+static void rv_WaitForInterrupt(brv1e_ctx_t *ctx);
+
+static uint32_t rv_MulDiv(rv_op_t op, word_t op1, word_t op2);
+
+static uint32_t rv_ExpandCompressed(uint32_t instr);
+
+static rv_exception_t rv_Load(brv1e_ctx_t *ctx, uint32_t addr, rv_funct3_load_t funct3);
+
+static rv_exception_t rv_Store(brv1e_ctx_t *ctx, uint32_t addr, rv_funct3_store_t funct3, word_t write_data);
+
+#ifndef BRV1E_DISPATCH_THREADED
+static word_t rv_GetRegVal(brv1e_ctx_t *ctx, reg_sel_t reg_sel);
+
+static void rv_SetRegVal(brv1e_ctx_t *ctx, reg_sel_t reg_sel, word_t write_data);
+#endif
 
 /* ----------------------------------------------------------------------------
  * Private Global Variables
  * ------------------------------------------------------------------------- */
 
-static word_t rf[31];
-static word_t pc;
-static uint32_t instruction;
-static uint8_t *memory;
-static word_t loaded;
-static FILE *logfile;
-
-static const uint32_t boot_rom[16] = {
-    0x300005b7, 0x00000613, 0x028000ef, 0x00050293,
-    0x020000ef, 0x00851513, 0x00a282b3, 0x014000ef,
-    0x00a60023, 0x00160613, 0xfe561ae3, 0x00000067,
-    0x0015c503, 0xfe050ee3, 0x0005c503, 0x00008067
+/* bootloader/bootloader.S, padded with NOPs */
+static const uint32_t boot_rom[64] = {
+    0x30000437, 0x00000a13, 0x098000ef, 0x00050493,
+    0x090000ef, 0x00050913, 0x00000993, 0x0699f863,
+    0x0b4000ef, 0x07f57313, 0x00130313, 0x08057513,
+    0x02051063, 0x06c000ef, 0x00a9a023, 0x40a90933,
+    0x00498993, 0xfff30313, 0xfe0316e3, 0xfd1ff06f,
+    0x084000ef, 0x00050393, 0x07c000ef, 0x00851513,
+    0x00a3e3b3, 0x00239393, 0x407983b3, 0x0003a503,
+    0x00a9a023, 0x40a90933, 0x00438393, 0x00498993,
+    0xfff30313, 0xfe0314e3, 0xf95ff06f, 0x00091463,
+    0x00000067, 0x02100513, 0x00a40123, 0xf6dff06f,
+    0x00000513, 0x00000e13, 0x02000e93, 0x000a1663,
+    0x00444a03, 0xfe0a0ee3, 0xfffa0a13, 0x00044f03,
+    0x01cf1f33, 0x01e56533, 0x008e0e13, 0xffde10e3,
+    0x00008067, 0x000a1663, 0x00444a03, 0xfe0a0ee3,
+    0xfffa0a13, 0x00044503, 0x00008067, 0x00000013,
+    0x00000013, 0x00000013, 0x00000013, 0x00000013
 };
 
-static uint64_t inst_cnt;
 
 /* ----------------------------------------------------------------------------
  * Private Function Definitions
  * ------------------------------------------------------------------------- */
 
-static void rv_MainLoop(void) {
+#ifdef BRV1E_DISPATCH_THREADED
+
+/* Look up the instruction at pc and jump straight to its handler */
+#define THREADED_DISPATCH() do { \
+    RV_TRACE_BEGIN(&ctx->trace, ctx->cpu.inst_cnt, ctx->cpu.pc.u); \
+    decoded = &ctx->decode_cache[DECODE_CACHE_IDX(ctx->cpu.pc.u)]; \
+    if (decoded->pc != ctx->cpu.pc.u) { \
+        goto miss; \
+    } \
+    RV_TRACE_INSTRUCTION(&ctx->trace, decoded->instruction); \
+    goto *decoded->handler; \
+} while (0)
+
+/* Retire the current instruction and dispatch the next one */
+#define THREADED_RETIRE(cycles, end_flags) do { \
+    ctx->cpu.cycle_cnt += (cycles); \
+    RV_TRACE_END(&ctx->trace, ctx->cpu.pc.u, (end_flags)); \
+    if (++ctx->cpu.inst_cnt >= inst_limit) { \
+        return RV_EXCEPTION_NONE; \
+    } \
+    THREADED_DISPATCH(); \
+} while (0)
+
+/* Stop at an instruction that raised an exception without retiring it */
+#define THREADED_FAULT(exception) do { \
+    RV_TRACE_END(&ctx->trace, ctx->cpu.pc.u, RV_TRACE_FLAG_EXCEPTION); \
+    return (exception); \
+} while (0)
+
+/* Write rd. x0 is written too and then cleared, which avoids a branch. */
+#define THREADED_WRITE_RD(val) do { \
+    uint32_t rd_val = (val); \
+    ctx->cpu.rf[decoded->rd].u = rd_val; \
+    ctx->cpu.rf[0].u = 0; \
+    if (decoded->rd) { \
+        RV_TRACE_RD(&ctx->trace, decoded->rd, rd_val); \
+    } \
+} while (0)
+
+/* Write rd, advance to the next sequential instruction and dispatch it */
+#define THREADED_WRITE_RD_NEXT(val, cycles) do { \
+    THREADED_WRITE_RD(val); \
+    ctx->cpu.pc.u += SIZE; \
+    THREADED_RETIRE((cycles), 0U); \
+} while (0)
+
+#define THREADED_BRANCH(cond) do { \
+    ctx->cpu.pc.u += (cond) ? decoded->imm.u : SIZE; \
+    THREADED_RETIRE(1U, 0U); \
+} while (0)
+
+#define THREADED_LOAD(funct3) do { \
+    if (rv_Load(ctx, RS1.u + decoded->imm.u, (funct3)) != RV_EXCEPTION_NONE) { \
+        THREADED_FAULT(RV_EXCEPTION_LOAD_ACCESS_FAULT); \
+    } \
+    THREADED_WRITE_RD_NEXT(ctx->loaded.u, 2U); \
+} while (0)
+
+/* A store to a device may raise an interrupt or halt the guest, so the main
+ * loop checks after it */
+#define THREADED_STORE(funct3) do { \
+    uint32_t store_addr = RS1.u + decoded->imm.u; \
+    if (store_addr >= ctx->ram_size) { \
+        inst_limit = 0; \
+    } \
+    if (rv_Store(ctx, store_addr, (funct3), RS2) != RV_EXCEPTION_NONE) { \
+        THREADED_FAULT(RV_EXCEPTION_STORE_ACCESS_FAULT); \
+    } \
+    ctx->cpu.pc.u += SIZE; \
+    THREADED_RETIRE(1U, 0U); \
+} while (0)
+
+#define RS1     (ctx->cpu.rf[decoded->rs1])
+#define RS2     (ctx->cpu.rf[decoded->rs2])
+#define IMM     (decoded->imm)
+#define SIZE    (RV_INSTR_SIZE(decoded->instruction))
+
+static rv_exception_t rv_Interpret(brv1e_ctx_t *ctx, uint64_t inst_limit) {
+    static const void *const handlers[] = {
+        [RV_OP_ILLEGAL] = &&op_illegal,
+        [RV_OP_ADD]   = &&op_add,   [RV_OP_SUB]   = &&op_sub,
+        [RV_OP_SLL]   = &&op_sll,   [RV_OP_SLT]   = &&op_slt,
+        [RV_OP_SLTU]  = &&op_sltu,  [RV_OP_XOR]   = &&op_xor,
+        [RV_OP_SRL]   = &&op_srl,   [RV_OP_SRA]   = &&op_sra,
+        [RV_OP_OR]    = &&op_or,    [RV_OP_AND]   = &&op_and,
+        [RV_OP_ADDI]  = &&op_addi,  [RV_OP_SLLI]  = &&op_slli,
+        [RV_OP_SLTI]  = &&op_slti,  [RV_OP_SLTIU] = &&op_sltiu,
+        [RV_OP_XORI]  = &&op_xori,  [RV_OP_SRLI]  = &&op_srli,
+        [RV_OP_SRAI]  = &&op_srai,  [RV_OP_ORI]   = &&op_ori,
+        [RV_OP_ANDI]  = &&op_andi,
+        [RV_OP_LUI]   = &&op_lui,   [RV_OP_AUIPC] = &&op_auipc,
+        [RV_OP_JAL]   = &&op_jal,   [RV_OP_JALR]  = &&op_jalr,
+        [RV_OP_BEQ]   = &&op_beq,   [RV_OP_BNE]   = &&op_bne,
+        [RV_OP_BLT]   = &&op_blt,   [RV_OP_BGE]   = &&op_bge,
+        [RV_OP_BLTU]  = &&op_bltu,  [RV_OP_BGEU]  = &&op_bgeu,
+        [RV_OP_LB]    = &&op_lb,    [RV_OP_LH]    = &&op_lh,
+        [RV_OP_LW]    = &&op_lw,    [RV_OP_LBU]   = &&op_lbu,
+        [RV_OP_LHU]   = &&op_lhu,
+        [RV_OP_SB]    = &&op_sb,    [RV_OP_SH]    = &&op_sh,
+        [RV_OP_SW]    = &&op_sw,
+        [RV_OP_NOP]   = &&op_nop,   [RV_OP_CSR]   = &&op_csr,
+        [RV_OP_MUL]   = &&op_mul,   [RV_OP_MULH]  = &&op_mulh,
+        [RV_OP_MULHSU] = &&op_mulhsu, [RV_OP_MULHU] = &&op_mulhu,
+        [RV_OP_DIV]   = &&op_div,   [RV_OP_DIVU]  = &&op_divu,
+        [RV_OP_REM]   = &&op_rem,   [RV_OP_REMU]  = &&op_remu,
+        [RV_OP_MRET]  = &&op_mret,  [RV_OP_WFI]   = &&op_wfi,
+        [RV_OP_ECALL] = &&op_ecall
+    };
+
+    rv_decoded_t *decoded;
+    rv_exception_t exception_status;
+    rv_loop_t loop;
+    uint32_t target;
+
+    THREADED_DISPATCH();
+
+miss:
+    /* Fetch instruction */
+    exception_status = rv_Fetch(ctx, ctx->cpu.pc);
+    if (exception_status != RV_EXCEPTION_NONE) {
+        RV_TRACE_END(&ctx->trace, ctx->cpu.pc.u, RV_TRACE_FLAG_FETCH_EXCEPTION);
+        return exception_status;
+    }
+
+    /* Decode instruction into the cache */
+    rv_Decode(ctx->instruction, decoded);
+    decoded->handler = handlers[decoded->op];
+    decoded->pc = ctx->cpu.pc.u;
+
+    /* Counted loops start with an addi or a nop */
+    if (((decoded->op == RV_OP_ADDI) || (decoded->op == RV_OP_NOP)) &&
+        rv_FindLoop(ctx, ctx->cpu.pc.u, &loop)) {
+        decoded->handler = &&op_loop;
+    }
+
+    /* Stores to predecoded code must drop it. An instruction may straddle
+     * two code pages. */
+    if (ctx->jit != NULL) {
+        rv_JITMarkCode(ctx->jit, ctx->cpu.pc.u);
+        rv_JITMarkCode(ctx->jit, ctx->cpu.pc.u + SIZE - 1U);
+    }
+
+    RV_TRACE_INSTRUCTION(&ctx->trace, decoded->instruction);
+    goto *decoded->handler;
+
+    /* Register-register */
+op_add:   THREADED_WRITE_RD_NEXT(RS1.u + RS2.u, 1U);
+op_sub:   THREADED_WRITE_RD_NEXT(RS1.u - RS2.u, 1U);
+op_sll:   THREADED_WRITE_RD_NEXT(RS1.u << (RS2.u & 0b11111U), 1U);
+op_slt:   THREADED_WRITE_RD_NEXT(RS1.s < RS2.s, 1U);
+op_sltu:  THREADED_WRITE_RD_NEXT(RS1.u < RS2.u, 1U);
+op_xor:   THREADED_WRITE_RD_NEXT(RS1.u ^ RS2.u, 1U);
+op_srl:   THREADED_WRITE_RD_NEXT(RS1.u >> (RS2.u & 0b11111U), 1U);
+op_sra:   THREADED_WRITE_RD_NEXT((uint32_t)(RS1.s >> (RS2.u & 0b11111U)), 1U);
+op_or:    THREADED_WRITE_RD_NEXT(RS1.u | RS2.u, 1U);
+op_and:   THREADED_WRITE_RD_NEXT(RS1.u & RS2.u, 1U);
+
+    /* Register-immediate */
+op_addi:  THREADED_WRITE_RD_NEXT(RS1.u + IMM.u, 1U);
+op_slli:  THREADED_WRITE_RD_NEXT(RS1.u << IMM.u, 1U);
+op_slti:  THREADED_WRITE_RD_NEXT(RS1.s < IMM.s, 1U);
+op_sltiu: THREADED_WRITE_RD_NEXT(RS1.u < IMM.u, 1U);
+op_xori:  THREADED_WRITE_RD_NEXT(RS1.u ^ IMM.u, 1U);
+op_srli:  THREADED_WRITE_RD_NEXT(RS1.u >> IMM.u, 1U);
+op_srai:  THREADED_WRITE_RD_NEXT((uint32_t)(RS1.s >> IMM.u), 1U);
+op_ori:   THREADED_WRITE_RD_NEXT(RS1.u | IMM.u, 1U);
+op_andi:  THREADED_WRITE_RD_NEXT(RS1.u & IMM.u, 1U);
+
+op_lui:   THREADED_WRITE_RD_NEXT(IMM.u, 1U);
+op_auipc: THREADED_WRITE_RD_NEXT(ctx->cpu.pc.u + IMM.u, 1U);
+
+op_jal:
+    /* rd <= pc + size, pc <= pc + immJ */
+    target = ctx->cpu.pc.u + IMM.u;
+    rv_ProfileJump(&ctx->profile, decoded->rd, 0U, ctx->cpu.pc.u + SIZE, target);
+    THREADED_WRITE_RD(ctx->cpu.pc.u + SIZE);
+    ctx->cpu.pc.u = target;
+    THREADED_RETIRE(1U, 0U);
+
+op_jalr:
+    /* rd <= pc + size, pc <= (rs1 + immI) & ~1. Read rs1 first in case
+     * rd == rs1. */
+    target = (RS1.u + IMM.u) & ~0b1U;
+    rv_ProfileJump(&ctx->profile, decoded->rd, decoded->rs1, ctx->cpu.pc.u + SIZE, target);
+    THREADED_WRITE_RD(ctx->cpu.pc.u + SIZE);
+    ctx->cpu.pc.u = target;
+    THREADED_RETIRE(1U, 0U);
+
+op_beq:   THREADED_BRANCH(RS1.u == RS2.u);
+op_bne:   THREADED_BRANCH(RS1.u != RS2.u);
+op_blt:   THREADED_BRANCH(RS1.s < RS2.s);
+op_bge:   THREADED_BRANCH(RS1.s >= RS2.s);
+op_bltu:  THREADED_BRANCH(RS1.u < RS2.u);
+op_bgeu:  THREADED_BRANCH(RS1.u >= RS2.u);
+
+op_lb:    THREADED_LOAD(FUNCT3_LOAD_SIGNED_BYTE);
+op_lh:    THREADED_LOAD(FUNCT3_LOAD_SIGNED_HALFWORD);
+op_lw:    THREADED_LOAD(FUNCT3_LOAD_WORD);
+op_lbu:   THREADED_LOAD(FUNCT3_LOAD_UNSIGNED_BYTE);
+op_lhu:   THREADED_LOAD(FUNCT3_LOAD_UNSIGNED_HALFWORD);
+
+op_sb:    THREADED_STORE(FUNCT3_STORE_BYTE);
+op_sh:    THREADED_STORE(FUNCT3_STORE_HALFWORD);
+op_sw:    THREADED_STORE(FUNCT3_STORE_WORD);
+
+op_nop:
+    ctx->cpu.pc.u += SIZE;
+    THREADED_RETIRE(1U, 0U);
+
+op_csr:
+    /* A write may enable an interrupt, so the main loop checks after it */
+    if (CSR_WRITES(decoded->instruction)) {
+        inst_limit = 0;
+    }
+    THREADED_WRITE_RD_NEXT(rv_CSRAccess(ctx, decoded), 1U);
+
+op_mret:
+    rv_Mret(ctx);
+    inst_limit = 0;
+    THREADED_RETIRE(1U, 0U);
+
+op_wfi:
+    rv_WaitForInterrupt(ctx);
+    ctx->cpu.pc.u += SIZE;
+    inst_limit = 0;
+    THREADED_RETIRE(1U, 0U);
+
+op_ecall:
+    /* May halt the guest, so the main loop checks after it */
+    rv_Ecall(ctx);
+    ctx->cpu.pc.u += SIZE;
+    inst_limit = 0;
+    THREADED_RETIRE(1U, 0U);
+
+op_mul:    THREADED_WRITE_RD_NEXT(rv_MulDiv(RV_OP_MUL, RS1, RS2), 1U);
+op_mulh:   THREADED_WRITE_RD_NEXT(rv_MulDiv(RV_OP_MULH, RS1, RS2), 1U);
+op_mulhsu: THREADED_WRITE_RD_NEXT(rv_MulDiv(RV_OP_MULHSU, RS1, RS2), 1U);
+op_mulhu:  THREADED_WRITE_RD_NEXT(rv_MulDiv(RV_OP_MULHU, RS1, RS2), 1U);
+op_div:    THREADED_WRITE_RD_NEXT(rv_MulDiv(RV_OP_DIV, RS1, RS2), RV_DIV_CYCLES);
+op_divu:   THREADED_WRITE_RD_NEXT(rv_MulDiv(RV_OP_DIVU, RS1, RS2), RV_DIV_CYCLES);
+op_rem:    THREADED_WRITE_RD_NEXT(rv_MulDiv(RV_OP_REM, RS1, RS2), RV_DIV_CYCLES);
+op_remu:   THREADED_WRITE_RD_NEXT(rv_MulDiv(RV_OP_REMU, RS1, RS2), RV_DIV_CYCLES);
+
+op_loop:
+    /* The first instruction of a counted loop. Whole iterations that fit
+     * retire at once, and the rest run as usual. A loop that is declined
+     * runs as usual from then on instead of being found again every
+     * iteration. */
+    switch (rv_SkipLoop(ctx, inst_limit)) {
+        case 1:
+            if (ctx->cpu.inst_cnt >= inst_limit) {
+                return RV_EXCEPTION_NONE;
+            }
+            THREADED_DISPATCH();
+            break;
+        case -1:
+            decoded->handler = handlers[decoded->op];
+            break;
+        default:
+            break;
+    }
+    goto *handlers[decoded->op];
+
+op_illegal:
+    ctx->halt.tval = decoded->instruction;
+    THREADED_FAULT(RV_EXCEPTION_ILLEGAL_INSTRUCTION);
+}
+
+#undef RS1
+#undef RS2
+#undef IMM
+#undef SIZE
+
+#else
+
+static rv_exception_t rv_Interpret(brv1e_ctx_t *ctx, uint64_t inst_limit) {
+    rv_loop_t loop;
+
     while (1) {
-        rv_Log("Cnt: %2llu | ", inst_cnt);
+        rv_exception_t exception_status;
 
-        /* Fetch instruction */
-        rv_exception_t exception_status = rv_Fetch(pc);
+        RV_TRACE_BEGIN(&ctx->trace, ctx->cpu.inst_cnt, ctx->cpu.pc.u);
 
-        /* Check for fetch exception */
-        if (exception_status != RV_EXCEPTION_NONE) {
-            return;
+        rv_decoded_t *decoded = &ctx->decode_cache[DECODE_CACHE_IDX(ctx->cpu.pc.u)];
+
+        if (decoded->pc != ctx->cpu.pc.u) {
+            /* Fetch instruction */
+            exception_status = rv_Fetch(ctx, ctx->cpu.pc);
+
+            /* Check for fetch exception */
+            if (exception_status != RV_EXCEPTION_NONE) {
+                RV_TRACE_END(&ctx->trace, ctx->cpu.pc.u, RV_TRACE_FLAG_FETCH_EXCEPTION);
+                return exception_status;
+            }
+
+            /* Decode instruction into the cache */
+            rv_Decode(ctx->instruction, decoded);
+            decoded->pc = ctx->cpu.pc.u;
+
+            /* Counted loops start with an addi or a nop */
+            decoded->loop = ((decoded->op == RV_OP_ADDI) || (decoded->op == RV_OP_NOP)) &&
+                            rv_FindLoop(ctx, ctx->cpu.pc.u, &loop);
+
+            /* Stores to predecoded code must drop it. An instruction may
+             * straddle two code pages. */
+            if (ctx->jit != NULL) {
+                rv_JITMarkCode(ctx->jit, ctx->cpu.pc.u);
+                rv_JITMarkCode(ctx->jit, ctx->cpu.pc.u + RV_INSTR_SIZE(decoded->instruction) - 1U);
+            }
         }
 
-        /* Decode and execute instruction */
-        rv_DecodeAndExecute();
+        /* Whole iterations of a counted loop that fit retire at once. A
+         * loop that is declined runs as usual from then on. */
+        if (decoded->loop) {
+            int skipped = rv_SkipLoop(ctx, inst_limit);
+            if (skipped > 0) {
+                if (ctx->cpu.inst_cnt >= inst_limit) {
+                    return RV_EXCEPTION_NONE;
+                }
+                continue;
+            }
+            if (skipped < 0) {
+                decoded->loop = 0;
+            }
+        }
+
+        RV_TRACE_INSTRUCTION(&ctx->trace, decoded->instruction);
+
+        /* Read the cycle count before executing since a store can
+         * invalidate its own cache entry */
+        uint32_t cycles = RV_OP_CYCLES(decoded->op);
+
+        /* Return to the main loop to check for interrupts after anything
+         * that may raise or enable one, or halt the guest */
+        int check_irq = (decoded->op == RV_OP_MRET) || (decoded->op == RV_OP_WFI) ||
+            (decoded->op == RV_OP_ECALL) ||
+            ((decoded->op == RV_OP_CSR) && CSR_WRITES(decoded->instruction)) ||
+            (RV_OP_IS_STORE(decoded->op) &&
+             (ctx->cpu.rf[decoded->rs1].u + decoded->imm.u >= ctx->ram_size));
 
-        ++inst_cnt;
+        /* Execute instruction. One that raised an exception does not
+         * retire. */
+        exception_status = rv_Execute(ctx, decoded);
+        if (exception_status != RV_EXCEPTION_NONE) {
+            RV_TRACE_END(&ctx->trace, ctx->cpu.pc.u, RV_TRACE_FLAG_EXCEPTION);
+            return exception_status;
+        }
 
-        rv_Log("\n");
+        ctx->cpu.cycle_cnt += cycles;
 
-        sleep(1);
+        RV_TRACE_END(&ctx->trace, ctx->cpu.pc.u, 0U);
+
+        if ((++ctx->cpu.inst_cnt >= inst_limit) || check_irq) {
+            return RV_EXCEPTION_NONE;
+        }
     }
 }
 
-static void rv_LoadProgram(const char *fn) {
-    if (fn == NULL) {
-        fn = "program.txt";
-    }
+#endif /* BRV1E_DISPATCH_THREADED */
+
+static brv1e_status_t rv_MainLoop(brv1e_ctx_t *ctx, uint64_t inst_limit) {
+    /* Forks taken from here on must see the new state */
+    rv_DropForkSnapshot(ctx);
+
+    while ((ctx->halt.reason == BRV1E_HALT_NONE) && (ctx->cpu.inst_cnt < inst_limit) &&
+           !atomic_load_explicit(&ctx->stopped, memory_order_relaxed)) {
+        uint64_t start_cnt = ctx->cpu.inst_cnt;
+        uint64_t chunk_limit = (ctx->cpu.inst_cnt | PACE_INTERVAL_MASK) + 1U;
+        if (chunk_limit > inst_limit) {
+            chunk_limit = inst_limit;
+        }
 
-    FILE *fd = fopen(fn, "rb");
-    assert(fd != NULL);
+        /* Interrupts are taken between chunks, so a chunk stops where one
+         * may become pending */
+        rv_TakeInterrupt(ctx);
+        chunk_limit = rv_InterruptLimit(ctx, chunk_limit);
 
-    size_t midx = 0;
-    uint8_t buf[16];
-    size_t nread;
-    while ((nread = fread(buf, 1, 16, fd))) {
-        memcpy(memory + midx, buf, nread);
-        midx += nread;
+        /* Stop right where the next sample is due */
+        if (ctx->profile.enabled && (chunk_limit > ctx->profile.next_sample)) {
+            chunk_limit = ctx->profile.next_sample;
+        }
+
+        rv_TraceSync(&ctx->trace);
+
+        rv_exception_t exception = RV_EXCEPTION_NONE;
+
+        /* Translated code does not produce trace records or track calls, so
+         * it only runs while tracing and profiling are off */
+        if ((ctx->jit != NULL) && !RV_TRACE_ACTIVE(&ctx->trace) && !ctx->profile.enabled) {
+            /* Translated code stops at instructions only the interpreter
+             * executes and short of the limit */
+            if (rv_JITExecute(ctx->jit, chunk_limit) != 0) {
+                exception = rv_Interpret(ctx, ctx->cpu.inst_cnt + 1U);
+            }
+        }
+        else {
+            exception = rv_Interpret(ctx, chunk_limit);
+        }
+
+        if (exception != RV_EXCEPTION_NONE) {
+            rv_Halt(ctx, exception);
+        }
+
+        if (rv_ProfileDue(&ctx->profile, ctx->cpu.inst_cnt)) {
+            rv_ProfileSample(&ctx->profile, ctx->cpu.pc.u, ctx->cpu.inst_cnt);
+        }
+
+        /* Pace whenever execution crosses an interval boundary */
+        if ((start_cnt ^ ctx->cpu.inst_cnt) > PACE_INTERVAL_MASK) {
+            rv_TimerPace(&ctx->timer, ctx->cpu.cycle_cnt);
+        }
     }
 
-    fclose(fd);
+    return (ctx->halt.reason != BRV1E_HALT_NONE) ? BRV1E_STATUS_HALTED : BRV1E_STATUS_RUNNING;
 }
 
-static rv_exception_t rv_DecodeAndExecute(void) {
-    word_t result, op1, op2;
-    rv_exception_t exception;
-    uint32_t branch_taken;
-    uint32_t addr;
+void rv_Decode(uint32_t instr, rv_decoded_t *decoded) {
+    if (RV_INSTR_SIZE(instr) == 2U) {
+        instr &= 0xFFFFU;
+        decoded->instruction = instr;
+        instr = rv_ExpandCompressed(instr);
+    }
+    else {
+        decoded->instruction = instr;
+    }
+
+    decoded->rd = (uint8_t)FIELD_RD(instr);
+    decoded->rs1 = (uint8_t)FIELD_RS1(instr);
+    decoded->rs2 = (uint8_t)FIELD_RS2(instr);
+    decoded->op = RV_OP_ILLEGAL;
+    decoded->imm.u = 0;
 
-    switch (FIELD_OPCODE(instruction)) {
+    switch (FIELD_OPCODE(instr)) {
         case OPCODE_OP:
-            op1 = rv_GetRegVal(FIELD_RS1(instruction));
-            op2 = rv_GetRegVal(FIELD_RS2(instruction));
-            
-            switch (FIELD_FUNCT3_OP(instruction)) {
-                case FUNCT3_OP_ADD:  result.s = (SPECIAL_OP(instruction)) ? (op1.s - op2.s) : (op1.s + op2.s); break;
-                case FUNCT3_OP_SLL:  result.u = op1.u << op2.u; break;
-                case FUNCT3_OP_SLT:  result.u = (op1.s < op2.s); break;
-                case FUNCT3_OP_SLTU: result.u = (op1.u < op2.u); break;
-                case FUNCT3_OP_XOR:  result.u = op1.u ^ op2.u; break;
-                case FUNCT3_OP_SRx:  result.u = (SPECIAL_OP(instruction)) ? (op1.s >> op2.u) : (op1.u >> op2.u); break;
-                case FUNCT3_OP_OR:   result.u = op1.u | op2.u; break;
-                case FUNCT3_OP_AND:  result.u = op1.u & op2.u; break;
-                default: assert(0); break;
+            if (MULDIV_OP(instr)) {
+                switch (FIELD_FUNCT3_OP(instr)) {
+                    case FUNCT3_OP_ADD:  decoded->op = RV_OP_MUL; break;
+                    case FUNCT3_OP_SLL:  decoded->op = RV_OP_MULH; break;
+                    case FUNCT3_OP_SLT:  decoded->op = RV_OP_MULHSU; break;
+                    case FUNCT3_OP_SLTU: decoded->op = RV_OP_MULHU; break;
+                    case FUNCT3_OP_XOR:  decoded->op = RV_OP_DIV; break;
+                    case FUNCT3_OP_SRx:  decoded->op = RV_OP_DIVU; break;
+                    case FUNCT3_OP_OR:   decoded->op = RV_OP_REM; break;
+                    case FUNCT3_OP_AND:  decoded->op = RV_OP_REMU; break;
+                    default: break;
+                }
+                break;
             }
 
-            rv_SetRegVal(FIELD_RD(instruction), result);
-
-            pc.u += 4U;
+            switch (FIELD_FUNCT3_OP(instr)) {
+                case FUNCT3_OP_ADD:  decoded->op = (SPECIAL_OP(instr)) ? RV_OP_SUB : RV_OP_ADD; break;
+                case FUNCT3_OP_SLL:  decoded->op = RV_OP_SLL; break;
+                case FUNCT3_OP_SLT:  decoded->op = RV_OP_SLT; break;
+                case FUNCT3_OP_SLTU: decoded->op = RV_OP_SLTU; break;
+                case FUNCT3_OP_XOR:  decoded->op = RV_OP_XOR; break;
+                case FUNCT3_OP_SRx:  decoded->op = (SPECIAL_OP(instr)) ? RV_OP_SRA : RV_OP_SRL; break;
+                case FUNCT3_OP_OR:   decoded->op = RV_OP_OR; break;
+                case FUNCT3_OP_AND:  decoded->op = RV_OP_AND; break;
+                default: break;
+            }
             break;
 
         case OPCODE_OP_IMM:
-            op1 = rv_GetRegVal(FIELD_RS1(instruction));
-            op2 = IMMEDIATE_I(instruction);
-            
-            switch (FIELD_FUNCT3_OP(instruction)) {
-                case FUNCT3_OP_ADD:  result.s = op1.s + op2.s; break;
-                case FUNCT3_OP_SLL:  result.u = op1.u << op2.u; break;
-                case FUNCT3_OP_SLT:  result.u = (op1.s < op2.s); break;
-                case FUNCT3_OP_SLTU: result.u = (op1.u < op2.u); break;
-                case FUNCT3_OP_XOR:  result.u = op1.u ^ op2.u; break;
-                case FUNCT3_OP_SRx:  result.u = (SPECIAL_OP(instruction)) ? (op1.s >> op2.u) : (op1.u >> op2.u); break;
-                case FUNCT3_OP_OR:   result.u = op1.u | op2.u; break;
-                case FUNCT3_OP_AND:  result.u = op1.u & op2.u; break;
-                default: assert(0); break;
+            decoded->imm = IMMEDIATE_I(instr);
+
+            switch (FIELD_FUNCT3_OP(instr)) {
+                case FUNCT3_OP_ADD:  decoded->op = RV_OP_ADDI; break;
+                case FUNCT3_OP_SLL:  decoded->op = RV_OP_SLLI; break;
+                case FUNCT3_OP_SLT:  decoded->op = RV_OP_SLTI; break;
+                case FUNCT3_OP_SLTU: decoded->op = RV_OP_SLTIU; break;
+                case FUNCT3_OP_XOR:  decoded->op = RV_OP_XORI; break;
+                case FUNCT3_OP_SRx:  decoded->op = (SPECIAL_OP(instr)) ? RV_OP_SRAI : RV_OP_SRLI; break;
+                case FUNCT3_OP_OR:   decoded->op = RV_OP_ORI; break;
+                case FUNCT3_OP_AND:  decoded->op = RV_OP_ANDI; break;
+                default: break;
             }
 
-            rv_SetRegVal(FIELD_RD(instruction), result);
-
-            pc.u += 4;
+            /* Shifts only use the shift amount */
+            if ((decoded->op == RV_OP_SLLI) || (decoded->op == RV_OP_SRLI) || (decoded->op == RV_OP_SRAI)) {
+                decoded->imm.u &= 0b11111U;
+            }
             break;
 
         case OPCODE_LUI:
-            /* rd <= immU */
-            rv_SetRegVal(FIELD_RD(instruction), IMMEDIATE_U(instruction));
-            pc.u += 4;
+            decoded->op = RV_OP_LUI;
+            decoded->imm = IMMEDIATE_U(instr);
             break;
 
         case OPCODE_AUIPC:
-            /* rd <= pc + immU */
-            rv_SetRegVal(FIELD_RD(instruction), (word_t)(pc.u + IMMEDIATE_U(instruction).u));
-            pc.u += 4;
+            decoded->op = RV_OP_AUIPC;
+            decoded->imm = IMMEDIATE_U(instr);
             break;
 
         case OPCODE_JAL:
-            rv_Log("J immediate: %08x", IMMEDIATE_J(instruction).s);
-            /* rd <= pc + 4 */
-            rv_SetRegVal(FIELD_RD(instruction), (word_t)(pc.u + 4));
-            /* pc <= pc + immJ */
-            pc.s += IMMEDIATE_J(instruction).s;
+            decoded->op = RV_OP_JAL;
+            decoded->imm = IMMEDIATE_J(instr);
             break;
 
         case OPCODE_JALR:
-            /* rd <= pc + 4 */
-            rv_SetRegVal(FIELD_RD(instruction), (word_t)(pc.u + 4));
-            /* pc <= rs1 + immI */
-            pc.u = rv_GetRegVal(FIELD_RS1(instruction)).u + IMMEDIATE_I(instruction).u;
+            decoded->op = RV_OP_JALR;
+            decoded->imm = IMMEDIATE_I(instr);
             break;
 
         case OPCODE_BRANCH:
-            op1 = rv_GetRegVal(FIELD_RS1(instruction));
-            op2 = rv_GetRegVal(FIELD_RS2(instruction));
-
-            switch (FIELD_FUNCT3_BRANCH(instruction)) {
-                case FUNCT3_BEQ:  branch_taken = (op1.s == op2.s); rv_Log("BEQ | "); break;
-                case FUNCT3_BNE:  branch_taken = (op1.s != op2.s); rv_Log("BNE | "); break;
-                case FUNCT3_BLT:  branch_taken = (op1.s < op2.s);  rv_Log("BLT | "); break;
-                case FUNCT3_BGE:  branch_taken = (op1.s >= op2.s); rv_Log("BGE | "); break;
-                case FUNCT3_BLTU: branch_taken = (op1.u < op2.u);  rv_Log("BLTU | "); break;
-                case FUNCT3_BGEU: branch_taken = (op1.u >= op2.u); rv_Log("BGEU | "); break;
-                default: assert(0); break;
-            }
-            
-            if (branch_taken) {
-                rv_Log("Taken with immediate %d | ", IMMEDIATE_B(instruction).s);
-                pc.s = pc.s + IMMEDIATE_B(instruction).s;
+            decoded->imm = IMMEDIATE_B(instr);
+
+            switch (FIELD_FUNCT3_BRANCH(instr)) {
+                case FUNCT3_BEQ:  decoded->op = RV_OP_BEQ; break;
+                case FUNCT3_BNE:  decoded->op = RV_OP_BNE; break;
+                case FUNCT3_BLT:  decoded->op = RV_OP_BLT; break;
+                case FUNCT3_BGE:  decoded->op = RV_OP_BGE; break;
+                case FUNCT3_BLTU: decoded->op = RV_OP_BLTU; break;
+                case FUNCT3_BGEU: decoded->op = RV_OP_BGEU; break;
+                default: break;
+            }
+            break;
+
+        case OPCODE_LOAD:
+            decoded->imm = IMMEDIATE_I(instr);
+
+            switch (FIELD_FUNCT3_LOAD(instr)) {
+                case FUNCT3_LOAD_SIGNED_BYTE:       decoded->op = RV_OP_LB; break;
+                case FUNCT3_LOAD_SIGNED_HALFWORD:   decoded->op = RV_OP_LH; break;
+                case FUNCT3_LOAD_WORD:              decoded->op = RV_OP_LW; break;
+                case FUNCT3_LOAD_UNSIGNED_BYTE:     decoded->op = RV_OP_LBU; break;
+                case FUNCT3_LOAD_UNSIGNED_HALFWORD: decoded->op = RV_OP_LHU; break;
+                default: break;
+            }
+            break;
+
+        case OPCODE_STORE:
+            decoded->imm = IMMEDIATE_S(instr);
+
+            switch (FIELD_FUNCT3_STORE(instr)) {
+                case FUNCT3_STORE_BYTE:     decoded->op = RV_OP_SB; break;
+                case FUNCT3_STORE_HALFWORD: decoded->op = RV_OP_SH; break;
+                case FUNCT3_STORE_WORD:     decoded->op = RV_OP_SW; break;
+                default: break;
+            }
+            break;
+
+        case OPCODE_MISC_MEM:
+            /* Fence is a nop */
+            decoded->op = RV_OP_NOP;
+            break;
+
+        case OPCODE_SYSTEM:
+            /* CSR accesses carry the CSR number in place of an immediate.
+             * The other system instructions, besides ecall, mret and wfi,
+             * are a nop. */
+            if (FIELD_FUNCT3(instr) != 0) {
+                decoded->op = RV_OP_CSR;
+                decoded->imm.u = instr >> 20;
+            }
+            else if (instr == INSTR_ECALL) {
+                decoded->op = RV_OP_ECALL;
+            }
+            else if (instr == INSTR_MRET) {
+                decoded->op = RV_OP_MRET;
+            }
+            else if (instr == INSTR_WFI) {
+                decoded->op = RV_OP_WFI;
             }
             else {
-                rv_Log("Not taken | ");
-                pc.u += 4;
+                decoded->op = RV_OP_NOP;
             }
             break;
 
-        case OPCODE_LOAD:
-            addr = rv_GetRegVal(FIELD_RS1(instruction)).u + IMMEDIATE_I(instruction).u;
-            rv_Log("Load from 0x%08x | ", addr);
+        default:
+            /* Illegal opcode */
+            break;
+    }
+}
+
+#ifndef BRV1E_DISPATCH_THREADED
+static rv_exception_t rv_Execute(brv1e_ctx_t *ctx, const rv_decoded_t *decoded) {
+    word_t op1 = rv_GetRegVal(ctx, decoded->rs1);
+    word_t op2 = rv_GetRegVal(ctx, decoded->rs2);
+    word_t imm = decoded->imm;
+    uint32_t size = RV_INSTR_SIZE(decoded->instruction);
+    word_t result;
+    rv_exception_t exception;
+
+    switch (decoded->op) {
+        /* Register-register */
+        case RV_OP_ADD:   result.u = op1.u + op2.u; break;
+        case RV_OP_SUB:   result.u = op1.u - op2.u; break;
+        case RV_OP_SLL:   result.u = op1.u << (op2.u & 0b11111U); break;
+        case RV_OP_SLT:   result.u = (op1.s < op2.s); break;
+        case RV_OP_SLTU:  result.u = (op1.u < op2.u); break;
+        case RV_OP_XOR:   result.u = op1.u ^ op2.u; break;
+        case RV_OP_SRL:   result.u = op1.u >> (op2.u & 0b11111U); break;
+        case RV_OP_SRA:   result.s = op1.s >> (op2.u & 0b11111U); break;
+        case RV_OP_OR:    result.u = op1.u | op2.u; break;
+        case RV_OP_AND:   result.u = op1.u & op2.u; break;
+
+        /* Register-immediate */
+        case RV_OP_ADDI:  result.u = op1.u + imm.u; break;
+        case RV_OP_SLLI:  result.u = op1.u << imm.u; break;
+        case RV_OP_SLTI:  result.u = (op1.s < imm.s); break;
+        case RV_OP_SLTIU: result.u = (op1.u < imm.u); break;
+        case RV_OP_XORI:  result.u = op1.u ^ imm.u; break;
+        case RV_OP_SRLI:  result.u = op1.u >> imm.u; break;
+        case RV_OP_SRAI:  result.s = op1.s >> imm.u; break;
+        case RV_OP_ORI:   result.u = op1.u | imm.u; break;
+        case RV_OP_ANDI:  result.u = op1.u & imm.u; break;
+
+        case RV_OP_LUI:
+            /* rd <= immU */
+            result = imm;
+            break;
+
+        case RV_OP_AUIPC:
+            /* rd <= pc + immU */
+            result.u = ctx->cpu.pc.u + imm.u;
+            break;
+
+        case RV_OP_JAL:
+            /* rd <= pc + size, pc <= pc + immJ */
+            rv_ProfileJump(&ctx->profile, decoded->rd, 0U, ctx->cpu.pc.u + size, ctx->cpu.pc.u + imm.u);
+            rv_SetRegVal(ctx, decoded->rd, (word_t)(ctx->cpu.pc.u + size));
+            ctx->cpu.pc.u += imm.u;
+            return RV_EXCEPTION_NONE;
+
+        case RV_OP_JALR:
+            /* rd <= pc + size, pc <= (rs1 + immI) & ~1 */
+            rv_ProfileJump(&ctx->profile, decoded->rd, decoded->rs1, ctx->cpu.pc.u + size, (op1.u + imm.u) & ~0b1U);
+            rv_SetRegVal(ctx, decoded->rd, (word_t)(ctx->cpu.pc.u + size));
+            ctx->cpu.pc.u = (op1.u + imm.u) & ~0b1U;
+            return RV_EXCEPTION_NONE;
+
+        case RV_OP_BEQ:  ctx->cpu.pc.u += (op1.u == op2.u) ? imm.u : size; return RV_EXCEPTION_NONE;
+        case RV_OP_BNE:  ctx->cpu.pc.u += (op1.u != op2.u) ? imm.u : size; return RV_EXCEPTION_NONE;
+        case RV_OP_BLT:  ctx->cpu.pc.u += (op1.s < op2.s)   ? imm.u : size; return RV_EXCEPTION_NONE;
+        case RV_OP_BGE:  ctx->cpu.pc.u += (op1.s >= op2.s)  ? imm.u : size; return RV_EXCEPTION_NONE;
+        case RV_OP_BLTU: ctx->cpu.pc.u += (op1.u < op2.u)   ? imm.u : size; return RV_EXCEPTION_NONE;
+        case RV_OP_BGEU: ctx->cpu.pc.u += (op1.u >= op2.u)  ? imm.u : size; return RV_EXCEPTION_NONE;
+
+        case RV_OP_LB:
+        case RV_OP_LH:
+        case RV_OP_LW:
+        case RV_OP_LBU:
+        case RV_OP_LHU:
             /* rd <= mem[rs1 + immI] */
-            exception = rv_Load(addr, FIELD_FUNCT3_LOAD(instruction));
+            exception = rv_Load(ctx, op1.u + imm.u, LOAD_FUNCT3(decoded->op));
             if (exception != RV_EXCEPTION_NONE) {
                 return exception;
             }
-            rv_SetRegVal(FIELD_RD(instruction), loaded);
-            pc.u += 4;
+            result = ctx->loaded;
             break;
 
-        case OPCODE_STORE:
+        case RV_OP_SB:
+        case RV_OP_SH:
+        case RV_OP_SW:
             /* mem[rs1 + immS] <= rs2 */
-            exception = rv_Store(
-                rv_GetRegVal(FIELD_RS1(instruction)).u + IMMEDIATE_S(instruction).u,
-                FIELD_FUNCT3_STORE(instruction),
-                rv_GetRegVal(FIELD_RS2(instruction))
-            );
+            exception = rv_Store(ctx, op1.u + imm.u, STORE_FUNCT3(decoded->op), op2);
             if (exception != RV_EXCEPTION_NONE) {
                 return exception;
             }
-            pc.u += 4;
-            break;
+            ctx->cpu.pc.u += size;
+            return RV_EXCEPTION_NONE;
 
-        case OPCODE_MISC_MEM:
-            /* Fence is a nop */
-            pc.u += 4;
+        case RV_OP_NOP:
+            ctx->cpu.pc.u += size;
+            return RV_EXCEPTION_NONE;
+
+        case RV_OP_CSR:
+            /* rd <= csr, then csr is written, set or cleared */
+            result.u = rv_CSRAccess(ctx, decoded);
             break;
 
-        case OPCODE_SYSTEM:
-            /* System instructions are a nop */
-            pc.u += 4;
+        case RV_OP_MRET:
+            rv_Mret(ctx);
+            return RV_EXCEPTION_NONE;
+
+        case RV_OP_WFI:
+            rv_WaitForInterrupt(ctx);
+            ctx->cpu.pc.u += size;
+            return RV_EXCEPTION_NONE;
+
+        case RV_OP_ECALL:
+            rv_Ecall(ctx);
+            ctx->cpu.pc.u += size;
+            return RV_EXCEPTION_NONE;
+
+        case RV_OP_MUL:
+        case RV_OP_MULH:
+        case RV_OP_MULHSU:
+        case RV_OP_MULHU:
+        case RV_OP_DIV:
+        case RV_OP_DIVU:
+        case RV_OP_REM:
+        case RV_OP_REMU:
+            result.u = rv_MulDiv((rv_op_t)decoded->op, op1, op2);
             break;
 
         default:
-            /* Illegal opcode */
+            ctx->halt.tval = decoded->instruction;
             return RV_EXCEPTION_ILLEGAL_INSTRUCTION;
     }
 
+    rv_SetRegVal(ctx, decoded->rd, result);
+    ctx->cpu.pc.u += size;
+
     return RV_EXCEPTION_NONE;
 }
+#endif /* BRV1E_DISPATCH_THREADED */
 
-static rv_exception_t rv_Fetch(word_t addr) {
-    rv_Log("Fetching from 0x%08x | ", pc.u);
+static int rv_OpenUARTInput(const char *path) {
+    size_t prefix_len = strlen(UART_RX_SOCKET_PREFIX);
 
-    /* Check for misaligned fetch */
-    if (addr.u & 0b11) {
-        printf("PC 0x%08x caused a misaligned address instruction exception\n | ", addr.u);
-        return RV_EXCEPTION_INSTRUCTION_ADDRESS_MISALIGNED;
+    if (strncmp(path, UART_RX_SOCKET_PREFIX, prefix_len) == 0) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(path + prefix_len) >= sizeof(addr.sun_path)) {
+            return -1;
+        }
+        strcpy(addr.sun_path, path + prefix_len);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((fd >= 0) && (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
     }
 
-    switch (addr.u) {
-        case MREGION_START_RAM ... MREGION_END_RAM:
-            /* Fetch from RAM */
-            instruction = *(uint32_t *)&memory[addr.u];
-            break;
+    /* Opening a named pipe would wait for a writer, so open it non-blocking
+     * and let the RX thread wait in poll() instead */
+    int fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    }
+    return fd;
+}
 
-        case MREGION_START_BOOT_ROM ... MREGION_END_BOOT_ROM:
-            /* Fetch from boot ROM */
-            rv_Log("BTRM idx %2d | ", (addr.u >> 2) & 0b11111U);
-            instruction = boot_rom[(addr.u >> 2) & 0b11111U];
-            break;
+static void rv_InvalidateDecodeCache(brv1e_ctx_t *ctx) {
+    for (uint32_t idx = 0; idx < DECODE_CACHE_SIZE; ++idx) {
+        ctx->decode_cache[idx].pc = DECODE_CACHE_INVALID_TAG(idx);
+    }
+}
+
+static void rv_InvalidateCode(brv1e_ctx_t *ctx) {
+    rv_InvalidateDecodeCache(ctx);
+    if (ctx->jit != NULL) {
+        rv_JITInvalidateAll(ctx->jit);
+    }
+}
+
+static void rv_DropForkSnapshot(brv1e_ctx_t *ctx) {
+    /* Existing forks keep their mappings */
+    if (ctx->fork_snapshot != NULL) {
+        fclose(ctx->fork_snapshot);
+        ctx->fork_snapshot = NULL;
+    }
+}
+
+static int rv_SaveSnapshot(const brv1e_ctx_t *ctx, int fd) {
+    rv_snapshot_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.header_size = sizeof(header);
+    header.ram_size = ctx->ram_size;
+    header.halt = ctx->halt;
+    header.cpu = ctx->cpu;
+    header.timer_reset_cycles = ctx->timer.reset_cycles;
+    header.timer_compare = ctx->timer.compare;
+    header.uart_rx_data = ctx->uart.rx_data;
+    header.uart_rx_next_cycles = ctx->uart.rx_next_cycles;
+    rv_UARTSave(&ctx->uart, header.uart_rx_fifo, &header.uart_rx_count, header.uart_tx_fifo, &header.uart_tx_count);
+    header.dma_src = ctx->dma.src;
+    header.dma_dst = ctx->dma.dst;
+    header.dma_len = ctx->dma.len;
+    header.dma_fill = ctx->dma.fill;
+    header.dma_error = ctx->dma.error;
+    header.dma_receiving = ctx->dma.receiving;
+    header.dma_done_cycles = ctx->dma.done_cycles;
+
+    if ((ftruncate(fd, 0) != 0) ||
+        (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))) {
+        return -1;
+    }
+
+    /* Zero blocks are skipped, which keeps mostly empty RAM small on disk */
+    static const uint8_t zero_block[SNAPSHOT_BLOCK_SIZE];
+    for (uint32_t offset = 0; offset < ctx->ram_size; offset += SNAPSHOT_BLOCK_SIZE) {
+        size_t len = (ctx->ram_size - offset < SNAPSHOT_BLOCK_SIZE) ? ctx->ram_size - offset : SNAPSHOT_BLOCK_SIZE;
+        if (memcmp(ctx->memory + offset, zero_block, len) == 0) {
+            continue;
+        }
+        if (pwrite(fd, ctx->memory + offset, len, SNAPSHOT_RAM_OFFSET + offset) != (ssize_t)len) {
+            return -1;
+        }
+    }
+
+    /* Extend the file over the whole mapping so every mapped page is backed */
+    return ftruncate(fd, (off_t)(SNAPSHOT_RAM_OFFSET + ctx->ram_map_size));
+}
+
+static int rv_RestoreSnapshot(brv1e_ctx_t *ctx, int fd) {
+    rv_snapshot_t header;
+    struct stat file_stat;
+
+    if ((pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) ||
+        (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) ||
+        (header.version != SNAPSHOT_VERSION) || (header.header_size != sizeof(header)) ||
+        (header.ram_size != ctx->ram_size) || (header.uart_rx_count > RV_UART_FIFO_SIZE) ||
+        (header.uart_tx_count > RV_UART_FIFO_SIZE) || (fstat(fd, &file_stat) != 0) ||
+        (file_stat.st_size < (off_t)(SNAPSHOT_RAM_OFFSET + ctx->ram_map_size))) {
+        return -1;
+    }
+
+    /* Map the snapshot's RAM copy-on-write in place of the current RAM. The
+     * memory map and the translator keep pointing at the same address. */
+    void *ram = mmap(ctx->memory, ctx->ram_map_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_FIXED, fd, SNAPSHOT_RAM_OFFSET);
+    if (ram == MAP_FAILED) {
+        return -1;
+    }
+
+    ctx->cpu = header.cpu;
+    ctx->halt = header.halt;
+    rv_TimerRestore(&ctx->timer, header.timer_reset_cycles, header.timer_compare, ctx->cpu.cycle_cnt);
+    rv_UARTRestore(&ctx->uart, header.uart_rx_data, header.uart_rx_next_cycles, header.uart_rx_fifo,
+                   header.uart_rx_count, header.uart_tx_fifo, header.uart_tx_count);
+    ctx->dma.src = header.dma_src;
+    ctx->dma.dst = header.dma_dst;
+    ctx->dma.len = header.dma_len;
+    ctx->dma.fill = header.dma_fill;
+    ctx->dma.error = header.dma_error;
+    ctx->dma.receiving = header.dma_receiving;
+    ctx->dma.done_cycles = header.dma_done_cycles;
+
+    rv_InvalidateCode(ctx);
+    rv_ProfileReset(&ctx->profile, ctx->cpu.inst_cnt);
+
+    return 0;
+}
 
+static void rv_InvalidateCodePage(brv1e_ctx_t *ctx, uint32_t addr) {
+    uint32_t page_start = addr & ~((1U << RV_JIT_PAGE_SHIFT) - 1U);
+
+    for (uint32_t page_addr = page_start; page_addr < page_start + (1U << RV_JIT_PAGE_SHIFT); page_addr += 2U) {
+        if (ctx->decode_cache[DECODE_CACHE_IDX(page_addr)].pc == page_addr) {
+            ctx->decode_cache[DECODE_CACHE_IDX(page_addr)].pc = DECODE_CACHE_INVALID_TAG(DECODE_CACHE_IDX(page_addr));
+        }
+    }
+
+    rv_JITInvalidate(ctx->jit, addr);
+}
+
+/* Drop code the DMA overwrote, as rv_Store() does for the core's stores */
+static void rv_DMAWritten(void *dev, uint32_t addr, uint32_t len) {
+    brv1e_ctx_t *ctx = dev;
+
+    if (len / 2U >= DECODE_CACHE_SIZE) {
+        rv_InvalidateCode(ctx);
+        return;
+    }
+
+    uint32_t end = ((addr + len - 1U) & ~0b1U) + 2U;
+    for (uint32_t hw = (addr & ~0b1U) - 2U; hw != end; hw += 2U) {
+        if (ctx->decode_cache[DECODE_CACHE_IDX(hw)].pc == hw) {
+            ctx->decode_cache[DECODE_CACHE_IDX(hw)].pc = DECODE_CACHE_INVALID_TAG(DECODE_CACHE_IDX(hw));
+        }
+    }
+
+    if (ctx->jit != NULL) {
+        uint32_t page_size = 1U << RV_JIT_PAGE_SHIFT;
+        for (uint32_t page = addr & ~(page_size - 1U); page < addr + len; page += page_size) {
+            if (rv_JITIsCode(ctx->jit, page)) {
+                rv_InvalidateCodePage(ctx, page);
+            }
+        }
+    }
+}
+
+static void rv_ExitWrite(void *dev, uint32_t offset, uint32_t write_data, uint32_t width, uint64_t cycles) {
+    (void)offset;
+    (void)width;
+    (void)cycles;
+    rv_Exit(dev, write_data);
+}
+
+/* Halt the guest at the current instruction, which still retires */
+static void rv_Exit(brv1e_ctx_t *ctx, uint32_t exit_code) {
+    ctx->halt.reason = BRV1E_HALT_EXIT;
+    ctx->halt.exit_code = exit_code;
+    ctx->halt.pc = ctx->cpu.pc.u;
+    ctx->halt.tval = 0;
+}
+
+static void rv_Ecall(brv1e_ctx_t *ctx) {
+    if (ctx->cpu.rf[REG_A7].u == ECALL_EXIT) {
+        rv_Exit(ctx, ctx->cpu.rf[REG_A0].u);
+    }
+}
+
+/* Halt the guest at the instruction that raised an exception. tval was
+ * recorded where the exception was raised. */
+static void rv_Halt(brv1e_ctx_t *ctx, rv_exception_t exception) {
+    switch (exception) {
+        case RV_EXCEPTION_ILLEGAL_INSTRUCTION:
+            ctx->halt.reason = BRV1E_HALT_ILLEGAL_INSTRUCTION;
+            break;
+        case RV_EXCEPTION_LOAD_ACCESS_FAULT:
+            ctx->halt.reason = BRV1E_HALT_LOAD_FAULT;
+            break;
+        case RV_EXCEPTION_STORE_ACCESS_FAULT:
+            ctx->halt.reason = BRV1E_HALT_STORE_FAULT;
+            break;
         default:
-            /* Raise an access-fault exception */
-            rv_Log("Fetching from 0x%08x raised an access fault exception | ", addr.u);
-            return RV_EXCEPTION_ACCESS_FAULT;
+            ctx->halt.reason = BRV1E_HALT_FETCH_FAULT;
+            break;
     }
 
-    rv_Log("Instruction: 0x%08x | ", instruction);
+    ctx->halt.exit_code = 0;
+    ctx->halt.pc = ctx->cpu.pc.u;
+}
+
+static rv_exception_t rv_Fetch(brv1e_ctx_t *ctx, word_t addr) {
+    /* Check for misaligned fetch. Compressed instructions only need halfword
+     * alignment. */
+    if (addr.u & 0b1) {
+        ctx->halt.tval = addr.u;
+        return RV_EXCEPTION_INSTRUCTION_ADDRESS_MISALIGNED;
+    }
+
+    /* Only host memory (RAM, boot ROM) can be executed */
+    if (rv_MemFetch(&ctx->mem, addr.u, &ctx->instruction) != 0) {
+        /* Raise an access-fault exception */
+        ctx->halt.tval = addr.u;
+        return RV_EXCEPTION_INSTRUCTION_ACCESS_FAULT;
+    }
 
     return RV_EXCEPTION_NONE;
 }
 
-static rv_exception_t rv_Load(uint32_t addr, rv_funct3_load_t funct3) {
-    /* Check for misaligned data access */
-    // if (DATA_ACCESS_MISALIGNED(addr, funct3)) {
-    //     return RV_EXCEPTION_ADDRESS_MISALIGNED; // FIXME
-    // }
+/* Check for a counted loop starting at pc */
+static int rv_FindLoop(const brv1e_ctx_t *ctx, uint32_t pc, rv_loop_t *loop) {
+    int found = 0;
 
-    switch (addr) {
-        case MREGION_START_RAM ... MREGION_END_RAM:
-            switch (funct3) {
-                case FUNCT3_LOAD_WORD:
-                    loaded.s = *(int32_t *)&memory[addr];
-                    break;
-                case FUNCT3_LOAD_SIGNED_HALFWORD:
-                    loaded.s = (int32_t)(*(int16_t *)&memory[addr]);
-                    break;
-                case FUNCT3_LOAD_SIGNED_BYTE:
-                    loaded.s = (int32_t)(*(int8_t *)&memory[addr]);
-                    break;
-                case FUNCT3_LOAD_UNSIGNED_HALFWORD:
-                    loaded.s = (int32_t)(*(uint16_t *)&memory[addr]);
-                    break;
-                case FUNCT3_LOAD_UNSIGNED_BYTE:
-                    loaded.s = (int32_t)(*(uint8_t *)&memory[addr]);
+    rv_LoopBegin(loop, pc);
+    while (found == 0) {
+        rv_decoded_t decoded;
+        uint32_t instr;
+
+        if ((pc & 0b1U) || (rv_MemFetch(&ctx->mem, pc, &instr) != 0)) {
+            return 0;
+        }
+
+        rv_Decode(instr, &decoded);
+        found = rv_LoopAppend(loop, pc, &decoded);
+        pc += RV_INSTR_SIZE(decoded.instruction);
+    }
+
+    return found > 0;
+}
+
+/* Retire the iterations of a counted loop starting at pc that fit before
+ * inst_limit. The loop is found again from memory each time, so it cannot
+ * go stale. Traces record every instruction, so loops run as usual while
+ * tracing. 1 if any iterations retired, 0 if none fit this time and -1 if
+ * there is no counted loop at pc or its counter wraps around. */
+static int rv_SkipLoop(brv1e_ctx_t *ctx, uint64_t inst_limit) {
+    rv_loop_t loop;
+
+    if (RV_TRACE_ACTIVE(&ctx->trace)) {
+        return 0;
+    }
+    if (!rv_FindLoop(ctx, ctx->cpu.pc.u, &loop)) {
+        return -1;
+    }
+    if ((ctx->cpu.inst_cnt >= inst_limit) || (inst_limit - ctx->cpu.inst_cnt < loop.insts)) {
+        return 0;
+    }
+
+    return (rv_LoopRun(&loop, &ctx->cpu, inst_limit) != 0) ? 1 : -1;
+}
+
+static uint32_t rv_CSRRead(const brv1e_ctx_t *ctx, uint32_t csr) {
+    /* The counters hold the totals before the current instruction, as the
+     * core's counters do while it executes */
+    switch (csr) {
+        case CSR_CYCLE:
+        case CSR_TIME:
+        case CSR_MCYCLE:
+            return (uint32_t)ctx->cpu.cycle_cnt;
+        case CSR_CYCLEH:
+        case CSR_TIMEH:
+        case CSR_MCYCLEH:
+            return (uint32_t)(ctx->cpu.cycle_cnt >> 32);
+        case CSR_INSTRET:
+        case CSR_MINSTRET:
+            return (uint32_t)ctx->cpu.inst_cnt;
+        case CSR_INSTRETH:
+        case CSR_MINSTRETH:
+            return (uint32_t)(ctx->cpu.inst_cnt >> 32);
+        case CSR_MSTATUS:
+            return ctx->cpu.mstatus | MSTATUS_MPP;
+        case CSR_MIE:
+            return ctx->cpu.mie;
+        case CSR_MTVEC:
+            return ctx->cpu.mtvec;
+        case CSR_MSCRATCH:
+            return ctx->cpu.mscratch;
+        case CSR_MEPC:
+            return ctx->cpu.mepc;
+        case CSR_MCAUSE:
+            return ctx->cpu.mcause;
+        case CSR_MIP:
+            return rv_PendingInterrupts(ctx);
+        default:
+            /* Unimplemented CSRs read as 0 */
+            return 0;
+    }
+}
+
+static void rv_CSRWrite(brv1e_ctx_t *ctx, uint32_t csr, uint32_t write_data) {
+    /* Only the trap CSRs can be written. Bits the core does not implement
+     * are dropped, and mip follows the devices. */
+    switch (csr) {
+        case CSR_MSTATUS:
+            ctx->cpu.mstatus = write_data & (MSTATUS_MIE | MSTATUS_MPIE);
+            break;
+        case CSR_MIE:
+            ctx->cpu.mie = write_data & (MIP_MTIP | MIP_MEIP);
+            break;
+        case CSR_MTVEC:
+            ctx->cpu.mtvec = write_data & ~0b10U;
+            break;
+        case CSR_MSCRATCH:
+            ctx->cpu.mscratch = write_data;
+            break;
+        case CSR_MEPC:
+            ctx->cpu.mepc = write_data & ~0b1U;
+            break;
+        case CSR_MCAUSE:
+            ctx->cpu.mcause = write_data;
+            break;
+        default:
+            break;
+    }
+}
+
+static uint32_t rv_CSRAccess(brv1e_ctx_t *ctx, const rv_decoded_t *decoded) {
+    uint32_t funct3 = FIELD_FUNCT3_CSR(decoded->instruction);
+    uint32_t csr = decoded->imm.u;
+
+    /* Read rs1 before rd is written in case they are the same */
+    uint32_t src = (funct3 & CSR_FUNCT3_IMM) ? decoded->rs1 : ctx->cpu.rf[decoded->rs1].u;
+    uint32_t old = rv_CSRRead(ctx, csr);
+
+    if (CSR_WRITES(decoded->instruction)) {
+        switch (funct3 & 0b11U) {
+            case CSR_FUNCT3_WRITE: rv_CSRWrite(ctx, csr, src); break;
+            case CSR_FUNCT3_SET:   rv_CSRWrite(ctx, csr, old | src); break;
+            case CSR_FUNCT3_CLEAR: rv_CSRWrite(ctx, csr, old & ~src); break;
+            default: break;
+        }
+    }
+
+    return old;
+}
+
+/* The mip bits the devices are requesting. The UART's request is masked
+ * while the DMA is receiving from it, as on the SoC. */
+static uint32_t rv_PendingInterrupts(const brv1e_ctx_t *ctx) {
+    uint64_t cycles = ctx->cpu.cycle_cnt;
+    uint64_t arrival;
+    uint32_t pending = 0;
+
+    if (rv_TimerDeadline(&ctx->timer, cycles) <= cycles) {
+        pending |= MIP_MTIP;
+    }
+    if (!ctx->dma.receiving && rv_UARTNextArrival(&ctx->uart, cycles, &arrival) && (arrival <= cycles)) {
+        pending |= MIP_MEIP;
+    }
+
+    return pending;
+}
+
+/* Trap to mtvec if an enabled interrupt is pending. External interrupts
+ * take priority over the timer. Like the core, a wfi retires first so the
+ * interrupt is taken on the instruction after it. */
+static void rv_TakeInterrupt(brv1e_ctx_t *ctx) {
+    uint32_t instr;
+
+    if (!(ctx->cpu.mstatus & MSTATUS_MIE) || (ctx->cpu.mie == 0)) {
+        return;
+    }
+
+    uint32_t pending = rv_PendingInterrupts(ctx) & ctx->cpu.mie;
+    if ((pending == 0) ||
+        ((rv_MemFetch(&ctx->mem, ctx->cpu.pc.u, &instr) == 0) && (instr == INSTR_WFI))) {
+        return;
+    }
+
+    uint32_t cause = (pending & MIP_MEIP) ? IRQ_EXTERNAL : IRQ_TIMER;
+
+    ctx->cpu.mepc = ctx->cpu.pc.u;
+    ctx->cpu.mcause = MCAUSE_INTERRUPT | cause;
+    ctx->cpu.mstatus = MSTATUS_MPIE;
+    ctx->cpu.pc.u = ctx->cpu.mtvec & ~MTVEC_VECTORED;
+    if (ctx->cpu.mtvec & MTVEC_VECTORED) {
+        ctx->cpu.pc.u += 4U * cause;
+    }
+
+    /* The core spends a cycle jumping to the handler */
+    ctx->cpu.cycle_cnt += 1U;
+}
+
+/* Shorten a chunk so it ends by the time an enabled interrupt may become
+ * pending. Each instruction takes at least a cycle, so stopping after as
+ * many instructions as there are cycles to the timer deadline is never
+ * late. */
+static uint64_t rv_InterruptLimit(const brv1e_ctx_t *ctx, uint64_t chunk_limit) {
+    uint64_t cycles = ctx->cpu.cycle_cnt;
+    uint64_t limit = chunk_limit;
+
+    if (!(ctx->cpu.mstatus & MSTATUS_MIE)) {
+        return chunk_limit;
+    }
+
+    if (ctx->cpu.mie & MIP_MTIP) {
+        uint64_t deadline = rv_TimerDeadline(&ctx->timer, cycles);
+        if (deadline > cycles) {
+            limit = ctx->cpu.inst_cnt + (deadline - cycles);
+        }
+    }
+
+    if (ctx->cpu.mie & MIP_MEIP) {
+        uint64_t arrival;
+        uint64_t irq_limit = ctx->cpu.inst_cnt + IRQ_POLL_INTERVAL;
+        if (rv_UARTNextArrival(&ctx->uart, cycles, &arrival) && (arrival > cycles) &&
+            (arrival - cycles < IRQ_POLL_INTERVAL)) {
+            irq_limit = ctx->cpu.inst_cnt + (arrival - cycles);
+        }
+        if (irq_limit < limit) {
+            limit = irq_limit;
+        }
+    }
+
+    return (limit < chunk_limit) ? limit : chunk_limit;
+}
+
+/* Return from a trap */
+static void rv_Mret(brv1e_ctx_t *ctx) {
+    ctx->cpu.pc.u = ctx->cpu.mepc;
+    ctx->cpu.mstatus = ((ctx->cpu.mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0U) | MSTATUS_MPIE;
+}
+
+/* Move the clock to the cycle the next enabled interrupt becomes pending,
+ * rather than executing the instructions that would wait for it. Only
+ * input from the host can make a UART interrupt pending, so with nothing
+ * received and no timer deadline, wait for the host. */
+static void rv_WaitForInterrupt(brv1e_ctx_t *ctx) {
+    const struct timespec idle = { .tv_sec = 0, .tv_nsec = WFI_IDLE_NS };
+
+    /* Nothing could wake the core, so carry on as if woken */
+    if (ctx->cpu.mie == 0) {
+        return;
+    }
+
+    while (1) {
+        uint64_t cycles = ctx->cpu.cycle_cnt;
+        uint64_t wake = UINT64_MAX;
+        uint64_t arrival;
+
+        if (ctx->cpu.mie & MIP_MTIP) {
+            wake = rv_TimerDeadline(&ctx->timer, cycles);
+        }
+        if ((ctx->cpu.mie & MIP_MEIP) && !ctx->dma.receiving &&
+            rv_UARTNextArrival(&ctx->uart, cycles, &arrival) && (arrival < wake)) {
+            wake = arrival;
+        }
+
+        if (wake != UINT64_MAX) {
+            if (wake > cycles) {
+                ctx->cpu.cycle_cnt = wake;
+                rv_TimerPace(&ctx->timer, wake);
+            }
+            return;
+        }
+
+        /* Let BRV1E_Stop() end the wait. The wfi retires as if woken. */
+        if (atomic_load_explicit(&ctx->stopped, memory_order_relaxed)) {
+            return;
+        }
+
+        nanosleep(&idle, NULL);
+    }
+}
+
+static uint32_t rv_MulDiv(rv_op_t op, word_t op1, word_t op2) {
+    /* Division by zero and overflow do not trap. A quotient by zero is all
+     * ones and the remainder is the dividend. INT32_MIN / -1 gives INT32_MIN
+     * with a remainder of 0, which is also -op1 for any other dividend. */
+    switch (op) {
+        case RV_OP_MUL:
+            return op1.u * op2.u;
+        case RV_OP_MULH:
+            return (uint32_t)(((int64_t)op1.s * op2.s) >> 32);
+        case RV_OP_MULHSU:
+            return (uint32_t)(((int64_t)op1.s * (int64_t)op2.u) >> 32);
+        case RV_OP_MULHU:
+            return (uint32_t)(((uint64_t)op1.u * op2.u) >> 32);
+        case RV_OP_DIV:
+            if (op2.u == 0) {
+                return UINT32_MAX;
+            }
+            else if (op2.s == -1) {
+                return 0U - op1.u;
+            }
+            return (uint32_t)(op1.s / op2.s);
+        case RV_OP_DIVU:
+            return (op2.u == 0) ? UINT32_MAX : (op1.u / op2.u);
+        case RV_OP_REM:
+            if (op2.u == 0) {
+                return op1.u;
+            }
+            else if (op2.s == -1) {
+                return 0U;
+            }
+            return (uint32_t)(op1.s % op2.s);
+        case RV_OP_REMU:
+            return (op2.u == 0) ? op1.u : (op1.u % op2.u);
+        default:
+            return 0;
+    }
+}
+
+static uint32_t rv_ExpandCompressed(uint32_t instr) {
+    static const rv_funct3_op_t ca_funct3[4] = {
+        FUNCT3_OP_ADD, FUNCT3_OP_XOR, FUNCT3_OP_OR, FUNCT3_OP_AND
+    };
+
+    uint32_t rd = CFIELD_RD(instr);
+    uint32_t rs2 = CFIELD_RS2(instr);
+    uint32_t rs1_p = CFIELD_RS1_P(instr);
+    uint32_t rs2_p = CFIELD_RS2_P(instr);
+    uint32_t imm6 = CIMMEDIATE_6(instr);
+    uint32_t imm;
+
+    /* Reserved encodings and the RV64/RV128 and floating point ones break
+     * out and expand to 0, an illegal instruction */
+    switch (C_OP(CFIELD_QUADRANT(instr), CFIELD_FUNCT3(instr))) {
+        case C_OP(0b00, 0b000):
+            /* c.addi4spn: addi rd', x2, nzuimm. All zeros is illegal. */
+            imm = ((instr >> 7) & 0x30U) | ((instr >> 1) & 0x3C0U) |
+                  ((instr >> 4) & 0x4U) | ((instr >> 2) & 0x8U);
+            if (imm == 0) {
+                break;
+            }
+            return ENCODE_I(OPCODE_OP_IMM, rs2_p, FUNCT3_OP_ADD, 2U, imm);
+
+        case C_OP(0b00, 0b010):
+            /* c.lw: lw rd', uimm(rs1') */
+            imm = ((instr >> 7) & 0x38U) | ((instr >> 4) & 0x4U) | ((instr << 1) & 0x40U);
+            return ENCODE_I(OPCODE_LOAD, rs2_p, FUNCT3_LOAD_WORD, rs1_p, imm);
+
+        case C_OP(0b00, 0b110):
+            /* c.sw: sw rs2', uimm(rs1') */
+            imm = ((instr >> 7) & 0x38U) | ((instr >> 4) & 0x4U) | ((instr << 1) & 0x40U);
+            return ENCODE_S(FUNCT3_STORE_WORD, rs1_p, rs2_p, imm);
+
+        case C_OP(0b01, 0b000):
+            /* c.addi (c.nop when rd is x0): addi rd, rd, imm */
+            return ENCODE_I(OPCODE_OP_IMM, rd, FUNCT3_OP_ADD, rd, imm6);
+
+        case C_OP(0b01, 0b001):
+            /* c.jal: jal x1, offset */
+            return ENCODE_J(1U, CIMMEDIATE_J(instr));
+
+        case C_OP(0b01, 0b010):
+            /* c.li: addi rd, x0, imm */
+            return ENCODE_I(OPCODE_OP_IMM, rd, FUNCT3_OP_ADD, 0U, imm6);
+
+        case C_OP(0b01, 0b011):
+            if (rd == 2U) {
+                /* c.addi16sp: addi x2, x2, nzimm */
+                imm = SIGN_EXTEND(((instr >> 3) & 0x200U) | ((instr >> 2) & 0x10U) |
+                                  ((instr << 1) & 0x40U) | ((instr << 4) & 0x180U) |
+                                  ((instr << 3) & 0x20U), 22);
+                if (imm == 0) {
                     break;
+                }
+                return ENCODE_I(OPCODE_OP_IMM, 2U, FUNCT3_OP_ADD, 2U, imm);
+            }
+
+            /* c.lui: lui rd, nzimm */
+            if (imm6 == 0) {
+                break;
+            }
+            return ENCODE_U(OPCODE_LUI, rd, imm6 << 12);
+
+        case C_OP(0b01, 0b100):
+            switch ((instr >> 10) & 0b11U) {
+                case 0b00:
+                case 0b01:
+                    /* c.srli, c.srai: srli/srai rd', rd', shamt. shamt[5]
+                     * must be 0 on RV32. */
+                    if (instr & 0x1000U) {
+                        break;
+                    }
+                    return ENCODE_I(OPCODE_OP_IMM, rs1_p, FUNCT3_OP_SRx, rs1_p,
+                                    imm6 | ((instr & 0x400U) ? 0x400U : 0U));
+                case 0b10:
+                    /* c.andi: andi rd', rd', imm */
+                    return ENCODE_I(OPCODE_OP_IMM, rs1_p, FUNCT3_OP_AND, rs1_p, imm6);
                 default:
-                    assert(0);
-                    break;
+                    /* c.sub, c.xor, c.or, c.and: op rd', rd', rs2' */
+                    if (instr & 0x1000U) {
+                        break;
+                    }
+                    return ENCODE_R(rs1_p, ca_funct3[(instr >> 5) & 0b11U], rs1_p, rs2_p,
+                                    (((instr >> 5) & 0b11U) == 0) ? 0b0100000U : 0U);
             }
             break;
 
-        case MREGION_TIMER:
-            // TODO load from timer
-            break;
+        case C_OP(0b01, 0b101):
+            /* c.j: jal x0, offset */
+            return ENCODE_J(0U, CIMMEDIATE_J(instr));
 
-        case MREGION_START_UART ... MREGION_END_UART:
-            loaded.u = (uint32_t)rv_UARTRead((uint8_t)addr);
-            rv_Log("0x%08X from UART | ", loaded.u);
-            break;
+        case C_OP(0b01, 0b110):
+            /* c.beqz: beq rs1', x0, offset */
+            return ENCODE_B(FUNCT3_BEQ, rs1_p, 0U, CIMMEDIATE_B(instr));
+
+        case C_OP(0b01, 0b111):
+            /* c.bnez: bne rs1', x0, offset */
+            return ENCODE_B(FUNCT3_BNE, rs1_p, 0U, CIMMEDIATE_B(instr));
+
+        case C_OP(0b10, 0b000):
+            /* c.slli: slli rd, rd, shamt */
+            if (instr & 0x1000U) {
+                break;
+            }
+            return ENCODE_I(OPCODE_OP_IMM, rd, FUNCT3_OP_SLL, rd, imm6);
+
+        case C_OP(0b10, 0b010):
+            /* c.lwsp: lw rd, uimm(x2) */
+            if (rd == 0) {
+                break;
+            }
+            imm = ((instr >> 7) & 0x20U) | ((instr >> 2) & 0x1CU) | ((instr << 4) & 0xC0U);
+            return ENCODE_I(OPCODE_LOAD, rd, FUNCT3_LOAD_WORD, 2U, imm);
+
+        case C_OP(0b10, 0b100):
+            if (!(instr & 0x1000U)) {
+                if (rs2 != 0) {
+                    /* c.mv: add rd, x0, rs2 */
+                    return ENCODE_R(rd, FUNCT3_OP_ADD, 0U, rs2, 0U);
+                }
+                if (rd == 0) {
+                    break;
+                }
+                /* c.jr: jalr x0, 0(rs1) */
+                return ENCODE_I(OPCODE_JALR, 0U, 0U, rd, 0U);
+            }
+
+            if (rs2 != 0) {
+                /* c.add: add rd, rd, rs2 */
+                return ENCODE_R(rd, FUNCT3_OP_ADD, rd, rs2, 0U);
+            }
+            if (rd == 0) {
+                /* c.ebreak */
+                return ENCODE_I(OPCODE_SYSTEM, 0U, 0U, 0U, 1U);
+            }
+            /* c.jalr: jalr x1, 0(rs1) */
+            return ENCODE_I(OPCODE_JALR, 1U, 0U, rd, 0U);
+
+        case C_OP(0b10, 0b110):
+            /* c.swsp: sw rs2, uimm(x2) */
+            imm = ((instr >> 7) & 0x3CU) | ((instr >> 1) & 0xC0U);
+            return ENCODE_S(FUNCT3_STORE_WORD, 2U, rs2, imm);
 
         default:
-            /* Raise an access-fault exception */
-            return RV_EXCEPTION_ACCESS_FAULT;
+            break;
+    }
+
+    return 0;
+}
+
+static rv_exception_t rv_Load(brv1e_ctx_t *ctx, uint32_t addr, rv_funct3_load_t funct3) {
+    /* Check for misaligned data access */
+    // if (DATA_ACCESS_MISALIGNED(addr, funct3)) {
+    //     return RV_EXCEPTION_ADDRESS_MISALIGNED; // FIXME
+    // }
+
+    if (rv_MemLoad(&ctx->mem, addr, FUNCT3_WIDTH(funct3), &ctx->loaded.u, ctx->cpu.cycle_cnt) != 0) {
+        /* Raise an access-fault exception */
+        ctx->halt.tval = addr;
+        return RV_EXCEPTION_LOAD_ACCESS_FAULT;
+    }
+
+    /* Sign-extend */
+    switch (funct3) {
+        case FUNCT3_LOAD_SIGNED_HALFWORD: ctx->loaded.s = (int16_t)ctx->loaded.u; break;
+        case FUNCT3_LOAD_SIGNED_BYTE:     ctx->loaded.s = (int8_t)ctx->loaded.u; break;
+        default: break;
     }
 
+    RV_TRACE_MEM(&ctx->trace, RV_TRACE_FLAG_LOAD, addr, ctx->loaded.u);
+
     return RV_EXCEPTION_NONE;
 }
 
-static rv_exception_t rv_Store(uint32_t addr, rv_funct3_store_t funct3, word_t write_data) {
+static rv_exception_t rv_Store(brv1e_ctx_t *ctx, uint32_t addr, rv_funct3_store_t funct3, word_t write_data) {
     /* Check for misaligned data access */
     // if (DATA_ACCESS_MISALIGNED(addr, funct3)) {
     //     return RV_EXCEPTION_ADDRESS_MISALIGNED; // TODO
     // }
 
-    switch (addr) {
-        case MREGION_START_RAM ... MREGION_END_RAM:
-            switch (funct3) {
-                case FUNCT3_STORE_WORD:
-                    *(uint32_t *)&memory[addr] = write_data.u;
-                    break;
-                case FUNCT3_STORE_HALFWORD:
-                    *(uint16_t *)&memory[addr] = (uint16_t)write_data.u;
-                    break;
-                case FUNCT3_STORE_BYTE:
-                    *(uint8_t *)&memory[addr] = (uint8_t)write_data.u;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case MREGION_TIMER:
-            // TODO what to do when tryting to write to timer?
-            break;
-        case MREGION_START_UART ... MREGION_END_UART:
-            rv_UARTWrite((uint8_t)addr, (uint8_t)write_data.u);
-            break;
-        default:
-            /* Raise an access-fault exception */
-            return RV_EXCEPTION_ACCESS_FAULT;
+    if (rv_MemStore(&ctx->mem, addr, FUNCT3_WIDTH(funct3), write_data.u, ctx->cpu.cycle_cnt) != 0) {
+        /* Raise an access-fault exception */
+        ctx->halt.tval = addr;
+        return RV_EXCEPTION_STORE_ACCESS_FAULT;
+    }
+
+    /* Drop predecoded instructions the store overwrote: any starting in the
+     * halfwords it touches or in the halfword before, which a 4-byte
+     * instruction extends over. Stores may be misaligned. */
+    uint32_t end = ((addr + FUNCT3_WIDTH(funct3) - 1U) & ~0b1U) + 2U;
+    for (uint32_t hw = (addr & ~0b1U) - 2U; hw != end; hw += 2U) {
+        if (ctx->decode_cache[DECODE_CACHE_IDX(hw)].pc == hw) {
+            ctx->decode_cache[DECODE_CACHE_IDX(hw)].pc = DECODE_CACHE_INVALID_TAG(DECODE_CACHE_IDX(hw));
+        }
     }
 
+    /* Drop translated code. The whole code page goes since the translator
+     * tracks code per page. */
+    if (ctx->jit != NULL) {
+        if (rv_JITIsCode(ctx->jit, addr)) {
+            rv_InvalidateCodePage(ctx, addr);
+        }
+        if (rv_JITIsCode(ctx->jit, addr + 3U)) {
+            rv_InvalidateCodePage(ctx, addr + 3U);
+        }
+    }
+
+    RV_TRACE_MEM(&ctx->trace, RV_TRACE_FLAG_STORE, addr, write_data.u);
+
     return RV_EXCEPTION_NONE; 
 }
 
-static word_t rv_GetRegVal(reg_sel_t reg_sel) {
-    assert(reg_sel <= 32);
-    return (reg_sel) ? rf[reg_sel + 1] : (word_t)0;
+#ifndef BRV1E_DISPATCH_THREADED
+static word_t rv_GetRegVal(brv1e_ctx_t *ctx, reg_sel_t reg_sel) {
+    assert(reg_sel < 32);
+    return ctx->cpu.rf[reg_sel];
 }
 
-static void rv_SetRegVal(reg_sel_t reg_sel, word_t write_data) {
-    assert(reg_sel <= 32);
+static void rv_SetRegVal(brv1e_ctx_t *ctx, reg_sel_t reg_sel, word_t write_data) {
+    assert(reg_sel < 32);
     if (reg_sel) {
-        rf[reg_sel + 1] = write_data;
+        ctx->cpu.rf[reg_sel] = write_data;
+        RV_TRACE_RD(&ctx->trace, reg_sel, write_data.u);
     }
 }
+#endif /* BRV1E_DISPATCH_THREADED */
 
 /* ----------------------------------------------------------------------------
  * Public Function Definitions
  * ------------------------------------------------------------------------- */
 
-void BRV1E_Run(const char *mem_image) {
-    logfile = fopen("rv_log.txt", "w");
-    fclose(logfile);
+void BRV1E_Run(const char *mem_image, const brv1e_opts_t *opts) {
+    brv1e_opts_t run_opts = { 0 };
+    if (opts != NULL) {
+        run_opts = *opts;
+    }
+
+    /* The UART is the console */
+    run_opts.uart_stdin = 1;
+
+    brv1e_ctx_t *ctx = BRV1E_Create(&run_opts);
+    if (ctx == NULL) {
+        printf("Could not create the emulator\n");
+        return;
+    }
+
+    /* With scripted UART input the bootloader can receive the program */
+    if ((mem_image == NULL) && (run_opts.uart_rx_file == NULL)) {
+        mem_image = "program.txt";
+    }
+
+    if ((mem_image != NULL) && (BRV1E_Load(ctx, mem_image) != 0)) {
+        printf("Could not load %s\n", mem_image);
+    }
+    else {
+        /* Emulator main loop */
+        BRV1E_RunContext(ctx);
+    }
+
+    BRV1E_Destroy(ctx);
+}
+
+brv1e_ctx_t *BRV1E_Create(const brv1e_opts_t *opts) {
+    static const brv1e_opts_t default_opts = { 0 };
+
+    if (opts == NULL) {
+        opts = &default_opts;
+    }
 
-    /* Initialize UART */
-    rv_InitUART();
+    uint32_t ram_size = (opts->ram_size != 0) ? opts->ram_size : RAM_DEFAULT_SIZE;
+    if ((ram_size > RAM_MAX_SIZE) || (ram_size % BRV1E_RAM_PAGE_SIZE)) {
+        return NULL;
+    }
+
+    brv1e_ctx_t *ctx = calloc(1, sizeof(brv1e_ctx_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
 
-    /* Allocate memory for RAM */
-    memory = malloc(RAM_SIZE);
-    assert(memory != NULL);
+    /* Allocate memory for RAM. It is mapped rather than allocated so that
+     * snapshots can be mapped over it. Host pages are only committed once
+     * the guest touches them, and no swap is reserved for the rest, so large
+     * RAMs cost nothing until used. */
+    ctx->ram_size = ram_size;
+    ctx->ram_map_size = RAM_MAP_SIZE(ram_size);
+    ctx->memory = mmap(NULL, ctx->ram_map_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ctx->memory == MAP_FAILED) {
+        free(ctx);
+        return NULL;
+    }
 
-    rv_LoadProgram(mem_image);
+    /* Open the UART output */
+    FILE *tx_file = stdout;
+    if (opts->uart_tx_discard) {
+        tx_file = NULL;
+    }
+    else if (opts->uart_tx_file != NULL) {
+        ctx->uart_tx_file = fopen(opts->uart_tx_file, "wb");
+        if (ctx->uart_tx_file == NULL) {
+            munmap(ctx->memory, ctx->ram_map_size);
+            free(ctx);
+            return NULL;
+        }
+        tx_file = ctx->uart_tx_file;
+    }
+
+    /* Open the UART input */
+    ctx->uart_rx_fd = -1;
+    int rx_fd = opts->uart_stdin ? STDIN_FILENO : -1;
+    if (opts->uart_rx_file != NULL) {
+        ctx->uart_rx_fd = rv_OpenUARTInput(opts->uart_rx_file);
+        if (ctx->uart_rx_fd < 0) {
+            if (ctx->uart_tx_file != NULL) {
+                fclose(ctx->uart_tx_file);
+            }
+            munmap(ctx->memory, ctx->ram_map_size);
+            free(ctx);
+            return NULL;
+        }
+        rx_fd = ctx->uart_rx_fd;
+    }
+
+    /* Start the trace writer */
+    if (opts->trace_file != NULL) {
+        if (rv_InitTrace(&ctx->trace, opts->trace_file) != 0) {
+            printf("Could not start trace to %s\n", opts->trace_file);
+        }
+    }
+
+    /* Start the profiler */
+    if ((opts->profile_file != NULL) || (opts->profile_folded_file != NULL)) {
+        if (rv_InitProfile(&ctx->profile, opts->profile_file, opts->profile_folded_file,
+                           opts->profile_period, 0) != 0) {
+            printf("Could not start the profiler\n");
+        }
+        else if (opts->profile_symbols != NULL) {
+            rv_ProfileLoadSymbols(&ctx->profile, opts->profile_symbols);
+        }
+    }
+    ctx->profile_symbols = opts->profile_symbols;
+
+    /* Start from an empty memory map. Devices map themselves. */
+    rv_InitMem(&ctx->mem);
+
+    /* Initialize the timer and the virtual clock */
+    rv_InitTimer(&ctx->timer, &ctx->mem, opts->clk_freq_hz, opts->realtime);
+
+    /* Initialize UART. A baud rate is turned into virtual cycles per byte. */
+    uint64_t rx_byte_cycles = 0;
+    if (opts->uart_baud != 0) {
+        rx_byte_cycles = (uint64_t)ctx->timer.clk_freq * UART_FRAME_BITS / opts->uart_baud;
+    }
+    rv_InitUART(&ctx->uart, &ctx->mem, tx_file, rx_fd, rx_byte_cycles);
+
+    rv_InitDMA(&ctx->dma, &ctx->mem, ctx->memory, ctx->ram_size, &ctx->uart, rv_DMAWritten, ctx);
+
+    rv_MemMapHost(&ctx->mem, "ram", MREGION_START_RAM, ctx->ram_size, ctx->memory, RV_MEM_WRITE);
+    rv_MemMapHost(&ctx->mem, "boot_rom", MREGION_START_BOOT_ROM, sizeof(boot_rom), (void *)boot_rom, 0);
+    rv_MemMapDevice(&ctx->mem, "exit", EXIT_REG_ADDR, EXIT_REG_SIZE, NULL, rv_ExitWrite, ctx);
+
+    /* Nothing has been predecoded yet */
+    rv_InvalidateDecodeCache(ctx);
 
     /* Initialize the PC */
-    pc.u = PC_START_ADDRESS;
+    ctx->direct_boot = opts->direct_boot;
+    ctx->cpu.pc.u = opts->direct_boot ? MREGION_START_RAM : PC_START_ADDRESS;
+
+    /* Start the translator */
+    if (opts->jit) {
+        ctx->jit = rv_InitJIT(&ctx->cpu, ctx->memory, ctx->ram_size,
+                              boot_rom, MREGION_START_BOOT_ROM, sizeof(boot_rom));
+        if (ctx->jit == NULL) {
+            printf("JIT is not available, interpreting\n");
+        }
+    }
 
-    /* Reset the instruction count */
-    inst_cnt = 0;
+    return ctx;
+}
 
-    rv_Log("Emulator started\n");
+int BRV1E_Load(brv1e_ctx_t *ctx, const char *mem_image) {
+    uint32_t entry;
 
-    /* Emulator main loop */
-    rv_MainLoop();
+    if (rv_LoadProgram(mem_image, ctx->memory, ctx->ram_size, &entry) != 0) {
+        return -1;
+    }
 
-    rv_Log("Exiting emulator\n");
+    /* Otherwise the boot ROM receives the program and jumps to address 0 */
+    if (ctx->direct_boot) {
+        ctx->cpu.pc.u = entry;
+    }
 
-    /* Free RAM memory */
-    free(memory);
-    memory = NULL;
+    /* Name profiled functions after the program's own symbols */
+    if (ctx->profile.enabled && (ctx->profile_symbols == NULL)) {
+        rv_ProfileLoadSymbols(&ctx->profile, mem_image);
+    }
+    rv_ProfileReset(&ctx->profile, ctx->cpu.inst_cnt);
+
+    /* Drop anything predecoded or translated from the old contents */
+    rv_InvalidateCode(ctx);
+    rv_DropForkSnapshot(ctx);
+
+    return 0;
+}
+
+int BRV1E_Save(const brv1e_ctx_t *ctx, const char *snapshot) {
+    int fd = open(snapshot, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int result = rv_SaveSnapshot(ctx, fd);
+
+    if (close(fd) != 0) {
+        result = -1;
+    }
+
+    return result;
+}
+
+int BRV1E_Restore(brv1e_ctx_t *ctx, const char *snapshot) {
+    int fd = open(snapshot, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* The mapping keeps the file alive once the descriptor is closed */
+    rv_DropForkSnapshot(ctx);
+    int result = rv_RestoreSnapshot(ctx, fd);
+    close(fd);
+
+    return result;
+}
+
+brv1e_ctx_t *BRV1E_Fork(brv1e_ctx_t *ctx, const brv1e_opts_t *opts) {
+    /* Forks taken while the parent is stopped share one snapshot, so their
+     * RAM shares pages until written */
+    if (ctx->fork_snapshot == NULL) {
+        ctx->fork_snapshot = tmpfile();
+        if (ctx->fork_snapshot == NULL) {
+            return NULL;
+        }
+        if (rv_SaveSnapshot(ctx, fileno(ctx->fork_snapshot)) != 0) {
+            rv_DropForkSnapshot(ctx);
+            return NULL;
+        }
+    }
+
+    /* The snapshot only restores into RAM of the same size */
+    brv1e_opts_t fork_opts = { 0 };
+    if (opts != NULL) {
+        fork_opts = *opts;
+    }
+    fork_opts.ram_size = ctx->ram_size;
+
+    brv1e_ctx_t *fork = BRV1E_Create(&fork_opts);
+    if ((fork != NULL) && (rv_RestoreSnapshot(fork, fileno(ctx->fork_snapshot)) != 0)) {
+        BRV1E_Destroy(fork);
+        fork = NULL;
+    }
+
+    return fork;
+}
+
+brv1e_status_t BRV1E_Boot(brv1e_ctx_t *ctx) {
+    /* Step one instruction at a time so execution stops right at the jump.
+     * Translated blocks end at jumps too. */
+    while ((ctx->halt.reason == BRV1E_HALT_NONE) && !atomic_load(&ctx->stopped) &&
+           (ctx->cpu.pc.u >= MREGION_START_BOOT_ROM) &&
+           (ctx->cpu.pc.u - MREGION_START_BOOT_ROM < sizeof(boot_rom))) {
+        rv_MainLoop(ctx, ctx->cpu.inst_cnt + 1U);
+    }
+
+    return (ctx->halt.reason != BRV1E_HALT_NONE) ? BRV1E_STATUS_HALTED : BRV1E_STATUS_RUNNING;
+}
+
+brv1e_status_t BRV1E_Step(brv1e_ctx_t *ctx, uint64_t num_insts) {
+    return rv_MainLoop(ctx, ctx->cpu.inst_cnt + num_insts);
+}
+
+brv1e_status_t BRV1E_RunContext(brv1e_ctx_t *ctx) {
+    return rv_MainLoop(ctx, UINT64_MAX);
+}
+
+void BRV1E_Stop(brv1e_ctx_t *ctx) {
+    atomic_store(&ctx->stopped, 1);
+}
+
+void BRV1E_GetHalt(const brv1e_ctx_t *ctx, brv1e_halt_t *halt) {
+    *halt = ctx->halt;
+}
+
+uint64_t BRV1E_GetInstCount(const brv1e_ctx_t *ctx) {
+    return ctx->cpu.inst_cnt;
+}
+
+uint64_t BRV1E_GetCycleCount(const brv1e_ctx_t *ctx) {
+    return ctx->cpu.cycle_cnt;
+}
+
+const char *BRV1E_ParseRAMSize(const char *arg, unsigned int *ram_size) {
+    char *end;
+    unsigned int shift = 0;
+
+    /* strtoull() would take a sign and negate the value */
+    if (!isdigit((unsigned char)arg[0])) {
+        return "not a number";
+    }
+
+    errno = 0;
+    unsigned long long size = strtoull(arg, &end, 0);
+    if (errno != 0) {
+        return "too large";
+    }
+
+    if ((*end == 'K') || (*end == 'k')) {
+        shift = 10;
+        ++end;
+    }
+    else if ((*end == 'M') || (*end == 'm')) {
+        shift = 20;
+        ++end;
+    }
+    if (*end != '\0') {
+        return "unknown suffix, use K or M";
+    }
+
+    /* Check before shifting so that nothing wraps */
+    if (size > (RAM_MAX_SIZE >> shift)) {
+        return "over the 256M maximum";
+    }
+    size <<= shift;
+
+    if (size == 0) {
+        return "zero";
+    }
+    if (size % BRV1E_RAM_PAGE_SIZE) {
+        return "not a multiple of 1K";
+    }
+
+    *ram_size = (unsigned int)size;
+    return NULL;
+}
+
+void BRV1E_Destroy(brv1e_ctx_t *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+
+    rv_UninitJIT(ctx->jit);
 
     /* Un-initialize the UART */
-    // rv_UninitUART();
+    rv_UninitUART(&ctx->uart);
+    if (ctx->uart_tx_file != NULL) {
+        fclose(ctx->uart_tx_file);
+    }
+    if (ctx->uart_rx_fd >= 0) {
+        close(ctx->uart_rx_fd);
+    }
+
+    /* Flush and close the trace */
+    rv_UninitTrace(&ctx->trace);
+
+    /* Write the profile */
+    rv_UninitProfile(&ctx->profile);
+
+    rv_DropForkSnapshot(ctx);
+
+    /* Free RAM memory */
+    munmap(ctx->memory, ctx->ram_map_size);
+    free(ctx);
 }
@@ -0,0 +1,183 @@
+/**
+ * @file    dma.c
+ * @brief   Source file for the DMA engine
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <string.h>
+
+#include "mem.h"
+#include "uart.h"
+#include "dma.h"
+
+/* ----------------------------------------------------------------------------
+ * Private Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Cycles the SoC's DMA takes per word */
+#define FILL_CYCLES_PER_WORD    (1U)
+#define COPY_CYCLES_PER_WORD    (2U)
+
+/* ----------------------------------------------------------------------------
+ * Private Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+static int rv_DMAInRAM(const rv_dma_t *dma, uint32_t addr, uint32_t len);
+
+static int rv_DMABusy(rv_dma_t *dma, uint64_t cycles);
+
+static void rv_DMAStart(rv_dma_t *dma, uint32_t cmd, uint64_t cycles);
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions
+ * ------------------------------------------------------------------------- */
+
+static int rv_DMAInRAM(const rv_dma_t *dma, uint32_t addr, uint32_t len) {
+    return (uint64_t)addr + len <= dma->ram_size;
+}
+
+/* Move the bytes that have arrived for a UART transfer, then check whether
+ * the transfer in progress is done */
+static int rv_DMABusy(rv_dma_t *dma, uint64_t cycles) {
+    if (dma->receiving) {
+        uint32_t start = dma->dst;
+        uint8_t byte;
+
+        while ((dma->len > 0) && rv_UARTReceive(dma->uart, cycles, &byte)) {
+            dma->ram[dma->dst++] = byte;
+            --dma->len;
+        }
+        if (dma->dst != start) {
+            dma->written(dma->written_ctx, start, dma->dst - start);
+        }
+
+        dma->receiving = (dma->len > 0);
+        return dma->receiving;
+    }
+
+    return cycles < dma->done_cycles;
+}
+
+static void rv_DMAStart(rv_dma_t *dma, uint32_t cmd, uint64_t cycles) {
+    int aligned = ((dma->src | dma->dst | dma->len) & 0b11U) == 0;
+    uint32_t words = dma->len / 4U;
+
+    dma->error = 0;
+    if (dma->len == 0) {
+        return;
+    }
+
+    switch (cmd) {
+        case RV_DMA_CMD_FILL:
+            if (!aligned || !rv_DMAInRAM(dma, dma->dst, dma->len)) {
+                break;
+            }
+            for (uint32_t idx = 0; idx < words; ++idx) {
+                memcpy(&dma->ram[dma->dst + idx * 4U], &dma->fill, sizeof(dma->fill));
+            }
+            dma->written(dma->written_ctx, dma->dst, dma->len);
+            dma->done_cycles = cycles + (uint64_t)words * FILL_CYCLES_PER_WORD;
+            dma->dst += dma->len;
+            dma->len = 0;
+            return;
+
+        case RV_DMA_CMD_COPY:
+            if (!aligned || !rv_DMAInRAM(dma, dma->src, dma->len) ||
+                !rv_DMAInRAM(dma, dma->dst, dma->len)) {
+                break;
+            }
+            /* The SoC copies a word at a time upwards, so an overlapping copy
+             * to a higher address repeats the start of the source */
+            if ((dma->dst > dma->src) && (dma->dst - dma->src < dma->len)) {
+                for (uint32_t idx = 0; idx < words; ++idx) {
+                    memmove(&dma->ram[dma->dst + idx * 4U], &dma->ram[dma->src + idx * 4U], 4U);
+                }
+            }
+            else {
+                memmove(&dma->ram[dma->dst], &dma->ram[dma->src], dma->len);
+            }
+            dma->written(dma->written_ctx, dma->dst, dma->len);
+            dma->done_cycles = cycles + (uint64_t)words * COPY_CYCLES_PER_WORD;
+            dma->src += dma->len;
+            dma->dst += dma->len;
+            dma->len = 0;
+            return;
+
+        case RV_DMA_CMD_UART_RX:
+            if (!rv_DMAInRAM(dma, dma->dst, dma->len)) {
+                break;
+            }
+            dma->receiving = 1;
+            rv_DMABusy(dma, cycles);
+            return;
+
+        default:
+            break;
+    }
+
+    dma->error = 1;
+}
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+void rv_InitDMA(rv_dma_t *dma, rv_mem_t *mem, uint8_t *ram, uint32_t ram_size, rv_uart_t *uart,
+                rv_dma_written_fn_t written, void *written_ctx) {
+    memset(dma, 0, sizeof(*dma));
+    dma->ram = ram;
+    dma->ram_size = ram_size;
+    dma->uart = uart;
+    dma->written = written;
+    dma->written_ctx = written_ctx;
+
+    rv_MemMapDevice(mem, "dma", RV_DMA_BASE, RV_DMA_SIZE, rv_DMARead, rv_DMAWrite, dma);
+}
+
+uint32_t rv_DMARead(void *dev, uint32_t offset, uint64_t cycles) {
+    rv_dma_t *dma = dev;
+    uint32_t read_data;
+
+    int busy = rv_DMABusy(dma, cycles);
+
+    switch (offset & ~0b11U) {
+        case RV_DMA_SRC:  read_data = dma->src; break;
+        case RV_DMA_DST:  read_data = dma->dst; break;
+        case RV_DMA_LEN:  read_data = dma->len; break;
+        case RV_DMA_FILL: read_data = dma->fill; break;
+        case RV_DMA_CTRL:
+            read_data = (busy ? RV_DMA_STATUS_BUSY : 0) | (dma->error ? RV_DMA_STATUS_ERROR : 0);
+            break;
+        default:
+            read_data = 0;
+            break;
+    }
+
+    return read_data >> (8U * (offset & 0b11U));
+}
+
+void rv_DMAWrite(void *dev, uint32_t offset, uint32_t write_data, uint32_t width, uint64_t cycles) {
+    rv_dma_t *dma = dev;
+
+    (void)width;
+
+    /* Like the SoC, registers only change while idle */
+    if (rv_DMABusy(dma, cycles)) {
+        return;
+    }
+
+    switch (offset) {
+        case RV_DMA_SRC:  dma->src = write_data; break;
+        case RV_DMA_DST:  dma->dst = write_data; break;
+        case RV_DMA_LEN:  dma->len = write_data; break;
+        case RV_DMA_FILL: dma->fill = write_data; break;
+        case RV_DMA_CTRL: rv_DMAStart(dma, write_data, cycles); break;
+        default: break;
+    }
+}
@@ -0,0 +1,938 @@
+/**
+ * @file    jit.c
+ * @brief   Source file for the rv32i to x86-64 basic block translator
+ *
+ * Translated blocks are called as
+ *
+ *     uint32_t block(rv_cpu_t *cpu, uint8_t *ram, const uint8_t *code_pages)
+ *
+ * and keep those pointers in rbx, r12 and r13. Guest registers live in
+ * cpu->rf and are loaded into eax/ecx for every instruction. A block returns
+ * 0 after updating the PC and the instruction and cycle counts, or 1 when it
+ * stopped early at an instruction the interpreter has to execute.
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "loop.h"
+
+#ifdef BRV1E_JIT
+
+#ifndef __x86_64__
+#error "The JIT only supports x86-64 hosts. Build with JIT=0."
+#endif
+
+/* ----------------------------------------------------------------------------
+ * Private Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Size of the buffer for translated code. Everything is flushed when full. */
+#define CODE_BUF_SIZE           (16U << 20)
+
+/* Worst case host code size of one block: MAX_BLOCK_INSTS stores, each with
+ * three side exit stubs, is about 12 KiB */
+#define MAX_BLOCK_CODE_SIZE     (16U << 10)
+
+/* Maximum number of guest instructions in one block */
+#define MAX_BLOCK_INSTS         (64U)
+
+/* Maximum number of side exits in one block. A store has the most, three. */
+#define MAX_BLOCK_EXITS         (3U * MAX_BLOCK_INSTS)
+
+/* Number of entries in the block lookup table. Must be a power of 2. */
+#define BLOCK_TABLE_SIZE        (1U << 12)
+#define BLOCK_TABLE_MASK        (BLOCK_TABLE_SIZE - 1U)
+
+#define CODE_PAGE_SIZE          (1U << RV_JIT_PAGE_SHIFT)
+
+/* Host registers */
+#define REG_EAX                 (0U)
+#define REG_ECX                 (1U)
+#define REG_EDX                 (2U)
+#define REG_ESI                 (6U)
+
+/* Condition codes for jcc/setcc/cmovcc */
+#define CC_B                    (0x2U)
+#define CC_AE                   (0x3U)
+#define CC_E                    (0x4U)
+#define CC_NE                   (0x5U)
+#define CC_A                    (0x7U)
+#define CC_L                    (0xCU)
+#define CC_GE                   (0xDU)
+#define CC_ALWAYS               (0x10U)
+
+/* Offsets into rv_cpu_t */
+#define OFFSET_RF(r)            ((uint32_t)(offsetof(rv_cpu_t, rf) + 4U * (r)))
+#define OFFSET_PC               ((uint32_t)offsetof(rv_cpu_t, pc))
+#define OFFSET_INST_CNT         ((uint32_t)offsetof(rv_cpu_t, inst_cnt))
+#define OFFSET_CYCLE_CNT        ((uint32_t)offsetof(rv_cpu_t, cycle_cnt))
+
+/* ----------------------------------------------------------------------------
+ * Private Macros
+ * ------------------------------------------------------------------------- */
+
+#define BLOCK_TABLE_IDX(addr)   (((addr) >> 1) & BLOCK_TABLE_MASK)
+
+/* ----------------------------------------------------------------------------
+ * Private Types
+ * ------------------------------------------------------------------------- */
+
+typedef uint32_t (*rv_jit_block_fn_t)(rv_cpu_t *cpu, uint8_t *ram, const uint8_t *code_pages);
+
+typedef struct {
+    uint32_t            start;  /* Guest address of the first instruction */
+    uint32_t            end;    /* Guest address after the last instruction */
+    uint32_t            insts;  /* Most instructions one run retires */
+    uint32_t            loop;   /* Non-zero if a counted loop starts here */
+    rv_jit_block_fn_t   code;   /* NULL when the entry is empty */
+} rv_jit_block_t;
+
+/* A jump to a side exit that is patched once the exit stub is emitted */
+typedef struct {
+    uint8_t     *patch;     /* Location of the rel32 to patch */
+    uint32_t    pc;         /* Guest PC to resume the interpreter at */
+    uint32_t    insts;      /* Instructions retired before the exit */
+    uint32_t    cycles;     /* Cycles elapsed before the exit */
+} rv_jit_exit_t;
+
+struct rv_jit {
+    rv_cpu_t            *cpu;
+    uint8_t             *ram;
+    uint32_t            ram_size;
+    const uint32_t      *rom;
+    uint32_t            rom_base;
+    uint32_t            rom_size;
+
+    /* One byte per code page, non-zero if the page holds code */
+    uint8_t             *code_pages;
+
+    /* Range of pages that may be marked, so clearing them all does not touch
+     * the rest of a large RAM */
+    uint32_t            marked_first;
+    uint32_t            marked_end;
+
+    uint8_t             *code_buf;
+    size_t              code_used;
+
+    rv_jit_block_t      block_table[BLOCK_TABLE_SIZE];
+};
+
+/* ----------------------------------------------------------------------------
+ * Private Global Variables
+ * ------------------------------------------------------------------------- */
+
+/* Translation state. Each thread translates for one context at a time. */
+
+/* Write pointer while translating */
+static _Thread_local uint8_t *emit;
+
+static _Thread_local rv_jit_exit_t exits[MAX_BLOCK_EXITS];
+static _Thread_local uint32_t num_exits;
+
+/* ----------------------------------------------------------------------------
+ * Private Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+static const uint8_t *rv_JITSource(const rv_jit_t *jit, uint32_t addr, uint32_t *src_base,
+                                   uint32_t *src_end);
+
+static int rv_JITFindLoop(const rv_jit_t *jit, uint32_t start, rv_loop_t *loop);
+
+static int rv_JITTranslate(rv_jit_t *jit, uint32_t start, rv_jit_block_t *block);
+
+static void rv_JITFlush(rv_jit_t *jit);
+
+static void rv_JITMarkPage(rv_jit_t *jit, uint32_t addr);
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions: Instruction Encoding
+ * ------------------------------------------------------------------------- */
+
+static void rv_Emit8(uint8_t b) {
+    *emit++ = b;
+}
+
+static void rv_Emit32(uint32_t v) {
+    memcpy(emit, &v, sizeof(v));
+    emit += sizeof(v);
+}
+
+/* op r32, [rbx + disp32] or op [rbx + disp32], r32 */
+static void rv_EmitRbxDisp(uint8_t opcode, uint32_t reg, uint32_t disp) {
+    rv_Emit8(opcode);
+    rv_Emit8((uint8_t)(0x80U | (reg << 3) | 0x3U));
+    rv_Emit32(disp);
+}
+
+/* reg <= guest register r */
+static void rv_EmitGetReg(uint32_t reg, uint32_t r) {
+    if (r == 0) {
+        /* xor reg, reg */
+        rv_Emit8(0x31);
+        rv_Emit8((uint8_t)(0xC0U | (reg << 3) | reg));
+    }
+    else {
+        /* mov reg, [rbx + rf[r]] */
+        rv_EmitRbxDisp(0x8B, reg, OFFSET_RF(r));
+    }
+}
+
+/* Guest register r <= reg */
+static void rv_EmitSetReg(uint32_t r, uint32_t reg) {
+    if (r != 0) {
+        /* mov [rbx + rf[r]], reg */
+        rv_EmitRbxDisp(0x89, reg, OFFSET_RF(r));
+    }
+}
+
+/* Guest register r <= imm */
+static void rv_EmitSetRegImm(uint32_t r, uint32_t imm) {
+    if (r != 0) {
+        /* mov dword [rbx + rf[r]], imm32 */
+        rv_EmitRbxDisp(0xC7, 0, OFFSET_RF(r));
+        rv_Emit32(imm);
+    }
+}
+
+/* mov reg, imm32 */
+static void rv_EmitMovImm(uint32_t reg, uint32_t imm) {
+    rv_Emit8((uint8_t)(0xB8U + reg));
+    rv_Emit32(imm);
+}
+
+/* op eax, ecx */
+static void rv_EmitAluReg(uint8_t opcode) {
+    rv_Emit8(opcode);
+    rv_Emit8(0xC8);
+}
+
+/* op eax, imm32 */
+static void rv_EmitAluImm(uint8_t opcode, uint32_t imm) {
+    rv_Emit8(opcode);
+    rv_Emit32(imm);
+}
+
+/* eax <= (eax cc ecx/imm) ? 1 : 0, after a cmp */
+static void rv_EmitSetCC(uint32_t cc) {
+    /* setcc al; movzx eax, al */
+    rv_Emit8(0x0F);
+    rv_Emit8((uint8_t)(0x90U | cc));
+    rv_Emit8(0xC0);
+    rv_Emit8(0x0F);
+    rv_Emit8(0xB6);
+    rv_Emit8(0xC0);
+}
+
+/* shl/shr/sar eax, cl (ext = 4/5/7) */
+static void rv_EmitShiftCl(uint32_t ext) {
+    rv_Emit8(0xD3);
+    rv_Emit8((uint8_t)(0xC0U | (ext << 3)));
+}
+
+/* shl/shr/sar eax, imm8 (ext = 4/5/7) */
+static void rv_EmitShiftImm(uint32_t ext, uint32_t amt) {
+    rv_Emit8(0xC1);
+    rv_Emit8((uint8_t)(0xC0U | (ext << 3)));
+    rv_Emit8((uint8_t)amt);
+}
+
+/* Short jcc (cc < 16) or jmp (cc = CC_ALWAYS) forward. Returns the rel8 to
+ * patch with rv_EmitLabel(). */
+static uint8_t *rv_EmitJump8(uint32_t cc) {
+    rv_Emit8((cc == CC_ALWAYS) ? 0xEB : (uint8_t)(0x70U | cc));
+    rv_Emit8(0);
+    return emit - 1;
+}
+
+/* Point a short jump at the current position */
+static void rv_EmitLabel(uint8_t *patch) {
+    *patch = (uint8_t)(emit - (patch + 1));
+}
+
+/* eax <= quotient, edx <= remainder of eax / ecx, with the RISC-V results for
+ * division by zero and overflow instead of #DE */
+static void rv_EmitDivide(int is_signed) {
+    /* test ecx, ecx; jz by_zero */
+    rv_Emit8(0x85); rv_Emit8(0xC9);
+    uint8_t *by_zero = rv_EmitJump8(CC_E);
+    uint8_t *by_minus_one = NULL;
+
+    if (is_signed) {
+        /* cmp ecx, -1; je by_minus_one; cdq; idiv ecx */
+        rv_Emit8(0x83); rv_Emit8(0xF9); rv_Emit8(0xFF);
+        by_minus_one = rv_EmitJump8(CC_E);
+        rv_Emit8(0x99);
+        rv_Emit8(0xF7); rv_Emit8(0xF9);
+    }
+    else {
+        /* xor edx, edx; div ecx */
+        rv_Emit8(0x31); rv_Emit8(0xD2);
+        rv_Emit8(0xF7); rv_Emit8(0xF1);
+    }
+    uint8_t *done = rv_EmitJump8(CC_ALWAYS);
+    uint8_t *done_minus_one = NULL;
+
+    if (is_signed) {
+        /* by_minus_one: neg eax; xor edx, edx. INT32_MIN stays INT32_MIN. */
+        rv_EmitLabel(by_minus_one);
+        rv_Emit8(0xF7); rv_Emit8(0xD8);
+        rv_Emit8(0x31); rv_Emit8(0xD2);
+        done_minus_one = rv_EmitJump8(CC_ALWAYS);
+    }
+
+    /* by_zero: mov edx, eax; mov eax, -1 */
+    rv_EmitLabel(by_zero);
+    rv_Emit8(0x89); rv_Emit8(0xC2);
+    rv_EmitMovImm(REG_EAX, UINT32_MAX);
+
+    rv_EmitLabel(done);
+    if (done_minus_one != NULL) {
+        rv_EmitLabel(done_minus_one);
+    }
+}
+
+/* add qword [rbx + disp32], imm32 */
+static void rv_EmitAddCounter(uint32_t disp, uint32_t imm) {
+    if (imm != 0) {
+        rv_Emit8(0x48);
+        rv_EmitRbxDisp(0x81, 0, disp);
+        rv_Emit32(imm);
+    }
+}
+
+/* Update the counters, set the return value and return */
+static void rv_EmitReturn(uint32_t insts, uint32_t cycles, uint32_t ret) {
+    rv_EmitAddCounter(OFFSET_INST_CNT, insts);
+    rv_EmitAddCounter(OFFSET_CYCLE_CNT, cycles);
+    rv_EmitMovImm(REG_EAX, ret);
+
+    /* pop r13; pop r12; pop rbx; ret */
+    rv_Emit8(0x41); rv_Emit8(0x5D);
+    rv_Emit8(0x41); rv_Emit8(0x5C);
+    rv_Emit8(0x5B);
+    rv_Emit8(0xC3);
+}
+
+/* jcc to a side exit that resumes the interpreter at pc */
+static void rv_EmitSideExit(uint32_t cc, uint32_t pc, uint32_t insts, uint32_t cycles) {
+    rv_Emit8(0x0F);
+    rv_Emit8((uint8_t)(0x80U | cc));
+
+    exits[num_exits].patch = emit;
+    exits[num_exits].pc = pc;
+    exits[num_exits].insts = insts;
+    exits[num_exits].cycles = cycles;
+    ++num_exits;
+
+    rv_Emit32(0);
+}
+
+/* eax <= rs1 + imm, side exit unless [eax, eax + width) is in RAM */
+static void rv_EmitRamAddress(const rv_decoded_t *decoded, uint32_t width, uint32_t ram_size,
+                              uint32_t pc, uint32_t insts, uint32_t cycles) {
+    rv_EmitGetReg(REG_EAX, decoded->rs1);
+    if (decoded->imm.u != 0) {
+        rv_EmitAluImm(0x05, decoded->imm.u);
+    }
+
+    /* cmp eax, ram_size - width; ja exit */
+    rv_EmitAluImm(0x3D, ram_size - width);
+    rv_EmitSideExit(CC_A, pc, insts, cycles);
+}
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions
+ * ------------------------------------------------------------------------- */
+
+/* Find the memory an address is in, NULL if it is in neither RAM nor the
+ * boot ROM */
+static const uint8_t *rv_JITSource(const rv_jit_t *jit, uint32_t addr, uint32_t *src_base,
+                                   uint32_t *src_end) {
+    if (addr < jit->ram_size) {
+        *src_base = 0;
+        *src_end = jit->ram_size;
+        return jit->ram;
+    }
+
+    if ((addr >= jit->rom_base) && (addr - jit->rom_base < jit->rom_size)) {
+        *src_base = jit->rom_base;
+        *src_end = jit->rom_base + jit->rom_size;
+        return (const uint8_t *)jit->rom;
+    }
+
+    return NULL;
+}
+
+/* Check for a counted loop starting at a block's first instruction. The
+ * loop is found again from memory each time, as the interpreter does. */
+static int rv_JITFindLoop(const rv_jit_t *jit, uint32_t start, rv_loop_t *loop) {
+    uint32_t src_base;
+    uint32_t src_end;
+    const uint8_t *src = rv_JITSource(jit, start, &src_base, &src_end);
+    uint32_t pc = start;
+    int found = 0;
+
+    rv_LoopBegin(loop, start);
+    while (found == 0) {
+        rv_decoded_t d;
+        uint32_t raw = 0;
+
+        if ((src == NULL) || (src_end - pc < 2U)) {
+            return 0;
+        }
+
+        memcpy(&raw, src + (pc - src_base), 2U);
+        if (RV_INSTR_SIZE(raw) == 4U) {
+            if (src_end - pc < 4U) {
+                return 0;
+            }
+            memcpy(&raw, src + (pc - src_base), 4U);
+        }
+        rv_Decode(raw, &d);
+
+        found = rv_LoopAppend(loop, pc, &d);
+        pc += RV_INSTR_SIZE(raw);
+    }
+
+    return found > 0;
+}
+
+static int rv_JITTranslate(rv_jit_t *jit, uint32_t start, rv_jit_block_t *block) {
+    uint32_t src_base;
+    uint32_t src_end;
+
+    if (start & 0b1U) {
+        return -1;
+    }
+
+    /* Find the memory the block is in */
+    const uint8_t *src = rv_JITSource(jit, start, &src_base, &src_end);
+    if (src == NULL) {
+        return -1;
+    }
+
+    if (jit->code_used + MAX_BLOCK_CODE_SIZE > CODE_BUF_SIZE) {
+        rv_JITFlush(jit);
+    }
+
+    uint8_t *code = jit->code_buf + jit->code_used;
+    emit = code;
+    num_exits = 0;
+
+    /* push rbx; push r12; push r13 */
+    rv_Emit8(0x53);
+    rv_Emit8(0x41); rv_Emit8(0x54);
+    rv_Emit8(0x41); rv_Emit8(0x55);
+
+    /* mov rbx, rdi; mov r12, rsi; mov r13, rdx */
+    rv_Emit8(0x48); rv_Emit8(0x89); rv_Emit8(0xFB);
+    rv_Emit8(0x49); rv_Emit8(0x89); rv_Emit8(0xF4);
+    rv_Emit8(0x49); rv_Emit8(0x89); rv_Emit8(0xD5);
+
+    uint32_t pc = start;
+    uint32_t insts = 0;
+    uint32_t cycles = 0;
+    int ended = 0;
+    rv_loop_t loop;
+    int loop_found = 0;
+
+    rv_LoopBegin(&loop, start);
+
+    while (!ended && (insts < MAX_BLOCK_INSTS) && (pc < src_end)) {
+        rv_decoded_t d;
+        uint32_t raw = 0;
+
+        memcpy(&raw, src + (pc - src_base), 2U);
+        if (RV_INSTR_SIZE(raw) == 4U) {
+            /* Leave an instruction cut off by the end of memory to the
+             * interpreter, which faults on it */
+            if (src_end - pc < 4U) {
+                break;
+            }
+            memcpy(&raw, src + (pc - src_base), 4U);
+        }
+        rv_Decode(raw, &d);
+
+        /* A counted loop is translated as well, for when its counter wraps
+         * and the closed form declines it */
+        if (loop_found == 0) {
+            loop_found = rv_LoopAppend(&loop, pc, &d);
+        }
+
+        uint32_t size = RV_INSTR_SIZE(raw);
+
+        uint32_t width = 4U;
+        uint8_t alu_opcode = 0;
+        uint32_t cc = 0;
+
+        switch (d.op) {
+            case RV_OP_ADD: alu_opcode = 0x01; goto alu_reg;
+            case RV_OP_SUB: alu_opcode = 0x29; goto alu_reg;
+            case RV_OP_XOR: alu_opcode = 0x31; goto alu_reg;
+            case RV_OP_OR:  alu_opcode = 0x09; goto alu_reg;
+            case RV_OP_AND: alu_opcode = 0x21; goto alu_reg;
+            alu_reg:
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                rv_EmitGetReg(REG_ECX, d.rs2);
+                rv_EmitAluReg(alu_opcode);
+                rv_EmitSetReg(d.rd, REG_EAX);
+                break;
+
+            case RV_OP_SLL: cc = 4; goto shift_reg;
+            case RV_OP_SRL: cc = 5; goto shift_reg;
+            case RV_OP_SRA: cc = 7; goto shift_reg;
+            shift_reg:
+                /* x86 masks the shift amount to 5 bits like RISC-V */
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                rv_EmitGetReg(REG_ECX, d.rs2);
+                rv_EmitShiftCl(cc);
+                rv_EmitSetReg(d.rd, REG_EAX);
+                break;
+
+            case RV_OP_SLT:  cc = CC_L; goto set_reg;
+            case RV_OP_SLTU: cc = CC_B; goto set_reg;
+            set_reg:
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                rv_EmitGetReg(REG_ECX, d.rs2);
+                rv_EmitAluReg(0x39);
+                rv_EmitSetCC(cc);
+                rv_EmitSetReg(d.rd, REG_EAX);
+                break;
+
+            case RV_OP_ADDI: alu_opcode = 0x05; goto alu_imm;
+            case RV_OP_XORI: alu_opcode = 0x35; goto alu_imm;
+            case RV_OP_ORI:  alu_opcode = 0x0D; goto alu_imm;
+            case RV_OP_ANDI: alu_opcode = 0x25; goto alu_imm;
+            alu_imm:
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                rv_EmitAluImm(alu_opcode, d.imm.u);
+                rv_EmitSetReg(d.rd, REG_EAX);
+                break;
+
+            case RV_OP_SLLI: cc = 4; goto shift_imm;
+            case RV_OP_SRLI: cc = 5; goto shift_imm;
+            case RV_OP_SRAI: cc = 7; goto shift_imm;
+            shift_imm:
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                rv_EmitShiftImm(cc, d.imm.u);
+                rv_EmitSetReg(d.rd, REG_EAX);
+                break;
+
+            case RV_OP_SLTI:  cc = CC_L; goto set_imm;
+            case RV_OP_SLTIU: cc = CC_B; goto set_imm;
+            set_imm:
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                rv_EmitAluImm(0x3D, d.imm.u);
+                rv_EmitSetCC(cc);
+                rv_EmitSetReg(d.rd, REG_EAX);
+                break;
+
+            case RV_OP_LUI:
+                rv_EmitSetRegImm(d.rd, d.imm.u);
+                break;
+
+            case RV_OP_AUIPC:
+                rv_EmitSetRegImm(d.rd, pc + d.imm.u);
+                break;
+
+            case RV_OP_JAL:
+                rv_EmitSetRegImm(d.rd, pc + size);
+                rv_EmitRbxDisp(0xC7, 0, OFFSET_PC);
+                rv_Emit32(pc + d.imm.u);
+                ended = 1;
+                break;
+
+            case RV_OP_JALR:
+                /* Compute the target before writing rd in case rd == rs1 */
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                if (d.imm.u != 0) {
+                    rv_EmitAluImm(0x05, d.imm.u);
+                }
+                rv_EmitAluImm(0x25, ~0b1U);     /* and eax, ~1 */
+                rv_EmitSetRegImm(d.rd, pc + size);
+                rv_EmitRbxDisp(0x89, REG_EAX, OFFSET_PC);
+                ended = 1;
+                break;
+
+            case RV_OP_BEQ:  cc = CC_E;  goto branch;
+            case RV_OP_BNE:  cc = CC_NE; goto branch;
+            case RV_OP_BLT:  cc = CC_L;  goto branch;
+            case RV_OP_BGE:  cc = CC_GE; goto branch;
+            case RV_OP_BLTU: cc = CC_B;  goto branch;
+            case RV_OP_BGEU: cc = CC_AE; goto branch;
+            branch:
+                /* edx <= pc + size; esi <= target; cmp; cmovcc edx, esi */
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                rv_EmitGetReg(REG_ECX, d.rs2);
+                rv_EmitMovImm(REG_EDX, pc + size);
+                rv_EmitMovImm(REG_ESI, pc + d.imm.u);
+                rv_EmitAluReg(0x39);
+                rv_Emit8(0x0F);
+                rv_Emit8((uint8_t)(0x40U | cc));
+                rv_Emit8(0xD6);
+                rv_EmitRbxDisp(0x89, REG_EDX, OFFSET_PC);
+                ended = 1;
+                break;
+
+            case RV_OP_LB:
+            case RV_OP_LBU:
+                width = 1U;
+                goto load;
+            case RV_OP_LH:
+            case RV_OP_LHU:
+                width = 2U;
+                goto load;
+            case RV_OP_LW:
+            load:
+                rv_EmitRamAddress(&d, width, jit->ram_size, pc, insts, cycles);
+
+                /* REX.B, then mov/movsx/movzx eax, [r12 + rax] */
+                rv_Emit8(0x41);
+                switch (d.op) {
+                    case RV_OP_LB:  rv_Emit8(0x0F); rv_Emit8(0xBE); break;
+                    case RV_OP_LBU: rv_Emit8(0x0F); rv_Emit8(0xB6); break;
+                    case RV_OP_LH:  rv_Emit8(0x0F); rv_Emit8(0xBF); break;
+                    case RV_OP_LHU: rv_Emit8(0x0F); rv_Emit8(0xB7); break;
+                    default:        rv_Emit8(0x8B); break;
+                }
+                rv_Emit8(0x04);
+                rv_Emit8(0x04);
+                rv_EmitSetReg(d.rd, REG_EAX);
+                break;
+
+            case RV_OP_SB:
+                width = 1U;
+                goto store;
+            case RV_OP_SH:
+                width = 2U;
+                goto store;
+            case RV_OP_SW:
+            store:
+                rv_EmitRamAddress(&d, width, jit->ram_size, pc, insts, cycles);
+
+                /* Misaligned stores could span two code pages */
+                if (width > 1U) {
+                    /* test al, width - 1; jnz exit */
+                    rv_Emit8(0xA8);
+                    rv_Emit8((uint8_t)(width - 1U));
+                    rv_EmitSideExit(CC_NE, pc, insts, cycles);
+                }
+
+                /* mov edx, eax; shr edx, RV_JIT_PAGE_SHIFT */
+                rv_Emit8(0x89); rv_Emit8(0xC2);
+                rv_Emit8(0xC1); rv_Emit8(0xEA); rv_Emit8(RV_JIT_PAGE_SHIFT);
+
+                /* cmp byte [r13 + rdx], 0; jne exit */
+                rv_Emit8(0x41); rv_Emit8(0x80); rv_Emit8(0x7C); rv_Emit8(0x15);
+                rv_Emit8(0x00); rv_Emit8(0x00);
+                rv_EmitSideExit(CC_NE, pc, insts, cycles);
+
+                /* mov [r12 + rax], ecx/cx/cl */
+                rv_EmitGetReg(REG_ECX, d.rs2);
+                if (width == 2U) {
+                    rv_Emit8(0x66);
+                }
+                rv_Emit8(0x41);
+                rv_Emit8((width == 1U) ? 0x88 : 0x89);
+                rv_Emit8(0x0C);
+                rv_Emit8(0x04);
+                break;
+
+            case RV_OP_MUL:
+                /* imul eax, ecx */
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                rv_EmitGetReg(REG_ECX, d.rs2);
+                rv_Emit8(0x0F); rv_Emit8(0xAF); rv_Emit8(0xC1);
+                rv_EmitSetReg(d.rd, REG_EAX);
+                break;
+
+            case RV_OP_MULH:
+            case RV_OP_MULHU:
+            case RV_OP_MULHSU:
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                rv_EmitGetReg(REG_ECX, d.rs2);
+                if (d.op == RV_OP_MULHSU) {
+                    /* esi <= (rs1 < 0) ? rs2 : 0; mov esi, eax; sar esi, 31; and esi, ecx */
+                    rv_Emit8(0x89); rv_Emit8(0xC6);
+                    rv_Emit8(0xC1); rv_Emit8(0xFE); rv_Emit8(31);
+                    rv_Emit8(0x21); rv_Emit8(0xCE);
+                }
+
+                /* edx:eax <= eax * ecx with imul ecx or mul ecx */
+                rv_Emit8(0xF7);
+                rv_Emit8((d.op == RV_OP_MULH) ? 0xE9 : 0xE1);
+
+                if (d.op == RV_OP_MULHSU) {
+                    /* The unsigned high word over-counts a negative rs1 by rs2:
+                     * sub edx, esi */
+                    rv_Emit8(0x29); rv_Emit8(0xF2);
+                }
+                rv_EmitSetReg(d.rd, REG_EDX);
+                break;
+
+            case RV_OP_DIV:
+            case RV_OP_DIVU:
+            case RV_OP_REM:
+            case RV_OP_REMU:
+                rv_EmitGetReg(REG_EAX, d.rs1);
+                rv_EmitGetReg(REG_ECX, d.rs2);
+                rv_EmitDivide((d.op == RV_OP_DIV) || (d.op == RV_OP_REM));
+                rv_EmitSetReg(d.rd, ((d.op == RV_OP_DIV) || (d.op == RV_OP_DIVU)) ? REG_EAX : REG_EDX);
+                break;
+
+            case RV_OP_NOP:
+                break;
+
+            default:
+                /* Leave CSR accesses, ecall, mret, wfi and illegal
+                 * instructions to the interpreter, which sees exact counters
+                 * and returns to the main loop to check for interrupts and
+                 * halts */
+                ended = -1;
+                break;
+        }
+
+        if (ended < 0) {
+            break;
+        }
+
+        ++insts;
+        cycles += RV_OP_CYCLES(d.op);
+        pc += size;
+    }
+
+    if (insts == 0) {
+        return -1;
+    }
+
+    /* Fall through to the next block when the block did not end in a jump */
+    if (ended <= 0) {
+        rv_EmitRbxDisp(0xC7, 0, OFFSET_PC);
+        rv_Emit32(pc);
+    }
+    rv_EmitReturn(insts, cycles, 0);
+
+    /* Side exit stubs */
+    for (uint32_t idx = 0; idx < num_exits; ++idx) {
+        uint32_t rel = (uint32_t)(emit - (exits[idx].patch + 4));
+        memcpy(exits[idx].patch, &rel, sizeof(rel));
+
+        rv_EmitRbxDisp(0xC7, 0, OFFSET_PC);
+        rv_Emit32(exits[idx].pc);
+        rv_EmitReturn(exits[idx].insts, exits[idx].cycles, 1);
+    }
+
+    jit->code_used += (size_t)(emit - code);
+
+    /* Protect the block's code from stores */
+    if (src == jit->ram) {
+        for (uint32_t addr = start; addr < pc; addr += CODE_PAGE_SIZE) {
+            rv_JITMarkPage(jit, addr);
+        }
+        rv_JITMarkPage(jit, pc - 1U);
+    }
+
+    block->start = start;
+    block->end = pc;
+    block->insts = insts;
+    block->loop = (loop_found > 0);
+    block->code = (rv_jit_block_fn_t)(void *)code;
+
+    return 0;
+}
+
+static void rv_JITFlush(rv_jit_t *jit) {
+    memset(jit->block_table, 0, sizeof(jit->block_table));
+    jit->code_used = 0;
+}
+
+static void rv_JITMarkPage(rv_jit_t *jit, uint32_t addr) {
+    uint32_t page = addr >> RV_JIT_PAGE_SHIFT;
+
+    jit->code_pages[page] = 1;
+    if (page < jit->marked_first) {
+        jit->marked_first = page;
+    }
+    if (page >= jit->marked_end) {
+        jit->marked_end = page + 1U;
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+rv_jit_t *rv_InitJIT(rv_cpu_t *cpu, uint8_t *ram, uint32_t ram_size,
+                     const uint32_t *rom, uint32_t rom_base, uint32_t rom_size) {
+    rv_jit_t *jit = malloc(sizeof(rv_jit_t));
+    if (jit == NULL) {
+        return NULL;
+    }
+
+    jit->cpu = cpu;
+    jit->ram = ram;
+    jit->ram_size = ram_size;
+    jit->rom = rom;
+    jit->rom_base = rom_base;
+    jit->rom_size = rom_size;
+
+    jit->code_buf = mmap(NULL, CODE_BUF_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code_buf == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+
+    jit->code_pages = calloc((ram_size + CODE_PAGE_SIZE - 1U) >> RV_JIT_PAGE_SHIFT, 1);
+    if (jit->code_pages == NULL) {
+        munmap(jit->code_buf, CODE_BUF_SIZE);
+        free(jit);
+        return NULL;
+    }
+
+    jit->marked_first = UINT32_MAX;
+    jit->marked_end = 0;
+    rv_JITFlush(jit);
+
+    return jit;
+}
+
+void rv_UninitJIT(rv_jit_t *jit) {
+    if (jit == NULL) {
+        return;
+    }
+
+    munmap(jit->code_buf, CODE_BUF_SIZE);
+    free(jit->code_pages);
+    free(jit);
+}
+
+int rv_JITExecute(rv_jit_t *jit, uint64_t inst_limit) {
+    while (jit->cpu->inst_cnt < inst_limit) {
+        uint32_t pc = jit->cpu->pc.u;
+        rv_jit_block_t *block = &jit->block_table[BLOCK_TABLE_IDX(pc)];
+
+        if ((block->code == NULL) || (block->start != pc)) {
+            if (rv_JITTranslate(jit, pc, block) != 0) {
+                return 1;
+            }
+        }
+
+        /* The interpreter steps up to the limit when a block would run
+         * past it */
+        if (inst_limit - jit->cpu->inst_cnt < block->insts) {
+            return 1;
+        }
+
+        /* Retire counted loops in closed form. With at least an iteration
+         * left before the limit, a loop is only declined if its counter
+         * wraps, and then it runs as translated code from here on instead
+         * of being found again every iteration. */
+        if (block->loop) {
+            rv_loop_t loop;
+            if (rv_JITFindLoop(jit, pc, &loop) && (rv_LoopRun(&loop, jit->cpu, inst_limit) != 0)) {
+                continue;
+            }
+            block->loop = 0;
+        }
+
+        if (block->code(jit->cpu, jit->ram, jit->code_pages)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void rv_JITMarkCode(rv_jit_t *jit, uint32_t addr) {
+    if (addr < jit->ram_size) {
+        rv_JITMarkPage(jit, addr);
+    }
+}
+
+int rv_JITIsCode(const rv_jit_t *jit, uint32_t addr) {
+    return (addr < jit->ram_size) && jit->code_pages[addr >> RV_JIT_PAGE_SHIFT];
+}
+
+void rv_JITInvalidate(rv_jit_t *jit, uint32_t addr) {
+    if (addr >= jit->ram_size) {
+        return;
+    }
+
+    uint32_t page_start = addr & ~(CODE_PAGE_SIZE - 1U);
+    uint32_t page_end = page_start + CODE_PAGE_SIZE;
+
+    for (uint32_t idx = 0; idx < BLOCK_TABLE_SIZE; ++idx) {
+        rv_jit_block_t *block = &jit->block_table[idx];
+        if ((block->code != NULL) && (block->start < page_end) && (block->end > page_start)) {
+            block->code = NULL;
+        }
+    }
+
+    jit->code_pages[addr >> RV_JIT_PAGE_SHIFT] = 0;
+}
+
+void rv_JITInvalidateAll(rv_jit_t *jit) {
+    rv_JITFlush(jit);
+
+    if (jit->marked_first < jit->marked_end) {
+        memset(jit->code_pages + jit->marked_first, 0, jit->marked_end - jit->marked_first);
+    }
+    jit->marked_first = UINT32_MAX;
+    jit->marked_end = 0;
+}
+
+#else
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+rv_jit_t *rv_InitJIT(rv_cpu_t *cpu, uint8_t *ram, uint32_t ram_size,
+                     const uint32_t *rom, uint32_t rom_base, uint32_t rom_size) {
+    (void)cpu; (void)ram; (void)ram_size; (void)rom; (void)rom_base; (void)rom_size;
+    return NULL;
+}
+
+void rv_UninitJIT(rv_jit_t *jit) {
+    (void)jit;
+}
+
+int rv_JITExecute(rv_jit_t *jit, uint64_t inst_limit) {
+    (void)jit;
+    (void)inst_limit;
+    return 1;
+}
+
+void rv_JITMarkCode(rv_jit_t *jit, uint32_t addr) {
+    (void)jit;
+    (void)addr;
+}
+
+int rv_JITIsCode(const rv_jit_t *jit, uint32_t addr) {
+    (void)jit;
+    (void)addr;
+    return 0;
+}
+
+void rv_JITInvalidate(rv_jit_t *jit, uint32_t addr) {
+    (void)jit;
+    (void)addr;
+}
+
+void rv_JITInvalidateAll(rv_jit_t *jit) {
+    (void)jit;
+}
+
+#endif /* BRV1E_JIT */
@@ -0,0 +1,360 @@
+/**
+ * @file    loader.c
+ * @brief   Source file for the program image loader
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loader.h"
+
+/* ----------------------------------------------------------------------------
+ * Private Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+#ifndef EM_RISCV
+#define EM_RISCV                (243)
+#endif
+
+/* ----------------------------------------------------------------------------
+ * Private Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+static int rv_ReadAt(FILE *file, long offset, void *buf, size_t len);
+
+static int rv_LoadRaw(FILE *file, uint8_t *ram, uint32_t ram_size);
+
+static int rv_LoadELF(FILE *file, const Elf32_Ehdr *ehdr, uint8_t *ram, uint32_t ram_size, uint32_t *entry);
+
+static int rv_FindSymbol(FILE *file, const Elf32_Ehdr *ehdr, const char *name, uint32_t *value);
+
+static int rv_ReadSymbols(FILE *file, const Elf32_Ehdr *ehdr, rv_symbol_t **symbols, uint32_t *num_symbols);
+
+static int rv_CompareSymbols(const void *a, const void *b);
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions
+ * ------------------------------------------------------------------------- */
+
+static int rv_ReadAt(FILE *file, long offset, void *buf, size_t len) {
+    if ((fseek(file, offset, SEEK_SET) != 0) || (fread(buf, 1, len, file) != len)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int rv_LoadRaw(FILE *file, uint8_t *ram, uint32_t ram_size) {
+    if (fseek(file, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+
+    size_t nread = fread(ram, 1, ram_size, file);
+
+    /* Anything left over does not fit */
+    if (ferror(file) || ((nread == ram_size) && (fgetc(file) != EOF))) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int rv_LoadELF(FILE *file, const Elf32_Ehdr *ehdr, uint8_t *ram, uint32_t ram_size, uint32_t *entry) {
+    if ((ehdr->e_ident[EI_CLASS] != ELFCLASS32) || (ehdr->e_ident[EI_DATA] != ELFDATA2LSB) ||
+        (ehdr->e_type != ET_EXEC) || (ehdr->e_machine != EM_RISCV) ||
+        (ehdr->e_phentsize != sizeof(Elf32_Phdr))) {
+        return -1;
+    }
+
+    /* Check every segment fits before touching RAM */
+    for (int pass = 0; pass < 2; ++pass) {
+        for (uint32_t idx = 0; idx < ehdr->e_phnum; ++idx) {
+            Elf32_Phdr phdr;
+            if (rv_ReadAt(file, (long)(ehdr->e_phoff + idx * sizeof(phdr)), &phdr, sizeof(phdr)) != 0) {
+                return -1;
+            }
+
+            if ((phdr.p_type != PT_LOAD) || (phdr.p_memsz == 0)) {
+                continue;
+            }
+
+            if (pass == 0) {
+                if ((phdr.p_filesz > phdr.p_memsz) || (phdr.p_paddr > ram_size) ||
+                    (phdr.p_memsz > ram_size - phdr.p_paddr)) {
+                    return -1;
+                }
+                continue;
+            }
+
+            /* The rest of the segment is .bss */
+            if (rv_ReadAt(file, (long)phdr.p_offset, ram + phdr.p_paddr, phdr.p_filesz) != 0) {
+                return -1;
+            }
+            memset(ram + phdr.p_paddr + phdr.p_filesz, 0, phdr.p_memsz - phdr.p_filesz);
+        }
+    }
+
+    if (rv_FindSymbol(file, ehdr, RV_LOADER_ENTRY_SYMBOL, entry) != 0) {
+        *entry = ehdr->e_entry;
+    }
+
+    return 0;
+}
+
+static int rv_FindSymbol(FILE *file, const Elf32_Ehdr *ehdr, const char *name, uint32_t *value) {
+    if (ehdr->e_shentsize != sizeof(Elf32_Shdr)) {
+        return -1;
+    }
+
+    for (uint32_t idx = 0; idx < ehdr->e_shnum; ++idx) {
+        Elf32_Shdr symtab;
+        Elf32_Shdr strtab;
+
+        if ((rv_ReadAt(file, (long)(ehdr->e_shoff + idx * sizeof(symtab)), &symtab, sizeof(symtab)) != 0) ||
+            (symtab.sh_type != SHT_SYMTAB) || (symtab.sh_link >= ehdr->e_shnum) ||
+            (rv_ReadAt(file, (long)(ehdr->e_shoff + symtab.sh_link * sizeof(strtab)), &strtab, sizeof(strtab)) != 0)) {
+            continue;
+        }
+
+        size_t name_len = strlen(name) + 1U;
+        char sym_name[64];
+        if (name_len > sizeof(sym_name)) {
+            return -1;
+        }
+
+        for (uint32_t sym_idx = 0; sym_idx < symtab.sh_size / sizeof(Elf32_Sym); ++sym_idx) {
+            Elf32_Sym sym;
+            if (rv_ReadAt(file, (long)(symtab.sh_offset + sym_idx * sizeof(sym)), &sym, sizeof(sym)) != 0) {
+                return -1;
+            }
+
+            if ((sym.st_name == 0) || (sym.st_name >= strtab.sh_size) || (sym.st_shndx == SHN_UNDEF) ||
+                (rv_ReadAt(file, (long)(strtab.sh_offset + sym.st_name), sym_name, name_len) != 0)) {
+                continue;
+            }
+
+            if (memcmp(sym_name, name, name_len) == 0) {
+                *value = sym.st_value;
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+static int rv_ReadSymbols(FILE *file, const Elf32_Ehdr *ehdr, rv_symbol_t **symbols, uint32_t *num_symbols) {
+    Elf32_Shdr *shdrs = NULL;
+    Elf32_Sym *syms = NULL;
+    char *strs = NULL;
+    rv_symbol_t *out = NULL;
+    uint32_t count = 0;
+    int result = -1;
+
+    if ((ehdr->e_shentsize != sizeof(Elf32_Shdr)) || (ehdr->e_shnum == 0)) {
+        return -1;
+    }
+
+    shdrs = malloc(ehdr->e_shnum * sizeof(Elf32_Shdr));
+    if ((shdrs == NULL) ||
+        (rv_ReadAt(file, (long)ehdr->e_shoff, shdrs, ehdr->e_shnum * sizeof(Elf32_Shdr)) != 0)) {
+        goto done;
+    }
+
+    uint32_t idx;
+    for (idx = 0; idx < ehdr->e_shnum; ++idx) {
+        if ((shdrs[idx].sh_type == SHT_SYMTAB) && (shdrs[idx].sh_link < ehdr->e_shnum)) {
+            break;
+        }
+    }
+    if (idx == ehdr->e_shnum) {
+        goto done;
+    }
+
+    /* Read the symbol and string tables whole rather than one entry at a
+     * time */
+    const Elf32_Shdr *symtab = &shdrs[idx];
+    const Elf32_Shdr *strtab = &shdrs[symtab->sh_link];
+    uint32_t num_syms = symtab->sh_size / sizeof(Elf32_Sym);
+
+    syms = malloc(num_syms * sizeof(Elf32_Sym) + 1U);
+    strs = malloc(strtab->sh_size + 1U);
+    out = malloc(num_syms * sizeof(rv_symbol_t) + 1U);
+    if ((syms == NULL) || (strs == NULL) || (out == NULL) ||
+        (rv_ReadAt(file, (long)symtab->sh_offset, syms, num_syms * sizeof(Elf32_Sym)) != 0) ||
+        (rv_ReadAt(file, (long)strtab->sh_offset, strs, strtab->sh_size) != 0)) {
+        goto done;
+    }
+    strs[strtab->sh_size] = '\0';
+
+    for (uint32_t sym_idx = 0; sym_idx < num_syms; ++sym_idx) {
+        const Elf32_Sym *sym = &syms[sym_idx];
+        uint32_t type = ELF32_ST_TYPE(sym->st_info);
+
+        if ((sym->st_name == 0) || (sym->st_name >= strtab->sh_size) ||
+            (sym->st_shndx == SHN_UNDEF) || (sym->st_shndx >= ehdr->e_shnum) ||
+            !(shdrs[sym->st_shndx].sh_flags & SHF_EXECINSTR)) {
+            continue;
+        }
+
+        /* Local labels in assembly would split the functions they are in */
+        if ((type != STT_FUNC) &&
+            ((type != STT_NOTYPE) || (ELF32_ST_BIND(sym->st_info) != STB_GLOBAL))) {
+            continue;
+        }
+
+        out[count].addr = sym->st_value;
+        out[count].size = sym->st_size;
+        out[count].name = strdup(strs + sym->st_name);
+        if (out[count].name == NULL) {
+            goto done;
+        }
+        ++count;
+    }
+
+    qsort(out, count, sizeof(rv_symbol_t), rv_CompareSymbols);
+
+    /* Keep the first symbol at each address, and let unsized symbols run up
+     * to the next one or the end of their section */
+    uint32_t kept = 0;
+    for (idx = 0; idx < count; ++idx) {
+        if ((kept != 0) && (out[kept - 1U].addr == out[idx].addr)) {
+            free(out[idx].name);
+            continue;
+        }
+        out[kept++] = out[idx];
+    }
+    count = kept;
+
+    for (idx = 0; idx < count; ++idx) {
+        if (out[idx].size != 0) {
+            continue;
+        }
+
+        uint32_t end = out[idx].addr + 1U;
+        for (uint32_t sec = 0; sec < ehdr->e_shnum; ++sec) {
+            if ((shdrs[sec].sh_flags & SHF_EXECINSTR) && (out[idx].addr >= shdrs[sec].sh_addr) &&
+                (out[idx].addr - shdrs[sec].sh_addr < shdrs[sec].sh_size)) {
+                end = shdrs[sec].sh_addr + shdrs[sec].sh_size;
+                break;
+            }
+        }
+        if ((idx + 1U < count) && (out[idx + 1U].addr < end)) {
+            end = out[idx + 1U].addr;
+        }
+
+        out[idx].size = end - out[idx].addr;
+    }
+
+    *symbols = out;
+    *num_symbols = count;
+    out = NULL;
+    result = 0;
+
+done:
+    if (out != NULL) {
+        rv_FreeSymbols(out, count);
+    }
+    free(strs);
+    free(syms);
+    free(shdrs);
+    return result;
+}
+
+static int rv_CompareSymbols(const void *a, const void *b) {
+    const rv_symbol_t *sym_a = a;
+    const rv_symbol_t *sym_b = b;
+
+    if (sym_a->addr != sym_b->addr) {
+        return (sym_a->addr < sym_b->addr) ? -1 : 1;
+    }
+
+    /* Prefer sized symbols, which come from C functions */
+    return (sym_a->size == 0) - (sym_b->size == 0);
+}
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+int rv_LoadProgram(const char *path, uint8_t *ram, uint32_t ram_size, uint32_t *entry) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    Elf32_Ehdr ehdr;
+    int result;
+
+    *entry = 0;
+
+    if ((fread(&ehdr, 1, sizeof(ehdr), file) == sizeof(ehdr)) &&
+        (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0)) {
+        result = rv_LoadELF(file, &ehdr, ram, ram_size, entry);
+    }
+    else {
+        result = rv_LoadRaw(file, ram, ram_size);
+    }
+
+    fclose(file);
+    return result;
+}
+
+int rv_LoadSymbols(const char *path, rv_symbol_t **symbols, uint32_t *num_symbols) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    Elf32_Ehdr ehdr;
+    int result = -1;
+
+    if ((fread(&ehdr, 1, sizeof(ehdr), file) == sizeof(ehdr)) &&
+        (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0) &&
+        (ehdr.e_ident[EI_CLASS] == ELFCLASS32)) {
+        result = rv_ReadSymbols(file, &ehdr, symbols, num_symbols);
+    }
+
+    fclose(file);
+    return result;
+}
+
+void rv_FreeSymbols(rv_symbol_t *symbols, uint32_t num_symbols) {
+    if (symbols == NULL) {
+        return;
+    }
+
+    for (uint32_t idx = 0; idx < num_symbols; ++idx) {
+        free(symbols[idx].name);
+    }
+    free(symbols);
+}
+
+const rv_symbol_t *rv_FindSymbolByAddr(const rv_symbol_t *symbols, uint32_t num_symbols, uint32_t addr) {
+    /* Find the last symbol starting at or before addr */
+    uint32_t lo = 0;
+    uint32_t hi = num_symbols;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2U;
+        if (symbols[mid].addr <= addr) {
+            lo = mid + 1U;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    if ((lo == 0) || (addr - symbols[lo - 1U].addr >= symbols[lo - 1U].size)) {
+        return NULL;
+    }
+
+    return &symbols[lo - 1U];
+}
@@ -0,0 +1,192 @@
+/**
+ * @file    loop.c
+ * @brief   Source file for closed-form execution of counted loops
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include "loop.h"
+
+/* ----------------------------------------------------------------------------
+ * Private Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+static word_t rv_LoopStep(const rv_loop_t *loop, uint32_t reg);
+
+static uint32_t rv_LoopInverse(uint32_t odd);
+
+static uint64_t rv_LoopIterations(const rv_loop_t *loop, const rv_cpu_t *cpu);
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions
+ * ------------------------------------------------------------------------- */
+
+/* What an iteration adds to a register, 0 for one the loop leaves alone */
+static word_t rv_LoopStep(const rv_loop_t *loop, uint32_t reg) {
+    word_t step = { .u = 0 };
+
+    for (uint32_t idx = 0; idx < loop->num_steps; ++idx) {
+        if (loop->step_reg[idx] == reg) {
+            step = loop->step[idx];
+        }
+    }
+
+    return step;
+}
+
+/* The inverse of an odd number modulo 2^32 by Newton's method. The number
+ * is its own inverse to 3 bits and each step doubles that. */
+static uint32_t rv_LoopInverse(uint32_t odd) {
+    uint32_t inv = odd;
+
+    for (uint32_t idx = 0; idx < 4U; ++idx) {
+        inv *= 2U - odd * inv;
+    }
+
+    return inv;
+}
+
+/* The number of iterations that run before the branch falls through,
+ * counting the one about to start. UINT64_MAX if the branch is always
+ * taken, 0 if the counter wraps around before the loop exits. */
+static uint64_t rv_LoopIterations(const rv_loop_t *loop, const rv_cpu_t *cpu) {
+    uint32_t swap = (rv_LoopStep(loop, loop->rs2).u != 0U);
+    uint32_t counter = swap ? loop->rs2 : loop->rs1;
+    uint32_t other = swap ? loop->rs1 : loop->rs2;
+    uint32_t step = rv_LoopStep(loop, counter).u;
+    uint32_t from = cpu->rf[counter].u;
+    uint32_t to = cpu->rf[other].u;
+
+    if (loop->op == RV_OP_BNE) {
+        /* Solve from + n * step == to modulo 2^32. With step = 2^shift * odd
+         * there is only a solution if to - from is a multiple of 2^shift,
+         * and it repeats every 2^(32 - shift) iterations. */
+        uint32_t diff = to - from;
+        uint32_t shift = (uint32_t)__builtin_ctz(step);
+        uint64_t period = (uint64_t)1 << (32U - shift);
+
+        if (diff & ((1U << shift) - 1U)) {
+            return UINT64_MAX;
+        }
+
+        uint64_t iters = (uint64_t)((diff >> shift) * rv_LoopInverse(step >> shift)) & (period - 1U);
+        return (iters == 0) ? period : iters;
+    }
+
+    /* Compare as unsigned, flipping the sign bit for the signed branches.
+     * With the counter on the left the branch is taken while it is below a
+     * bound, or at or above one: y < x is x >= y + 1 and y >= x is
+     * x < y + 1. */
+    uint32_t bias = ((loop->op == RV_OP_BLT) || (loop->op == RV_OP_BGE)) ? 0x80000000U : 0U;
+    int64_t start = (int64_t)(from ^ bias);
+    int64_t bound = (int64_t)(to ^ bias) + swap;
+    int64_t delta = (int32_t)step;
+    int below = ((loop->op == RV_OP_BLT) || (loop->op == RV_OP_BLTU)) != (int)swap;
+    int64_t iters = 1;
+
+    if (below && (delta > 0) && (bound > start)) {
+        iters = (bound - start + delta - 1) / delta;
+    }
+    else if (!below && (delta < 0) && (start >= bound)) {
+        iters = (start - bound) / -delta + 1;
+    }
+
+    /* The counter moves away from the bound, or would pass through zero or
+     * all ones on the way to it */
+    int64_t last = start + iters * delta;
+    if ((last < 0) || (last > (int64_t)UINT32_MAX) || (below ? (last < bound) : (last >= bound))) {
+        return 0;
+    }
+
+    return (uint64_t)iters;
+}
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+void rv_LoopBegin(rv_loop_t *loop, uint32_t start) {
+    loop->start = start;
+    loop->end = start;
+    loop->insts = 0;
+    loop->cycles = 0;
+    loop->num_steps = 0;
+}
+
+int rv_LoopAppend(rv_loop_t *loop, uint32_t pc, const rv_decoded_t *decoded) {
+    if (loop->insts == RV_LOOP_MAX_INSTS) {
+        return -1;
+    }
+
+    ++loop->insts;
+    loop->cycles += RV_OP_CYCLES(decoded->op);
+
+    if (RV_OP_IS_BRANCH(decoded->op)) {
+        loop->op = decoded->op;
+        loop->rs1 = decoded->rs1;
+        loop->rs2 = decoded->rs2;
+        loop->end = pc + RV_INSTR_SIZE(decoded->instruction);
+
+        /* Exactly one side must move. A beq loop runs at most twice. */
+        int moves1 = (rv_LoopStep(loop, decoded->rs1).u != 0U);
+        int moves2 = (rv_LoopStep(loop, decoded->rs2).u != 0U);
+        return ((pc + decoded->imm.u == loop->start) && (decoded->op != RV_OP_BEQ) &&
+                (moves1 != moves2)) ? 1 : -1;
+    }
+
+    /* Arithmetic into x0 is a nop */
+    if ((decoded->op == RV_OP_NOP) ||
+        ((decoded->rd == 0) && (decoded->op >= RV_OP_ADD) && (decoded->op <= RV_OP_AUIPC))) {
+        return 0;
+    }
+
+    if ((decoded->op != RV_OP_ADDI) || (decoded->rs1 != decoded->rd)) {
+        return -1;
+    }
+
+    /* Steps of the same register add up, since the branch comes last */
+    for (uint32_t idx = 0; idx < loop->num_steps; ++idx) {
+        if (loop->step_reg[idx] == decoded->rd) {
+            loop->step[idx].u += decoded->imm.u;
+            return 0;
+        }
+    }
+
+    loop->step_reg[loop->num_steps] = decoded->rd;
+    loop->step[loop->num_steps] = decoded->imm;
+    ++loop->num_steps;
+    return 0;
+}
+
+uint64_t rv_LoopRun(const rv_loop_t *loop, rv_cpu_t *cpu, uint64_t inst_limit) {
+    if (cpu->inst_cnt >= inst_limit) {
+        return 0;
+    }
+
+    uint64_t fit = (inst_limit - cpu->inst_cnt) / loop->insts;
+    uint64_t iters = rv_LoopIterations(loop, cpu);
+    if ((fit == 0) || (iters == 0)) {
+        return 0;
+    }
+
+    /* Stop at the start of an iteration if the loop runs past the limit */
+    cpu->pc.u = loop->end;
+    if (iters > fit) {
+        iters = fit;
+        cpu->pc.u = loop->start;
+    }
+
+    for (uint32_t idx = 0; idx < loop->num_steps; ++idx) {
+        cpu->rf[loop->step_reg[idx]].u += (uint32_t)iters * loop->step[idx].u;
+    }
+
+    cpu->inst_cnt += iters * loop->insts;
+    cpu->cycle_cnt += iters * loop->cycles;
+
+    return iters * loop->insts;
+}
@@ -1,6 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <unistd.h>
+
 #include "BaseRV1E.h"
 
-int main(int argc, char **argv) {
-    BRV1E_Run((argc == 2) ? argv[1] : (void *)0);
+/* Exit statuses for runs that did not end with the guest's own exit code,
+ * the first as timeout(1) uses */
+#define EXIT_STATUS_LIMIT       (124)   /* The instruction budget or the timeout ran out */
+#define EXIT_STATUS_FAULT       (125)   /* The guest raised an exception */
+
+/* The context the timeout stops */
+static brv1e_ctx_t *timeout_ctx;
+static volatile sig_atomic_t timed_out;
+
+/* Non-zero if a fetch fault ends the run successfully */
+static int fetch_fault_exits;
+
+static void usage(const char *prog) {
+    printf("Usage: %s [-t trace_file] [-f clk_freq_hz] [-r] [-j] [-d] [-u rx_file] [-b baud] [-s snapshot] [-l snapshot]\n"
+           "       [-p profile] [-g folded] [-n period] [-y symbols] [-M ram_size] [-i max_insts] [-T seconds]\n"
+           "       [-o stats_file] [-e] [mem_image]\n", prog);
+    printf("  -t  Write a binary instruction trace to trace_file\n");
+    printf("  -f  Virtual clock frequency (default 100000000)\n");
+    printf("  -r  Pace execution to the wall clock\n");
+    printf("  -j  Translate guest code into host code\n");
+    printf("  -d  Start at the program's entry point instead of the boot ROM\n");
+    printf("  -u  Feed the UART from a file, pipe or unix:socket instead of stdin\n");
+    printf("  -b  UART receive baud rate (default: as fast as input arrives)\n");
+    printf("  -s  Save a snapshot once the boot ROM jumps to the program\n");
+    printf("  -l  Start from a snapshot instead of booting mem_image\n");
+    printf("  -p  Write a flat profile of guest functions to profile\n");
+    printf("  -g  Write folded call stacks for flame graphs to folded\n");
+    printf("  -n  Instructions between profile samples (default 1000)\n");
+    printf("  -y  Name profiled functions from this ELF file (default: mem_image)\n");
+    printf("  -M  RAM size in bytes, a multiple of 1K up to 256M (default 2K)\n");
+    printf("  -i  Stop after executing max_insts instructions\n");
+    printf("  -T  Stop after running for this many wall clock seconds\n");
+    printf("  -o  Write a JSON summary of the run to stats_file, - for stderr\n");
+    printf("  -e  Exit with 0 after a fetch fault, for programs that halt by jumping away\n");
+}
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void on_timeout(int sig) {
+    (void)sig;
+    timed_out = 1;
+    BRV1E_Stop(timeout_ctx);
+}
+
+static int start_timeout(brv1e_ctx_t *ctx, double seconds) {
+    struct sigaction action = { .sa_handler = on_timeout };
+    struct itimerval timer = { 0 };
+
+    timeout_ctx = ctx;
+    timer.it_value.tv_sec = (time_t)seconds;
+    timer.it_value.tv_usec = (suseconds_t)((seconds - (double)timer.it_value.tv_sec) * 1e6);
+    if ((timer.it_value.tv_sec == 0) && (timer.it_value.tv_usec == 0)) {
+        timer.it_value.tv_usec = 1;
+    }
+
+    sigemptyset(&action.sa_mask);
+    if ((sigaction(SIGALRM, &action, NULL) != 0) || (setitimer(ITIMER_REAL, &timer, NULL) != 0)) {
+        return -1;
+    }
     return 0;
 }
+
+static const char *halt_name(brv1e_halt_reason_t reason) {
+    switch (reason) {
+        case BRV1E_HALT_EXIT:                   return "exit";
+        case BRV1E_HALT_FETCH_FAULT:            return "fetch_fault";
+        case BRV1E_HALT_ILLEGAL_INSTRUCTION:    return "illegal_instruction";
+        case BRV1E_HALT_LOAD_FAULT:             return "load_fault";
+        case BRV1E_HALT_STORE_FAULT:            return "store_fault";
+        default:                                return timed_out ? "timeout" : "instruction_limit";
+    }
+}
+
+/* Explain on stderr why a run stopped other than by the guest exiting */
+static void report_halt(const brv1e_halt_t *halt) {
+    switch (halt->reason) {
+        case BRV1E_HALT_EXIT:
+            break;
+        case BRV1E_HALT_FETCH_FAULT:
+            fprintf(stderr, "Fetch fault at 0x%08x\n", halt->pc);
+            break;
+        case BRV1E_HALT_ILLEGAL_INSTRUCTION:
+            fprintf(stderr, "Illegal instruction 0x%08x at 0x%08x\n", halt->tval, halt->pc);
+            break;
+        case BRV1E_HALT_LOAD_FAULT:
+            fprintf(stderr, "Load fault at 0x%08x, address 0x%08x\n", halt->pc, halt->tval);
+            break;
+        case BRV1E_HALT_STORE_FAULT:
+            fprintf(stderr, "Store fault at 0x%08x, address 0x%08x\n", halt->pc, halt->tval);
+            break;
+        default:
+            fprintf(stderr, timed_out ? "Timed out\n" : "Instruction limit reached\n");
+            break;
+    }
+}
+
+static int write_stats(const char *path, const brv1e_halt_t *halt, uint64_t insts, uint64_t cycles,
+                       double seconds) {
+    FILE *file = (path[0] == '-') && (path[1] == '\0') ? stderr : fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+
+    fprintf(file, "{\"exit_reason\": \"%s\"", halt_name(halt->reason));
+    if (halt->reason == BRV1E_HALT_EXIT) {
+        fprintf(file, ", \"exit_code\": %u", halt->exit_code);
+    }
+    if (halt->reason != BRV1E_HALT_NONE) {
+        fprintf(file, ", \"pc\": \"0x%08x\"", halt->pc);
+    }
+    if ((halt->reason != BRV1E_HALT_NONE) && (halt->reason != BRV1E_HALT_EXIT)) {
+        fprintf(file, ", \"tval\": \"0x%08x\"", halt->tval);
+    }
+    fprintf(file, ", \"instructions\": %llu, \"cycles\": %llu, \"wall_seconds\": %.6f, \"mips\": %.3f}\n",
+            (unsigned long long)insts, (unsigned long long)cycles, seconds,
+            (seconds > 0) ? (double)insts / seconds / 1e6 : 0.0);
+
+    return (file == stderr) ? 0 : fclose(file);
+}
+
+int main(int argc, char **argv) {
+    brv1e_opts_t opts = { 0 };
+    const char *save_snapshot = NULL;
+    const char *load_snapshot = NULL;
+    const char *stats_file = NULL;
+    uint64_t max_insts = 0;
+    double timeout = 0;
+    const char *size_error;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:f:rjdu:b:s:l:p:g:n:y:M:i:T:o:eh")) != -1) {
+        switch (opt) {
+            case 't':
+                opts.trace_file = optarg;
+                break;
+            case 'f':
+                opts.clk_freq_hz = (unsigned int)strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                opts.realtime = 1;
+                break;
+            case 'j':
+                opts.jit = 1;
+                break;
+            case 'd':
+                opts.direct_boot = 1;
+                break;
+            case 'u':
+                opts.uart_rx_file = optarg;
+                break;
+            case 'b':
+                opts.uart_baud = (unsigned int)strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                save_snapshot = optarg;
+                break;
+            case 'l':
+                load_snapshot = optarg;
+                break;
+            case 'p':
+                opts.profile_file = optarg;
+                break;
+            case 'g':
+                opts.profile_folded_file = optarg;
+                break;
+            case 'n':
+                opts.profile_period = (unsigned int)strtoul(optarg, NULL, 0);
+                break;
+            case 'y':
+                opts.profile_symbols = optarg;
+                break;
+            case 'M':
+                size_error = BRV1E_ParseRAMSize(optarg, &opts.ram_size);
+                if (size_error != NULL) {
+                    fprintf(stderr, "Invalid RAM size '%s': %s\n", optarg, size_error);
+                    return 1;
+                }
+                break;
+            case 'i':
+                max_insts = strtoull(optarg, NULL, 0);
+                break;
+            case 'T':
+                timeout = strtod(optarg, NULL);
+                break;
+            case 'o':
+                stats_file = optarg;
+                break;
+            case 'e':
+                fetch_fault_exits = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    const char *mem_image = (optind < argc) ? argv[optind] : (void *)0;
+
+    /* The UART is the console */
+    opts.uart_stdin = 1;
+
+    brv1e_ctx_t *ctx = BRV1E_Create(&opts);
+    if (ctx == NULL) {
+        printf("Could not create the emulator\n");
+        return 1;
+    }
+
+    if (load_snapshot != NULL) {
+        if (BRV1E_Restore(ctx, load_snapshot) != 0) {
+            printf("Could not restore %s\n", load_snapshot);
+            BRV1E_Destroy(ctx);
+            return 1;
+        }
+    }
+    else {
+        /* With scripted UART input the bootloader can receive the program */
+        if ((mem_image == NULL) && (opts.uart_rx_file == NULL)) {
+            mem_image = "program.txt";
+        }
+
+        if ((mem_image != NULL) && (BRV1E_Load(ctx, mem_image) != 0)) {
+            printf("Could not load %s\n", mem_image);
+            BRV1E_Destroy(ctx);
+            return 1;
+        }
+    }
+
+    if ((timeout > 0) && (start_timeout(ctx, timeout) != 0)) {
+        printf("Could not start the timeout\n");
+        BRV1E_Destroy(ctx);
+        return 1;
+    }
+
+    /* The budget and the statistics cover this run only, not the run a
+     * snapshot was saved from */
+    uint64_t start_insts = BRV1E_GetInstCount(ctx);
+    uint64_t start_cycles = BRV1E_GetCycleCount(ctx);
+    double start_time = now_seconds();
+    int result = 0;
+
+    if ((save_snapshot != NULL) && (BRV1E_Boot(ctx) == BRV1E_STATUS_RUNNING) && !timed_out) {
+        if (BRV1E_Save(ctx, save_snapshot) != 0) {
+            printf("Could not save %s\n", save_snapshot);
+            result = 1;
+        }
+    }
+
+    if (result == 0) {
+        if (max_insts == 0) {
+            BRV1E_RunContext(ctx);
+        }
+        else if (BRV1E_GetInstCount(ctx) - start_insts < max_insts) {
+            BRV1E_Step(ctx, max_insts - (BRV1E_GetInstCount(ctx) - start_insts));
+        }
+    }
+
+    double seconds = now_seconds() - start_time;
+    uint64_t insts = BRV1E_GetInstCount(ctx) - start_insts;
+    uint64_t cycles = BRV1E_GetCycleCount(ctx) - start_cycles;
+    brv1e_halt_t halt;
+    BRV1E_GetHalt(ctx, &halt);
+
+    /* Flush the guest's output before reporting */
+    BRV1E_Destroy(ctx);
+
+    if (result != 0) {
+        return result;
+    }
+
+    report_halt(&halt);
+    if ((stats_file != NULL) && (write_stats(stats_file, &halt, insts, cycles, seconds) != 0)) {
+        printf("Could not write %s\n", stats_file);
+    }
+
+    /* Programs written before the exit register halt by jumping to unmapped
+     * memory, which is only a success with -e */
+    switch (halt.reason) {
+        case BRV1E_HALT_EXIT:           return (int)(halt.exit_code & 0xFFU);
+        case BRV1E_HALT_FETCH_FAULT:    return fetch_fault_exits ? 0 : EXIT_STATUS_FAULT;
+        case BRV1E_HALT_NONE:           return EXIT_STATUS_LIMIT;
+        default:                        return EXIT_STATUS_FAULT;
+    }
+}
@@ -0,0 +1,117 @@
+/**
+ * @file    mem.c
+ * @brief   Source file for the guest memory map
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stddef.h>
+
+#include "mem.h"
+
+/* ----------------------------------------------------------------------------
+ * Private Macros
+ * ------------------------------------------------------------------------- */
+
+#define PAGE_OF(addr)           ((addr) >> RV_MEM_PAGE_SHIFT)
+
+/* ----------------------------------------------------------------------------
+ * Private Global Variables
+ * ------------------------------------------------------------------------- */
+
+/* Mapped in every page without a region. Every access to it faults. */
+static const rv_mem_region_t unmapped = { .name = "unmapped" };
+
+/* ----------------------------------------------------------------------------
+ * Private Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+static int rv_MemMap(rv_mem_t *mem, const rv_mem_region_t *region);
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions
+ * ------------------------------------------------------------------------- */
+
+static int rv_MemMap(rv_mem_t *mem, const rv_mem_region_t *region) {
+    if ((mem->num_regions == RV_MEM_MAX_REGIONS) || (region->size == 0) ||
+        (region->base + (region->size - 1U) < region->base)) {
+        return -1;
+    }
+
+    uint32_t first = PAGE_OF(region->base);
+    uint32_t last = PAGE_OF(region->base + (region->size - 1U));
+
+    /* Pages hold a single region */
+    for (uint32_t page = first; page <= last; ++page) {
+        if (mem->page_table[page] != &unmapped) {
+            return -1;
+        }
+    }
+
+    mem->regions[mem->num_regions] = *region;
+    for (uint32_t page = first; page <= last; ++page) {
+        mem->page_table[page] = &mem->regions[mem->num_regions];
+    }
+    ++mem->num_regions;
+
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+void rv_InitMem(rv_mem_t *mem) {
+    for (uint32_t page = 0; page < RV_MEM_NUM_PAGES; ++page) {
+        mem->page_table[page] = &unmapped;
+    }
+    mem->num_regions = 0;
+}
+
+int rv_MemMapHost(rv_mem_t *mem, const char *name, uint32_t base, uint32_t size, void *host, uint32_t flags) {
+    if ((host == NULL) || (size < 4U)) {
+        return -1;
+    }
+
+    rv_mem_region_t region = {
+        .name = name, .base = base, .size = size, .flags = flags, .host = host
+    };
+    return rv_MemMap(mem, &region);
+}
+
+int rv_MemMapDevice(rv_mem_t *mem, const char *name, uint32_t base, uint32_t size,
+                    rv_mem_read_fn_t read, rv_mem_write_fn_t write, void *dev) {
+    rv_mem_region_t region = {
+        .name = name, .base = base, .size = size, .read = read, .write = write, .dev = dev
+    };
+    return rv_MemMap(mem, &region);
+}
+
+int rv_MemLoadDevice(const rv_mem_region_t *region, uint32_t offset, uint32_t width,
+                     uint32_t *read_data, uint64_t cycles) {
+    /* Host memory only gets here when the access is out of bounds */
+    if ((region->read == NULL) || (offset >= region->size)) {
+        return -1;
+    }
+
+    uint32_t data = region->read(region->dev, offset, cycles);
+    *read_data = (width == 4U) ? data : (data & ((1U << (8U * width)) - 1U));
+
+    return 0;
+}
+
+int rv_MemStoreDevice(const rv_mem_region_t *region, uint32_t offset, uint32_t width,
+                      uint32_t write_data, uint64_t cycles) {
+    if ((region->write == NULL) || (offset >= region->size)) {
+        return -1;
+    }
+
+    region->write(region->dev, offset, write_data, width, cycles);
+
+    return 0;
+}
@@ -0,0 +1,418 @@
+/**
+ * @file    profile.c
+ * @brief   Source file for the sampling guest profiler
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+/* ----------------------------------------------------------------------------
+ * Private Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Initial sizes of the stack table and the function pool */
+#define STACKS_INIT_SIZE        (256U)
+#define POOL_INIT_SIZE          (1024U)
+
+/* FNV-1a */
+#define HASH_BASIS              (2166136261U)
+#define HASH_PRIME              (16777619U)
+
+/* ----------------------------------------------------------------------------
+ * Private Types
+ * ------------------------------------------------------------------------- */
+
+/* A function in the flat profile */
+typedef struct {
+    uint32_t    addr;
+    uint64_t    self;
+    uint64_t    total;
+} rv_profile_func_t;
+
+/* ----------------------------------------------------------------------------
+ * Private Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+static uint32_t rv_ProfileFunction(const rv_profile_t *profile, uint32_t addr, uint32_t fallback);
+
+static int rv_ProfileGrowStacks(rv_profile_t *profile);
+
+static rv_profile_stack_t *rv_ProfileFindStack(rv_profile_t *profile, const uint32_t *funcs,
+                                               uint32_t depth, uint32_t hash);
+
+static const char *rv_ProfileName(const rv_profile_t *profile, uint32_t addr, char *buf, size_t size);
+
+static void rv_ProfileWriteReport(const rv_profile_t *profile, FILE *file);
+
+static void rv_ProfileWriteFolded(const rv_profile_t *profile, FILE *file);
+
+static int rv_CompareAddrs(const void *a, const void *b);
+
+static int rv_CompareFuncs(const void *a, const void *b);
+
+static int rv_CompareBusiest(const void *a, const void *b);
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions
+ * ------------------------------------------------------------------------- */
+
+/* The start of the function containing addr, or fallback if no symbol
+ * contains it */
+static uint32_t rv_ProfileFunction(const rv_profile_t *profile, uint32_t addr, uint32_t fallback) {
+    const rv_symbol_t *sym = rv_FindSymbolByAddr(profile->symbols, profile->num_symbols, addr);
+    return (sym != NULL) ? sym->addr : fallback;
+}
+
+static int rv_ProfileGrowStacks(rv_profile_t *profile) {
+    uint32_t new_size = profile->stacks_size * 2U;
+    rv_profile_stack_t *new_stacks = calloc(new_size, sizeof(rv_profile_stack_t));
+    if (new_stacks == NULL) {
+        return -1;
+    }
+
+    for (uint32_t idx = 0; idx < profile->stacks_size; ++idx) {
+        const rv_profile_stack_t *stack = &profile->stacks[idx];
+        if (stack->count == 0) {
+            continue;
+        }
+
+        uint32_t slot = stack->hash & (new_size - 1U);
+        while (new_stacks[slot].count != 0) {
+            slot = (slot + 1U) & (new_size - 1U);
+        }
+        new_stacks[slot] = *stack;
+    }
+
+    free(profile->stacks);
+    profile->stacks = new_stacks;
+    profile->stacks_size = new_size;
+
+    return 0;
+}
+
+/* Find a stack in the table, adding it with a count of 0 if it is new.
+ * Returns NULL if memory runs out. */
+static rv_profile_stack_t *rv_ProfileFindStack(rv_profile_t *profile, const uint32_t *funcs,
+                                               uint32_t depth, uint32_t hash) {
+    uint32_t mask = profile->stacks_size - 1U;
+    uint32_t slot = hash & mask;
+
+    while (profile->stacks[slot].count != 0) {
+        rv_profile_stack_t *stack = &profile->stacks[slot];
+        if ((stack->hash == hash) && (stack->depth == depth) &&
+            (memcmp(&profile->pool[stack->offset], funcs, depth * sizeof(uint32_t)) == 0)) {
+            return stack;
+        }
+        slot = (slot + 1U) & mask;
+    }
+
+    /* Keep the table at most half full so probes stay short */
+    if ((profile->num_stacks + 1U) * 2U > profile->stacks_size) {
+        if (rv_ProfileGrowStacks(profile) != 0) {
+            return NULL;
+        }
+        return rv_ProfileFindStack(profile, funcs, depth, hash);
+    }
+
+    if (profile->pool_used + depth > profile->pool_size) {
+        uint32_t new_size = profile->pool_size * 2U;
+        while (profile->pool_used + depth > new_size) {
+            new_size *= 2U;
+        }
+
+        uint32_t *new_pool = realloc(profile->pool, new_size * sizeof(uint32_t));
+        if (new_pool == NULL) {
+            return NULL;
+        }
+        profile->pool = new_pool;
+        profile->pool_size = new_size;
+    }
+
+    rv_profile_stack_t *stack = &profile->stacks[slot];
+    stack->hash = hash;
+    stack->depth = depth;
+    stack->offset = profile->pool_used;
+    memcpy(&profile->pool[stack->offset], funcs, depth * sizeof(uint32_t));
+    profile->pool_used += depth;
+    ++profile->num_stacks;
+
+    return stack;
+}
+
+static const char *rv_ProfileName(const rv_profile_t *profile, uint32_t addr, char *buf, size_t size) {
+    const rv_symbol_t *sym = rv_FindSymbolByAddr(profile->symbols, profile->num_symbols, addr);
+    if ((sym != NULL) && (sym->addr == addr)) {
+        return sym->name;
+    }
+
+    snprintf(buf, size, "0x%08x", addr);
+    return buf;
+}
+
+static void rv_ProfileWriteReport(const rv_profile_t *profile, FILE *file) {
+    /* Collect the distinct functions */
+    uint32_t *addrs = malloc((profile->pool_used + 1U) * sizeof(uint32_t));
+    rv_profile_func_t *funcs = calloc(profile->pool_used + 1U, sizeof(rv_profile_func_t));
+    if ((addrs == NULL) || (funcs == NULL)) {
+        free(addrs);
+        free(funcs);
+        return;
+    }
+
+    memcpy(addrs, profile->pool, profile->pool_used * sizeof(uint32_t));
+    qsort(addrs, profile->pool_used, sizeof(uint32_t), rv_CompareAddrs);
+
+    uint32_t num_funcs = 0;
+    for (uint32_t idx = 0; idx < profile->pool_used; ++idx) {
+        if ((num_funcs == 0) || (funcs[num_funcs - 1U].addr != addrs[idx])) {
+            funcs[num_funcs++].addr = addrs[idx];
+        }
+    }
+
+    /* Self counts go to the innermost function. Total counts go to every
+     * function on the stack, once even if it recursed. */
+    for (uint32_t idx = 0; idx < profile->stacks_size; ++idx) {
+        const rv_profile_stack_t *stack = &profile->stacks[idx];
+        if (stack->count == 0) {
+            continue;
+        }
+
+        const uint32_t *stack_funcs = &profile->pool[stack->offset];
+        for (uint32_t level = 0; level < stack->depth; ++level) {
+            uint32_t outer;
+            for (outer = 0; outer < level; ++outer) {
+                if (stack_funcs[outer] == stack_funcs[level]) {
+                    break;
+                }
+            }
+
+            rv_profile_func_t key = { .addr = stack_funcs[level] };
+            rv_profile_func_t *func = bsearch(&key, funcs, num_funcs, sizeof(rv_profile_func_t), rv_CompareFuncs);
+            if (outer == level) {
+                func->total += stack->count;
+            }
+            if (level == stack->depth - 1U) {
+                func->self += stack->count;
+            }
+        }
+    }
+
+    qsort(funcs, num_funcs, sizeof(rv_profile_func_t), rv_CompareBusiest);
+
+    double scale = (profile->num_samples != 0) ? (100.0 / (double)profile->num_samples) : 0.0;
+
+    fprintf(file, "Flat profile: %llu samples, 1 every %u instructions\n\n",
+            (unsigned long long)profile->num_samples, profile->period);
+    fprintf(file, "  self%%        self  total%%       total  function\n");
+    for (uint32_t idx = 0; idx < num_funcs; ++idx) {
+        char buf[16];
+        fprintf(file, "%6.2f %11llu %6.2f %11llu  %s\n",
+                (double)funcs[idx].self * scale, (unsigned long long)funcs[idx].self,
+                (double)funcs[idx].total * scale, (unsigned long long)funcs[idx].total,
+                rv_ProfileName(profile, funcs[idx].addr, buf, sizeof(buf)));
+    }
+
+    free(addrs);
+    free(funcs);
+}
+
+static void rv_ProfileWriteFolded(const rv_profile_t *profile, FILE *file) {
+    for (uint32_t idx = 0; idx < profile->stacks_size; ++idx) {
+        const rv_profile_stack_t *stack = &profile->stacks[idx];
+        if (stack->count == 0) {
+            continue;
+        }
+
+        for (uint32_t level = 0; level < stack->depth; ++level) {
+            char buf[16];
+            fprintf(file, "%s%s", (level != 0) ? ";" : "",
+                    rv_ProfileName(profile, profile->pool[stack->offset + level], buf, sizeof(buf)));
+        }
+        fprintf(file, " %llu\n", (unsigned long long)stack->count);
+    }
+}
+
+static int rv_CompareAddrs(const void *a, const void *b) {
+    uint32_t addr_a = *(const uint32_t *)a;
+    uint32_t addr_b = *(const uint32_t *)b;
+    return (addr_a > addr_b) - (addr_a < addr_b);
+}
+
+static int rv_CompareFuncs(const void *a, const void *b) {
+    return rv_CompareAddrs(&((const rv_profile_func_t *)a)->addr, &((const rv_profile_func_t *)b)->addr);
+}
+
+/* Most self samples first, then most total samples */
+static int rv_CompareBusiest(const void *a, const void *b) {
+    const rv_profile_func_t *func_a = a;
+    const rv_profile_func_t *func_b = b;
+
+    if (func_a->self != func_b->self) {
+        return (func_a->self < func_b->self) ? 1 : -1;
+    }
+    return (func_a->total < func_b->total) - (func_a->total > func_b->total);
+}
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+int rv_InitProfile(rv_profile_t *profile, const char *report_file, const char *folded_file,
+                   uint32_t period, uint64_t inst_cnt) {
+    profile->stacks = calloc(STACKS_INIT_SIZE, sizeof(rv_profile_stack_t));
+    profile->pool = malloc(POOL_INIT_SIZE * sizeof(uint32_t));
+    if ((profile->stacks == NULL) || (profile->pool == NULL)) {
+        free(profile->stacks);
+        free(profile->pool);
+        profile->stacks = NULL;
+        profile->pool = NULL;
+        return -1;
+    }
+
+    profile->stacks_size = STACKS_INIT_SIZE;
+    profile->pool_size = POOL_INIT_SIZE;
+    profile->report_file = report_file;
+    profile->folded_file = folded_file;
+    profile->period = (period != 0) ? period : RV_PROFILE_DEFAULT_PERIOD;
+    profile->next_sample = inst_cnt + profile->period;
+    profile->enabled = 1;
+
+    return 0;
+}
+
+void rv_UninitProfile(rv_profile_t *profile) {
+    if (profile->stacks == NULL) {
+        return;
+    }
+
+    if (profile->report_file != NULL) {
+        FILE *file = fopen(profile->report_file, "w");
+        if (file != NULL) {
+            rv_ProfileWriteReport(profile, file);
+            fclose(file);
+        }
+        else {
+            printf("Could not write profile to %s\n", profile->report_file);
+        }
+    }
+
+    if (profile->folded_file != NULL) {
+        FILE *file = fopen(profile->folded_file, "w");
+        if (file != NULL) {
+            rv_ProfileWriteFolded(profile, file);
+            fclose(file);
+        }
+        else {
+            printf("Could not write folded stacks to %s\n", profile->folded_file);
+        }
+    }
+
+    rv_FreeSymbols(profile->symbols, profile->num_symbols);
+    free(profile->stacks);
+    free(profile->pool);
+    memset(profile, 0, sizeof(*profile));
+}
+
+void rv_ProfileLoadSymbols(rv_profile_t *profile, const char *path) {
+    rv_symbol_t *symbols;
+    uint32_t num_symbols;
+
+    if (rv_LoadSymbols(path, &symbols, &num_symbols) != 0) {
+        symbols = NULL;
+        num_symbols = 0;
+    }
+
+    rv_FreeSymbols(profile->symbols, profile->num_symbols);
+    profile->symbols = symbols;
+    profile->num_symbols = num_symbols;
+}
+
+void rv_ProfileReset(rv_profile_t *profile, uint64_t inst_cnt) {
+    profile->next_sample = inst_cnt + profile->period;
+    profile->depth = 0;
+    profile->overflow = 0;
+}
+
+void rv_ProfileSample(rv_profile_t *profile, uint32_t pc, uint64_t inst_cnt) {
+    uint32_t funcs[RV_PROFILE_MAX_DEPTH + 2U];
+    uint32_t depth = 0;
+    uint32_t hash = HASH_BASIS;
+
+    profile->next_sample = inst_cnt + profile->period;
+
+    /* The function that made the outermost call was never called itself. The
+     * call was 2 or 4 bytes long, either way it starts inside the caller. */
+    if (profile->depth != 0) {
+        const rv_symbol_t *root = rv_FindSymbolByAddr(profile->symbols, profile->num_symbols,
+                                                      profile->frames[0].ret_addr - 2U);
+        if (root != NULL) {
+            funcs[depth++] = root->addr;
+        }
+    }
+
+    for (uint32_t level = 0; level < profile->depth; ++level) {
+        uint32_t target = profile->frames[level].target;
+        funcs[depth++] = rv_ProfileFunction(profile, target, target);
+    }
+
+    /* Without a symbol the PC is taken to be in the function last called */
+    uint32_t caller = (depth != 0) ? funcs[depth - 1U] : pc;
+    uint32_t func = rv_ProfileFunction(profile, pc, caller);
+
+    /* A function entered by a plain jump (a tail call) shows up below the
+     * function that jumped to it */
+    if ((depth == 0) || (func != caller)) {
+        funcs[depth++] = func;
+    }
+
+    for (uint32_t level = 0; level < depth; ++level) {
+        hash = (hash ^ funcs[level]) * HASH_PRIME;
+    }
+
+    rv_profile_stack_t *stack = rv_ProfileFindStack(profile, funcs, depth, hash);
+    if (stack == NULL) {
+        /* Out of memory. Keep what was collected. */
+        profile->enabled = 0;
+        return;
+    }
+
+    ++stack->count;
+    ++profile->num_samples;
+}
+
+void rv_ProfileCall(rv_profile_t *profile, uint32_t target, uint32_t ret_addr) {
+    if (profile->depth == RV_PROFILE_MAX_DEPTH) {
+        ++profile->overflow;
+        return;
+    }
+
+    profile->frames[profile->depth].target = target;
+    profile->frames[profile->depth].ret_addr = ret_addr;
+    ++profile->depth;
+}
+
+void rv_ProfileReturn(rv_profile_t *profile, uint32_t target) {
+    if (profile->overflow != 0) {
+        --profile->overflow;
+        return;
+    }
+
+    /* Pop up to the frame returned to, which skips frames left by longjmp.
+     * Returns that match no frame are ignored. */
+    for (uint32_t level = profile->depth; level > 0; --level) {
+        if (profile->frames[level - 1U].ret_addr == target) {
+            profile->depth = level - 1U;
+            return;
+        }
+    }
+}
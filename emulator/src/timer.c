@@ -0,0 +1,112 @@
+/**
+ * @file    timer.c
+ * @brief   Source file for the timer and the virtual clock
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <time.h>
+
+#include "mem.h"
+#include "timer.h"
+
+/* ----------------------------------------------------------------------------
+ * Private Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+#define NS_PER_S                (1000000000ULL)
+
+/* Don't bother sleeping for less than this */
+#define PACE_MIN_SLEEP_NS       (100000ULL)
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+void rv_InitTimer(rv_timer_t *timer, rv_mem_t *mem, uint32_t clk_freq_hz, int realtime) {
+    timer->clk_freq = (clk_freq_hz != 0) ? clk_freq_hz : RV_DEFAULT_CLK_FREQ_HZ;
+    timer->paced = realtime;
+    timer->reset_cycles = 0;
+    timer->compare = UINT32_MAX;
+    clock_gettime(CLOCK_MONOTONIC, &timer->start_time);
+
+    rv_MemMapDevice(mem, "timer", RV_TIMER_BASE, RV_TIMER_SIZE, rv_TimerRead, rv_TimerWrite, timer);
+}
+
+uint32_t rv_TimerRead(void *dev, uint32_t offset, uint64_t cycles) {
+    const rv_timer_t *timer = dev;
+    uint32_t read_data;
+
+    switch (offset & ~0b11U) {
+        case RV_TIMER_TIME:
+            read_data = (uint32_t)(cycles - timer->reset_cycles);
+            break;
+        case RV_TIMER_COMPARE:
+            read_data = timer->compare;
+            break;
+        default:
+            /* The reset register reads as 0 */
+            read_data = 0;
+            break;
+    }
+
+    return read_data >> (8U * (offset & 0b11U));
+}
+
+void rv_TimerWrite(void *dev, uint32_t offset, uint32_t write_data, uint32_t width, uint64_t cycles) {
+    rv_timer_t *timer = dev;
+
+    if (offset == RV_TIMER_RESET) {
+        timer->reset_cycles = cycles;
+    }
+    else if ((offset == RV_TIMER_COMPARE) && (width == 4U)) {
+        timer->compare = write_data;
+    }
+}
+
+uint64_t rv_TimerDeadline(const rv_timer_t *timer, uint64_t cycles) {
+    uint32_t time = (uint32_t)(cycles - timer->reset_cycles);
+
+    return (time >= timer->compare) ? cycles : cycles + (timer->compare - time);
+}
+
+void rv_TimerPace(const rv_timer_t *timer, uint64_t cycles) {
+    if (!timer->paced) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t elapsed_ns = (uint64_t)(now.tv_sec - timer->start_time.tv_sec) * NS_PER_S +
+                          (uint64_t)now.tv_nsec - (uint64_t)timer->start_time.tv_nsec;
+    uint64_t virtual_ns = (uint64_t)((double)cycles * NS_PER_S / timer->clk_freq);
+
+    if (virtual_ns > elapsed_ns + PACE_MIN_SLEEP_NS) {
+        uint64_t ahead_ns = virtual_ns - elapsed_ns;
+        struct timespec delay = {
+            .tv_sec = (time_t)(ahead_ns / NS_PER_S),
+            .tv_nsec = (long)(ahead_ns % NS_PER_S)
+        };
+        nanosleep(&delay, NULL);
+    }
+}
+
+void rv_TimerRestore(rv_timer_t *timer, uint64_t reset_cycles, uint32_t compare, uint64_t cycles) {
+    timer->reset_cycles = reset_cycles;
+    timer->compare = compare;
+
+    /* Move the start time back so the wall clock is level with cycles */
+    uint64_t virtual_ns = (uint64_t)((double)cycles * NS_PER_S / timer->clk_freq);
+    clock_gettime(CLOCK_MONOTONIC, &timer->start_time);
+
+    uint64_t start_ns = (uint64_t)timer->start_time.tv_sec * NS_PER_S + (uint64_t)timer->start_time.tv_nsec;
+    start_ns = (start_ns > virtual_ns) ? start_ns - virtual_ns : 0;
+    timer->start_time.tv_sec = (time_t)(start_ns / NS_PER_S);
+    timer->start_time.tv_nsec = (long)(start_ns % NS_PER_S);
+}
@@ -0,0 +1,227 @@
+/**
+ * @file    trace.c
+ * @brief   Source file for the binary instruction trace
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "trace.h"
+
+#ifdef BRV1E_TRACE
+
+/* ----------------------------------------------------------------------------
+ * Private Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Number of records in the ring buffer. Must be a power of 2. */
+#define RING_SIZE               (1U << 16)
+#define RING_MASK               (RING_SIZE - 1U)
+
+/* How long the writer thread sleeps when the ring buffer is empty */
+#define WRITER_IDLE_NS          (1000000L)
+
+/* ----------------------------------------------------------------------------
+ * Private Global Variables
+ * ------------------------------------------------------------------------- */
+
+/* Number of times SIGUSR1 was received */
+static volatile sig_atomic_t toggles;
+
+static pthread_once_t signal_once = PTHREAD_ONCE_INIT;
+
+/* ----------------------------------------------------------------------------
+ * Private Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+static void *rv_TraceWriterThread(void *arg);
+
+static void rv_TraceToggleHandler(int sig);
+
+static void rv_TraceInstallHandler(void);
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions
+ * ------------------------------------------------------------------------- */
+
+static void *rv_TraceWriterThread(void *arg) {
+    rv_trace_t *trace = arg;
+    const struct timespec idle = { .tv_sec = 0, .tv_nsec = WRITER_IDLE_NS };
+
+    while (1) {
+        size_t tail = atomic_load_explicit(&trace->ring_tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&trace->ring_head, memory_order_acquire);
+
+        if (head == tail) {
+            if (atomic_load(&trace->stopping)) {
+                break;
+            }
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        /* Write the largest contiguous chunk in one call */
+        size_t start = tail & RING_MASK;
+        size_t count = head - tail;
+        if (start + count > RING_SIZE) {
+            count = RING_SIZE - start;
+        }
+
+        fwrite(&trace->ring[start], sizeof(rv_trace_record_t), count, trace->file);
+
+        atomic_store_explicit(&trace->ring_tail, tail + count, memory_order_release);
+    }
+
+    return NULL;
+}
+
+static void rv_TraceToggleHandler(int sig) {
+    (void)sig;
+    toggles = toggles + 1;
+}
+
+static void rv_TraceInstallHandler(void) {
+    /* SIGUSR1 toggles tracing */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = rv_TraceToggleHandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+int rv_InitTrace(rv_trace_t *trace, const char *fn) {
+    /* Return if already initialized */
+    if (trace->active) {
+        return 0;
+    }
+
+    trace->ring = malloc(RING_SIZE * sizeof(rv_trace_record_t));
+    if (trace->ring == NULL) {
+        return -1;
+    }
+
+    trace->file = fopen(fn, "wb");
+    if (trace->file == NULL) {
+        free(trace->ring);
+        trace->ring = NULL;
+        return -1;
+    }
+
+    rv_trace_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RV_TRACE_MAGIC, sizeof(RV_TRACE_MAGIC));
+    header.version = RV_TRACE_VERSION;
+    header.record_size = sizeof(rv_trace_record_t);
+    fwrite(&header, sizeof(header), 1, trace->file);
+
+    atomic_store(&trace->ring_head, 0);
+    atomic_store(&trace->ring_tail, 0);
+    atomic_store(&trace->stopping, 0);
+
+    pthread_once(&signal_once, rv_TraceInstallHandler);
+    trace->toggles_seen = (unsigned int)toggles;
+
+    trace->active = 1;
+    trace->enabled = 1;
+
+    pthread_create(&trace->writer_thread_id, NULL, rv_TraceWriterThread, trace);
+
+    return 0;
+}
+
+void rv_UninitTrace(rv_trace_t *trace) {
+    /* Return if not initialized */
+    if (!trace->active) {
+        return;
+    }
+
+    trace->enabled = 0;
+    trace->active = 0;
+
+    /* The writer thread drains the ring buffer before exiting */
+    atomic_store(&trace->stopping, 1);
+    pthread_join(trace->writer_thread_id, NULL);
+
+    fclose(trace->file);
+    trace->file = NULL;
+
+    free(trace->ring);
+    trace->ring = NULL;
+}
+
+void rv_TraceSetEnabled(rv_trace_t *trace, int enabled) {
+    trace->enabled = trace->active && enabled;
+}
+
+void rv_TraceSync(rv_trace_t *trace) {
+    unsigned int received = (unsigned int)toggles;
+
+    if (received != trace->toggles_seen) {
+        if ((received - trace->toggles_seen) & 1U) {
+            trace->enabled = trace->active && !trace->enabled;
+        }
+        trace->toggles_seen = received;
+    }
+}
+
+void rv_TracePush(rv_trace_t *trace, const rv_trace_record_t *rec) {
+    size_t head = atomic_load_explicit(&trace->ring_head, memory_order_relaxed);
+
+    /* Wait for the writer thread if the ring buffer is full */
+    while (head - atomic_load_explicit(&trace->ring_tail, memory_order_acquire) >= RING_SIZE) {
+        sched_yield();
+    }
+
+    trace->ring[head & RING_MASK] = *rec;
+
+    atomic_store_explicit(&trace->ring_head, head + 1, memory_order_release);
+}
+
+#else
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+int rv_InitTrace(rv_trace_t *trace, const char *fn) {
+    (void)trace;
+    (void)fn;
+    return -1;
+}
+
+void rv_UninitTrace(rv_trace_t *trace) {
+    (void)trace;
+}
+
+void rv_TraceSetEnabled(rv_trace_t *trace, int enabled) {
+    (void)trace;
+    (void)enabled;
+}
+
+void rv_TraceSync(rv_trace_t *trace) {
+    (void)trace;
+}
+
+void rv_TracePush(rv_trace_t *trace, const rv_trace_record_t *rec) {
+    (void)trace;
+    (void)rec;
+}
+
+#endif /* BRV1E_TRACE */
@@ -7,92 +7,169 @@
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
 #include <assert.h>
+#include <sys/stat.h>
 
+#include "mem.h"
 #include "uart.h"
 
 /* ----------------------------------------------------------------------------
- * Private Global Varaibles
+ * Private Symbolic Constants
  * ------------------------------------------------------------------------- */
 
-static struct uart {
-    uint8_t rx_data;
-    uint8_t rx_ready;
-    uint8_t tx_data;
-    uint8_t tx_busy;
-} uart;
+#define FIFO_MASK               (RV_UART_FIFO_SIZE - 1U)
 
-static pthread_mutex_t rx_mutex;
-static pthread_mutex_t tx_mutex;
+/* How long the threads sleep when they have nothing to do */
+#define IDLE_NS                 (1000000L)
 
-static int active = 0;
-
-static pthread_t printing_thread_id;
-static pthread_t rx_thread_id;
+/* Largest value a count register can hold */
+#define COUNT_MAX               (0xFFU)
 
 /* ----------------------------------------------------------------------------
  * Private Function Prototypes
  * ------------------------------------------------------------------------- */
 
-// static void *rv_PrintingThread(void *arg);
-
 static void *rv_RxThread(void *arg);
 
+static void *rv_TxThread(void *arg);
+
+static void rv_Idle(void);
+
+static void rv_RxFill(rv_uart_t *uart);
+
+static unsigned int rv_RxArrived(const rv_uart_t *uart, uint64_t cycles);
+
+static unsigned int rv_TxQueued(rv_uart_t *uart);
+
 /* ----------------------------------------------------------------------------
  * Private Function Definitions
  * ------------------------------------------------------------------------- */
 
-static void *rv_PrintingThread(void *arg) {
-    uint8_t saved_tx;
+static void rv_Idle(void) {
+    const struct timespec idle = { .tv_sec = 0, .tv_nsec = IDLE_NS };
+    nanosleep(&idle, NULL);
+}
 
-    while (1) {
-        if (!active) {
+/* Top up the RX FIFO from a regular file */
+static void rv_RxFill(rv_uart_t *uart) {
+    rv_uart_fifo_t *fifo = &uart->rx_fifo;
+    unsigned int head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    unsigned int space = RV_UART_FIFO_SIZE - (head - atomic_load_explicit(&fifo->tail, memory_order_relaxed));
+
+    while ((space != 0) && !uart->rx_eof) {
+        unsigned int start = head & FIFO_MASK;
+        unsigned int count = (start + space > RV_UART_FIFO_SIZE) ? (RV_UART_FIFO_SIZE - start) : space;
+
+        ssize_t nread = read(uart->rx_fd, &fifo->data[start], count);
+        if (nread <= 0) {
+            uart->rx_eof = 1;
             break;
         }
 
-        /* Check for tx data */
-        pthread_mutex_lock(&tx_mutex);
-        if (uart.tx_busy) {
-            saved_tx = uart.tx_data;
-            pthread_mutex_unlock(&tx_mutex);
+        head += (unsigned int)nread;
+        space -= (unsigned int)nread;
+    }
+
+    atomic_store_explicit(&fifo->head, head, memory_order_release);
+}
+
+/* Bytes received by the host that have also arrived at the line rate */
+static unsigned int rv_RxArrived(const rv_uart_t *uart, uint64_t cycles) {
+    const rv_uart_fifo_t *fifo = &uart->rx_fifo;
+    unsigned int queued = atomic_load_explicit(&fifo->head, memory_order_acquire) -
+                          atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+
+    if (cycles < uart->rx_next_cycles) {
+        return 0;
+    }
+    if ((queued == 0) || (uart->rx_byte_cycles == 0)) {
+        return queued;
+    }
+
+    uint64_t arrived = 1U + (cycles - uart->rx_next_cycles) / uart->rx_byte_cycles;
+    return (arrived < queued) ? (unsigned int)arrived : queued;
+}
+
+/* Bytes waiting to be written out */
+static unsigned int rv_TxQueued(rv_uart_t *uart) {
+    rv_uart_fifo_t *fifo = &uart->tx_fifo;
+    return atomic_load_explicit(&fifo->head, memory_order_relaxed) -
+           atomic_load_explicit(&fifo->tail, memory_order_acquire);
+}
+
+static void *rv_RxThread(void *arg) {
+    rv_uart_t *uart = arg;
+    rv_uart_fifo_t *fifo = &uart->rx_fifo;
+    uint8_t buf[256];
+
+    while (!atomic_load(&uart->stopping) && !atomic_load(&uart->rx_pausing)) {
+        unsigned int head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+        unsigned int space = RV_UART_FIFO_SIZE -
+            (head - atomic_load_explicit(&fifo->tail, memory_order_acquire));
+
+        /* Wait for the guest to make room */
+        if (space == 0) {
+            rv_Idle();
+            continue;
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = uart->rx_fd, .events = POLLIN },
+            { .fd = uart->rx_wake_pipe[0], .events = POLLIN }
+        };
+        if (poll(fds, 2, -1) < 0) {
+            continue;
+        }
+        if (fds[1].revents) {
+            break;
+        }
 
-            printf("%C", (char)saved_tx);
-            fflush(stdout);
+        ssize_t nread = read(uart->rx_fd, buf, (space < sizeof(buf)) ? space : sizeof(buf));
 
-            /* Indicate that printing is done */
-            pthread_mutex_lock(&tx_mutex);
-            uart.tx_busy = 0U;
-            pthread_mutex_unlock(&tx_mutex);
+        /* Stop at the end of input */
+        if (nread <= 0) {
+            break;
         }
-        else {
-            pthread_mutex_unlock(&tx_mutex);
+
+        for (ssize_t idx = 0; idx < nread; ++idx) {
+            fifo->data[(head + (unsigned int)idx) & FIFO_MASK] = buf[idx];
         }
+        atomic_store_explicit(&fifo->head, head + (unsigned int)nread, memory_order_release);
     }
 
     return NULL;
 }
 
-static void *rv_RxThread(void *arg) {
-    char c;
+static void *rv_TxThread(void *arg) {
+    rv_uart_t *uart = arg;
+    rv_uart_fifo_t *fifo = &uart->tx_fifo;
 
     while (1) {
-        c = getchar();
-        pthread_mutex_lock(&rx_mutex);
-        uart.rx_ready = 1;
-        uart.rx_data = (uint8_t)c;
-        pthread_mutex_unlock(&rx_mutex);
+        unsigned int tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&fifo->head, memory_order_acquire);
+
+        if (head == tail) {
+            /* Everything is written out by the time stopping is seen */
+            if (atomic_load(&uart->stopping)) {
+                break;
+            }
+            rv_Idle();
+            continue;
+        }
+
+        /* Write the largest contiguous chunk in one call */
+        unsigned int start = tail & FIFO_MASK;
+        unsigned int count = head - tail;
+        if (start + count > RV_UART_FIFO_SIZE) {
+            count = RV_UART_FIFO_SIZE - start;
+        }
 
-        printf("Got char %c\n", c);
-        // if (!active) {
-        //     break;
-        // }
+        fwrite(&fifo->data[start], 1, count, uart->tx_file);
+        fflush(uart->tx_file);
 
-        // if (read(STDIN_FILENO, &c, 1) > 0) {
-        //     pthread_mutex_lock(&rx_mutex);
-        //     uart.rx_ready = 1U;
-        //     uart.rx_data = (uint8_t)c;
-        //     pthread_mutex_unlock(&rx_mutex);
-        // }
+        atomic_store_explicit(&fifo->tail, tail + count, memory_order_release);
     }
 
     return NULL;
@@ -102,73 +179,234 @@ static void *rv_RxThread(void *arg) {
  * Public Function Definitions
  * ------------------------------------------------------------------------- */
 
-void rv_InitUART(void) {
-    /* Return if already initialized */
-    if (active) {
-        return;
+void rv_InitUART(rv_uart_t *uart, rv_mem_t *mem, FILE *tx_file, int rx_fd, uint64_t rx_byte_cycles) {
+    /* Clear UART registers and FIFOs */
+    atomic_store(&uart->rx_fifo.head, 0);
+    atomic_store(&uart->rx_fifo.tail, 0);
+    atomic_store(&uart->tx_fifo.head, 0);
+    atomic_store(&uart->tx_fifo.tail, 0);
+    atomic_store(&uart->stopping, 0);
+    atomic_store(&uart->rx_pausing, 0);
+    uart->rx_data = 0;
+    uart->rx_byte_cycles = rx_byte_cycles;
+    uart->rx_next_cycles = 0;
+
+    uart->tx_file = tx_file;
+    uart->rx_fd = -1;
+    uart->rx_sync = 0;
+    uart->rx_eof = 0;
+    uart->term_saved = 0;
+
+    rv_MemMapDevice(mem, "uart", RV_UART_BASE, RV_UART_SIZE, rv_UARTRead, rv_UARTWrite, uart);
+
+    if (tx_file != NULL) {
+        pthread_create(&uart->tx_thread_id, NULL, rv_TxThread, uart);
+    }
+
+    /* A file can be read whenever the guest wants more, so the whole of it
+     * has arrived before the guest starts */
+    struct stat rx_stat;
+    if ((rx_fd >= 0) && (fstat(rx_fd, &rx_stat) == 0) && S_ISREG(rx_stat.st_mode)) {
+        uart->rx_fd = rx_fd;
+        uart->rx_sync = 1;
+        rv_RxFill(uart);
     }
+    else if ((rx_fd >= 0) && (pipe(uart->rx_wake_pipe) == 0)) {
+        /* Turn off canonical mode and echo */
+        if (isatty(rx_fd) && (tcgetattr(rx_fd, &uart->saved_term) == 0)) {
+            struct termios term_settings = uart->saved_term;
+            term_settings.c_lflag &= ~(ICANON | ECHO);
+            tcsetattr(rx_fd, TCSANOW, &term_settings);
+            uart->term_saved = 1;
+        }
 
-    active = 1;
+        uart->rx_fd = rx_fd;
+        pthread_create(&uart->rx_thread_id, NULL, rv_RxThread, uart);
+    }
+}
 
-    /* Clear UART register structure*/
-    memset((void *)&uart, 0, sizeof(uart));
+void rv_UninitUART(rv_uart_t *uart) {
+    atomic_store(&uart->stopping, 1);
 
-    /* Turn off canonical mode and echo */
-    struct termios term_settings;
-    tcgetattr(STDIN_FILENO, &term_settings);
-    term_settings.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &term_settings);
+    if (uart->rx_sync) {
+        uart->rx_fd = -1;
+    }
+    else if (uart->rx_fd >= 0) {
+        /* Wake the RX thread if it is waiting for input */
+        ssize_t written = write(uart->rx_wake_pipe[1], "", 1);
+        (void)written;
 
-    /* Initialize mutexes */
-    pthread_mutex_init(&rx_mutex, NULL);
-    pthread_mutex_init(&tx_mutex, NULL);
+        pthread_join(uart->rx_thread_id, NULL);
 
-    /* Create thread for printing */
-    // pthread_create(&printing_thread_id, NULL, rv_PrintingThread, NULL);
+        close(uart->rx_wake_pipe[0]);
+        close(uart->rx_wake_pipe[1]);
 
-    /* Create rx thread */
-    pthread_create(&rx_thread_id, NULL, rv_RxThread, NULL);
+        if (uart->term_saved) {
+            tcsetattr(uart->rx_fd, TCSANOW, &uart->saved_term);
+            uart->term_saved = 0;
+        }
+        uart->rx_fd = -1;
+    }
+
+    /* The TX thread drains the FIFO before exiting */
+    if (uart->tx_file != NULL) {
+        pthread_join(uart->tx_thread_id, NULL);
+        uart->tx_file = NULL;
+    }
 }
 
-void rv_UninitUART(void) {
-    /* Return if not initialized */
-    if (!active) {
-        return;
+void rv_UARTSave(const rv_uart_t *uart, uint8_t *rx, uint32_t *rx_count, uint8_t *tx, uint32_t *tx_count) {
+    const rv_uart_fifo_t *fifo = &uart->rx_fifo;
+
+    /* The guest is stopped, so only the threads move the FIFOs, and only
+     * away from the bytes being copied */
+    unsigned int tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+    *rx_count = atomic_load_explicit(&fifo->head, memory_order_acquire) - tail;
+    for (uint32_t idx = 0; idx < *rx_count; ++idx) {
+        rx[idx] = fifo->data[(tail + idx) & FIFO_MASK];
     }
 
-    active = 0;
+    fifo = &uart->tx_fifo;
+    tail = atomic_load_explicit(&fifo->tail, memory_order_acquire);
+    *tx_count = atomic_load_explicit(&fifo->head, memory_order_relaxed) - tail;
+    for (uint32_t idx = 0; idx < *tx_count; ++idx) {
+        tx[idx] = fifo->data[(tail + idx) & FIFO_MASK];
+    }
+}
 
-    /* Join threads */
-    pthread_join(printing_thread_id, NULL);
-    pthread_join(rx_thread_id, NULL);
+void rv_UARTRestore(rv_uart_t *uart, uint8_t rx_data, uint64_t rx_next_cycles, const uint8_t *rx, uint32_t rx_count,
+                    const uint8_t *tx, uint32_t tx_count) {
+    rv_uart_fifo_t *fifo = &uart->rx_fifo;
+    int rx_thread = (uart->rx_fd >= 0) && !uart->rx_sync;
+
+    uart->rx_data = rx_data;
+    uart->rx_next_cycles = rx_next_cycles;
+
+    /* The restored bytes go in front of the tail, so park the RX thread
+     * while the FIFO has no producer */
+    if (rx_thread) {
+        atomic_store(&uart->rx_pausing, 1);
+        ssize_t written = write(uart->rx_wake_pipe[1], "", 1);
+        pthread_join(uart->rx_thread_id, NULL);
+
+        /* The thread only polls the pipe, so the byte is still there */
+        uint8_t wake;
+        ssize_t nread = read(uart->rx_wake_pipe[0], &wake, 1);
+        (void)written;
+        (void)nread;
+        atomic_store(&uart->rx_pausing, 0);
+    }
 
-    /* Destroy mutexes */
-    pthread_mutex_destroy(&rx_mutex);
-    pthread_mutex_destroy(&tx_mutex);
+    /* Make room by giving back the newest received bytes. A file is read
+     * again from there; from anything else they are lost. */
+    unsigned int tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    if (head - tail > RV_UART_FIFO_SIZE - rx_count) {
+        unsigned int excess = (head - tail) - (RV_UART_FIFO_SIZE - rx_count);
+        head -= excess;
+        if (uart->rx_sync && (lseek(uart->rx_fd, -(off_t)excess, SEEK_CUR) >= 0)) {
+            uart->rx_eof = 0;
+        }
+    }
+
+    tail -= rx_count;
+    for (uint32_t idx = 0; idx < rx_count; ++idx) {
+        fifo->data[(tail + idx) & FIFO_MASK] = rx[idx];
+    }
+    atomic_store_explicit(&fifo->head, head, memory_order_relaxed);
+    atomic_store_explicit(&fifo->tail, tail, memory_order_release);
+
+    if (rx_thread) {
+        pthread_create(&uart->rx_thread_id, NULL, rv_RxThread, uart);
+    }
+
+    /* Queue the restored output behind anything pending, waiting for the TX
+     * thread to make room */
+    if (uart->tx_file != NULL) {
+        fifo = &uart->tx_fifo;
+        head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+        for (uint32_t idx = 0; idx < tx_count; ++idx) {
+            while (head - atomic_load_explicit(&fifo->tail, memory_order_acquire) == RV_UART_FIFO_SIZE) {
+                rv_Idle();
+            }
+            fifo->data[head & FIFO_MASK] = tx[idx];
+            atomic_store_explicit(&fifo->head, ++head, memory_order_release);
+        }
+    }
 }
 
-uint8_t rv_UARTRead(uint8_t addr) {
-    assert(active);
-    assert(addr <= 0b11);
+int rv_UARTReceive(rv_uart_t *uart, uint64_t cycles, uint8_t *byte) {
+    rv_uart_fifo_t *fifo = &uart->rx_fifo;
+
+    unsigned int count = rv_RxArrived(uart, cycles);
+    if (count == 0) {
+        return 0;
+    }
+
+    unsigned int tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+    uart->rx_data = fifo->data[tail & FIFO_MASK];
+    atomic_store_explicit(&fifo->tail, tail + 1U, memory_order_release);
+
+    /* A byte that arrived while this one waited is not held back another
+     * byte time */
+    uart->rx_next_cycles = ((count > 1U) ? uart->rx_next_cycles : cycles) + uart->rx_byte_cycles;
+
+    /* Keep the FIFO at least half full, so it only runs dry at the end of
+     * the file */
+    if (uart->rx_sync &&
+        (atomic_load_explicit(&fifo->head, memory_order_relaxed) - (tail + 1U) < RV_UART_FIFO_SIZE / 2U)) {
+        rv_RxFill(uart);
+    }
+
+    *byte = uart->rx_data;
+    return 1;
+}
+
+int rv_UARTNextArrival(const rv_uart_t *uart, uint64_t cycles, uint64_t *arrival) {
+    const rv_uart_fifo_t *fifo = &uart->rx_fifo;
+
+    if (atomic_load_explicit(&fifo->head, memory_order_acquire) ==
+        atomic_load_explicit(&fifo->tail, memory_order_relaxed)) {
+        return 0;
+    }
+
+    *arrival = (cycles < uart->rx_next_cycles) ? uart->rx_next_cycles : cycles;
+    return 1;
+}
+
+uint32_t rv_UARTRead(void *dev, uint32_t offset, uint64_t cycles) {
+    rv_uart_t *uart = dev;
+    unsigned int count;
+
+    assert(offset < RV_UART_SIZE);
 
     uint8_t read_data = 0;
 
-    switch (addr) {
-        case 0b00U:
-            pthread_mutex_lock(&rx_mutex);
-            uart.rx_ready = 0;
-            read_data = uart.rx_data;
-            pthread_mutex_unlock(&rx_mutex);
+    switch (offset) {
+        case RV_UART_RX_DATA:
+            /* The last byte is read again when none has arrived */
+            rv_UARTReceive(uart, cycles, &read_data);
+            read_data = uart->rx_data;
+            break;
+        case RV_UART_RX_READY:
+            read_data = (rv_RxArrived(uart, cycles) != 0);
+            break;
+        case RV_UART_TX_BUSY:
+            /* Busy only while the FIFO is full */
+            read_data = (uart->tx_file != NULL) && (rv_TxQueued(uart) == RV_UART_FIFO_SIZE);
+            break;
+        case RV_UART_RX_COUNT:
+            count = rv_RxArrived(uart, cycles);
+            read_data = (count < COUNT_MAX) ? count : COUNT_MAX;
             break;
-        case 0b01U:
-            pthread_mutex_lock(&rx_mutex);
-            read_data = uart.rx_ready;
-            pthread_mutex_unlock(&rx_mutex);
+        case RV_UART_TX_FREE:
+            /* Discarded output never fills up */
+            count = (uart->tx_file != NULL) ? (RV_UART_FIFO_SIZE - rv_TxQueued(uart)) : COUNT_MAX;
+            read_data = (count < COUNT_MAX) ? count : COUNT_MAX;
             break;
-        case 0b11U:
-            pthread_mutex_lock(&tx_mutex);
-            read_data = uart.tx_busy;
-            pthread_mutex_unlock(&tx_mutex);
+        case RV_UART_TX_COUNT:
+            count = (uart->tx_file != NULL) ? rv_TxQueued(uart) : 0;
+            read_data = (count < COUNT_MAX) ? count : COUNT_MAX;
             break;
         default:
             break;
@@ -177,15 +415,23 @@ uint8_t rv_UARTRead(uint8_t addr) {
     return read_data;
 }
 
-void rv_UARTWrite(uint8_t addr, uint8_t write_data) {
-    assert(active);
-    assert(addr <= 0b11);
+void rv_UARTWrite(void *dev, uint32_t offset, uint32_t write_data, uint32_t width, uint64_t cycles) {
+    rv_uart_t *uart = dev;
+    rv_uart_fifo_t *fifo = &uart->tx_fifo;
+
+    (void)width;
+    (void)cycles;
+
+    assert(offset < RV_UART_SIZE);
+
+    if ((offset != RV_UART_TX_DATA) || (uart->tx_file == NULL)) {
+        return;
+    }
 
-    if ((addr == 0b10) && (uart.tx_busy == 0)) {
-        printf("%c",(char)write_data);
-        // pthread_mutex_lock(&tx_mutex);
-        // uart.tx_busy = 1U;
-        // uart.tx_data = write_data;
-        // pthread_mutex_unlock(&tx_mutex);
+    /* Like the hardware, writes while busy are dropped */
+    unsigned int head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&fifo->tail, memory_order_acquire) < RV_UART_FIFO_SIZE) {
+        fifo->data[head & FIFO_MASK] = (uint8_t)write_data;
+        atomic_store_explicit(&fifo->head, head + 1U, memory_order_release);
     }
 }
@@ -0,0 +1,228 @@
+/**
+ * @file    rv_bootframe.c
+ * @brief   Frames a program for the UART bootloader
+ *
+ * The bootloader receives the image size and the sum of its words, each a
+ * 32-bit little-endian value, then tokens that rebuild the image a word at a
+ * time from address 0 (see bootloader/bootloader.S). Words are either sent
+ * as literals or repeated from earlier in the image, which shrinks the
+ * zero-filled and repetitive parts of a program. ELF files are laid out in
+ * memory first, dropping trailing zeros since startup code clears .bss.
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loader.h"
+
+/* ----------------------------------------------------------------------------
+ * Private Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+/* Far more than is practical to send at UART rates */
+#define MAX_PROGRAM_SIZE        (16U << 20)
+
+/* Token limits */
+#define MAX_LITERAL_WORDS       (0x80U)
+#define MIN_COPY_WORDS          (2U)
+#define MAX_COPY_WORDS          (0x80U)
+#define MAX_COPY_DISTANCE       (0xFFFFU)
+
+/* Token flag for repeating earlier words */
+#define TOKEN_COPY              (0x80U)
+
+/* Earlier positions with the same word hash that are tried for a copy */
+#define HASH_BITS               (16U)
+#define MAX_CHAIN_LENGTH        (256U)
+
+#define NO_POSITION             (UINT32_MAX)
+
+/* ----------------------------------------------------------------------------
+ * Private Macros
+ * ------------------------------------------------------------------------- */
+
+#define HASH_WORD(w)            (((w) * 0x9E3779B1U) >> (32U - HASH_BITS))
+
+/* ----------------------------------------------------------------------------
+ * Private Function Prototypes
+ * ------------------------------------------------------------------------- */
+
+static void rv_PutWord(FILE *out, uint32_t word);
+
+static void rv_PutLiterals(FILE *out, const uint32_t *words, uint32_t count);
+
+static int rv_WriteFrame(FILE *out, const uint32_t *words, uint32_t num_words);
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions
+ * ------------------------------------------------------------------------- */
+
+static void rv_PutWord(FILE *out, uint32_t word) {
+    for (uint32_t shift = 0; shift < 32U; shift += 8U) {
+        fputc((int)((word >> shift) & 0xFFU), out);
+    }
+}
+
+static void rv_PutLiterals(FILE *out, const uint32_t *words, uint32_t count) {
+    while (count > 0) {
+        uint32_t run = (count < MAX_LITERAL_WORDS) ? count : MAX_LITERAL_WORDS;
+
+        fputc((int)(run - 1U), out);
+        for (uint32_t idx = 0; idx < run; ++idx) {
+            rv_PutWord(out, words[idx]);
+        }
+
+        words += run;
+        count -= run;
+    }
+}
+
+/* Greedily take the longest copy found through a chain of earlier positions
+ * with the same word hash */
+static int rv_WriteFrame(FILE *out, const uint32_t *words, uint32_t num_words) {
+    uint32_t *head = malloc(sizeof(uint32_t) << HASH_BITS);
+    uint32_t *prev = malloc(sizeof(uint32_t) * ((num_words > 0) ? num_words : 1U));
+    if ((head == NULL) || (prev == NULL)) {
+        free(head);
+        free(prev);
+        return -1;
+    }
+    for (uint32_t idx = 0; idx < (1U << HASH_BITS); ++idx) {
+        head[idx] = NO_POSITION;
+    }
+
+    uint32_t checksum = 0;
+    for (uint32_t idx = 0; idx < num_words; ++idx) {
+        checksum += words[idx];
+    }
+
+    rv_PutWord(out, num_words * 4U);
+    rv_PutWord(out, checksum);
+
+    uint32_t literal_start = 0;
+    uint32_t pos = 0;
+    while (pos < num_words) {
+        uint32_t best_len = 0;
+        uint32_t best_dist = 0;
+        uint32_t max_len = num_words - pos;
+        if (max_len > MAX_COPY_WORDS) {
+            max_len = MAX_COPY_WORDS;
+        }
+
+        uint32_t chain = 0;
+        for (uint32_t cand = head[HASH_WORD(words[pos])];
+             (cand != NO_POSITION) && (pos - cand <= MAX_COPY_DISTANCE) &&
+             (chain < MAX_CHAIN_LENGTH);
+             cand = prev[cand], ++chain) {
+            /* Copies may overlap the words they write, like the bootloader */
+            uint32_t len = 0;
+            while ((len < max_len) && (words[cand + len] == words[pos + len])) {
+                ++len;
+            }
+            if (len > best_len) {
+                best_len = len;
+                best_dist = pos - cand;
+                if (len == max_len) {
+                    break;
+                }
+            }
+        }
+
+        if (best_len < MIN_COPY_WORDS) {
+            best_len = 1;
+        }
+        else {
+            rv_PutLiterals(out, &words[literal_start], pos - literal_start);
+            fputc((int)(TOKEN_COPY | (best_len - 1U)), out);
+            fputc((int)(best_dist & 0xFFU), out);
+            fputc((int)(best_dist >> 8), out);
+            literal_start = pos + best_len;
+        }
+
+        /* Every position covered can be copied from later */
+        for (uint32_t end = pos + best_len; pos < end; ++pos) {
+            uint32_t hash = HASH_WORD(words[pos]);
+            prev[pos] = head[hash];
+            head[hash] = pos;
+        }
+    }
+    rv_PutLiterals(out, &words[literal_start], num_words - literal_start);
+
+    free(head);
+    free(prev);
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    uint32_t entry;
+
+    if ((argc < 2) || (argc > 3)) {
+        printf("Usage: %s program [output_file]\n", argv[0]);
+        printf("Writes the bootloader framing of program (ELF32 or raw) to output_file or stdout\n");
+        return 1;
+    }
+
+    /* Only the pages the program touches are committed */
+    uint8_t *program = calloc(1, MAX_PROGRAM_SIZE);
+    if (program == NULL) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    if (rv_LoadProgram(argv[1], program, MAX_PROGRAM_SIZE, &entry) != 0) {
+        printf("Could not load %s\n", argv[1]);
+        free(program);
+        return 1;
+    }
+
+    /* The bootloader always jumps to address 0 */
+    if (entry != 0) {
+        printf("%s does not start at address 0\n", argv[1]);
+        free(program);
+        return 1;
+    }
+
+    uint32_t size = MAX_PROGRAM_SIZE;
+    while ((size > 0) && (program[size - 1U] == 0)) {
+        --size;
+    }
+    size = (size + 3U) & ~3U;
+
+    /* Guest memory is little-endian, like the frame */
+    uint32_t num_words = size / 4U;
+    uint32_t *words = (uint32_t *)program;
+    for (uint32_t idx = 0; idx < num_words; ++idx) {
+        const uint8_t *bytes = &program[idx * 4U];
+        words[idx] = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+                     ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    }
+
+    FILE *out = (argc == 3) ? fopen(argv[2], "wb") : stdout;
+    if (out == NULL) {
+        printf("Could not open %s\n", argv[2]);
+        free(program);
+        return 1;
+    }
+
+    int failed = (rv_WriteFrame(out, words, num_words) != 0) || ferror(out);
+
+    if ((out != stdout) && (fclose(out) != 0)) {
+        failed = 1;
+    }
+
+    free(program);
+    return failed;
+}
@@ -0,0 +1,429 @@
+/**
+ * @file    rv_runner.c
+ * @brief   Runs many firmware images in parallel, one emulator context each
+ *
+ * Images are spread over per-thread work queues. A thread takes work from
+ * the back of its own queue and, when that runs dry, steals from the front
+ * of another thread's queue, so long-running images do not leave the other
+ * cores idle. Images are direct-booted at their entry point, or with -u
+ * sent through the boot ROM's UART bootloader as framed by rv_bootframe.
+ *
+ * In fork mode every job is instead a fork of one context restored from a
+ * snapshot, so the jobs start from an already booted guest and share its RAM
+ * copy-on-write. Each fork can receive its own UART input.
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "BaseRV1E.h"
+
+/* ----------------------------------------------------------------------------
+ * Private Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+#define DEFAULT_MAX_INSTS       (1000000000ULL)
+
+/* ----------------------------------------------------------------------------
+ * Private Types
+ * ------------------------------------------------------------------------- */
+
+typedef enum {
+    JOB_ERROR,      /* The image could not be loaded */
+    JOB_HALTED,     /* The guest halted by jumping to unmapped memory */
+    JOB_EXITED,     /* The guest exited with code 0 */
+    JOB_FAILED,     /* The guest exited with another code */
+    JOB_FAULT,      /* The guest raised another exception */
+    JOB_TIMEOUT     /* The instruction budget ran out */
+} rv_job_result_t;
+
+typedef struct {
+    const char          *image;     /* Or UART input, or the job's name */
+    rv_job_result_t     result;
+    uint64_t            inst_cnt;
+    uint64_t            cycle_cnt;
+    double              seconds;
+} rv_job_t;
+
+/* A worker's queue of job indices. The owner pops from the back and thieves
+ * take from the front. */
+typedef struct {
+    size_t              *jobs;
+    size_t              front;
+    size_t              back;
+    pthread_mutex_t     lock;
+} rv_queue_t;
+
+typedef struct {
+    unsigned int        idx;
+    pthread_t           thread_id;
+} rv_worker_t;
+
+/* ----------------------------------------------------------------------------
+ * Private Global Variables
+ * ------------------------------------------------------------------------- */
+
+static rv_job_t *jobs;
+static rv_queue_t *queues;
+static unsigned int num_workers;
+
+static uint64_t max_insts = DEFAULT_MAX_INSTS;
+static const char *out_dir;
+static int use_jit;
+
+/* Guest RAM size in bytes, 0 for the default */
+static unsigned int ram_size;
+
+/* Non-zero when images are UART input rather than RAM images */
+static int uart_input;
+
+/* Non-zero to print CSV instead of the aligned report */
+static int csv_output;
+
+/* Non-zero if a fetch fault counts as a successful halt */
+static int fetch_fault_exits;
+
+/* The context jobs fork from in fork mode, otherwise NULL */
+static brv1e_ctx_t *fork_parent;
+static pthread_mutex_t fork_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions
+ * ------------------------------------------------------------------------- */
+
+static void usage(const char *prog) {
+    printf("Usage: %s [-p threads] [-n max_insts] [-o out_dir] [-j] [-M ram_size] [-e] [-u] [-m] image...\n", prog);
+    printf("       %s [-p threads] [-n max_insts] [-o out_dir] [-j] [-M ram_size] [-e] -F snapshot [-c copies | uart_input...]\n", prog);
+    printf("  -p  Number of worker threads (default: one per core)\n");
+    printf("  -n  Instruction budget per image (default %llu)\n", (unsigned long long)DEFAULT_MAX_INSTS);
+    printf("  -o  Write each image's UART output to out_dir/<image>.uart\n");
+    printf("  -j  Translate guest code into host code\n");
+    printf("  -M  RAM size in bytes, a multiple of 1K up to 256M (default 2K)\n");
+    printf("  -e  A fetch fault (HALTED) is not a failure, for programs that halt by\n");
+    printf("      jumping away\n");
+    printf("  -u  Images are UART input for the boot ROM (see rv_bootframe)\n");
+    printf("  -m  Print machine-readable CSV\n");
+    printf("  -F  Fork every job from the state saved in snapshot, one per\n");
+    printf("      UART input file\n");
+    printf("  -c  Number of forks to run without UART input (default 1)\n");
+}
+
+static double rv_Now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static int rv_QueuePopBack(rv_queue_t *queue, size_t *job) {
+    int found = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->back > queue->front) {
+        *job = queue->jobs[--queue->back];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return found;
+}
+
+static int rv_QueueStealFront(rv_queue_t *queue, size_t *job) {
+    int found = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->back > queue->front) {
+        *job = queue->jobs[queue->front++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return found;
+}
+
+static void rv_RunJob(rv_job_t *job) {
+    char tx_file[4096];
+
+    brv1e_opts_t opts = { 0 };
+    opts.direct_boot = !uart_input;
+    opts.jit = use_jit;
+    opts.ram_size = ram_size;
+    if (uart_input) {
+        opts.uart_rx_file = job->image;
+    }
+
+    if (out_dir != NULL) {
+        const char *base = strrchr(job->image, '/');
+        base = (base != NULL) ? base + 1 : job->image;
+        snprintf(tx_file, sizeof(tx_file), "%s/%s.uart", out_dir, base);
+        opts.uart_tx_file = tx_file;
+    }
+    else {
+        opts.uart_tx_discard = 1;
+    }
+
+    double start = rv_Now();
+
+    brv1e_ctx_t *ctx;
+    if (fork_parent != NULL) {
+        /* Forking writes the parent's shared snapshot the first time */
+        pthread_mutex_lock(&fork_lock);
+        ctx = BRV1E_Fork(fork_parent, &opts);
+        pthread_mutex_unlock(&fork_lock);
+    }
+    else {
+        ctx = BRV1E_Create(&opts);
+    }
+
+    if ((ctx == NULL) || ((fork_parent == NULL) && !uart_input && (BRV1E_Load(ctx, job->image) != 0))) {
+        job->result = JOB_ERROR;
+        BRV1E_Destroy(ctx);
+        return;
+    }
+
+    /* Forks carry the parent's counts, which are not this job's work */
+    uint64_t start_insts = BRV1E_GetInstCount(ctx);
+    uint64_t start_cycles = BRV1E_GetCycleCount(ctx);
+
+    brv1e_halt_t halt;
+    BRV1E_Step(ctx, max_insts);
+    BRV1E_GetHalt(ctx, &halt);
+
+    switch (halt.reason) {
+        case BRV1E_HALT_NONE:           job->result = JOB_TIMEOUT; break;
+        case BRV1E_HALT_FETCH_FAULT:    job->result = JOB_HALTED; break;
+        case BRV1E_HALT_EXIT:           job->result = (halt.exit_code == 0) ? JOB_EXITED : JOB_FAILED; break;
+        default:                        job->result = JOB_FAULT; break;
+    }
+    job->inst_cnt = BRV1E_GetInstCount(ctx) - start_insts;
+    job->cycle_cnt = BRV1E_GetCycleCount(ctx) - start_cycles;
+
+    BRV1E_Destroy(ctx);
+
+    job->seconds = rv_Now() - start;
+}
+
+static void *rv_WorkerThread(void *arg) {
+    rv_worker_t *worker = arg;
+    size_t job;
+
+    while (1) {
+        int found = rv_QueuePopBack(&queues[worker->idx], &job);
+
+        /* Steal, starting from the next worker so thieves spread out */
+        for (unsigned int offset = 1; !found && (offset < num_workers); ++offset) {
+            found = rv_QueueStealFront(&queues[(worker->idx + offset) % num_workers], &job);
+        }
+
+        /* No work is ever added, so empty queues mean everything is taken */
+        if (!found) {
+            break;
+        }
+
+        rv_RunJob(&jobs[job]);
+    }
+
+    return NULL;
+}
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *snapshot = NULL;
+    size_t num_copies = 1;
+    const char *size_error;
+    int opt;
+
+    num_workers = (num_cores > 0) ? (unsigned int)num_cores : 1U;
+
+    while ((opt = getopt(argc, argv, "p:n:o:jM:eumF:c:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                num_workers = (unsigned int)strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                max_insts = strtoull(optarg, NULL, 0);
+                break;
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'j':
+                use_jit = 1;
+                break;
+            case 'M':
+                size_error = BRV1E_ParseRAMSize(optarg, &ram_size);
+                if (size_error != NULL) {
+                    fprintf(stderr, "Invalid RAM size '%s': %s\n", optarg, size_error);
+                    return 1;
+                }
+                break;
+            case 'e':
+                fetch_fault_exits = 1;
+                break;
+            case 'u':
+                uart_input = 1;
+                break;
+            case 'm':
+                csv_output = 1;
+                break;
+            case 'F':
+                snapshot = optarg;
+                break;
+            case 'c':
+                num_copies = (size_t)strtoull(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    /* Forks without input files are numbered copies */
+    int fork_copies = (snapshot != NULL) && (optind == argc);
+    if (snapshot != NULL) {
+        uart_input = !fork_copies;
+    }
+
+    size_t num_jobs = fork_copies ? num_copies : (size_t)(argc - optind);
+    if ((num_jobs == 0) || (num_workers == 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (num_workers > num_jobs) {
+        num_workers = (unsigned int)num_jobs;
+    }
+
+    jobs = calloc(num_jobs, sizeof(rv_job_t));
+    queues = calloc(num_workers, sizeof(rv_queue_t));
+    rv_worker_t *workers = calloc(num_workers, sizeof(rv_worker_t));
+    if ((jobs == NULL) || (queues == NULL) || (workers == NULL)) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    /* Restore the state every job forks from */
+    char **fork_names = NULL;
+    if (snapshot != NULL) {
+        brv1e_opts_t parent_opts = { 0 };
+        parent_opts.uart_tx_discard = 1;
+        parent_opts.ram_size = ram_size;
+        fork_parent = BRV1E_Create(&parent_opts);
+        if ((fork_parent == NULL) || (BRV1E_Restore(fork_parent, snapshot) != 0)) {
+            printf("Could not restore %s\n", snapshot);
+            return 1;
+        }
+    }
+
+    /* Numbered copies name themselves after the snapshot */
+    if (fork_copies) {
+        fork_names = calloc(num_jobs, sizeof(char *));
+        for (size_t job = 0; (fork_names != NULL) && (job < num_jobs); ++job) {
+            size_t len = strlen(snapshot) + 24U;
+            fork_names[job] = malloc(len);
+            if (fork_names[job] == NULL) {
+                printf("Out of memory\n");
+                return 1;
+            }
+            snprintf(fork_names[job], len, "%s.%zu", snapshot, job);
+        }
+        if (fork_names == NULL) {
+            printf("Out of memory\n");
+            return 1;
+        }
+    }
+
+    /* Deal the images out round-robin */
+    for (unsigned int idx = 0; idx < num_workers; ++idx) {
+        queues[idx].jobs = calloc(num_jobs / num_workers + 1U, sizeof(size_t));
+        pthread_mutex_init(&queues[idx].lock, NULL);
+    }
+    for (size_t job = 0; job < num_jobs; ++job) {
+        rv_queue_t *queue = &queues[job % num_workers];
+        jobs[job].image = (fork_names != NULL) ? fork_names[job] : argv[optind + (int)job];
+        queue->jobs[queue->back++] = job;
+    }
+
+    double start = rv_Now();
+
+    for (unsigned int idx = 0; idx < num_workers; ++idx) {
+        workers[idx].idx = idx;
+        pthread_create(&workers[idx].thread_id, NULL, rv_WorkerThread, &workers[idx]);
+    }
+    for (unsigned int idx = 0; idx < num_workers; ++idx) {
+        pthread_join(workers[idx].thread_id, NULL);
+    }
+
+    double seconds = rv_Now() - start;
+
+    /* Report in the order the images were given */
+    static const char *const result_names[] = {
+        [JOB_ERROR] = "ERROR", [JOB_HALTED] = "HALTED", [JOB_EXITED] = "EXITED",
+        [JOB_FAILED] = "FAILED", [JOB_FAULT] = "FAULT", [JOB_TIMEOUT] = "TIMEOUT"
+    };
+
+    uint64_t total_insts = 0;
+    size_t failures = 0;
+
+    if (csv_output) {
+        printf("image,result,insts,cycles,seconds,mips\n");
+    }
+
+    for (size_t job = 0; job < num_jobs; ++job) {
+        if (csv_output) {
+            printf("%s,%s,%llu,%llu,%.6f,%.1f\n",
+                   jobs[job].image, result_names[jobs[job].result],
+                   (unsigned long long)jobs[job].inst_cnt,
+                   (unsigned long long)jobs[job].cycle_cnt, jobs[job].seconds,
+                   (jobs[job].seconds > 0) ? (double)jobs[job].inst_cnt / jobs[job].seconds / 1e6 : 0.0);
+        }
+        else {
+            printf("%-7s %12llu insts %12llu cycles %8.3f s  %s\n",
+                   result_names[jobs[job].result],
+                   (unsigned long long)jobs[job].inst_cnt,
+                   (unsigned long long)jobs[job].cycle_cnt,
+                   jobs[job].seconds, jobs[job].image);
+        }
+
+        total_insts += jobs[job].inst_cnt;
+        failures += (jobs[job].result != JOB_EXITED) &&
+                    ((jobs[job].result != JOB_HALTED) || !fetch_fault_exits);
+    }
+
+    if (!csv_output) {
+        printf("%zu images, %zu failed, %u threads, %.3f s, %.1f MIPS\n",
+               num_jobs, failures, num_workers, seconds,
+               (seconds > 0) ? (double)total_insts / seconds / 1e6 : 0.0);
+    }
+
+    for (unsigned int idx = 0; idx < num_workers; ++idx) {
+        pthread_mutex_destroy(&queues[idx].lock);
+        free(queues[idx].jobs);
+    }
+    free(workers);
+    free(queues);
+    free(jobs);
+
+    if (fork_names != NULL) {
+        for (size_t job = 0; job < num_jobs; ++job) {
+            free(fork_names[job]);
+        }
+        free(fork_names);
+    }
+    BRV1E_Destroy(fork_parent);
+
+    return (failures == 0) ? 0 : 1;
+}
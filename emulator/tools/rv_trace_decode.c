@@ -0,0 +1,171 @@
+/**
+ * @file    rv_trace_decode.c
+ * @brief   Converts a binary trace produced by the emulator into text
+ *
+ * @copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+/* ----------------------------------------------------------------------------
+ * Includes
+ * ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "trace.h"
+
+/* ----------------------------------------------------------------------------
+ * Private Symbolic Constants
+ * ------------------------------------------------------------------------- */
+
+#define MREGION_START_BOOT_ROM  (0x10000000U)
+#define MREGION_END_BOOT_ROM    (0x100000FFU)
+
+#define MREGION_START_UART      (0x30000000U)
+#define MREGION_END_UART        (0x30000007U)
+
+#define OPCODE_JAL              (0b1101111U)
+#define OPCODE_BRANCH           (0b1100011U)
+#define OPCODE_LOAD             (0b0000011U)
+
+#define RECORDS_PER_READ        (4096U)
+
+/* ----------------------------------------------------------------------------
+ * Private Macros
+ * ------------------------------------------------------------------------- */
+
+#define FIELD_OPCODE(i)         ((i) & 0b1111111U)
+#define FIELD_FUNCT3(i)         (((i) >> 12U) & 0b111U)
+
+/* Immediate value for B-type instructions */
+#define IMMEDIATE_B(i)  ((int32_t)( (((int32_t)(i) >> 20) & ~0b100000011111) | \
+                                    (((i) << 4) & 0x800) | \
+                                    (((i) >> 7) & 0b11110) ))
+
+/* Immediate value for J-type instructions */
+#define IMMEDIATE_J(i)  ((int32_t)( (((int32_t)(i) >> 20) & 0xFFF007FE) | \
+                                    ((i) & 0xFF000) | \
+                                    (((i) >> 9) & 0x800) ))
+
+/* ----------------------------------------------------------------------------
+ * Private Global Variables
+ * ------------------------------------------------------------------------- */
+
+static const char *branch_names[8] = {
+    "BEQ", "BNE", NULL, NULL, "BLT", "BGE", "BLTU", "BGEU"
+};
+
+static rv_trace_record_t records[RECORDS_PER_READ];
+
+/* ----------------------------------------------------------------------------
+ * Private Function Definitions
+ * ------------------------------------------------------------------------- */
+
+static void rv_PrintRecord(FILE *out, const rv_trace_record_t *rec) {
+    uint32_t i = rec->instruction;
+
+    fprintf(out, "Cnt: %2llu | Fetching from 0x%08x | ",
+            (unsigned long long)rec->inst_cnt, rec->pc);
+
+    if ((rec->pc >= MREGION_START_BOOT_ROM) && (rec->pc <= MREGION_END_BOOT_ROM)) {
+        fprintf(out, "BTRM idx %2d | ", (rec->pc >> 2) & 0b111111U);
+    }
+
+    if (rec->flags & RV_TRACE_FLAG_FETCH_EXCEPTION) {
+        fprintf(out, "Fetching from 0x%08x raised an access fault exception | \n", rec->pc);
+        return;
+    }
+
+    if ((i & 0b11U) != 0b11U) {
+        fprintf(out, "Instruction: 0x%04x (compressed) | \n", i);
+        return;
+    }
+
+    fprintf(out, "Instruction: 0x%08x | ", i);
+
+    switch (FIELD_OPCODE(i)) {
+        case OPCODE_JAL:
+            fprintf(out, "J immediate: %08x", IMMEDIATE_J(i));
+            break;
+
+        case OPCODE_BRANCH:
+            if (branch_names[FIELD_FUNCT3(i)] != NULL) {
+                fprintf(out, "%s | ", branch_names[FIELD_FUNCT3(i)]);
+            }
+            if (rec->next_pc != rec->pc + 4U) {
+                fprintf(out, "Taken with immediate %d | ", IMMEDIATE_B(i));
+            }
+            else {
+                fprintf(out, "Not taken | ");
+            }
+            break;
+
+        case OPCODE_LOAD:
+            fprintf(out, "Load from 0x%08x | ", rec->mem_addr);
+            if ((rec->flags & RV_TRACE_FLAG_LOAD) &&
+                (rec->mem_addr >= MREGION_START_UART) &&
+                (rec->mem_addr <= MREGION_END_UART)) {
+                fprintf(out, "0x%08X from UART | ", rec->mem_val);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    fprintf(out, "\n");
+}
+
+/* ----------------------------------------------------------------------------
+ * Public Function Definitions
+ * ------------------------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    if ((argc < 2) || (argc > 3)) {
+        printf("Usage: %s trace_file [output_file]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        printf("Could not open %s\n", argv[1]);
+        return 1;
+    }
+
+    FILE *out = (argc == 3) ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        printf("Could not open %s\n", argv[2]);
+        fclose(in);
+        return 1;
+    }
+
+    rv_trace_header_t header;
+    if ((fread(&header, sizeof(header), 1, in) != 1) ||
+        (memcmp(header.magic, RV_TRACE_MAGIC, sizeof(RV_TRACE_MAGIC)) != 0) ||
+        (header.version != RV_TRACE_VERSION) ||
+        (header.record_size != sizeof(rv_trace_record_t))) {
+        printf("%s is not a supported trace file\n", argv[1]);
+        fclose(in);
+        return 1;
+    }
+
+    fprintf(out, "Emulator started\n");
+
+    size_t nread;
+    while ((nread = fread(records, sizeof(rv_trace_record_t), RECORDS_PER_READ, in))) {
+        for (size_t idx = 0; idx < nread; ++idx) {
+            rv_PrintRecord(out, &records[idx]);
+        }
+    }
+
+    fprintf(out, "Exiting emulator\n");
+
+    fclose(in);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return 0;
+}
@@ -49,7 +49,9 @@ begin
 
   soc_inst : entity work.soc_top(arch)
     generic map (
-      CLK_FREQ_HZ => 100000000
+      CLK_FREQ_HZ     => 100000000,
+      RAM_ADDR_BITS   => 11,      -- 2 KB, the size ram.ld links for by default
+      CORE_PIPELINED  => false    -- true for the five stage pipelined core
     )
     port map (
       clk         => clk,
@@ -0,0 +1,365 @@
+--
+--  File:   core_compare_tb.vhd
+--  Brief:  Runs a program on core_top and core_pipelined side by side and
+--          compares their register writes and UART output
+--
+--  Copyright (C) 2023 Nick Chan
+--  See the LICENSE file at the root of the project for licensing info.
+--
+--  Note: Two SoCs, one with each core, are sent the same boot frame (see
+--  emulator/tools/rv_bootframe.c) over their UARTs, so the boot ROM loads
+--  and starts the program on both. From the jump to the program on, every
+--  register write each core retires is queued, and the queues are compared
+--  in order: the cores must write the same values to the same registers,
+--  however many cycles each takes. The bytes the two SoCs transmit are
+--  compared the same way and written to TX_FILE.
+--
+--  The boot ROM's polling loops are left out because they spin for as long
+--  as the UART makes them wait. For the same reason the program must not
+--  poll a peripheral or read cycle or time. It may read instret: each core's
+--  count when the program starts is taken off the values read, so the reads
+--  compare the instructions retired since.
+--
+--  The run passes once both SoCs have transmitted TX_BYTES bytes without a
+--  mismatch, and fails on a mismatch or after MAX_CYCLES cycles.
+--
+
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+use std.textio.all;
+use std.env.all;
+use work.soc_package.all;
+
+entity core_compare_tb is
+  generic (
+    FRAME_FILE  : string;                       -- Boot frame, a hex byte per line
+    TX_FILE     : string  := "tx.bin";          -- Where the transmitted bytes go
+    TX_BYTES    : integer := 10;                -- Bytes each SoC must transmit
+    MAX_CYCLES  : integer := 2000000
+  );
+end core_compare_tb;
+
+architecture sim of core_compare_tb is
+
+  -----------------------------------------------------------------------------
+  -- Constants
+  -----------------------------------------------------------------------------
+
+  constant CLK_PERIOD     : time    := 10 ns;
+
+  -- soc_top runs its UART at 9600 baud, so this makes a bit 10 cycles long
+  constant CLK_FREQ_HZ    : integer := 96000;
+  constant BIT_TIME       : time    := CLK_PERIOD * (CLK_FREQ_HZ / 9600);
+
+  -- How far one core's register writes may run ahead of the other's
+  constant TRACE_DEPTH    : integer := 4096;
+
+  -----------------------------------------------------------------------------
+  -- Types
+  -----------------------------------------------------------------------------
+
+  subtype byte_t is std_logic_vector(7 downto 0);
+  type byte_array_t is array(0 to TX_BYTES - 1) of byte_t;
+
+  -- A register write: rd and the value
+  subtype trace_entry_t is std_logic_vector(36 downto 0);
+  type trace_t is array(0 to TRACE_DEPTH - 1) of trace_entry_t;
+
+  -----------------------------------------------------------------------------
+  -- Functions
+  -----------------------------------------------------------------------------
+
+  -- csrr of instret or minstret
+  function reads_instret(instr : word_t) return boolean is
+  begin
+    return (instr(6 downto 0) = "1110011") AND (instr(14 downto 12) /= "000") AND
+           (instr(14 downto 12) /= "100") AND
+           ((instr(31 downto 20) = x"C02") OR (instr(31 downto 20) = x"B02"));
+  end function;
+
+  -----------------------------------------------------------------------------
+  -- Signals
+  -----------------------------------------------------------------------------
+
+  signal clk              : std_logic := '0';
+  signal rst_n            : std_logic := '0';
+  signal uart_rx          : std_logic := '1';
+
+  -- Index 0 is the SoC with core_top, 1 the one with core_pipelined
+  type sl_pair_t is array(0 to 1) of std_logic;
+  type tx_log_pair_t is array(0 to 1) of byte_array_t;
+  type count_pair_t is array(0 to 1) of natural;
+
+  signal uart_tx          : sl_pair_t;
+  signal tx_log           : tx_log_pair_t;
+  signal tx_count         : count_pair_t := (others => 0);
+
+  signal writes_compared  : natural := 0;
+
+begin
+
+  clk <= NOT clk after CLK_PERIOD / 2;
+
+  -----------------------------------------------------------------------------
+  -- The SoCs
+  -----------------------------------------------------------------------------
+
+  soc_single : entity work.soc_top(arch)
+    generic map (
+      CLK_FREQ_HZ     => CLK_FREQ_HZ,
+      CORE_PIPELINED  => false
+    )
+    port map (
+      clk             => clk,
+      clk_dbg         => clk,
+      rst_n           => rst_n,
+      uart_rx         => uart_rx,
+      uart_tx         => uart_tx(0),
+      gpio_in         => (others => '0'),
+      gpio_out        => open,
+      dbg_rs3_sel     => "00000",
+      dbg_rs3_val     => open,
+      dbg_curr_instr  => open,
+      dbg_imm         => open,
+      dbg_curr_pc     => open,
+      dbg_alu_result  => open,
+      dbg_ctrl_sigs   => open
+    );
+
+  soc_pipelined : entity work.soc_top(arch)
+    generic map (
+      CLK_FREQ_HZ     => CLK_FREQ_HZ,
+      CORE_PIPELINED  => true
+    )
+    port map (
+      clk             => clk,
+      clk_dbg         => clk,
+      rst_n           => rst_n,
+      uart_rx         => uart_rx,
+      uart_tx         => uart_tx(1),
+      gpio_in         => (others => '0'),
+      gpio_out        => open,
+      dbg_rs3_sel     => "00000",
+      dbg_rs3_val     => open,
+      dbg_curr_instr  => open,
+      dbg_imm         => open,
+      dbg_curr_pc     => open,
+      dbg_alu_result  => open,
+      dbg_ctrl_sigs   => open
+    );
+
+  -----------------------------------------------------------------------------
+  -- Stimulus: reset, then send the boot frame to both SoCs
+  -----------------------------------------------------------------------------
+
+  process
+    file frame      : text open read_mode is FRAME_FILE;
+    variable l      : line;
+    variable value  : byte_t;
+    variable good   : boolean;
+  begin
+    wait for CLK_PERIOD * 4;
+    rst_n <= '1';
+    wait for CLK_PERIOD * 16;
+
+    while NOT endfile(frame) loop
+      readline(frame, l);
+      hread(l, value, good);
+      if good then
+        -- Start bit, data bits from bit 0, stop bit
+        uart_rx <= '0';
+        wait for BIT_TIME;
+        for ii in 0 to 7 loop
+          uart_rx <= value(ii);
+          wait for BIT_TIME;
+        end loop;
+        uart_rx <= '1';
+        wait for BIT_TIME;
+      end if;
+    end loop;
+
+    wait;
+  end process;
+
+  -----------------------------------------------------------------------------
+  -- UART output
+  -----------------------------------------------------------------------------
+
+  gen_tx_monitor : for soc in 0 to 1 generate
+    process
+      variable value : byte_t;
+    begin
+      for ii in 0 to TX_BYTES - 1 loop
+        wait until falling_edge(uart_tx(soc)) AND (rst_n = '1');
+
+        -- Sample the middle of each data bit
+        wait for BIT_TIME + BIT_TIME / 2;
+        for bit_idx in 0 to 7 loop
+          value(bit_idx) := uart_tx(soc);
+          wait for BIT_TIME;
+        end loop;
+        assert uart_tx(soc) = '1' report "SoC " & integer'image(soc) & ": missing stop bit"
+          severity failure;
+
+        tx_log(soc)(ii) <= value;
+        tx_count(soc)   <= ii + 1;
+      end loop;
+
+      wait;
+    end process;
+  end generate;
+
+  -----------------------------------------------------------------------------
+  -- Register writes
+  -----------------------------------------------------------------------------
+
+  process
+    alias single_retire is
+      << signal .core_compare_tb.soc_single.gen_core_single_cycle.core_inst.retire : std_logic >>;
+    alias single_instr is
+      << signal .core_compare_tb.soc_single.gen_core_single_cycle.core_inst.instr : word_t >>;
+    alias single_ctrl is
+      << signal .core_compare_tb.soc_single.gen_core_single_cycle.core_inst.ctrl_bus : ctrl_bus_t >>;
+    alias single_rd_wd is
+      << signal .core_compare_tb.soc_single.gen_core_single_cycle.core_inst.rd_wd : word_t >>;
+    alias single_instret is
+      << signal .core_compare_tb.soc_single.gen_core_single_cycle.core_inst.core_csr_inst.instret_cnt :
+         unsigned(63 downto 0) >>;
+    alias single_imem_addr is
+      << signal .core_compare_tb.soc_single.imem_addr : word_t >>;
+
+    alias pipelined_stall_all is
+      << signal .core_compare_tb.soc_pipelined.gen_core_pipelined.core_inst.stall_all : std_logic >>;
+    alias pipelined_ex_retire is
+      << signal .core_compare_tb.soc_pipelined.gen_core_pipelined.core_inst.ex_retire : std_logic >>;
+    alias pipelined_ex_instr is
+      << signal .core_compare_tb.soc_pipelined.gen_core_pipelined.core_inst.ex_instr : word_t >>;
+    alias pipelined_wb_valid is
+      << signal .core_compare_tb.soc_pipelined.gen_core_pipelined.core_inst.wb_valid : std_logic >>;
+    alias pipelined_rd_we is
+      << signal .core_compare_tb.soc_pipelined.gen_core_pipelined.core_inst.wb_rd_we : std_logic >>;
+    alias pipelined_rd_sel is
+      << signal .core_compare_tb.soc_pipelined.gen_core_pipelined.core_inst.wb_rd_sel : rf_sel_t >>;
+    alias pipelined_rd_wd is
+      << signal .core_compare_tb.soc_pipelined.gen_core_pipelined.core_inst.wb_rd_wd : word_t >>;
+    alias pipelined_instret is
+      << signal .core_compare_tb.soc_pipelined.gen_core_pipelined.core_inst.core_csr_inst.instret_cnt :
+         unsigned(63 downto 0) >>;
+    alias pipelined_imem_addr is
+      << signal .core_compare_tb.soc_pipelined.imem_addr : word_t >>;
+
+    variable single_trace     : trace_t;
+    variable pipelined_trace  : trace_t;
+    variable single_count     : natural := 0;
+    variable pipelined_count  : natural := 0;
+    variable compared         : natural := 0;
+    variable single_started   : boolean := false;
+    variable pipelined_started: boolean := false;
+    variable single_base      : unsigned(31 downto 0) := (others => '0');
+    variable pipelined_base   : unsigned(31 downto 0) := (others => '0');
+    variable mem_reads_instret: boolean := false;   -- Follow instret reads down the pipeline
+    variable wb_reads_instret : boolean := false;
+    variable value            : unsigned(31 downto 0);
+    variable expected         : trace_entry_t;
+    variable actual           : trace_entry_t;
+  begin
+    wait until rising_edge(clk);
+
+    -- Signals still hold the values from before this edge, which are the
+    -- writes the register files take at it
+    if rst_n = '1' then
+      if single_started AND (single_retire = '1') AND (single_ctrl.rd_we = '1') AND
+         (single_ctrl.rd_sel /= "00000") then
+        value := unsigned(single_rd_wd);
+        if reads_instret(single_instr) then
+          value := value - single_base;
+        end if;
+        single_trace(single_count mod TRACE_DEPTH) := single_ctrl.rd_sel & std_logic_vector(value);
+        single_count := single_count + 1;
+      end if;
+
+      if pipelined_started AND (pipelined_wb_valid = '1') AND (pipelined_stall_all = '0') AND
+         (pipelined_rd_we = '1') AND (pipelined_rd_sel /= "00000") then
+        value := unsigned(pipelined_rd_wd);
+        if wb_reads_instret then
+          value := value - pipelined_base;
+        end if;
+        pipelined_trace(pipelined_count mod TRACE_DEPTH) := pipelined_rd_sel & std_logic_vector(value);
+        pipelined_count := pipelined_count + 1;
+      end if;
+
+      if pipelined_stall_all = '0' then
+        wb_reads_instret  := mem_reads_instret;
+        mem_reads_instret := (pipelined_ex_retire = '1') AND reads_instret(pipelined_ex_instr);
+      end if;
+
+      -- The boot ROM's last instructions write no registers, so tracing
+      -- can start at the first fetch from RAM. Both cores are retiring the
+      -- jump there, and have counted the same instructions before it if
+      -- they count alike.
+      if (NOT single_started) AND (unsigned(single_imem_addr) < unsigned(MREGION_BOOT_ROM)) then
+        single_started := true;
+        single_base    := single_instret(31 downto 0);
+      end if;
+      if (NOT pipelined_started) AND (unsigned(pipelined_imem_addr) < unsigned(MREGION_BOOT_ROM)) then
+        pipelined_started := true;
+        pipelined_base    := pipelined_instret(31 downto 0);
+      end if;
+    end if;
+
+    assert (single_count - compared < TRACE_DEPTH) AND (pipelined_count - compared < TRACE_DEPTH)
+      report "One core is more than " & integer'image(TRACE_DEPTH) & " register writes ahead"
+      severity failure;
+
+    while (compared < single_count) AND (compared < pipelined_count) loop
+      expected := single_trace(compared mod TRACE_DEPTH);
+      actual   := pipelined_trace(compared mod TRACE_DEPTH);
+      assert actual = expected
+        report "Register write " & integer'image(compared) & " differs: core_top wrote x" &
+               integer'image(to_integer(unsigned(expected(36 downto 32)))) & " = 0x" &
+               to_hstring(expected(31 downto 0)) & ", core_pipelined wrote x" &
+               integer'image(to_integer(unsigned(actual(36 downto 32)))) & " = 0x" &
+               to_hstring(actual(31 downto 0))
+        severity failure;
+      compared := compared + 1;
+    end loop;
+
+    writes_compared <= compared;
+  end process;
+
+  -----------------------------------------------------------------------------
+  -- Result
+  -----------------------------------------------------------------------------
+
+  process
+    type byte_file_t is file of character;
+    file tx_out     : byte_file_t;
+    variable msg    : line;
+  begin
+    wait until ((tx_count(0) = TX_BYTES) AND (tx_count(1) = TX_BYTES)) for CLK_PERIOD * MAX_CYCLES;
+
+    assert (tx_count(0) = TX_BYTES) AND (tx_count(1) = TX_BYTES)
+      report "Timed out: core_top sent " & integer'image(tx_count(0)) & " bytes, core_pipelined " &
+             integer'image(tx_count(1)) & " of " & integer'image(TX_BYTES)
+      severity failure;
+
+    file_open(tx_out, TX_FILE, write_mode);
+    for ii in 0 to TX_BYTES - 1 loop
+      assert tx_log(1)(ii) = tx_log(0)(ii)
+        report "UART byte " & integer'image(ii) & " differs: core_top sent 0x" &
+               to_hstring(tx_log(0)(ii)) & ", core_pipelined 0x" & to_hstring(tx_log(1)(ii))
+        severity failure;
+      write(tx_out, character'val(to_integer(unsigned(tx_log(0)(ii)))));
+    end loop;
+    file_close(tx_out);
+
+    assert writes_compared > 0 report "No register writes were traced" severity failure;
+
+    write(msg, string'("PASS: ") & integer'image(writes_compared) & " register writes and " &
+                integer'image(TX_BYTES) & " UART bytes match");
+    writeline(output, msg);
+    finish;
+  end process;
+
+end sim;
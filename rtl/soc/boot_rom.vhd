@@ -8,46 +8,98 @@
 
 library ieee;
 use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
 use work.soc_package.all;
 
 entity boot_rom is
   port (
     clk           : in  std_logic;
     rst_n         : in  std_logic;
-    boot_rom_addr : in  word_t;
+    boot_rom_addr : in  std_logic_vector(5 downto 0);  -- Word address
     boot_rom_do   : out word_t
   );
 end boot_rom;
 
 architecture arch of boot_rom is
 
-  constant boot_image: word_array_t(0 to 15) := (
-    x"300005b7",
-    x"00000613",
-    x"028000ef",
-    x"00050293",
-    x"020000ef",
+  -- bootloader/bootloader.S, padded with NOPs
+  constant boot_image: word_array_t(0 to 63) := (
+    x"30000437",
+    x"00000a13",
+    x"098000ef",
+    x"00050493",
+    x"090000ef",
+    x"00050913",
+    x"00000993",
+    x"0699f863",
+    x"0b4000ef",
+    x"07f57313",
+    x"00130313",
+    x"08057513",
+    x"02051063",
+    x"06c000ef",
+    x"00a9a023",
+    x"40a90933",
+    x"00498993",
+    x"fff30313",
+    x"fe0316e3",
+    x"fd1ff06f",
+    x"084000ef",
+    x"00050393",
+    x"07c000ef",
     x"00851513",
-    x"00a282b3",
-    x"014000ef",
-    x"00a60023",
-    x"00160613",
-    x"fe561ae3",
+    x"00a3e3b3",
+    x"00239393",
+    x"407983b3",
+    x"0003a503",
+    x"00a9a023",
+    x"40a90933",
+    x"00438393",
+    x"00498993",
+    x"fff30313",
+    x"fe0314e3",
+    x"f95ff06f",
+    x"00091463",
     x"00000067",
-    x"0015c503",
-    x"fe050ee3",
-    x"0005c503",
-    x"00008067"
+    x"02100513",
+    x"00a40123",
+    x"f6dff06f",
+    x"00000513",
+    x"00000e13",
+    x"02000e93",
+    x"000a1663",
+    x"00444a03",
+    x"fe0a0ee3",
+    x"fffa0a13",
+    x"00044f03",
+    x"01cf1f33",
+    x"01e56533",
+    x"008e0e13",
+    x"ffde10e3",
+    x"00008067",
+    x"000a1663",
+    x"00444a03",
+    x"fe0a0ee3",
+    x"fffa0a13",
+    x"00044503",
+    x"00008067",
+    x"00000013",
+    x"00000013",
+    x"00000013",
+    x"00000013",
+    x"00000013"
   );
 
-  signal rom_do_reg: word_t := x"00000013";
+  -- core_top executes the word at BOOT_ROM_BASE in its first cycle, so it
+  -- is already on the output out of reset
+  signal rom_do_reg: word_t := boot_image(0);
 
 begin
 
   process(clk, rst_n)
   begin
     if rst_n = '0' then
-      rom_do_reg <= x"00000013";
+      rom_do_reg <= boot_image(0);
     elsif rising_edge(clk) then
       rom_do_reg <= boot_image(to_integer(unsigned(boot_rom_addr)));
     end if;
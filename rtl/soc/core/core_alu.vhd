@@ -71,8 +71,8 @@ begin
     op1_plus_op2                      when "0000",  -- add
     op1_minus_op2                     when "1000",  -- sub
     shft_do                           when "0001",  -- sll
-    (0 => op1_lt_op2, others => '0')  when "1010",  -- slt
-    (0 => op1_ltu_op2, others => '0') when "1011",  -- sltu
+    (0 => op1_lt_op2, others => '0')  when "0010",  -- slt
+    (0 => op1_ltu_op2, others => '0') when "0011",  -- sltu
     alu_operand1 XOR alu_operand2     when "0100",  -- xor
     shft_do                           when "0101",  -- srl
     shft_do                           when "1101",  -- sra
@@ -36,9 +36,9 @@ begin
 
   op1_eq_op2 <= '1' when (sub_result = x"00000000") else '0';
 
-  op1_lt_op2 <= '0'; -- TODO
+  op1_lt_op2 <= '1' when (signed(cmp_operand1) < signed(cmp_operand2)) else '0';
 
-  op1_ltu_op2 <= '0'; -- TODO
+  op1_ltu_op2 <= '1' when (unsigned(cmp_operand1) < unsigned(cmp_operand2)) else '0';
 
   with cmp_opcode select cmp_result <=
     op1_eq_op2      when "000", -- EQ
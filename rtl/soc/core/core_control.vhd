@@ -7,6 +7,12 @@
 --
 --  Note: Doesn't detect illegal instrucitons (they will cause undefined behavior)
 --
+--  Interrupts are taken at the start of an instruction, never in the second
+--  cycle of a load or partway through a divide. The trap cycle jumps to the
+--  handler in place of executing the instruction, which is left for mret to
+--  return to. wfi holds the PC until an interrupt enabled in mie is pending,
+--  then retires, so the interrupt is taken on the instruction after it.
+--
 
 library ieee;
 use ieee.std_logic_1164.all;
@@ -17,6 +23,9 @@ entity core_control is
     clk               : in  std_logic;
     rst_n             : in  std_logic; -- FIXME use this
     instr             : in  word_t;
+    muldiv_stall      : in  std_logic;
+    irq               : in  std_logic; -- An interrupt should be taken
+    wake              : in  std_logic; -- An interrupt enabled in mie is pending
     ctrl_bus          : out ctrl_bus_t
   );
 end core_control;
@@ -25,30 +34,56 @@ architecture arch of core_control is
 
   signal stall  : std_logic;
   signal cycle  : std_logic := '0';
+  signal rd_we  : std_logic;
+  signal trap   : std_logic;
+  signal wfi    : std_logic;
+  signal mret   : std_logic;
+  signal div_cont : std_logic := '0'; -- A divide is past its first cycle
   
-  signal opcode : std_logic_vector(4 downto 0)  := instr(6 downto 2);
-  signal funct3 : std_logic_vector(2 downto 0)  := instr(14 downto 12);
-  signal funct7 : std_logic_vector(6 downto 0)  := instr(31 downto 25);
-  signal rs1    : std_logic_vector(4 downto 0)  := instr(19 downto 15);
-  signal rs2    : std_logic_vector(4 downto 0)  := instr(24 downto 20);
-  signal rd     : std_logic_vector(4 downto 0)  := instr(11 downto 7);
+  signal opcode : std_logic_vector(4 downto 0);
+  signal funct3 : std_logic_vector(2 downto 0);
+  signal funct7 : std_logic_vector(6 downto 0);
+  signal rs1    : std_logic_vector(4 downto 0);
+  signal rs2    : std_logic_vector(4 downto 0);
+  signal rd     : std_logic_vector(4 downto 0);
   
 begin
 
+  opcode <= instr(6 downto 2);
+  funct3 <= instr(14 downto 12);
+  funct7 <= instr(31 downto 25);
+  rs1    <= instr(19 downto 15);
+  rs2    <= instr(24 downto 20);
+  rd     <= instr(11 downto 7);
+
   stall <= '1' when (opcode = "00000") else '0';
 
   process(clk)
   begin
     if rising_edge(clk) then
-      if (cycle = '0') AND (stall = '1') then
+      if (cycle = '0') AND (stall = '1') AND (trap = '0') then
         cycle <= '1';
       else
         cycle <= '0';
       end if;
+      div_cont <= muldiv_stall;
     end if;
   end process;
 
-  ctrl_bus.pc_we <= '0' when ((cycle & stall) = "01") else '1';
+  wfi  <= '1' when (instr = x"10500073") else '0';
+  mret <= '1' when (instr = x"30200073") else '0';
+
+  trap <= irq AND NOT cycle AND NOT div_cont AND NOT wfi;
+
+  ctrl_bus.trap <= trap;
+  ctrl_bus.wfi  <= wfi;
+  ctrl_bus.mret <= mret AND NOT trap;
+
+  -- Divides stall until the multiply/divide unit has the result
+  ctrl_bus.pc_we <= '1' when (trap = '1') else
+                    '0' when (((cycle & stall) = "01") OR (muldiv_stall = '1') OR
+                              ((wfi = '1') AND (wake = '0'))) else
+                    '1';
 
   ctrl_bus.cmp_opcode <= funct3;
 
@@ -61,7 +96,7 @@ begin
   ctrl_bus.rs2_sel <= rs2;
   ctrl_bus.rd_sel  <= rd;
 
-  with opcode select ctrl_bus.rd_we <=
+  with opcode select rd_we <=
     '1' when "01100", -- OP
     '1' when "00100", -- OP-IMM
     '1' when "01101", -- lui
@@ -69,12 +104,16 @@ begin
     '1' when "00000", -- Loads
     '1' when "11011", -- jal
     '1' when "11001", -- jalr
+    '1' when "11100", -- CSR reads (rd is x0 for ecall/ebreak)
     '0' when others;
 
+  ctrl_bus.rd_we <= rd_we AND NOT muldiv_stall AND NOT trap;
+
   with opcode select ctrl_bus.rd_wd_sel <=
     "10" when "11011",  -- jal
     "10" when "11001",  -- jalr
     "01" when "00000",  -- Loads
+    "11" when "11100",  -- CSR reads
     "00" when others;
 
   with opcode select ctrl_bus.alu_opcode <=
@@ -97,11 +136,23 @@ begin
   -- Immediate is selected unless OP instruction
   ctrl_bus.alu_operand2_sel <= '0' when (opcode = "01100") else '1';
 
-  -- Data memory is enabled when opcode is load or store
-  ctrl_bus.dmem_en <= '1' when (opcode(4) & opcode(2 downto 0) = "0000") else '0';
+  -- Data memory is enabled when opcode is load or store. Loads only enable it
+  -- in their first cycle, so reads with side effects (the UART's rx_data)
+  -- happen once; the address is held for the second cycle.
+  ctrl_bus.dmem_en <= '1' when ((opcode(4) & opcode(2 downto 0) = "0000") AND (cycle = '0') AND
+                               (trap = '0')) else '0';
 
-  ctrl_bus.dmem_we <= opcode(3);
+  ctrl_bus.dmem_we <= opcode(3) AND NOT trap;
 
   ctrl_bus.dmem_dtype <= funct3;
+
+  -- RV32M instructions are OP with funct7 = 0000001
+  ctrl_bus.muldiv_en <= '1' when ((opcode = "01100") AND (funct7 = "0000001") AND (trap = '0')) else '0';
+
+  -- csrrw always writes. csrrs and csrrc only write when rs1 (or the
+  -- immediate) is not 0.
+  ctrl_bus.csr_we <= '1' when ((opcode = "11100") AND (funct3 /= "000") AND
+                               ((funct3(1 downto 0) = "01") OR (rs1 /= "00000")) AND
+                               (trap = '0')) else '0';
     
 end arch;
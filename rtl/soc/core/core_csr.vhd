@@ -0,0 +1,168 @@
+--
+--  File:   core_csr.vhd
+--  Brief:  Zicsr performance counters (cycle, time, instret) and machine-mode
+--          trap CSRs
+--
+--  Copyright (C) 2023 Nick Chan
+--  See the LICENSE file at the root of the project for licensing info.
+--
+--  Note: The counters are read-only and writes to them are ignored. time
+--  counts core clock cycles, like the timer peripheral. Reading a counter
+--  returns its value before the current instruction, which is what the
+--  emulator returns for the same one cycle per instruction (two per load,
+--  34 per divide) timing.
+--
+--  The trap CSRs are mstatus (MIE, MPIE; MPP reads as machine mode), mie
+--  (MTIE, MEIE), mtvec (direct or vectored), mscratch, mepc, mcause and mip,
+--  which shows the interrupt requests. Only the timer (cause 7) and the UART
+--  receiver (cause 11, taking priority) interrupt.
+--
+
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+use work.soc_package.all;
+
+entity core_csr is
+  port (
+    clk         : in  std_logic;
+    rst_n       : in  std_logic;
+    retire      : in  std_logic;                      -- An instruction retires this cycle
+    csr_addr    : in  std_logic_vector(11 downto 0);  -- CSR number
+    csr_rd      : out word_t;                         -- CSR read data
+    csr_we      : in  std_logic;                      -- Write the CSR this cycle
+    csr_op      : in  std_logic_vector(1 downto 0);   -- funct3(1:0): 01 write, 10 set, 11 clear
+    csr_wd      : in  word_t;                         -- rs1 or the zero-extended immediate
+
+    -- Interrupts
+    irq_timer   : in  std_logic;                      -- Machine timer interrupt request
+    irq_ext     : in  std_logic;                      -- Machine external interrupt request
+    trap        : in  std_logic;                      -- Take the interrupt this cycle
+    trap_pc     : in  word_t;                         -- PC of the interrupted instruction
+    mret        : in  std_logic;                      -- Return from the trap this cycle
+    irq         : out std_logic;                      -- An interrupt should be taken
+    wake        : out std_logic;                      -- An interrupt enabled in mie is pending
+    trap_vector : out word_t;                         -- Where the interrupt jumps to
+    mepc_val    : out word_t                          -- Where mret returns to
+  );
+end core_csr;
+
+architecture arch of core_csr is
+
+  signal cycle_cnt    : unsigned(63 downto 0) := (others => '0');
+  signal instret_cnt  : unsigned(63 downto 0) := (others => '0');
+
+  signal mstatus_mie  : std_logic := '0';
+  signal mstatus_mpie : std_logic := '0';
+  signal mie_mtie     : std_logic := '0';
+  signal mie_meie     : std_logic := '0';
+  signal mtvec        : word_t    := (others => '0');
+  signal mscratch     : word_t    := (others => '0');
+  signal mepc         : word_t    := (others => '0');
+  signal mcause       : word_t    := (others => '0');
+
+  signal mstatus      : word_t;
+  signal mie          : word_t;
+  signal mip          : word_t;
+  signal csr_val      : word_t;     -- Value before the write
+  signal csr_new      : word_t;     -- Value after the write
+  signal timer_en     : std_logic;  -- Pending and enabled
+  signal ext_en       : std_logic;
+  signal irq_cause    : std_logic_vector(3 downto 0);
+
+begin
+
+  process (clk, rst_n)
+  begin
+    if rst_n = '0' then
+      cycle_cnt   <= (others => '0');
+      instret_cnt <= (others => '0');
+    elsif rising_edge(clk) then
+      cycle_cnt <= cycle_cnt + 1;
+      if retire = '1' then
+        instret_cnt <= instret_cnt + 1;
+      end if;
+    end if;
+  end process;
+
+  process (clk, rst_n)
+  begin
+    if rst_n = '0' then
+      mstatus_mie   <= '0';
+      mstatus_mpie  <= '0';
+      mie_mtie      <= '0';
+      mie_meie      <= '0';
+    elsif rising_edge(clk) then
+      if trap = '1' then
+        mepc          <= trap_pc;
+        mcause        <= x"8000000" & irq_cause;
+        mstatus_mpie  <= mstatus_mie;
+        mstatus_mie   <= '0';
+      elsif mret = '1' then
+        mstatus_mie   <= mstatus_mpie;
+        mstatus_mpie  <= '1';
+      elsif csr_we = '1' then
+        case csr_addr is
+          when x"300" =>
+            mstatus_mie   <= csr_new(3);
+            mstatus_mpie  <= csr_new(7);
+          when x"304" =>
+            mie_mtie      <= csr_new(7);
+            mie_meie      <= csr_new(11);
+          when x"305" => mtvec    <= csr_new(31 downto 2) & '0' & csr_new(0);
+          when x"340" => mscratch <= csr_new;
+          when x"341" => mepc     <= csr_new(31 downto 1) & '0';
+          when x"342" => mcause   <= csr_new;
+          when others => null;
+        end case;
+      end if;
+    end if;
+  end process;
+
+  mstatus <= "0000000000000000000" & "11" & "000" & mstatus_mpie & "000" & mstatus_mie & "000";
+  mie     <= x"00000" & mie_meie & "000" & mie_mtie & "0000000";
+  mip     <= x"00000" & irq_ext & "000" & irq_timer & "0000000";
+
+  with csr_addr select csr_val <=
+    std_logic_vector(cycle_cnt(31 downto 0))    when x"C00", -- cycle
+    std_logic_vector(cycle_cnt(31 downto 0))    when x"C01", -- time
+    std_logic_vector(instret_cnt(31 downto 0))  when x"C02", -- instret
+    std_logic_vector(cycle_cnt(63 downto 32))   when x"C80", -- cycleh
+    std_logic_vector(cycle_cnt(63 downto 32))   when x"C81", -- timeh
+    std_logic_vector(instret_cnt(63 downto 32)) when x"C82", -- instreth
+    std_logic_vector(cycle_cnt(31 downto 0))    when x"B00", -- mcycle
+    std_logic_vector(instret_cnt(31 downto 0))  when x"B02", -- minstret
+    std_logic_vector(cycle_cnt(63 downto 32))   when x"B80", -- mcycleh
+    std_logic_vector(instret_cnt(63 downto 32)) when x"B82", -- minstreth
+    mstatus                                     when x"300", -- mstatus
+    mie                                         when x"304", -- mie
+    mtvec                                       when x"305", -- mtvec
+    mscratch                                    when x"340", -- mscratch
+    mepc                                        when x"341", -- mepc
+    mcause                                      when x"342", -- mcause
+    mip                                         when x"344", -- mip
+    (others => '0')                             when others;
+
+  csr_rd <= csr_val;
+
+  with csr_op select csr_new <=
+    csr_wd                    when "01",  -- csrrw
+    csr_val OR csr_wd         when "10",  -- csrrs
+    csr_val AND NOT csr_wd    when others; -- csrrc
+
+  timer_en  <= irq_timer AND mie_mtie;
+  ext_en    <= irq_ext AND mie_meie;
+
+  irq_cause <= x"B" when (ext_en = '1') else x"7";
+
+  irq   <= mstatus_mie AND (timer_en OR ext_en);
+  wake  <= timer_en OR ext_en;
+
+  -- Vectored mode jumps to base + 4 * cause
+  trap_vector <= std_logic_vector(unsigned(mtvec(31 downto 2) & "00") + unsigned(irq_cause & "00"))
+                   when (mtvec(0) = '1') else
+                 mtvec(31 downto 2) & "00";
+
+  mepc_val <= mepc;
+
+end arch;
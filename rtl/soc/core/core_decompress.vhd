@@ -0,0 +1,247 @@
+--
+--  File:   core_decompress.vhd
+--  Brief:  Expands RV32C compressed instructions
+--
+--  Copyright (C) 2023 Nick Chan
+--  See the LICENSE file at the root of the project for licensing info.
+--
+--  Note: The low 16 bits of a fetch whose bottom two bits are not "11" hold a
+--  compressed instruction. It is rewritten into the 32-bit instruction it
+--  stands for, so the rest of the core only ever decodes the base ISA. 32-bit
+--  instructions pass straight through. Reserved encodings and the floating
+--  point ones expand to all zeros, an illegal instruction.
+--
+
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+use work.soc_package.all;
+
+entity core_decompress is
+  port (
+    instr_in    : in  word_t;     -- Fetched instruction
+    instr_out   : out word_t;     -- 32-bit instruction to execute
+    compressed  : out std_logic   -- instr_in was 16 bits long
+  );
+end core_decompress;
+
+architecture arch of core_decompress is
+
+  constant OPCODE_LOAD    : std_logic_vector(6 downto 0) := "0000011";
+  constant OPCODE_OP_IMM  : std_logic_vector(6 downto 0) := "0010011";
+  constant OPCODE_STORE   : std_logic_vector(6 downto 0) := "0100011";
+  constant OPCODE_OP      : std_logic_vector(6 downto 0) := "0110011";
+  constant OPCODE_LUI     : std_logic_vector(6 downto 0) := "0110111";
+  constant OPCODE_BRANCH  : std_logic_vector(6 downto 0) := "1100011";
+  constant OPCODE_JALR    : std_logic_vector(6 downto 0) := "1100111";
+  constant OPCODE_JAL     : std_logic_vector(6 downto 0) := "1101111";
+  constant OPCODE_SYSTEM  : std_logic_vector(6 downto 0) := "1110011";
+
+  subtype reg_t is std_logic_vector(4 downto 0);
+  subtype funct3_t is std_logic_vector(2 downto 0);
+
+  constant X0 : reg_t := "00000";
+  constant X1 : reg_t := "00001";
+  constant X2 : reg_t := "00010";
+
+  function enc_r(rd : reg_t; funct3 : funct3_t; rs1 : reg_t; rs2 : reg_t;
+                 funct7 : std_logic_vector(6 downto 0)) return word_t is
+  begin
+    return funct7 & rs2 & rs1 & funct3 & rd & OPCODE_OP;
+  end function;
+
+  function enc_i(opcode : std_logic_vector(6 downto 0); rd : reg_t; funct3 : funct3_t;
+                 rs1 : reg_t; imm : std_logic_vector(11 downto 0)) return word_t is
+  begin
+    return imm & rs1 & funct3 & rd & opcode;
+  end function;
+
+  function enc_s(rs1 : reg_t; rs2 : reg_t; imm : std_logic_vector(11 downto 0)) return word_t is
+  begin
+    return imm(11 downto 5) & rs2 & rs1 & "010" & imm(4 downto 0) & OPCODE_STORE;
+  end function;
+
+  function enc_b(funct3 : funct3_t; rs1 : reg_t; imm : std_logic_vector(12 downto 0)) return word_t is
+  begin
+    return imm(12) & imm(10 downto 5) & X0 & rs1 & funct3 & imm(4 downto 1) & imm(11) &
+           OPCODE_BRANCH;
+  end function;
+
+  function enc_j(rd : reg_t; imm : std_logic_vector(20 downto 0)) return word_t is
+  begin
+    return imm(20) & imm(10 downto 1) & imm(11) & imm(19 downto 12) & rd & OPCODE_JAL;
+  end function;
+
+  signal c          : std_logic_vector(15 downto 0);
+  signal c_op       : std_logic_vector(4 downto 0);     -- Quadrant and funct3
+
+  signal rd         : reg_t;  -- Full register fields
+  signal rs2        : reg_t;
+  signal rs1_p      : reg_t;  -- Three bit register fields, x8 to x15
+  signal rs2_p      : reg_t;
+
+  signal imm6       : std_logic_vector(11 downto 0);  -- CI immediate
+  signal imm_j      : std_logic_vector(20 downto 0);  -- CJ offset
+  signal imm_b      : std_logic_vector(12 downto 0);  -- CB offset
+  signal imm_16sp   : std_logic_vector(11 downto 0);  -- c.addi16sp
+  signal imm_lui    : std_logic_vector(19 downto 0);  -- c.lui
+  signal imm_4spn   : std_logic_vector(11 downto 0);  -- c.addi4spn
+  signal imm_lw     : std_logic_vector(11 downto 0);  -- c.lw and c.sw
+  signal imm_lwsp   : std_logic_vector(11 downto 0);
+  signal imm_swsp   : std_logic_vector(11 downto 0);
+
+  signal expanded   : word_t;
+
+begin
+
+  c <= instr_in(15 downto 0);
+
+  rd    <= c(11 downto 7);
+  rs2   <= c(6 downto 2);
+  rs1_p <= "01" & c(9 downto 7);
+  rs2_p <= "01" & c(4 downto 2);
+
+  c_op <= c(1 downto 0) & c(15 downto 13);
+
+  imm6      <= std_logic_vector(resize(signed(c(12) & c(6 downto 2)), 12));
+  imm_j     <= std_logic_vector(resize(signed(c(12) & c(8) & c(10 downto 9) & c(6) & c(7) &
+                                              c(2) & c(11) & c(5 downto 3) & '0'), 21));
+  imm_b     <= std_logic_vector(resize(signed(c(12) & c(6 downto 5) & c(2) & c(11 downto 10) &
+                                              c(4 downto 3) & '0'), 13));
+  imm_16sp  <= std_logic_vector(resize(signed(c(12) & c(4 downto 3) & c(5) & c(2) & c(6) &
+                                              "0000"), 12));
+  imm_lui   <= std_logic_vector(resize(signed(c(12) & c(6 downto 2)), 20));
+  imm_4spn  <= "00" & c(10 downto 7) & c(12 downto 11) & c(5) & c(6) & "00";
+  imm_lw    <= "00000" & c(5) & c(12 downto 10) & c(6) & "00";
+  imm_lwsp  <= "0000" & c(3 downto 2) & c(12) & c(6 downto 4) & "00";
+  imm_swsp  <= "0000" & c(8 downto 7) & c(12 downto 9) & "00";
+
+  process (c, c_op, rd, rs2, rs1_p, rs2_p, imm6, imm_j, imm_b, imm_16sp, imm_lui, imm_4spn,
+           imm_lw, imm_lwsp, imm_swsp)
+  begin
+    expanded <= (others => '0');
+
+    case c_op is
+
+      -- c.addi4spn: addi rd', x2, nzuimm. All zeros is illegal.
+      when "00000" =>
+        if imm_4spn /= x"000" then
+          expanded <= enc_i(OPCODE_OP_IMM, rs2_p, "000", X2, imm_4spn);
+        end if;
+
+      -- c.lw: lw rd', uimm(rs1')
+      when "00010" =>
+        expanded <= enc_i(OPCODE_LOAD, rs2_p, "010", rs1_p, imm_lw);
+
+      -- c.sw: sw rs2', uimm(rs1')
+      when "00110" =>
+        expanded <= enc_s(rs1_p, rs2_p, imm_lw);
+
+      -- c.addi (c.nop when rd is x0): addi rd, rd, imm
+      when "01000" =>
+        expanded <= enc_i(OPCODE_OP_IMM, rd, "000", rd, imm6);
+
+      -- c.jal: jal x1, offset
+      when "01001" =>
+        expanded <= enc_j(X1, imm_j);
+
+      -- c.li: addi rd, x0, imm
+      when "01010" =>
+        expanded <= enc_i(OPCODE_OP_IMM, rd, "000", X0, imm6);
+
+      -- c.addi16sp: addi x2, x2, nzimm, or c.lui: lui rd, nzimm
+      when "01011" =>
+        if rd = X2 then
+          if imm_16sp /= x"000" then
+            expanded <= enc_i(OPCODE_OP_IMM, X2, "000", X2, imm_16sp);
+          end if;
+        elsif imm6 /= x"000" then
+          expanded <= imm_lui & rd & OPCODE_LUI;
+        end if;
+
+      when "01100" =>
+        case c(11 downto 10) is
+          -- c.srli, c.srai: srli/srai rd', rd', shamt. shamt(5) must be 0.
+          when "00" | "01" =>
+            if c(12) = '0' then
+              expanded <= enc_i(OPCODE_OP_IMM, rs1_p, "101", rs1_p,
+                                '0' & c(10) & "0000" & imm6(5 downto 0));
+            end if;
+
+          -- c.andi: andi rd', rd', imm
+          when "10" =>
+            expanded <= enc_i(OPCODE_OP_IMM, rs1_p, "111", rs1_p, imm6);
+
+          -- c.sub, c.xor, c.or, c.and: op rd', rd', rs2'
+          when others =>
+            if c(12) = '0' then
+              case c(6 downto 5) is
+                when "00"   => expanded <= enc_r(rs1_p, "000", rs1_p, rs2_p, "0100000");
+                when "01"   => expanded <= enc_r(rs1_p, "100", rs1_p, rs2_p, "0000000");
+                when "10"   => expanded <= enc_r(rs1_p, "110", rs1_p, rs2_p, "0000000");
+                when others => expanded <= enc_r(rs1_p, "111", rs1_p, rs2_p, "0000000");
+              end case;
+            end if;
+        end case;
+
+      -- c.j: jal x0, offset
+      when "01101" =>
+        expanded <= enc_j(X0, imm_j);
+
+      -- c.beqz: beq rs1', x0, offset
+      when "01110" =>
+        expanded <= enc_b("000", rs1_p, imm_b);
+
+      -- c.bnez: bne rs1', x0, offset
+      when "01111" =>
+        expanded <= enc_b("001", rs1_p, imm_b);
+
+      -- c.slli: slli rd, rd, shamt
+      when "10000" =>
+        if c(12) = '0' then
+          expanded <= enc_i(OPCODE_OP_IMM, rd, "001", rd, imm6);
+        end if;
+
+      -- c.lwsp: lw rd, uimm(x2)
+      when "10010" =>
+        if rd /= X0 then
+          expanded <= enc_i(OPCODE_LOAD, rd, "010", X2, imm_lwsp);
+        end if;
+
+      when "10100" =>
+        if c(12) = '0' then
+          if rs2 /= X0 then
+            -- c.mv: add rd, x0, rs2
+            expanded <= enc_r(rd, "000", X0, rs2, "0000000");
+          elsif rd /= X0 then
+            -- c.jr: jalr x0, 0(rs1)
+            expanded <= enc_i(OPCODE_JALR, X0, "000", rd, x"000");
+          end if;
+        else
+          if rs2 /= X0 then
+            -- c.add: add rd, rd, rs2
+            expanded <= enc_r(rd, "000", rd, rs2, "0000000");
+          elsif rd = X0 then
+            -- c.ebreak
+            expanded <= enc_i(OPCODE_SYSTEM, X0, "000", X0, x"001");
+          else
+            -- c.jalr: jalr x1, 0(rs1)
+            expanded <= enc_i(OPCODE_JALR, X1, "000", rd, x"000");
+          end if;
+        end if;
+
+      -- c.swsp: sw rs2, uimm(x2)
+      when "10110" =>
+        expanded <= enc_s(X2, rs2, imm_swsp);
+
+      when others =>
+        null;
+
+    end case;
+  end process;
+
+  compressed <= '0' when (instr_in(1 downto 0) = "11") else '1';
+
+  instr_out <= instr_in when (instr_in(1 downto 0) = "11") else expanded;
+
+end arch;
@@ -20,7 +20,7 @@ end core_imm_gen;
 architecture arch of core_imm_gen is
   
   -- The immediate sign bit is always stored in instr(31)
-  signal sign: std_logic := instr(31);
+  signal sign: std_logic;
   
   signal I: word_t;
   signal S: word_t;
@@ -29,6 +29,8 @@ architecture arch of core_imm_gen is
   signal J: word_t;
   
 begin
+
+  sign <= instr(31);
   
   -- I-immediate
   I(31 downto 12) <= (others => sign);
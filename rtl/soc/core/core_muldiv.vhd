@@ -0,0 +1,151 @@
+--
+--  File:   core_muldiv.vhd
+--  Brief:  RV32M multiply and divide unit
+--
+--  Copyright (C) 2023 Nick Chan
+--  See the LICENSE file at the root of the project for licensing info.
+--
+--  Note: Multiplies are a single 33x33 signed product, which synthesis maps
+--  onto DSP slices, and finish in the instruction's cycle. Divides use a
+--  restoring divider that produces one quotient bit per cycle: a cycle to
+--  load the operands, 32 to iterate and a cycle to write the result, 34 in
+--  all. muldiv_stall holds the PC until the result is ready, the same way
+--  loads are stalled. Division by zero and overflow give the results the
+--  ISA specifies instead of trapping.
+--
+
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+use work.soc_package.all;
+
+entity core_muldiv is
+  port (
+    clk           : in  std_logic;
+    rst_n         : in  std_logic;
+    muldiv_en     : in  std_logic;                    -- An M instruction is executing
+    funct3        : in  std_logic_vector(2 downto 0); -- Operation
+    operand1      : in  word_t;                       -- rs1
+    operand2      : in  word_t;                       -- rs2
+    muldiv_result : out word_t;
+    muldiv_stall  : out std_logic                     -- The result is not ready yet
+  );
+end core_muldiv;
+
+architecture arch of core_muldiv is
+
+  type div_state_t is (idle, busy, done);
+  signal div_state      : div_state_t := idle;
+
+  signal product        : signed(65 downto 0);
+  signal mul_operand1   : signed(32 downto 0);
+  signal mul_operand2   : signed(32 downto 0);
+
+  signal div_en         : std_logic;
+  signal div_count      : integer range 0 to 31 := 0;
+  signal div_divisor    : unsigned(31 downto 0) := (others => '0');
+  signal div_quotient   : unsigned(31 downto 0) := (others => '0');
+  signal div_remainder  : unsigned(31 downto 0) := (others => '0');
+  signal div_negate_q   : std_logic := '0';
+  signal div_negate_r   : std_logic := '0';
+  signal quotient       : word_t;
+  signal remainder      : word_t;
+
+begin
+
+  -- rs1 is unsigned for mulhu, rs2 is unsigned for mulhsu and mulhu
+  mul_operand1 <= signed((operand1(31) AND NOT (funct3(1) AND funct3(0))) & operand1);
+  mul_operand2 <= signed((operand2(31) AND NOT funct3(1)) & operand2);
+
+  product <= mul_operand1 * mul_operand2;
+
+  -- div, divu, rem and remu have funct3(2) set
+  div_en <= muldiv_en AND funct3(2);
+
+  divider : process (clk, rst_n)
+    variable partial : unsigned(32 downto 0);
+  begin
+    if rst_n = '0' then
+      div_state <= idle;
+    elsif rising_edge(clk) then
+      case div_state is
+
+        when idle =>
+
+          -- Divide magnitudes. divu and remu have funct3(0) set.
+          if div_en = '1' then
+            if (funct3(0) = '0') AND (operand1(31) = '1') then
+              div_quotient <= unsigned(-signed(operand1));
+            else
+              div_quotient <= unsigned(operand1);
+            end if;
+
+            if (funct3(0) = '0') AND (operand2(31) = '1') then
+              div_divisor <= unsigned(-signed(operand2));
+            else
+              div_divisor <= unsigned(operand2);
+            end if;
+
+            -- The quotient by zero is all ones whatever the dividend's sign
+            if (funct3(0) = '0') AND (operand2 /= x"00000000") then
+              div_negate_q <= operand1(31) XOR operand2(31);
+            else
+              div_negate_q <= '0';
+            end if;
+            div_negate_r  <= operand1(31) AND NOT funct3(0);
+
+            div_remainder <= (others => '0');
+            div_count     <= 0;
+            div_state     <= busy;
+          end if;
+
+        when busy =>
+
+          -- Shift the next dividend bit into the remainder and subtract the
+          -- divisor if it fits
+          partial := div_remainder & div_quotient(31);
+          if partial >= ('0' & div_divisor) then
+            partial := partial - ('0' & div_divisor);
+            div_quotient <= div_quotient(30 downto 0) & '1';
+          else
+            div_quotient <= div_quotient(30 downto 0) & '0';
+          end if;
+          div_remainder <= partial(31 downto 0);
+
+          if div_count = 31 then
+            div_state <= done;
+          else
+            div_count <= div_count + 1;
+          end if;
+
+        when done =>
+
+          -- The PC advances on this edge
+          div_state <= idle;
+
+        when others =>
+
+          div_state <= idle;
+
+      end case;
+    end if;
+  end process divider;
+
+  quotient  <= std_logic_vector(-signed(div_quotient)) when (div_negate_q = '1') else
+               std_logic_vector(div_quotient);
+  remainder <= std_logic_vector(-signed(div_remainder)) when (div_negate_r = '1') else
+               std_logic_vector(div_remainder);
+
+  muldiv_stall <= '1' when ((div_en = '1') AND (div_state /= done)) else '0';
+
+  with funct3 select muldiv_result <=
+    std_logic_vector(product(31 downto 0))  when "000", -- mul
+    std_logic_vector(product(63 downto 32)) when "001", -- mulh
+    std_logic_vector(product(63 downto 32)) when "010", -- mulhsu
+    std_logic_vector(product(63 downto 32)) when "011", -- mulhu
+    quotient                                when "100", -- div
+    quotient                                when "101", -- divu
+    remainder                               when "110", -- rem
+    remainder                               when others; -- remu
+
+end arch;
@@ -0,0 +1,494 @@
+--
+--  File:   core_pipelined.vhd
+--  Brief:  Five stage pipelined variant of the core
+--
+--  Copyright (C) 2023 Nick Chan
+--  See the LICENSE file at the root of the project for licensing info.
+--
+--  Note: A drop-in replacement for core_top, chosen by the CORE_PIPELINED
+--  generic of soc_top. The stages are:
+--
+--    IF   imem_addr is driven with the next fetch address. Instruction
+--         memory reads are synchronous, so the memory's output register is
+--         the IF/ID pipeline register.
+--    ID   Expand, decode and read the register file. Writes from WB are
+--         bypassed to the register reads.
+--    EX   ALU, branch compare, multiply/divide and CSR reads. Operands are
+--         forwarded from MEM and WB. Taken branches and jumps redirect the
+--         fetch and squash the one instruction in ID.
+--    MEM  Data memory access
+--    WB   Register file write
+--
+--  Data memory reads are synchronous, so a load spends two cycles in MEM, as
+--  it does on the single cycle core, and divides spend 34 cycles in EX. The
+--  whole pipeline holds while either is waiting, which keeps the memory and
+--  forwarding paths simple. An instruction that uses the result of the load
+--  right in front of it waits one cycle in ID.
+--
+--  Unlike core_top, the cycle counts also depend on the instruction order:
+--  each taken branch or jump and each load-use stall costs a cycle.
+--
+--  Interrupts are taken in EX: the instruction there and the one in ID are
+--  squashed and the fetch is redirected to the handler, while older
+--  instructions finish. mret redirects from EX like a jump. wfi waits in EX,
+--  holding IF and ID, until an interrupt enabled in mie is pending.
+--
+
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+use work.soc_package.all;
+
+entity core_pipelined is
+  port (
+    clk             : in  std_logic;
+    rst_n           : in  std_logic;
+
+    -- Data memory
+    dmem_en         : out std_logic;
+    dmem_addr       : out word_t;
+    dmem_dtype      : out std_logic_vector(2 downto 0);
+    dmem_wd         : out word_t;
+    dmem_we         : out std_logic;
+    dmem_do         : in  word_t;
+
+    -- Instruction memory
+    imem_addr       : out word_t;
+    imem_do         : in  word_t;
+
+    -- Interrupt requests
+    irq_timer       : in  std_logic;
+    irq_ext         : in  std_logic;
+
+    -- Debug
+    dbg_rs3_sel     : in  rf_sel_t;
+    dbg_rs3_val     : out word_t;
+    dbg_curr_instr  : out word_t;
+    dbg_imm         : out word_t;
+    dbg_curr_pc     : out word_t;
+    dbg_alu_result  : out word_t;
+    dbg_ctrl_sigs   : out word_t
+  );
+end core_pipelined;
+
+architecture arch of core_pipelined is
+
+  -----------------------------------------------------------------------------
+  -- Signals
+  -----------------------------------------------------------------------------
+
+  signal stall_all        : std_logic;  -- Hold every stage
+  signal load_use         : std_logic;  -- Hold IF and ID, bubble into EX
+  signal redirect         : std_logic;  -- Taken branch, jump or mret in EX
+  signal wfi_wait         : std_logic;  -- Hold IF, ID and EX, bubble into MEM
+  signal fetch_addr       : word_t;
+
+  -- ID
+  signal id_valid         : std_logic := '0';
+  signal id_pc            : word_t    := BOOT_ROM_BASE;
+  signal id_instr         : word_t;
+  signal id_compressed    : std_logic;
+  signal id_next_seq_pc   : word_t;
+  signal id_imm           : word_t;
+  signal id_ctrl          : ctrl_bus_t;
+  signal id_dmem_en       : std_logic;  -- Load or store
+  signal id_rf_rs1_val    : word_t;
+  signal id_rf_rs2_val    : word_t;
+  signal id_rs1_val       : word_t;
+  signal id_rs2_val       : word_t;
+
+  -- EX
+  signal ex_valid         : std_logic := '0';
+  signal ex_pc            : word_t;
+  signal ex_next_seq_pc   : word_t;
+  signal ex_instr         : word_t;
+  signal ex_imm           : word_t;
+  signal ex_ctrl          : ctrl_bus_t;
+  signal ex_rs1_val       : word_t;
+  signal ex_rs2_val       : word_t;
+  signal ex_rs1_fwd       : word_t;
+  signal ex_rs2_fwd       : word_t;
+  signal ex_alu_operand1  : word_t;
+  signal ex_alu_operand2  : word_t;
+  signal ex_alu_result    : word_t;
+  signal ex_branch_en     : std_logic;
+  signal ex_muldiv_en     : std_logic;
+  signal ex_muldiv_res    : word_t;
+  signal ex_muldiv_stall  : std_logic;
+  signal ex_op_result     : word_t;     -- ALU or multiply/divide result
+  signal ex_csr_rd        : word_t;
+  signal ex_csr_wd        : word_t;
+  signal ex_csr_we        : std_logic;
+  signal ex_mret          : std_logic;
+  signal ex_trap          : std_logic;  -- Take an interrupt in place of EX
+  signal ex_retire        : std_logic;  -- The instruction in EX moves on to MEM
+  signal ex_div_cont      : std_logic := '0'; -- A divide is past its first cycle
+  signal irq              : std_logic;
+  signal wake             : std_logic;
+  signal trap_vector      : word_t;
+  signal mepc_val         : word_t;
+  signal ex_result        : word_t;     -- rd write data, except for loads
+
+  -- MEM
+  signal mem_valid        : std_logic := '0';
+  signal mem_ctrl         : ctrl_bus_t;
+  signal mem_result       : word_t;     -- rd write data, or the address of a load or store
+  signal mem_addr         : word_t;
+  signal mem_wd           : word_t;
+  signal mem_issued       : std_logic := '0'; -- The access has been seen by the memory
+  signal mem_is_load      : std_logic;
+  signal mem_load_data    : word_t;     -- Load data taken while the pipeline is held
+  signal mem_load_held    : std_logic := '0';
+  signal mem_rd_wd        : word_t;
+  signal mem_load_wait    : std_logic;
+
+  -- WB
+  signal wb_valid         : std_logic := '0';
+  signal wb_rd_sel        : rf_sel_t;
+  signal wb_rd_we         : std_logic;
+  signal wb_rd_wd         : word_t;
+
+begin
+
+  -----------------------------------------------------------------------------
+  -- Hazards
+  -----------------------------------------------------------------------------
+
+  -- Loads wait a cycle for the synchronous memory and divides wait for the
+  -- divider
+  stall_all <= mem_load_wait OR ex_muldiv_stall;
+
+  -- The instruction in ID needs a load that is still in EX
+  load_use <=
+    '1' when ((ex_valid = '1') AND (ex_ctrl.rd_wd_sel = "01") AND (ex_ctrl.rd_sel /= "00000") AND
+              ((ex_ctrl.rd_sel = id_ctrl.rs1_sel) OR (ex_ctrl.rd_sel = id_ctrl.rs2_sel))) else
+    '0';
+
+  redirect <= ex_valid AND (ex_branch_en OR ex_ctrl.mret) AND NOT stall_all;
+
+  wfi_wait <= ex_valid AND ex_ctrl.wfi AND NOT wake;
+
+  -- Interrupts wait for a load in MEM and for a divide that has started.
+  -- wfi retires first, so the interrupt is taken on the instruction after
+  -- it.
+  ex_trap <= irq AND ex_valid AND NOT ex_ctrl.wfi AND NOT mem_load_wait AND NOT ex_div_cont;
+
+  -----------------------------------------------------------------------------
+  -- IF
+  -----------------------------------------------------------------------------
+
+  -- The address read now is the instruction in ID next cycle. ID is
+  -- refetched while it is held or still empty after reset. jalr clears bit 0
+  -- of its target.
+  fetch_addr <=
+    trap_vector     when (ex_trap = '1') else
+    mepc_val        when ((redirect = '1') AND (ex_ctrl.mret = '1')) else
+    ex_alu_result(31 downto 1) & '0' when (redirect = '1') else
+    id_pc           when ((stall_all = '1') OR (load_use = '1') OR (wfi_wait = '1') OR
+                          (id_valid = '0')) else
+    id_next_seq_pc;
+
+  imem_addr <= fetch_addr;
+
+  process (clk, rst_n)
+  begin
+    if rst_n = '0' then
+      id_valid <= '0';
+      id_pc    <= BOOT_ROM_BASE;
+    elsif rising_edge(clk) then
+      id_valid <= '1';
+      id_pc    <= fetch_addr;
+    end if;
+  end process;
+
+  -----------------------------------------------------------------------------
+  -- ID
+  -----------------------------------------------------------------------------
+
+  core_decompress_inst : entity work.core_decompress(arch)
+    port map (
+      instr_in    => imem_do,
+      instr_out   => id_instr,
+      compressed  => id_compressed
+    );
+
+  id_next_seq_pc <= std_logic_vector(unsigned(id_pc) + 2) when (id_compressed = '1') else
+                    std_logic_vector(unsigned(id_pc) + 4);
+
+  core_imm_gen_inst : entity work.core_imm_gen(arch)
+    port map (
+      instr => id_instr,
+      imm   => id_imm
+    );
+
+  -- Only the decoded fields are used. Stalls are handled here.
+  core_control_inst : entity work.core_control(arch)
+    port map (
+      clk           => clk,
+      rst_n         => rst_n,
+      instr         => id_instr,
+      muldiv_stall  => '0',
+      irq           => '0',
+      wake          => '1',
+      ctrl_bus      => id_ctrl
+    );
+
+  core_reg_file_inst : entity work.core_reg_file(arch)
+    port map (
+      clk     => clk,
+      rst_n   => rst_n,
+      rs1_sel => id_ctrl.rs1_sel,
+      rs2_sel => id_ctrl.rs2_sel,
+      rs1_val => id_rf_rs1_val,
+      rs2_val => id_rf_rs2_val,
+      rd_sel  => wb_rd_sel,
+      rd_we   => wb_rd_we,
+      rd_wd   => wb_rd_wd,
+      -- Debug
+      dbg_rs3_sel => dbg_rs3_sel,
+      dbg_rs3_val => dbg_rs3_val
+    );
+
+  -- core_control only enables loads in the first of their two cycles on
+  -- core_top, and an instruction can sit in ID for longer here
+  id_dmem_en <= '1' when (id_instr(6) & id_instr(4 downto 2) = "0000") else '0';
+
+  -- The register file is written at the end of WB, so a read in the same
+  -- cycle takes the value being written
+  id_rs1_val <= wb_rd_wd when ((wb_rd_we = '1') AND (wb_rd_sel = id_ctrl.rs1_sel) AND
+                               (wb_rd_sel /= "00000")) else
+                id_rf_rs1_val;
+  id_rs2_val <= wb_rd_wd when ((wb_rd_we = '1') AND (wb_rd_sel = id_ctrl.rs2_sel) AND
+                               (wb_rd_sel /= "00000")) else
+                id_rf_rs2_val;
+
+  -- ID/EX register
+  process (clk, rst_n)
+  begin
+    if rst_n = '0' then
+      ex_valid <= '0';
+    elsif rising_edge(clk) then
+      if (stall_all = '0') AND (wfi_wait = '0') then
+        if (redirect = '1') OR (load_use = '1') OR (ex_trap = '1') then
+          ex_valid <= '0';
+        else
+          ex_valid <= id_valid;
+        end if;
+        ex_pc           <= id_pc;
+        ex_next_seq_pc  <= id_next_seq_pc;
+        ex_instr        <= id_instr;
+        ex_imm          <= id_imm;
+        ex_ctrl         <= id_ctrl;
+        ex_ctrl.dmem_en <= id_dmem_en;
+        ex_rs1_val      <= id_rs1_val;
+        ex_rs2_val      <= id_rs2_val;
+      end if;
+    end if;
+  end process;
+
+  -----------------------------------------------------------------------------
+  -- EX
+  -----------------------------------------------------------------------------
+
+  -- Forward results that have not been written to the register file yet. A
+  -- load in MEM never needs forwarding, load_use keeps a bubble behind it.
+  ex_rs1_fwd <=
+    mem_result  when ((mem_valid = '1') AND (mem_ctrl.rd_we = '1') AND (mem_is_load = '0') AND
+                      (mem_ctrl.rd_sel = ex_ctrl.rs1_sel) AND (ex_ctrl.rs1_sel /= "00000")) else
+    wb_rd_wd    when ((wb_rd_we = '1') AND (wb_rd_sel = ex_ctrl.rs1_sel) AND
+                      (ex_ctrl.rs1_sel /= "00000")) else
+    ex_rs1_val;
+
+  ex_rs2_fwd <=
+    mem_result  when ((mem_valid = '1') AND (mem_ctrl.rd_we = '1') AND (mem_is_load = '0') AND
+                      (mem_ctrl.rd_sel = ex_ctrl.rs2_sel) AND (ex_ctrl.rs2_sel /= "00000")) else
+    wb_rd_wd    when ((wb_rd_we = '1') AND (wb_rd_sel = ex_ctrl.rs2_sel) AND
+                      (ex_ctrl.rs2_sel /= "00000")) else
+    ex_rs2_val;
+
+  -- ALU operand 1 source mux
+  with ex_ctrl.alu_operand1_sel select ex_alu_operand1 <=
+    ex_rs1_fwd  when "00",
+    ex_pc       when "01",
+    x"00000000" when others;
+
+  -- ALU operand 2 source mux
+  ex_alu_operand2 <= ex_rs2_fwd when (ex_ctrl.alu_operand2_sel = '0') else ex_imm;
+
+  core_alu_inst : entity work.core_alu(arch)
+    port map (
+      alu_operand1  => ex_alu_operand1,
+      alu_operand2  => ex_alu_operand2,
+      alu_opcode    => ex_ctrl.alu_opcode,
+      alu_result    => ex_alu_result
+    );
+
+  core_branch_alu_inst : entity work.core_branch_alu(arch)
+    port map (
+      cmp_operand1      => ex_rs1_fwd,
+      cmp_operand2      => ex_rs2_fwd,
+      cmp_opcode        => ex_ctrl.cmp_opcode,
+      cond_branch_en    => ex_ctrl.cond_branch_en,
+      uncond_branch_en  => ex_ctrl.uncond_branch_en,
+      branch_en         => ex_branch_en
+    );
+
+  ex_muldiv_en <= ex_valid AND ex_ctrl.muldiv_en AND NOT ex_trap;
+
+  process (clk, rst_n)
+  begin
+    if rst_n = '0' then
+      ex_div_cont <= '0';
+    elsif rising_edge(clk) then
+      ex_div_cont <= ex_muldiv_stall;
+    end if;
+  end process;
+
+  core_muldiv_inst : entity work.core_muldiv(arch)
+    port map (
+      clk           => clk,
+      rst_n         => rst_n,
+      muldiv_en     => ex_muldiv_en,
+      funct3        => ex_instr(14 downto 12),
+      operand1      => ex_rs1_fwd,
+      operand2      => ex_rs2_fwd,
+      muldiv_result => ex_muldiv_res,
+      muldiv_stall  => ex_muldiv_stall
+    );
+
+  -- An instruction retires when it leaves EX, since nothing squashes it
+  -- after that. instret then counts every older instruction when a CSR is
+  -- read in EX, as on core_top.
+  ex_retire <= ex_valid AND NOT wfi_wait AND NOT ex_trap AND NOT stall_all;
+
+  -- CSRs are written as the instruction leaves EX
+  ex_csr_we <= ex_valid AND ex_ctrl.csr_we AND NOT stall_all AND NOT ex_trap;
+  ex_mret   <= ex_valid AND ex_ctrl.mret AND NOT stall_all AND NOT ex_trap;
+
+  -- The immediate forms take rs1 as a 5-bit immediate
+  ex_csr_wd <= x"000000" & "000" & ex_instr(19 downto 15) when (ex_instr(14) = '1') else ex_rs1_fwd;
+
+  core_csr_inst : entity work.core_csr(arch)
+    port map (
+      clk         => clk,
+      rst_n       => rst_n,
+      retire      => ex_retire,
+      csr_addr    => ex_instr(31 downto 20),
+      csr_rd      => ex_csr_rd,
+      csr_we      => ex_csr_we,
+      csr_op      => ex_instr(13 downto 12),
+      csr_wd      => ex_csr_wd,
+      irq_timer   => irq_timer,
+      irq_ext     => irq_ext,
+      trap        => ex_trap,
+      trap_pc     => ex_pc,
+      mret        => ex_mret,
+      irq         => irq,
+      wake        => wake,
+      trap_vector => trap_vector,
+      mepc_val    => mepc_val
+    );
+
+  ex_op_result <= ex_muldiv_res when (ex_ctrl.muldiv_en = '1') else ex_alu_result;
+
+  -- rd write data source mux. Loads are filled in by MEM.
+  with ex_ctrl.rd_wd_sel select ex_result <=
+    ex_op_result    when "00",
+    ex_csr_rd       when "11",
+    ex_next_seq_pc  when "10",
+    ex_alu_result   when others;
+
+  -- EX/MEM register
+  process (clk, rst_n)
+  begin
+    if rst_n = '0' then
+      mem_valid <= '0';
+    elsif rising_edge(clk) then
+      if stall_all = '0' then
+        mem_valid   <= ex_valid AND NOT wfi_wait AND NOT ex_trap;
+        mem_ctrl    <= ex_ctrl;
+        mem_result  <= ex_result;
+        mem_addr    <= ex_alu_result;
+        mem_wd      <= ex_rs2_fwd;
+      end if;
+    end if;
+  end process;
+
+  -----------------------------------------------------------------------------
+  -- MEM
+  -----------------------------------------------------------------------------
+
+  mem_is_load <= '1' when (mem_ctrl.rd_wd_sel = "01") else '0';
+
+  -- The memory is given the access for at least one cycle before the load
+  -- data is taken
+  mem_load_wait <= mem_valid AND mem_is_load AND NOT mem_issued;
+
+  -- Load data is only valid in the cycle after the access, since the UART
+  -- moves on to its next byte. It is kept if the pipeline is still held.
+  process (clk, rst_n)
+  begin
+    if rst_n = '0' then
+      mem_issued    <= '0';
+      mem_load_held <= '0';
+    elsif rising_edge(clk) then
+      if stall_all = '0' then
+        mem_issued    <= '0';
+        mem_load_held <= '0';
+      elsif (mem_valid = '1') AND (mem_ctrl.dmem_en = '1') then
+        mem_issued <= '1';
+        if (mem_issued = '1') AND (mem_load_held = '0') then
+          mem_load_data <= dmem_do;
+          mem_load_held <= '1';
+        end if;
+      end if;
+    end if;
+  end process;
+
+  mem_rd_wd <=
+    mem_result    when (mem_is_load = '0') else
+    mem_load_data when (mem_load_held = '1') else
+    dmem_do;
+
+  -- Each access is issued once, even while the pipeline is held, like the
+  -- one cycle of dmem_en a load or store gets on core_top
+  dmem_en     <= mem_valid AND mem_ctrl.dmem_en AND NOT mem_issued;
+  dmem_addr   <= mem_addr;
+  dmem_dtype  <= mem_ctrl.dmem_dtype;
+  dmem_wd     <= mem_wd;
+  dmem_we     <= mem_valid AND mem_ctrl.dmem_en AND mem_ctrl.dmem_we AND NOT mem_issued;
+
+  -- MEM/WB register
+  process (clk, rst_n)
+  begin
+    if rst_n = '0' then
+      wb_valid <= '0';
+      wb_rd_we <= '0';
+    elsif rising_edge(clk) then
+      if stall_all = '0' then
+        wb_valid  <= mem_valid;
+        wb_rd_sel <= mem_ctrl.rd_sel;
+        wb_rd_we  <= mem_valid AND mem_ctrl.rd_we;
+        wb_rd_wd  <= mem_rd_wd;
+      end if;
+    end if;
+  end process;
+
+  -----------------------------------------------------------------------------
+  -- Debug
+  -----------------------------------------------------------------------------
+
+  -- The instruction in EX
+  dbg_curr_instr  <= ex_instr;
+  dbg_imm         <= ex_imm;
+  dbg_curr_pc     <= ex_pc;
+  dbg_alu_result  <= ex_alu_result;
+  dbg_ctrl_sigs   <=
+    x"000000" &
+    ex_ctrl.alu_opcode &
+    "0" &
+    ex_ctrl.uncond_branch_en &
+    ex_ctrl.cond_branch_en &
+    ex_branch_en;
+
+end arch;
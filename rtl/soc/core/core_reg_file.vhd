@@ -31,7 +31,9 @@ end core_reg_file;
 
 architecture arch of core_reg_file is
   
-  type reg_file_t is array(1 to 31) of word_t;
+  -- regs(0) is never written. It keeps the read muxes in range while the
+  -- selects are still unknown at the start of a simulation.
+  type reg_file_t is array(0 to 31) of word_t;
   
   signal regs: reg_file_t;
   
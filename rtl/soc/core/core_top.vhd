@@ -28,6 +28,10 @@ entity core_top is
     imem_addr       : out word_t;
     imem_do         : in  word_t;
 
+    -- Interrupt requests
+    irq_timer       : in  std_logic;
+    irq_ext         : in  std_logic;
+
     -- Debug
     dbg_rs3_sel     : in  rf_sel_t;
     dbg_rs3_val     : out word_t;
@@ -41,7 +45,8 @@ end core_top;
 
 architecture arch of core_top is
   
-  signal instr        : word_t  := imem_do;
+  signal instr        : word_t;     -- Instruction, expanded if compressed
+  signal compressed   : std_logic;  -- instr was a 16-bit instruction
 
   signal imm          : word_t;     -- Immediate value
 
@@ -56,11 +61,24 @@ architecture arch of core_top is
   signal rs1_val      : word_t;     -- rs1 value
   signal rs2_val      : word_t;     -- rs2 value
   signal rd_wd        : word_t;     -- rd write data
+  signal rd_we        : std_logic;  -- rd write enable
 
   signal alu_operand1 : word_t;     -- ALU operand 1
   signal alu_operand2 : word_t;     -- ALU operand 2
   signal alu_result   : word_t;     -- ALU result
 
+  signal csr_rd       : word_t;     -- CSR read data
+  signal csr_wd       : word_t;     -- CSR write source
+  signal retire       : std_logic;  -- The instruction retires this cycle
+  signal irq          : std_logic;  -- An interrupt should be taken
+  signal wake         : std_logic;  -- An interrupt enabled in mie is pending
+  signal trap_vector  : word_t;     -- Interrupt handler address
+  signal mepc_val     : word_t;     -- mret return address
+
+  signal muldiv_res   : word_t;     -- Multiply/divide result
+  signal muldiv_stall : std_logic;  -- Divide in progress
+  signal op_result    : word_t;     -- ALU or multiply/divide result
+
 begin
   
   -- Program counter register
@@ -73,6 +91,13 @@ begin
     end if;
   end process;
 
+  core_decompress_inst : entity work.core_decompress(arch)
+    port map (
+      instr_in    => imem_do,
+      instr_out   => instr,
+      compressed  => compressed
+    );
+
   core_imm_gen_inst : entity work.core_imm_gen(arch)
     port map (
       instr => instr,
@@ -98,7 +123,7 @@ begin
       rs1_val => rs1_val,
       rs2_val => rs2_val,
       rd_sel  => ctrl_bus.rd_sel,
-      rd_we   => ctrl_bus.rd_we,
+      rd_we   => rd_we,
       rd_wd   => rd_wd,
       -- Debug
       dbg_rs3_sel => dbg_rs3_sel,
@@ -113,18 +138,70 @@ begin
       alu_result    => alu_result
     );
 
-  next_seq_pc <= std_logic_vector(unsigned(pc_val) + 4);
+  core_muldiv_inst : entity work.core_muldiv(arch)
+    port map (
+      clk           => clk,
+      rst_n         => rst_n,
+      muldiv_en     => ctrl_bus.muldiv_en,
+      funct3        => instr(14 downto 12),
+      operand1      => rs1_val,
+      operand2      => rs2_val,
+      muldiv_result => muldiv_res,
+      muldiv_stall  => muldiv_stall
+    );
+
+  -- An instruction retires whenever the PC advances, except to take an
+  -- interrupt
+  retire <= ctrl_bus.pc_we AND NOT ctrl_bus.trap;
+
+  -- rd is written as the instruction retires, so a load whose rd is its base
+  -- register keeps its address for its second cycle
+  rd_we <= ctrl_bus.rd_we AND ctrl_bus.pc_we;
+
+  -- The immediate forms take rs1 as a 5-bit immediate
+  csr_wd <= x"000000" & "000" & instr(19 downto 15) when (instr(14) = '1') else rs1_val;
+
+  core_csr_inst : entity work.core_csr(arch)
+    port map (
+      clk         => clk,
+      rst_n       => rst_n,
+      retire      => retire,
+      csr_addr    => instr(31 downto 20),
+      csr_rd      => csr_rd,
+      csr_we      => ctrl_bus.csr_we,
+      csr_op      => instr(13 downto 12),
+      csr_wd      => csr_wd,
+      irq_timer   => irq_timer,
+      irq_ext     => irq_ext,
+      trap        => ctrl_bus.trap,
+      trap_pc     => pc_val,
+      mret        => ctrl_bus.mret,
+      irq         => irq,
+      wake        => wake,
+      trap_vector => trap_vector,
+      mepc_val    => mepc_val
+    );
+
+  next_seq_pc <= std_logic_vector(unsigned(pc_val) + 2) when (compressed = '1') else
+                 std_logic_vector(unsigned(pc_val) + 4);
   
   core_control_inst : entity work.core_control(arch)
     port map (
-      clk       => clk,
-      rst_n     => rst_n,
-      instr     => instr,
-      ctrl_bus  => ctrl_bus
+      clk           => clk,
+      rst_n         => rst_n,
+      instr         => instr,
+      muldiv_stall  => muldiv_stall,
+      irq           => irq,
+      wake          => wake,
+      ctrl_bus      => ctrl_bus
     );
   
-  -- Program counter write data source mux
-  next_pc <= next_seq_pc when (branch_en = '0') else alu_result;
+  -- Program counter write data source mux. jalr clears bit 0 of its target;
+  -- branch and jal targets are even already.
+  next_pc <= trap_vector  when (ctrl_bus.trap = '1') else
+             mepc_val     when (ctrl_bus.mret = '1') else
+             next_seq_pc  when (branch_en = '0') else
+             alu_result(31 downto 1) & '0';
 
   -- ALU operand 1 source mux
   with ctrl_bus.alu_operand1_sel select alu_operand1 <=
@@ -135,10 +212,13 @@ begin
   -- ALU operand 2 source mux
   alu_operand2 <= rs2_val when (ctrl_bus.alu_operand2_sel = '0') else imm;
   
+  op_result <= muldiv_res when (ctrl_bus.muldiv_en = '1') else alu_result;
+
   -- rd write data source mux
   with ctrl_bus.rd_wd_sel select rd_wd <=
-    alu_result  when "00",
+    op_result   when "00",
     dmem_do     when "01",
+    csr_rd      when "11",
     next_seq_pc when others;
   
   dmem_en     <= ctrl_bus.dmem_en;
@@ -0,0 +1,215 @@
+--
+--  File:   dma.vhd
+--  Brief:  DMA engine for filling and copying RAM and receiving from the UART
+--
+--  Copyright (C) 2023 Nick Chan
+--  See the LICENSE file at the root of the project for licensing info.
+--
+--  Note: Writing a command to ctrl starts a transfer of len bytes using the
+--  other registers. Registers, each a word:
+--
+--    0x00  src     Copy source address
+--    0x04  dst     Destination address
+--    0x08  len     Bytes to transfer
+--    0x0C  fill    Word stored by a fill
+--    0x10  ctrl    Write: 1 fill, 2 copy, 3 receive from the UART
+--                  Read:  bit 0 busy, bit 1 error
+--
+--  Fills and copies move whole words, so their addresses and len must be
+--  multiples of 4. A fill stores a word per cycle and a copy a word every two
+--  cycles. A UART transfer stores each byte as it is received. A transfer
+--  that is misaligned or leaves RAM sets error instead of starting. While
+--  busy, the DMA owns RAM port 1 and the UART, so the core must only poll
+--  ctrl until the transfer is done.
+--
+
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+use work.soc_package.all;
+
+entity dma is
+  generic (
+    RAM_ADDR_BITS   : in  integer
+  );
+  port (
+    clk             : in  std_logic;
+    rst_n           : in  std_logic;
+
+    -- Registers
+    dma_addr        : in  std_logic_vector(2 downto 0); -- Word offset
+    dma_en          : in  std_logic;
+    dma_wd          : in  word_t;
+    dma_we          : in  std_logic;
+    dma_do          : out word_t;
+    dma_busy        : out std_logic;
+
+    -- RAM port 1, used while busy
+    dma_ram_addr    : out word_t;
+    dma_ram_dtype   : out std_logic_vector(2 downto 0);
+    dma_ram_wd      : out word_t;
+    dma_ram_we      : out std_logic;
+    dma_ram_do      : in  word_t;
+
+    -- UART receiver, used while busy
+    dma_uart_en     : out std_logic;  -- Pops rx_data
+    dma_uart_do     : in  std_logic_vector(7 downto 0);
+    uart_rx_ready   : in  std_logic
+  );
+end dma;
+
+architecture arch of dma is
+
+  constant CMD_FILL     : word_t := x"00000001";
+  constant CMD_COPY     : word_t := x"00000002";
+  constant CMD_UART_RX  : word_t := x"00000003";
+
+  constant DTYPE_BYTE   : std_logic_vector(2 downto 0) := "000";
+  constant DTYPE_WORD   : std_logic_vector(2 downto 0) := "010";
+
+  type dma_state_t is (idle, fill, copy_read, copy_write, rx_wait, rx_store);
+
+  signal dma_state      : dma_state_t := idle;
+
+  signal src            : unsigned(31 downto 0) := (others => '0');
+  signal dst            : unsigned(31 downto 0) := (others => '0');
+  signal len            : unsigned(31 downto 0) := (others => '0');
+  signal fill_word      : word_t := (others => '0');
+  signal dma_error      : std_logic := '0';
+  signal busy           : std_logic;
+
+  signal starting       : std_logic;
+  signal aligned        : std_logic;  -- src, dst and len are word multiples
+  signal src_in_ram     : std_logic;  -- src to src + len is inside RAM
+  signal dst_in_ram     : std_logic;
+  signal last           : std_logic;  -- The current word or byte is the last one
+
+  function in_ram(addr : unsigned(31 downto 0); len : unsigned(31 downto 0)) return std_logic is
+  begin
+    if (resize(addr, 33) + resize(len, 33)) <= to_unsigned(2 ** RAM_ADDR_BITS, 33) then
+      return '1';
+    else
+      return '0';
+    end if;
+  end function;
+
+begin
+
+  starting <= dma_en AND dma_we when ((dma_addr = "100") AND (dma_state = idle)) else '0';
+
+  aligned <= NOT (src(1) OR src(0) OR dst(1) OR dst(0) OR len(1) OR len(0));
+
+  src_in_ram <= in_ram(src, len);
+  dst_in_ram <= in_ram(dst, len);
+
+  last <= '1' when ((dma_state = rx_store) AND (len = 1)) OR
+                   ((dma_state /= rx_store) AND (len = 4)) else '0';
+
+  process (clk, rst_n)
+  begin
+    if rst_n = '0' then
+      dma_state <= idle;
+      dma_error <= '0';
+    elsif rising_edge(clk) then
+      case dma_state is
+
+        when idle =>
+
+          if (dma_en = '1') AND (dma_we = '1') then
+            case dma_addr is
+              when "000"  => src       <= unsigned(dma_wd);
+              when "001"  => dst       <= unsigned(dma_wd);
+              when "010"  => len       <= unsigned(dma_wd);
+              when "011"  => fill_word <= dma_wd;
+              when others => null;
+            end case;
+          end if;
+
+          if starting = '1' then
+            dma_error <= '0';
+            if len /= 0 then
+              if (dma_wd = CMD_FILL) AND (aligned = '1') AND (dst_in_ram = '1') then
+                dma_state <= fill;
+              elsif (dma_wd = CMD_COPY) AND (aligned = '1') AND (src_in_ram = '1') AND
+                    (dst_in_ram = '1') then
+                dma_state <= copy_read;
+              elsif (dma_wd = CMD_UART_RX) AND (dst_in_ram = '1') then
+                dma_state <= rx_wait;
+              else
+                dma_error <= '1';
+              end if;
+            end if;
+          end if;
+
+        when fill =>
+
+          dst <= dst + 4;
+          len <= len - 4;
+          if last = '1' then
+            dma_state <= idle;
+          end if;
+
+        -- RAM reads are synchronous, so the word read here is written next
+        when copy_read =>
+
+          src       <= src + 4;
+          dma_state <= copy_write;
+
+        when copy_write =>
+
+          dst <= dst + 4;
+          len <= len - 4;
+          if last = '1' then
+            dma_state <= idle;
+          else
+            dma_state <= copy_read;
+          end if;
+
+        -- The UART's output is registered, so the byte popped here is stored
+        -- next
+        when rx_wait =>
+
+          if uart_rx_ready = '1' then
+            dma_state <= rx_store;
+          end if;
+
+        when rx_store =>
+
+          dst <= dst + 1;
+          len <= len - 1;
+          if last = '1' then
+            dma_state <= idle;
+          else
+            dma_state <= rx_wait;
+          end if;
+
+      end case;
+    end if;
+  end process;
+
+  busy     <= '0' when (dma_state = idle) else '1';
+  dma_busy <= busy;
+
+  with dma_addr select dma_do <=
+    std_logic_vector(src)                 when "000",
+    std_logic_vector(dst)                 when "001",
+    std_logic_vector(len)                 when "010",
+    fill_word                             when "011",
+    x"0000000" & "00" & dma_error & busy  when "100",
+    (others => '0')                       when others;
+
+  dma_ram_addr  <= std_logic_vector(src) when (dma_state = copy_read) else std_logic_vector(dst);
+  dma_ram_dtype <= DTYPE_BYTE when (dma_state = rx_store) else DTYPE_WORD;
+
+  -- A byte is written to every lane, so it lands whatever its address
+  dma_ram_wd <=
+    fill_word                                                 when (dma_state = fill) else
+    dma_ram_do                                                when (dma_state = copy_write) else
+    dma_uart_do & dma_uart_do & dma_uart_do & dma_uart_do;
+
+  dma_ram_we <= '1' when ((dma_state = fill) OR (dma_state = copy_write) OR
+                          (dma_state = rx_store)) else '0';
+
+  dma_uart_en <= uart_rx_ready when (dma_state = rx_wait) else '0';
+
+end arch;
@@ -16,6 +16,9 @@ entity mem_controller is
     RAM_ADDR_BITS   : in  integer
   );
   port (
+    clk             : in  std_logic;
+    rst_n           : in  std_logic;
+
     -- Data memory
     dmem_en         : in  std_logic;
     dmem_addr       : in  word_t;
@@ -38,18 +41,36 @@ entity mem_controller is
     ram_port2_do    : in  word_t;
     
     -- Boot ROM
-    boot_rom_addr   : out std_logic_vector(4 downto 0);
+    boot_rom_addr   : out std_logic_vector(5 downto 0);
     boot_rom_do     : in  word_t;
 
     -- Timer
-    timer_val       : in  word_t;
+    timer_addr      : out std_logic_vector(1 downto 0);
+    timer_wd        : out word_t;
+    timer_we        : out std_logic;
+    timer_do        : in  word_t;
 
     -- UART
-    uart_addr       : out std_logic_vector(1 downto 0);
+    uart_addr       : out std_logic_vector(2 downto 0);
     uart_en         : out std_logic;
     uart_wd         : out std_logic_vector(7 downto 0);
     uart_we         : out std_logic;
-    uart_do         : in  std_logic_vector(7 downto 0)
+    uart_do         : in  std_logic_vector(7 downto 0);
+
+    -- DMA registers
+    dma_addr        : out std_logic_vector(2 downto 0);
+    dma_en          : out std_logic;
+    dma_wd          : out word_t;
+    dma_we          : out std_logic;
+    dma_do          : in  word_t;
+
+    -- DMA transfers, which take over RAM port 1 and the UART while busy
+    dma_busy        : in  std_logic;
+    dma_ram_addr    : in  word_t;
+    dma_ram_dtype   : in  std_logic_vector(2 downto 0);
+    dma_ram_wd      : in  word_t;
+    dma_ram_we      : in  std_logic;
+    dma_uart_en     : in  std_logic
   );
 end mem_controller;
 
@@ -58,6 +79,7 @@ architecture arch of mem_controller is
   signal dmem_is_ram_access       : std_logic;
   signal dmem_is_timer_access     : std_logic;
   signal dmem_is_uart_access      : std_logic;
+  signal dmem_is_dma_access       : std_logic;
 
   signal dmem_invalid_address     : std_logic;
   signal dmem_misaligned_access   : std_logic;
@@ -69,6 +91,7 @@ architecture arch of mem_controller is
   signal imem_invalid_address     : std_logic;
   signal imem_misaligned_access   : std_logic;
   signal imem_invalid_access      : std_logic;
+  signal imem_region_reg          : std_logic_vector(3 downto 0);
   
 begin
 
@@ -83,11 +106,14 @@ begin
     end if;
   end process;
 
-  dmem_is_timer_access <= '1' when (dmem_addr = x"20000000") else '0';
+  dmem_is_timer_access <= '1' when ((dmem_addr AND x"FFFFFFF0") = x"20000000") else '0';
+
+  dmem_is_uart_access <= '1' when ((dmem_addr AND x"FFFFFFF8") = x"30000000") else '0';
 
-  dmem_is_uart_access <= '1' when ((dmem_addr AND x"FFFFFFFC") = x"30000000") else '0';
+  dmem_is_dma_access <= '1' when ((dmem_addr AND x"FFFFFFE0") = x"40000000") else '0';
 
-  dmem_invalid_address <= NOT (dmem_is_ram_access OR dmem_is_timer_access OR dmem_is_uart_access);
+  dmem_invalid_address <= NOT (dmem_is_ram_access OR dmem_is_timer_access OR dmem_is_uart_access OR
+                               dmem_is_dma_access);
 
   dmem_misaligned_access <= '0'; -- TODO
 
@@ -95,8 +121,9 @@ begin
 
   with dmem_addr(31 downto 28) select dmem_do <=
     ram_port1_do        when x"0",
-    timer_val           when x"2",
+    timer_do            when x"2",
     x"000000" & uart_do when x"3",
+    dma_do              when x"4",
     (others => '0')     when others;
 
   ---------- Instruction memory ----------
@@ -110,33 +137,62 @@ begin
     end if;
   end process;
 
-  imem_is_boot_rom_access <= '1' when ((imem_addr AND x"FFFFFFE0") = x"10000000") else '0';
+  imem_is_boot_rom_access <= '1' when ((imem_addr AND x"FFFFFF00") = x"10000000") else '0';
 
   imem_invalid_address <= NOT (imem_is_ram_access OR imem_is_boot_rom_access);
 
-  -- Instruction fetches must always be word aligned
-  imem_misaligned_access <= imem_addr(1) OR imem_addr(0);
+  -- Instruction fetches must be halfword aligned. The boot ROM is read a word
+  -- at a time and holds no compressed code, so fetches from it must be word
+  -- aligned.
+  imem_misaligned_access <= imem_addr(0) OR (imem_is_boot_rom_access AND imem_addr(1));
 
   imem_invalid_access <= imem_misaligned_access OR imem_invalid_address;
 
-  with imem_addr(31 downto 28) select imem_do <=
+  -- The RAM and boot ROM register their outputs, so imem_do is chosen by the
+  -- region of the address they were given on the last clock edge. Selecting
+  -- on imem_addr would close a combinational loop through the next PC.
+  process(clk, rst_n)
+  begin
+    if rst_n = '0' then
+      imem_region_reg <= x"1";
+    elsif rising_edge(clk) then
+      imem_region_reg <= imem_addr(31 downto 28);
+    end if;
+  end process;
+
+  with imem_region_reg select imem_do <=
     ram_port2_do    when x"0",
     boot_rom_do     when x"1",
     (others => '0') when others;
 
   ---------- Memory peripheral output signals ----------
 
-  ram_port1_addr  <= dmem_addr((RAM_ADDR_BITS - 1) downto 0);
-  ram_port1_dtype <= dmem_dtype;
-  ram_port1_wd    <= dmem_wd;
-  ram_port1_we    <= dmem_we AND (NOT dmem_invalid_access); -- TODO
+  -- The core must leave RAM and the UART alone while the DMA is busy
+  ram_port1_addr  <= dma_ram_addr((RAM_ADDR_BITS - 1) downto 0) when (dma_busy = '1') else
+                     dmem_addr((RAM_ADDR_BITS - 1) downto 0);
+  ram_port1_dtype <= dma_ram_dtype when (dma_busy = '1') else dmem_dtype;
+  ram_port1_wd    <= dma_ram_wd when (dma_busy = '1') else dmem_wd;
+  -- Only stores to RAM addresses write RAM: the port sees the low address
+  -- bits of every access, so a peripheral store would otherwise alias low
+  -- RAM. dmem_we is only meaningful while dmem_en is set.
+  ram_port1_we    <= dma_ram_we when (dma_busy = '1') else
+                     dmem_is_ram_access AND dmem_en AND dmem_we AND (NOT dmem_invalid_access); -- TODO
   ram_port2_addr  <= imem_addr((RAM_ADDR_BITS - 1) downto 0);
 
-  boot_rom_addr   <= imem_addr(6 downto 2);
+  boot_rom_addr   <= imem_addr(7 downto 2);
 
-  uart_addr       <= dmem_addr(1 downto 0);
-  uart_en         <= dmem_is_uart_access AND dmem_en;
+  timer_addr      <= dmem_addr(3 downto 2);
+  timer_wd        <= dmem_wd;
+  timer_we        <= dmem_is_timer_access AND dmem_en AND dmem_we;
+
+  uart_addr       <= "000" when (dma_busy = '1') else dmem_addr(2 downto 0);
+  uart_en         <= dma_uart_en when (dma_busy = '1') else dmem_is_uart_access AND dmem_en;
   uart_wd         <= dmem_wd(7 downto 0);
-  uart_we         <= uart_en AND dmem_we;
+  uart_we         <= dmem_is_uart_access AND dmem_en AND dmem_we AND NOT dma_busy;
+
+  dma_addr        <= dmem_addr(4 downto 2);
+  dma_en          <= dmem_is_dma_access AND dmem_en;
+  dma_wd          <= dmem_wd;
+  dma_we          <= dmem_is_dma_access AND dmem_en AND dmem_we;
   
 end arch;
@@ -18,15 +18,16 @@ entity ram is
   port (
     clk             : in  std_logic;
 
-    -- Port 1: Read/Write
+    -- Port 1: Read/Write. Loads are sign or zero extended according to
+    -- dtype, and bytes and halfwords are stored from the low bits of wd.
     ram_port1_addr  : in  std_logic_vector((RAM_ADDR_BITS - 1) downto 0);
     ram_port1_dtype : in  std_logic_vector(2 downto 0);
     ram_port1_wd    : in  word_t;
     ram_port1_we    : in  std_logic;
     ram_port1_do    : out word_t;
 
-    -- Port 2: Read only
-    ram_port2_addr  : in  std_logic_vector((RAM_ADDR_BITS - 1) downto 0); -- Bottom 2 bits not used
+    -- Port 2: Read only, a word from any halfword aligned address
+    ram_port2_addr  : in  std_logic_vector((RAM_ADDR_BITS - 1) downto 0); -- Bottom bit not used
     ram_port2_do    : out word_t
   );
 end ram;
@@ -50,6 +51,7 @@ architecture arch of ram is
 
   type byte_array_t is array(0 to 3) of std_logic_vector(7 downto 0);
   type bram_we_array_t is array(0 to 3) of std_logic;
+  type bram_addr_array_t is array(0 to 3) of std_logic_vector((RAM_ADDR_BITS - 3) downto 0);
 
   signal bram_port1_addr  : std_logic_vector((RAM_ADDR_BITS - 3) downto 0);
   signal bram_port1_we    : bram_we_array_t;
@@ -58,6 +60,17 @@ architecture arch of ram is
   signal bram_port2_addr  : bram_addr_array_t;
   signal bram_port2_do    : byte_array_t;
 
+  signal port2_word       : unsigned((RAM_ADDR_BITS - 3) downto 0);  -- Word holding the low half
+  signal port2_next_word  : unsigned((RAM_ADDR_BITS - 3) downto 0);  -- Word after it
+  signal port2_upper_hw   : std_logic := '0'; -- Last read started at the upper halfword
+
+  signal port1_wd         : word_t;     -- Write data copied to each lane it may go to
+  signal port1_dtype      : std_logic_vector(2 downto 0) := (others => '0');  -- Last read's dtype
+  signal port1_offset     : std_logic_vector(1 downto 0) := (others => '0');  -- and byte offset
+  signal port1_word       : word_t;
+  signal port1_hw         : std_logic_vector(15 downto 0);
+  signal port1_byte       : std_logic_vector(7 downto 0);
+
   signal width_is_w       : std_logic;  -- Width is word
   signal width_is_hw      : std_logic;  -- Width is halfword
   signal width_is_b       : std_logic;  -- Width is byte
@@ -85,19 +98,73 @@ begin
         bram_port2_do   => bram_port2_do(ii)
       );
       
-      bram_port1_wd(ii) <= ram_port1_wd((7 + (8 * ii)) downto (8 * ii));
-      
-      bram_port2_addr(ii) <= ram_port2_addr((RAM_ADDR_BITS - 1) downto 2);
+      bram_port1_wd(ii) <= port1_wd((7 + (8 * ii)) downto (8 * ii));
       
-      ram_port2_do((7 + (8 * ii)) downto (8 * ii)) <= bram_port2_do(ii);
-
   end generate;
 
+  -- A read from the upper halfword of a word takes bytes 2 and 3 from that
+  -- word and bytes 0 and 1 from the next one, so 32-bit instructions after a
+  -- compressed one can be fetched in one cycle
+  port2_word      <= unsigned(ram_port2_addr((RAM_ADDR_BITS - 1) downto 2));
+  port2_next_word <= port2_word + 1;
+
+  bram_port2_addr(3) <= std_logic_vector(port2_word);
+  bram_port2_addr(2) <= std_logic_vector(port2_word);
+  bram_port2_addr(1) <= std_logic_vector(port2_next_word) when (ram_port2_addr(1) = '1') else
+                        std_logic_vector(port2_word);
+  bram_port2_addr(0) <= std_logic_vector(port2_next_word) when (ram_port2_addr(1) = '1') else
+                        std_logic_vector(port2_word);
+
+  -- Reads are synchronous, so the halfword select is too
+  process (clk)
+  begin
+    if rising_edge(clk) then
+      port2_upper_hw <= ram_port2_addr(1);
+    end if;
+  end process;
+
+  ram_port2_do <=
+    bram_port2_do(1) & bram_port2_do(0) & bram_port2_do(3) & bram_port2_do(2)
+      when (port2_upper_hw = '1') else
+    bram_port2_do(3) & bram_port2_do(2) & bram_port2_do(1) & bram_port2_do(0);
+
   bram_port1_addr <= ram_port1_addr((RAM_ADDR_BITS - 1) downto 2);
 
-  width_is_w  <= '1' when (dtype(1 downto 0) = "10") else '0';
-  width_is_hw <= '1' when (dtype(1 downto 0) = "01") else '0';
-  width_is_b  <= '1' when (dtype(1 downto 0) = "00") else '0';
+  width_is_w  <= '1' when (ram_port1_dtype(1 downto 0) = "10") else '0';
+  width_is_hw <= '1' when (ram_port1_dtype(1 downto 0) = "01") else '0';
+  width_is_b  <= '1' when (ram_port1_dtype(1 downto 0) = "00") else '0';
+
+  -- Only the lanes picked by the write enables below are written
+  port1_wd <=
+    ram_port1_wd(7 downto 0) & ram_port1_wd(7 downto 0) &
+    ram_port1_wd(7 downto 0) & ram_port1_wd(7 downto 0)   when (width_is_b = '1') else
+    ram_port1_wd(15 downto 0) & ram_port1_wd(15 downto 0) when (width_is_hw = '1') else
+    ram_port1_wd;
+
+  -- Reads are synchronous, so the lane select and extension are too
+  process (clk)
+  begin
+    if rising_edge(clk) then
+      port1_dtype  <= ram_port1_dtype;
+      port1_offset <= ram_port1_addr(1 downto 0);
+    end if;
+  end process;
+
+  port1_word <= bram_port1_do(3) & bram_port1_do(2) & bram_port1_do(1) & bram_port1_do(0);
+  port1_hw   <= port1_word(31 downto 16) when (port1_offset(1) = '1') else port1_word(15 downto 0);
+
+  with port1_offset select port1_byte <=
+    bram_port1_do(0)  when "00",
+    bram_port1_do(1)  when "01",
+    bram_port1_do(2)  when "10",
+    bram_port1_do(3)  when others;
+
+  with port1_dtype select ram_port1_do <=
+    std_logic_vector(resize(signed(port1_byte), 32))  when "000", -- lb
+    std_logic_vector(resize(signed(port1_hw), 32))    when "001", -- lh
+    x"000000" & port1_byte                            when "100", -- lbu
+    x"0000" & port1_hw                                when "101", -- lhu
+    port1_word                                        when others; -- lw
 
   addr_byte_3 <= '1' when (ram_port1_addr(1 downto 0) = "11") else '0';
   addr_byte_2 <= '1' when (ram_port1_addr(1 downto 0) = "10") else '0';
@@ -110,7 +177,7 @@ begin
     (
       (width_is_w)                    OR
       (width_is_hw AND addr_byte_2)   OR
-      (width_is_byte AND addr_byte_3)
+      (width_is_b AND addr_byte_3)
     )
   );
 
@@ -120,7 +187,7 @@ begin
     (
       (width_is_w)                    OR
       (width_is_hw AND addr_byte_2)   OR
-      (width_is_byte AND addr_byte_2)
+      (width_is_b AND addr_byte_2)
     )
   );
 
@@ -130,7 +197,7 @@ begin
     (
       (width_is_w)                    OR
       (width_is_hw AND addr_byte_0)   OR
-      (width_is_byte AND addr_byte_1)
+      (width_is_b AND addr_byte_1)
     )
   );
 
@@ -140,7 +207,7 @@ begin
     (
       (width_is_w)                    OR
       (width_is_hw AND addr_byte_0)   OR
-      (width_is_byte AND addr_byte_0)
+      (width_is_b AND addr_byte_0)
     )
   );
 
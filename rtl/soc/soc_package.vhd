@@ -1,6 +1,6 @@
 --  
---  File:   core_package.vhd
---  Brief:  TODO
+--  File:   soc_package.vhd
+--  Brief:  Types and constants shared by the SoC and the cores
 --
 --  Copyright (C) 2023 Nick Chan
 --  See the LICENSE file at the root of the project for licensing info.
@@ -9,7 +9,7 @@
 library ieee;
 use ieee.std_logic_1164.all;
 
-package core_package is
+package soc_package is
   
   -- In RISC-V, a word is 32 bits
   subtype word_t is std_logic_vector(31 downto 0);
@@ -36,6 +36,11 @@ package core_package is
     dmem_en           : std_logic;                    -- Data memory enable
     dmem_we           : std_logic;                    -- Data memory write enable
     dmem_dtype        : std_logic_vector(2 downto 0); -- Data memory data type
+    muldiv_en         : std_logic;                    -- Multiply/divide enable
+    csr_we            : std_logic;                    -- CSR write enable
+    mret              : std_logic;                    -- Return from a trap
+    wfi               : std_logic;                    -- Wait for an interrupt
+    trap              : std_logic;                    -- Take an interrupt in place of the instruction
   end record;
 
   -- Instruction opcodes
@@ -44,5 +49,9 @@ package core_package is
   constant MREGION_BOOT_ROM : word_t := x"10000000";
   constant MREGION_TIMER    : word_t := x"20000000";
   constant MREGION_UART     : word_t := x"30000000";
+  constant MREGION_DMA      : word_t := x"40000000";
 
-end core_package;
+  -- The cores start executing the boot ROM out of reset
+  constant BOOT_ROM_BASE    : word_t := MREGION_BOOT_ROM;
+
+end soc_package;
@@ -12,7 +12,9 @@ use work.soc_package.all;
 
 entity soc_top is
   generic (
-    CLK_FREQ_HZ     : integer
+    CLK_FREQ_HZ     : integer;
+    RAM_ADDR_BITS   : integer := 11;  -- RAM is 2 ** RAM_ADDR_BITS bytes, see software/system/ram.ld
+    CORE_PIPELINED  : boolean := false  -- Use the five stage pipelined core instead of core_top
   );
   port (
     clk             : in  std_logic;
@@ -45,7 +47,6 @@ architecture arch of soc_top is
   -----------------------------------------------------------------------------
 
   constant UART_BAUD_RATE : integer := 9600;
-  constant RAM_ADDR_BITS  : integer := 10;
 
   -----------------------------------------------------------------------------
   -- Signals
@@ -68,46 +69,100 @@ architecture arch of soc_top is
   signal ram_port2_addr   : std_logic_vector((RAM_ADDR_BITS - 1) downto 0);
   signal ram_port2_do     : word_t;
   
-  signal boot_rom_addr    : std_logic_vector(4 downto 0);
+  signal boot_rom_addr    : std_logic_vector(5 downto 0);
   signal boot_rom_do      : word_t;
   
-  signal timer_val        : word_t;
+  signal timer_addr       : std_logic_vector(1 downto 0);
+  signal timer_wd         : word_t;
+  signal timer_we         : std_logic;
+  signal timer_do         : word_t;
+  signal timer_irq        : std_logic;
 
-  signal uart_addr        : std_logic_vector(1 downto 0);
+  signal uart_addr        : std_logic_vector(2 downto 0);
   signal uart_en          : std_logic;
   signal uart_wd          : std_logic_vector(7 downto 0);
   signal uart_we          : std_logic;
   signal uart_do          : std_logic_vector(7 downto 0);
+  signal uart_rx_ready    : std_logic;
+
+  signal dma_addr         : std_logic_vector(2 downto 0);
+  signal dma_en           : std_logic;
+  signal dma_wd           : word_t;
+  signal dma_we           : std_logic;
+  signal dma_do           : word_t;
+  signal dma_busy         : std_logic;
+  signal dma_ram_addr     : word_t;
+  signal dma_ram_dtype    : std_logic_vector(2 downto 0);
+  signal dma_ram_wd       : word_t;
+  signal dma_ram_we       : std_logic;
+  signal dma_uart_en      : std_logic;
+
+  signal irq_ext          : std_logic;
 
 begin
 
-  core_inst : entity work.core_top(arch)
-    port map (
-      clk         => clk_dbg,
-      rst_n       => rst_n,
-      dmem_en     => dmem_en,
-      dmem_addr   => dmem_addr,
-      dmem_dtype  => dmem_dtype,
-      dmem_wd     => dmem_wd,
-      dmem_we     => dmem_we,
-      dmem_do     => dmem_do,
-      imem_addr   => imem_addr,
-      imem_do     => imem_do,
-      -- Debug
-      dbg_rs3_sel     => dbg_rs3_sel,
-      dbg_rs3_val     => dbg_rs3_val,
-      dbg_curr_instr  => dbg_curr_instr,
-      dbg_imm         => dbg_imm,
-      dbg_curr_pc     => dbg_curr_pc,
-      dbg_alu_result  => dbg_alu_result,
-      dbg_ctrl_sigs   => dbg_ctrl_sigs
-    );
+  -- The UART interrupt is held off while the DMA is receiving its bytes
+  irq_ext <= uart_rx_ready AND NOT dma_busy;
+
+  gen_core_single_cycle : if NOT CORE_PIPELINED generate
+    core_inst : entity work.core_top(arch)
+      port map (
+        clk         => clk_dbg,
+        rst_n       => rst_n,
+        dmem_en     => dmem_en,
+        dmem_addr   => dmem_addr,
+        dmem_dtype  => dmem_dtype,
+        dmem_wd     => dmem_wd,
+        dmem_we     => dmem_we,
+        dmem_do     => dmem_do,
+        imem_addr   => imem_addr,
+        imem_do     => imem_do,
+        irq_timer   => timer_irq,
+        irq_ext     => irq_ext,
+        -- Debug
+        dbg_rs3_sel     => dbg_rs3_sel,
+        dbg_rs3_val     => dbg_rs3_val,
+        dbg_curr_instr  => dbg_curr_instr,
+        dbg_imm         => dbg_imm,
+        dbg_curr_pc     => dbg_curr_pc,
+        dbg_alu_result  => dbg_alu_result,
+        dbg_ctrl_sigs   => dbg_ctrl_sigs
+      );
+  end generate;
+
+  gen_core_pipelined : if CORE_PIPELINED generate
+    core_inst : entity work.core_pipelined(arch)
+      port map (
+        clk         => clk_dbg,
+        rst_n       => rst_n,
+        dmem_en     => dmem_en,
+        dmem_addr   => dmem_addr,
+        dmem_dtype  => dmem_dtype,
+        dmem_wd     => dmem_wd,
+        dmem_we     => dmem_we,
+        dmem_do     => dmem_do,
+        imem_addr   => imem_addr,
+        imem_do     => imem_do,
+        irq_timer   => timer_irq,
+        irq_ext     => irq_ext,
+        -- Debug
+        dbg_rs3_sel     => dbg_rs3_sel,
+        dbg_rs3_val     => dbg_rs3_val,
+        dbg_curr_instr  => dbg_curr_instr,
+        dbg_imm         => dbg_imm,
+        dbg_curr_pc     => dbg_curr_pc,
+        dbg_alu_result  => dbg_alu_result,
+        dbg_ctrl_sigs   => dbg_ctrl_sigs
+      );
+  end generate;
 
   mem_controler_inst : entity work.mem_controller(arch)
     generic map (
       RAM_ADDR_BITS => RAM_ADDR_BITS
     )
     port map (
+      clk             => clk,
+      rst_n           => rst_n,
       dmem_en         => dmem_en,
       dmem_addr       => dmem_addr,
       dmem_dtype      => dmem_dtype,
@@ -125,12 +180,26 @@ begin
       ram_port2_do    => ram_port2_do,
       boot_rom_addr   => boot_rom_addr,
       boot_rom_do     => boot_rom_do,
-      timer_val       => timer_val,
+      timer_addr      => timer_addr,
+      timer_wd        => timer_wd,
+      timer_we        => timer_we,
+      timer_do        => timer_do,
       uart_addr       => uart_addr,
       uart_en         => uart_en,
       uart_wd         => uart_wd,
       uart_we         => uart_we,
-      uart_do         => uart_do
+      uart_do         => uart_do,
+      dma_addr        => dma_addr,
+      dma_en          => dma_en,
+      dma_wd          => dma_wd,
+      dma_we          => dma_we,
+      dma_do          => dma_do,
+      dma_busy        => dma_busy,
+      dma_ram_addr    => dma_ram_addr,
+      dma_ram_dtype   => dma_ram_dtype,
+      dma_ram_wd      => dma_ram_wd,
+      dma_ram_we      => dma_ram_we,
+      dma_uart_en     => dma_uart_en
     );
 
   ram_inst : entity work.ram(arch)
@@ -150,15 +219,21 @@ begin
 
   boot_rom_inst : entity work.boot_rom(arch)
     port map (
+      clk           => clk,
+      rst_n         => rst_n,
       boot_rom_addr => boot_rom_addr,
       boot_rom_do   => boot_rom_do
     );
 
   timer_inst : entity work.timer(arch)
     port map (
-      clk       => clk,
-      rst_n     => rst_n,
-      timer_val => timer_val
+      clk         => clk,
+      rst_n       => rst_n,
+      timer_addr  => timer_addr,
+      timer_wd    => timer_wd,
+      timer_we    => timer_we,
+      timer_do    => timer_do,
+      timer_irq   => timer_irq
     );
 
   uart_inst : entity work.uart(arch)
@@ -175,7 +250,31 @@ begin
       uart_en         => uart_en,
       uart_wd         => uart_wd,
       uart_we         => uart_we,
-      uart_do         => uart_do
+      uart_do         => uart_do,
+      uart_rx_ready   => uart_rx_ready
+    );
+
+  dma_inst : entity work.dma(arch)
+    generic map (
+      RAM_ADDR_BITS => RAM_ADDR_BITS
+    )
+    port map (
+      clk             => clk,
+      rst_n           => rst_n,
+      dma_addr        => dma_addr,
+      dma_en          => dma_en,
+      dma_wd          => dma_wd,
+      dma_we          => dma_we,
+      dma_do          => dma_do,
+      dma_busy        => dma_busy,
+      dma_ram_addr    => dma_ram_addr,
+      dma_ram_dtype   => dma_ram_dtype,
+      dma_ram_wd      => dma_ram_wd,
+      dma_ram_we      => dma_ram_we,
+      dma_ram_do      => ram_port1_do,
+      dma_uart_en     => dma_uart_en,
+      dma_uart_do     => uart_do,
+      uart_rx_ready   => uart_rx_ready
     );
 
   gpio_out <= (others => '0'); -- TODO GPIO
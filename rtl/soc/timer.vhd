@@ -1,10 +1,17 @@
---  
+--
 --  File:   timer.vhd
 --  Brief:  A simple memory mapped timer.
 --
 --  Copyright (C) 2023 Nick Chan
 --  See the LICENSE file at the root of the project for licensing info.
---  
+--
+--  Note: Registers, each a word:
+--
+--    0x00  time      Core clock cycles since reset
+--    0x04  reset     Write: restart time from 0. Reads as 0.
+--    0x08  compare   The interrupt is requested while time >= compare. Only
+--                    written with sw. Resets to 0xFFFFFFFF.
+--
 
 library ieee;
 use ieee.std_logic_1164.all;
@@ -13,15 +20,20 @@ use work.soc_package.all;
 
 entity timer is
   port (
-    clk       : in  std_logic;
-    rst_n     : in  std_logic;
-    timer_val : out word_t
+    clk         : in  std_logic;
+    rst_n       : in  std_logic;
+    timer_addr  : in  std_logic_vector(1 downto 0); -- Word offset
+    timer_wd    : in  word_t;
+    timer_we    : in  std_logic;
+    timer_do    : out word_t;
+    timer_irq   : out std_logic                     -- Machine timer interrupt request
   );
 end timer;
 
 architecture arch of timer is
 
   signal timer_ff : unsigned(31 downto 0) := (others => '0');
+  signal compare  : unsigned(31 downto 0) := (others => '1');
 
 begin
 
@@ -29,11 +41,25 @@ begin
   begin
     if rst_n = '0' then
       timer_ff <= (others => '0');
+      compare  <= (others => '1');
     elsif rising_edge(clk) then
-      timer_ff <= timer_ff + 1;
+      if (timer_we = '1') AND (timer_addr = "01") then
+        timer_ff <= (others => '0');
+      else
+        timer_ff <= timer_ff + 1;
+      end if;
+
+      if (timer_we = '1') AND (timer_addr = "10") then
+        compare <= unsigned(timer_wd);
+      end if;
     end if;
   end process;
 
-  timer_val <= std_logic_vector(timer_ff);
+  with timer_addr select timer_do <=
+    std_logic_vector(timer_ff)  when "00",
+    std_logic_vector(compare)   when "10",
+    (others => '0')             when others;
+
+  timer_irq <= '1' when (timer_ff >= compare) else '0';
 
 end arch;
@@ -4,7 +4,22 @@
 --
 --  Copyright (C) 2023 Nick Chan
 --  See the LICENSE file at the root of the project for licensing info.
---  
+--
+--  Note: Received and transmitted bytes go through FIFOs of 2 ** UART_FIFO_BITS
+--  bytes, so firmware can move data in bursts and the receiver can run at
+--  high baud rates without the core polling every byte. Bytes received while
+--  the RX FIFO is full are dropped. Registers:
+--
+--    0  rx_data    Read: the oldest received byte, popped by the read
+--    1  rx_ready   The RX FIFO is not empty
+--    2  tx_data    Write: a byte to transmit, dropped if the TX FIFO is full
+--    3  tx_busy    The TX FIFO is full
+--    4  rx_count   Bytes in the RX FIFO
+--    5  tx_free    Bytes that can be written to tx_data without checking
+--    6  tx_count   Bytes not fully transmitted yet
+--
+--  A load must only enable the UART for one cycle or it pops rx_data twice.
+--
 
 library ieee;
 use ieee.std_logic_1164.all;
@@ -13,7 +28,8 @@ use ieee.numeric_std.all;
 entity uart is
   generic (
     CLK_FREQ_HZ     : integer;
-    UART_BAUD_RATE  : integer
+    UART_BAUD_RATE  : integer;
+    UART_FIFO_BITS  : integer := 4  -- Each FIFO holds 2 ** UART_FIFO_BITS bytes, at most 128
   );
   port (
     clk             : in  std_logic;
@@ -21,11 +37,12 @@ entity uart is
     uart_rx_pin     : in  std_logic;
     uart_tx_pin     : out std_logic;
 
-    uart_addr       : in  std_logic_vector(1 downto 0);
+    uart_addr       : in  std_logic_vector(2 downto 0);
     uart_en         : in  std_logic;
     uart_wd         : in  std_logic_vector(7 downto 0);
     uart_we         : in  std_logic;
-    uart_do         : out std_logic_vector(7 downto 0)
+    uart_do         : out std_logic_vector(7 downto 0);
+    uart_rx_ready   : out std_logic   -- For the DMA, which cannot poll
   );
 end uart;
 
@@ -34,22 +51,36 @@ architecture arch of uart is
   constant TICKS_IN_FULL_BAUD_CYCLE : integer := CLK_FREQ_HZ / UART_BAUD_RATE;
   constant TICKS_IN_HALF_BAUD_CYCLE : integer := CLK_FREQ_HZ / 2 / UART_BAUD_RATE;
   
+  constant FIFO_DEPTH : integer := 2 ** UART_FIFO_BITS;
+
   type uart_state_t is (idle, start, data, stop);
   signal rx_state         : uart_state_t := idle;
   signal tx_state         : uart_state_t := idle;
-    
+
+  type fifo_t is array(0 to FIFO_DEPTH - 1) of std_logic_vector(7 downto 0);
+
+  -- FIFO pointers have an extra bit to tell a full FIFO from an empty one
+  subtype fifo_ptr_t is unsigned(UART_FIFO_BITS downto 0);
+
   signal received_byte    : std_logic_vector(7 downto 0)  := (others => '0');
-  signal pending_rx_data  : std_logic_vector(7 downto 0)  := (others => '0');
-  signal pending_rx_ready : std_logic := '0';
-  signal pending_rx_cmp   : std_logic := '1';
-  signal rx_ready         : std_logic := '0';
+  signal rx_fifo          : fifo_t;
+  signal rx_wr_ptr        : fifo_ptr_t := (others => '0');
+  signal rx_rd_ptr        : fifo_ptr_t := (others => '0');
+  signal rx_count         : fifo_ptr_t;
+  signal rx_ready         : std_logic;
   signal reading_rx       : std_logic;
-  signal rx_data          : std_logic_vector(7 downto 0)  := (others => '0');
-  
-  signal tx_busy          : std_logic := '0';
+  signal rx_data          : std_logic_vector(7 downto 0);
+
+  signal tx_fifo          : fifo_t;
+  signal tx_wr_ptr        : fifo_ptr_t := (others => '0');
+  signal tx_rd_ptr        : fifo_ptr_t := (others => '0');
+  signal tx_fifo_count    : fifo_ptr_t;
+  signal tx_count         : unsigned(7 downto 0);   -- Including the byte being shifted out
+  signal tx_free          : fifo_ptr_t;
+  signal tx_busy          : std_logic;
   signal tx_data          : std_logic_vector(7 downto 0)  := (others => '0');
   signal writing_tx       : std_logic;
-  
+
   signal uart_do_wd       : std_logic_vector(7 downto 0);
 
 begin
@@ -104,9 +135,12 @@ begin
         when stop =>
           
           if clk_ticks = TICKS_IN_FULL_BAUD_CYCLE - 1 then -- wait for 1 baud rate cycle
-            pending_rx_data   <= received_byte;
-            pending_rx_ready  <= pending_rx_ready XOR '1';
-            rx_state          <= idle;
+            -- Queue the byte, or drop it if the FIFO is full
+            if rx_count /= FIFO_DEPTH then
+              rx_fifo(to_integer(rx_wr_ptr(UART_FIFO_BITS - 1 downto 0))) <= received_byte;
+              rx_wr_ptr <= rx_wr_ptr + 1;
+            end if;
+            rx_state <= idle;
           else
             clk_ticks := clk_ticks + 1;
           end if;
@@ -119,9 +153,19 @@ begin
     end if;
   end process uart_receiver;
   
-  reading_rx <= '1' when (uart_en & uart_we & uart_addr = "1000") else '0';
+  reading_rx <= '1' when (uart_en & uart_we & uart_addr = "10000") else '0';
 
-  writing_tx <= '1' when (uart_en & uart_we & uart_addr = "1110") else '0';
+  writing_tx <= '1' when (uart_en & uart_we & uart_addr = "11010") else '0';
+
+  rx_count      <= rx_wr_ptr - rx_rd_ptr;
+  rx_ready      <= '0' when (rx_count = 0) else '1';
+  rx_data       <= rx_fifo(to_integer(rx_rd_ptr(UART_FIFO_BITS - 1 downto 0)));
+
+  tx_fifo_count <= tx_wr_ptr - tx_rd_ptr;
+  tx_free       <= FIFO_DEPTH - tx_fifo_count;
+  tx_busy       <= '1' when (tx_fifo_count = FIFO_DEPTH) else '0';
+  tx_count      <= resize(tx_fifo_count, 8) + 1 when (tx_state /= idle) else
+                   resize(tx_fifo_count, 8);
 
   uart_transmitter : process(clk)
     variable tick_count : integer range 0 to TICKS_IN_FULL_BAUD_CYCLE - 1 := 0;
@@ -133,14 +177,13 @@ begin
         when idle =>
 
           uart_tx_pin <= '1';
-          tx_busy     <= '0';
           tick_count  := 0;
           bit_count   := 0;
 
-          if writing_tx = '1' then
-            -- The tx data register has been written to so start transmitting
-            tx_busy   <= '1';
-            tx_data   <= uart_wd;
+          if tx_fifo_count /= 0 then
+            -- Start transmitting the oldest queued byte
+            tx_data   <= tx_fifo(to_integer(tx_rd_ptr(UART_FIFO_BITS - 1 downto 0)));
+            tx_rd_ptr <= tx_rd_ptr + 1;
             tx_state  <= start;
           end if;
 
@@ -190,24 +233,31 @@ begin
     end if;
   end process uart_transmitter;
 
+  -- Register accesses pop the RX FIFO and push the TX FIFO
   process(clk)
   begin
     if rising_edge(clk) then
-      if reading_rx = '1' then
-        rx_ready <= '0';
-      elsif (pending_rx_ready XNOR pending_rx_cmp) = '1' then
-        rx_ready <= '1';
-        rx_data <= pending_rx_data;
-        pending_rx_cmp <= pending_rx_cmp XOR '1';
+      if (reading_rx = '1') AND (rx_ready = '1') then
+        rx_rd_ptr <= rx_rd_ptr + 1;
+      end if;
+
+      if (writing_tx = '1') AND (tx_busy = '0') then
+        tx_fifo(to_integer(tx_wr_ptr(UART_FIFO_BITS - 1 downto 0))) <= uart_wd;
+        tx_wr_ptr <= tx_wr_ptr + 1;
       end if;
     end if;
   end process;
 
+  uart_rx_ready <= rx_ready;
+
   with uart_addr select uart_do_wd <=
-    rx_data               when "00",
-    "0000000" & rx_ready  when "01",
-    "0000000" & tx_busy   when "11",
-    x"00"                 when others;
+    rx_data                               when "000",
+    "0000000" & rx_ready                  when "001",
+    "0000000" & tx_busy                   when "011",
+    std_logic_vector(resize(rx_count, 8)) when "100",
+    std_logic_vector(resize(tx_free, 8))  when "101",
+    std_logic_vector(tx_count)            when "110",
+    x"00"                                 when others;
 
   process(clk)
   begin
@@ -0,0 +1,57 @@
+#
+# File:   fmax.tcl
+# Brief:  Synthesize, place and route soc_top with each core and report the
+#         fastest clock each one meets
+#
+# Copyright (C) 2023 Nick Chan
+# See the LICENSE file at the root of the project for licensing info.
+#
+# Usage: vivado -mode batch -source fmax.tcl
+#
+# soc_top is built out of context for the Basys3's part, with clk and clk_dbg
+# constrained to 100 MHz. The fastest clock is the period less the worst
+# negative slack; the critical path of each build is written next to this
+# script as timing_<core>.rpt.
+#
+
+set part xc7a35tcpg236-1
+set period 10.0
+set script_dir [file dirname [file normalize [info script]]]
+set soc_dir [file join $script_dir .. soc]
+
+set sources [concat \
+    [list [file join $soc_dir soc_package.vhd]] \
+    [glob [file join $soc_dir core *.vhd]] \
+    [glob [file join $soc_dir ram *.vhd]] \
+    [list [file join $soc_dir boot_rom.vhd] [file join $soc_dir dma.vhd] \
+          [file join $soc_dir mem_controller.vhd] [file join $soc_dir timer.vhd] \
+          [file join $soc_dir uart.vhd] [file join $soc_dir soc_top.vhd]]]
+
+set results {}
+
+foreach {core pipelined} {core_top false core_pipelined true} {
+    close_project -quiet
+    create_project -in_memory -part $part
+    read_vhdl -vhdl2008 $sources
+
+    synth_design -top soc_top -part $part -mode out_of_context \
+        -generic CLK_FREQ_HZ=100000000 -generic CORE_PIPELINED=$pipelined
+
+    create_clock -name clk -period $period [get_ports clk]
+    create_clock -name clk_dbg -period $period [get_ports clk_dbg]
+
+    opt_design
+    place_design
+    route_design
+
+    set wns [get_property SLACK [get_timing_paths -max_paths 1 -nworst 1 -setup]]
+    set fmax [expr {1000.0 / ($period - $wns)}]
+    report_timing -max_paths 1 -file [file join $script_dir timing_$core.rpt]
+
+    lappend results [format "%-16s WNS %7.3f ns  Fmax %6.1f MHz" $core $wns $fmax]
+}
+
+puts ""
+foreach line $results {
+    puts $line
+}
@@ -0,0 +1,49 @@
+/*
+ * File:    bench.c
+ * Brief:   Benchmark harness: runs the benchmark and prints its checksum
+ * 
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#include "memory_map.h"
+#include "bench.h"
+
+/* The emulator stops when the core fetches from unmapped memory */
+#define HALT_ADDRESS    (0xFFFFFFFCU)
+
+static void bench_putc(char c)
+{
+    while (UART->tx_busy) {}
+    UART->tx_data = c;
+}
+
+static void bench_puts(const char *s)
+{
+    while (*s) {
+        bench_putc(*s++);
+    }
+}
+
+static void bench_puthex(u32 value)
+{
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        bench_putc("0123456789abcdef"[(value >> shift) & 0xF]);
+    }
+}
+
+int main(void)
+{
+    u32 checksum = bench_run();
+
+    bench_puts(bench_name);
+    bench_puts(": ");
+    bench_puthex(checksum);
+    bench_putc('\n');
+
+    /* Wait for the TX FIFO to drain, then stop */
+    while (UART->tx_count) {}
+    ((void (*)(void))HALT_ADDRESS)();
+
+    return 0;
+}
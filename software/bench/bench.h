@@ -0,0 +1,33 @@
+/*
+ * File:    bench.h
+ * Brief:   Interface between the benchmark harness and each benchmark
+ * 
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "integer.h"
+
+/* Defined by each benchmark: its name and its workload. bench_run() returns
+ * a checksum of the results so the work cannot be optimized away and
+ * emulator bugs show up as a wrong checksum. */
+extern const char bench_name[];
+
+u32 bench_run(void);
+
+/* A small xorshift generator for test data. It needs no multiplier, so the
+ * checksums do not depend on the ISA the benchmarks are built for. */
+static inline u32 bench_rand(u32 *state)
+{
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+#endif  /* BENCH_H */
@@ -0,0 +1,42 @@
+/*
+ * File:    crc32.c
+ * Brief:   Bitwise CRC-32 (IEEE 802.3) over a pseudo-random buffer
+ * 
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#include "bench.h"
+
+#define BUF_SIZE    (256)
+#define ITERATIONS  (2048)
+
+const char bench_name[] = "crc32";
+
+static u8 buf[BUF_SIZE];
+
+static u32 crc32(const u8 *data, u32 len, u32 crc)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320U & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+u32 bench_run(void)
+{
+    u32 seed = 0x12345678;
+    u32 crc = 0;
+
+    for (int iter = 0; iter < ITERATIONS; ++iter) {
+        /* Change part of the data each time round */
+        buf[iter % BUF_SIZE] ^= (u8)bench_rand(&seed);
+        crc = crc32(buf, BUF_SIZE, crc);
+    }
+
+    return crc;
+}
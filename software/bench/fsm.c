@@ -0,0 +1,129 @@
+/*
+ * File:    fsm.c
+ * Brief:   Branch-heavy state machine classifying numeric tokens, in the
+ *          style of the CoreMark state benchmark
+ * 
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#include "bench.h"
+
+#define ITERATIONS  (20000)
+
+const char bench_name[] = "fsm";
+
+typedef enum {
+    STATE_START,
+    STATE_INVALID,
+    STATE_S1,
+    STATE_INT,
+    STATE_FLOAT,
+    STATE_EXPONENT,
+    STATE_S2,
+    STATE_SCIENTIFIC,
+    NUM_STATES
+} state_t;
+
+/* Comma separated tokens. One character is corrupted on each pass. */
+static char input[] = "5012,1.2e-3,-874,+122,-.3e+8,1.5,0x1F,12e,-110.700,"
+                      "3.,+1e9,35,.5,-,7e7e7,9999,0.0001,abc,-3.14159,42";
+
+static int is_digit(char c)
+{
+    return (c >= '0') && (c <= '9');
+}
+
+static state_t next_state(state_t state, char c)
+{
+    switch (state) {
+        case STATE_START:
+            if (is_digit(c)) {
+                return STATE_INT;
+            }
+            if ((c == '+') || (c == '-')) {
+                return STATE_S1;
+            }
+            if (c == '.') {
+                return STATE_FLOAT;
+            }
+            return STATE_INVALID;
+        case STATE_S1:
+            if (is_digit(c)) {
+                return STATE_INT;
+            }
+            if (c == '.') {
+                return STATE_FLOAT;
+            }
+            return STATE_INVALID;
+        case STATE_INT:
+            if (is_digit(c)) {
+                return STATE_INT;
+            }
+            if (c == '.') {
+                return STATE_FLOAT;
+            }
+            if ((c == 'e') || (c == 'E')) {
+                return STATE_S2;
+            }
+            return STATE_INVALID;
+        case STATE_FLOAT:
+            if (is_digit(c)) {
+                return STATE_FLOAT;
+            }
+            if ((c == 'e') || (c == 'E')) {
+                return STATE_S2;
+            }
+            return STATE_INVALID;
+        case STATE_S2:
+            if ((c == '+') || (c == '-')) {
+                return STATE_EXPONENT;
+            }
+            if (is_digit(c)) {
+                return STATE_SCIENTIFIC;
+            }
+            return STATE_INVALID;
+        case STATE_EXPONENT:
+        case STATE_SCIENTIFIC:
+            if (is_digit(c)) {
+                return STATE_SCIENTIFIC;
+            }
+            return STATE_INVALID;
+        default:
+            return STATE_INVALID;
+    }
+}
+
+u32 bench_run(void)
+{
+    u32 final_counts[NUM_STATES] = { 0 };
+    u32 seed = 0x5EED;
+    u32 sum = 0;
+
+    for (int iter = 0; iter < ITERATIONS; ++iter) {
+        state_t state = STATE_START;
+
+        for (const char *p = input; *p; ++p) {
+            if (*p == ',') {
+                ++final_counts[state];
+                state = STATE_START;
+            }
+            else {
+                state = next_state(state, *p);
+            }
+        }
+        ++final_counts[state];
+
+        /* Corrupt one character for the next pass */
+        u32 pos = bench_rand(&seed) % (sizeof(input) - 1);
+        if (input[pos] != ',') {
+            input[pos] ^= (iter & 1) ? 0x01 : 0x10;
+        }
+    }
+
+    for (int idx = 0; idx < NUM_STATES; ++idx) {
+        sum = (sum << 3) ^ (sum >> 29) ^ final_counts[idx];
+    }
+
+    return sum;
+}
@@ -0,0 +1,102 @@
+/*
+ * File:    intmix.c
+ * Brief:   Record copies, string compares, switches and integer multiply
+ *          and divide, in the style of Dhrystone
+ * 
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#include "bench.h"
+
+#define ITERATIONS  (20000)
+
+const char bench_name[] = "intmix";
+
+typedef enum { IDENT_1, IDENT_2, IDENT_3, IDENT_4, IDENT_5 } ident_t;
+
+typedef struct record {
+    struct record *ptr_comp;
+    ident_t discr;
+    ident_t enum_comp;
+    int int_comp;
+    char str_comp[16];
+} record_t;
+
+static record_t records[2];
+static char str_1[16] = "DHRYSTONE 1ST ";
+static char str_2[16] = "DHRYSTONE 2ND ";
+static int array[16];
+
+static int str_compare(const char *a, const char *b)
+{
+    while (*a && (*a == *b)) {
+        ++a;
+        ++b;
+    }
+    return (int)(u8)*a - (int)(u8)*b;
+}
+
+static void str_copy(char *dest, const char *src)
+{
+    while ((*dest++ = *src++)) {}
+}
+
+static ident_t func_1(char c1, char c2)
+{
+    return (c1 != c2) ? IDENT_1 : IDENT_2;
+}
+
+static ident_t proc_6(ident_t value, int int_par)
+{
+    switch (value) {
+        case IDENT_1: return (int_par > 100) ? IDENT_1 : IDENT_4;
+        case IDENT_2: return IDENT_1;
+        case IDENT_3: return IDENT_2;
+        case IDENT_4: return IDENT_3;
+        default:      return IDENT_5;
+    }
+}
+
+static void proc_1(record_t *rec, int run)
+{
+    record_t *next = rec->ptr_comp;
+
+    *next = *rec;
+    next->int_comp = rec->int_comp * 5 + run;
+    next->enum_comp = proc_6(rec->enum_comp, next->int_comp);
+    next->ptr_comp = rec;
+    rec->int_comp = (next->int_comp / 3) % 1000 + (next->int_comp % 7);
+}
+
+u32 bench_run(void)
+{
+    u32 sum = 0;
+
+    records[0].ptr_comp = &records[1];
+    records[0].discr = IDENT_1;
+    records[0].enum_comp = IDENT_3;
+    records[0].int_comp = 40;
+    str_copy(records[0].str_comp, "DHRYSTONE SOME ");
+
+    for (int run = 1; run <= ITERATIONS; ++run) {
+        int int_1 = 2;
+        int int_2 = 3;
+        int int_3 = int_1 * int_2 - run % 11;
+
+        str_2[12] = (char)('A' + run % 4);
+        ident_t ident = func_1(str_1[12], str_2[12]);
+        if (str_compare(str_1, str_2) > 0) {
+            ++int_1;
+        }
+
+        proc_1(&records[0], run);
+        array[run & 15] += int_3 + (int)ident;
+        int_2 = (int_2 * int_3 + array[(run + 5) & 15]) / (int_1 + 1);
+
+        sum += (u32)(int_2 + records[0].int_comp + (int)records[1].enum_comp);
+        sum ^= (u32)str_compare(records[1].str_comp, str_1);
+    }
+
+    return sum;
+}
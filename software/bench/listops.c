@@ -0,0 +1,118 @@
+/*
+ * File:    listops.c
+ * Brief:   Linked list find, reverse and merge sort, in the style of the
+ *          CoreMark list benchmark
+ * 
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#include "bench.h"
+
+#define NUM_NODES   (48)
+#define ITERATIONS  (3000)
+
+const char bench_name[] = "listops";
+
+typedef struct node {
+    struct node *next;
+    u16 key;
+    u16 data;
+} node_t;
+
+static node_t nodes[NUM_NODES];
+
+static node_t *list_find(node_t *list, u16 key)
+{
+    while (list && (list->key != key)) {
+        list = list->next;
+    }
+    return list;
+}
+
+static node_t *list_reverse(node_t *list)
+{
+    node_t *prev = 0;
+    while (list) {
+        node_t *next = list->next;
+        list->next = prev;
+        prev = list;
+        list = next;
+    }
+    return prev;
+}
+
+/* Bottom-up merge sort by data, as in CoreMark */
+static node_t *list_sort(node_t *list)
+{
+    for (int insize = 1; ; insize <<= 1) {
+        node_t *p = list;
+        node_t *tail = 0;
+        int merges = 0;
+
+        list = 0;
+        while (p) {
+            node_t *q = p;
+            int psize = 0;
+            ++merges;
+
+            for (int idx = 0; (idx < insize) && q; ++idx) {
+                ++psize;
+                q = q->next;
+            }
+
+            int qsize = insize;
+            while ((psize > 0) || ((qsize > 0) && q)) {
+                node_t *e;
+                if (psize == 0) {
+                    e = q; q = q->next; --qsize;
+                }
+                else if ((qsize == 0) || !q || (p->data <= q->data)) {
+                    e = p; p = p->next; --psize;
+                }
+                else {
+                    e = q; q = q->next; --qsize;
+                }
+
+                if (tail) {
+                    tail->next = e;
+                }
+                else {
+                    list = e;
+                }
+                tail = e;
+            }
+            p = q;
+        }
+        tail->next = 0;
+
+        if (merges <= 1) {
+            return list;
+        }
+    }
+}
+
+u32 bench_run(void)
+{
+    u32 seed = 0xFEEDBEEF;
+    u32 sum = 0;
+
+    for (int iter = 0; iter < ITERATIONS; ++iter) {
+        for (int idx = 0; idx < NUM_NODES; ++idx) {
+            nodes[idx].next = (idx + 1 < NUM_NODES) ? &nodes[idx + 1] : 0;
+            nodes[idx].key = (u16)idx;
+            nodes[idx].data = (u16)bench_rand(&seed);
+        }
+
+        node_t *list = list_sort(&nodes[0]);
+        list = list_reverse(list);
+
+        for (int idx = 0; idx < NUM_NODES; idx += 3) {
+            node_t *found = list_find(list, (u16)((idx * 7 + iter) % 64));
+            sum += found ? found->data : 1;
+        }
+        sum ^= list->data;
+    }
+
+    return sum;
+}
@@ -0,0 +1,68 @@
+/*
+ * File:    memops.c
+ * Brief:   Word and byte memcpy and memset over RAM buffers
+ * 
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#include "bench.h"
+
+#define BUF_WORDS   (64)
+#define ITERATIONS  (40000)
+
+const char bench_name[] = "memops";
+
+static u32 src[BUF_WORDS];
+static u32 dst[BUF_WORDS];
+
+static void copy_words(u32 *d, const u32 *s, u32 words)
+{
+    /* Unrolled by 4 like a typical library copy */
+    while (words >= 4) {
+        u32 a = s[0], b = s[1], c = s[2], e = s[3];
+        d[0] = a; d[1] = b; d[2] = c; d[3] = e;
+        d += 4;
+        s += 4;
+        words -= 4;
+    }
+    while (words--) {
+        *d++ = *s++;
+    }
+}
+
+static void copy_bytes(u8 *d, const u8 *s, u32 len)
+{
+    while (len--) {
+        *d++ = *s++;
+    }
+}
+
+static void set_words(u32 *d, u32 value, u32 words)
+{
+    while (words--) {
+        *d++ = value;
+    }
+}
+
+u32 bench_run(void)
+{
+    u32 seed = 0xC0FFEE;
+    u32 sum = 0;
+
+    for (int idx = 0; idx < BUF_WORDS; ++idx) {
+        src[idx] = bench_rand(&seed);
+    }
+
+    for (int iter = 0; iter < ITERATIONS; ++iter) {
+        set_words(dst, (u32)iter, BUF_WORDS);
+        copy_words(dst, src, BUF_WORDS - (iter & 7));
+
+        /* Misaligned byte copies within the buffer */
+        copy_bytes((u8 *)dst + 1 + (iter & 3), (const u8 *)src, 64);
+
+        sum += dst[iter % BUF_WORDS] ^ dst[BUF_WORDS - 1];
+    }
+
+    return sum;
+}
@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# File:    run_bench.sh
+# Brief:   Runs the benchmarks on the emulator and reports their throughput
+#
+# Each benchmark runs once on the interpreter and once on the translator. One
+# CSV line is printed per run:
+#
+#   benchmark,engine,status,insts,seconds,mips
+#
+# status is "ok", "wrong" if the printed checksum differs from expected.txt,
+# "slow" if MIPS fell more than the tolerance below the baseline, or the
+# runner's result if the guest did not halt or exit with code 0. The exit code is non-zero if any
+# run is not "ok". Save the output as a baseline to compare later runs to.
+#
+# Copyright (C) 2023 Nick Chan
+# See the LICENSE file at the root of the project for licensing info.
+
+usage() {
+    echo "Usage: $0 [-e emulator_dir] [-M ram_size] [-b baseline.csv] [-t tolerance_pct] benchmark.elf..."
+    exit 1
+}
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+EMULATOR_DIR="$SCRIPT_DIR/../../emulator"
+RAM_SIZE=2048
+BASELINE=
+TOLERANCE=10
+
+while getopts "e:M:b:t:h" opt; do
+    case $opt in
+        e) EMULATOR_DIR=$OPTARG ;;
+        M) RAM_SIZE=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        t) TOLERANCE=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] || usage
+
+OUT_DIR=$(mktemp -d)
+trap 'rm -rf "$OUT_DIR"' EXIT
+
+echo "benchmark,engine,status,insts,seconds,mips"
+failed=0
+
+for engine in interp jit; do
+    jit_flag=
+    [ $engine = jit ] && jit_flag=-j
+
+    # One thread so the runs do not compete for the host
+    "$EMULATOR_DIR/rv_runner" -p 1 -m -M "$RAM_SIZE" -o "$OUT_DIR" $jit_flag "$@" > "$OUT_DIR/results.csv"
+
+    # Skip the header and anything the emulator printed that is not CSV
+    tail -n +2 "$OUT_DIR/results.csv" | grep , > "$OUT_DIR/rows.csv"
+    while IFS=, read -r image result insts cycles seconds mips; do
+        base=$(basename "$image")
+        name=${base%.elf}
+
+        status=ok
+        if [ "$result" != EXITED ]; then
+            status=$(echo "$result" | tr 'A-Z' 'a-z')
+        elif [ "$(cat "$OUT_DIR/$base.uart" 2>/dev/null)" != "$(grep "^$name: " "$SCRIPT_DIR/expected.txt")" ]; then
+            status=wrong
+        elif [ -n "$BASELINE" ]; then
+            base_mips=$(awk -F, -v n="$name" -v e="$engine" '$1 == n && $2 == e { print $6 }' "$BASELINE")
+            if [ -n "$base_mips" ] && \
+               awk -v m="$mips" -v b="$base_mips" -v t="$TOLERANCE" 'BEGIN { exit !(m < b * (100 - t) / 100) }'; then
+                status=slow
+            fi
+        fi
+
+        [ $status = ok ] || failed=1
+        echo "$name,$engine,$status,$insts,$seconds,$mips"
+    done < "$OUT_DIR/rows.csv"
+done
+
+exit $failed
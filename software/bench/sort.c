@@ -0,0 +1,71 @@
+/*
+ * File:    sort.c
+ * Brief:   Insertion sort and binary search over an array of words
+ * 
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#include "bench.h"
+
+#define NUM_KEYS    (96)
+#define ITERATIONS  (1000)
+
+const char bench_name[] = "sort";
+
+static u32 keys[NUM_KEYS];
+
+static void insertion_sort(u32 *a, int n)
+{
+    for (int i = 1; i < n; ++i) {
+        u32 key = a[i];
+        int j = i - 1;
+        while ((j >= 0) && (a[j] > key)) {
+            a[j + 1] = a[j];
+            --j;
+        }
+        a[j + 1] = key;
+    }
+}
+
+static int binary_search(const u32 *a, int n, u32 key)
+{
+    int lo = 0;
+    int hi = n - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) >> 1;
+        if (a[mid] == key) {
+            return mid;
+        }
+        if (a[mid] < key) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+u32 bench_run(void)
+{
+    u32 seed = 0xBADC0DE;
+    u32 sum = 0;
+
+    for (int iter = 0; iter < ITERATIONS; ++iter) {
+        for (int idx = 0; idx < NUM_KEYS; ++idx) {
+            keys[idx] = bench_rand(&seed) >> 16;
+        }
+
+        insertion_sort(keys, NUM_KEYS);
+
+        /* Half of the probes hit */
+        for (int idx = 0; idx < NUM_KEYS; ++idx) {
+            u32 probe = (idx & 1) ? keys[idx] : (bench_rand(&seed) >> 16);
+            sum += (u32)binary_search(keys, NUM_KEYS, probe);
+        }
+        sum ^= keys[iter % NUM_KEYS];
+    }
+
+    return sum;
+}
@@ -0,0 +1,17 @@
+/*
+ * File:    console.h
+ * Brief:   Console on the UART, used by printf and friends via syscalls.c
+ *
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+/* Output is buffered in RAM and sent as the UART has room, on later writes
+ * and reads and at exit. Call this to wait until everything written so far
+ * has been sent. */
+void console_flush(void);
+
+#endif  /* CONSOLE_H */
@@ -0,0 +1,26 @@
+/*
+ * File:    dma.h
+ * Brief:   DMA driver
+ *
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#ifndef DMA_H
+#define DMA_H
+
+#include "integer.h"
+
+/* Each call waits for its transfer and returns 0, or -1 if the DMA rejected
+ * it. Bytes the DMA cannot move a word at a time are moved by the core. */
+
+/* Set len bytes at dst to value, like memset */
+int dma_fill(void *dst, u8 value, u32 len);
+
+/* Copy len bytes from src to dst, like memcpy. The regions must not overlap. */
+int dma_copy(void *dst, const void *src, u32 len);
+
+/* Store the next len bytes received by the UART at dst */
+int dma_uart_receive(void *dst, u32 len);
+
+#endif  /* DMA_H */
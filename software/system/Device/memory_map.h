@@ -16,7 +16,11 @@ typedef struct __attribute__((packed))
     volatile u8 rx_data;
     volatile u8 rx_ready;
     volatile u8 tx_data;
-    volatile u8 tx_busy;
+    volatile u8 tx_busy;    /* TX FIFO full */
+    volatile u8 rx_count;   /* Bytes waiting in the RX FIFO */
+    volatile u8 tx_free;    /* Bytes that can be written without waiting */
+    volatile u8 tx_count;   /* Bytes still to be sent */
+    volatile u8 reserved;
 } uart_t;
 
 #define UART ((uart_t*)0x30000000)
@@ -33,8 +37,32 @@ typedef struct __attribute__((packed))
 {
     volatile u32   time;
     volatile u8    reset;
+    volatile u8    reserved[3];
+    volatile u32   compare;     /* Interrupt while time >= compare */
 } timer_t;
 
 #define TIMER ((timer_t*)0x20000000)
 
+typedef struct __attribute__((packed))
+{
+    volatile u32 src;       /* Copy source */
+    volatile u32 dst;
+    volatile u32 len;       /* Bytes to transfer */
+    volatile u32 fill;      /* Word stored by a fill */
+    volatile u32 ctrl;      /* Write a DMA_CMD_*, read DMA_STATUS_* */
+} dma_t;
+
+#define DMA ((dma_t*)0x40000000)
+
+#define DMA_CMD_FILL        (1U)
+#define DMA_CMD_COPY        (2U)
+#define DMA_CMD_UART_RX     (3U)
+
+#define DMA_STATUS_BUSY     (1U << 0)
+#define DMA_STATUS_ERROR    (1U << 1)
+
+/* Emulator only: storing a word here ends emulation with it as the exit
+ * code. The SoC has nothing mapped here and drops the store. */
+#define EXIT_CODE (*(volatile u32*)0x50000000)
+
 #endif  /* MEMORY_MAP_H */
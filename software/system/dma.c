@@ -0,0 +1,95 @@
+/*
+ * File:    dma.c
+ * Brief:   DMA driver
+ *
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
+
+#include "memory_map.h"
+#include "dma.h"
+
+/* Start a transfer and wait for it. The core must leave RAM and the UART
+ * alone while the DMA is busy, so the wait is written out to keep the
+ * compiler from touching the stack. */
+static int dma_run(u32 cmd)
+{
+    u32 status;
+
+    __asm__ volatile (
+        "    sw      %2, 16(%1)\n"      /* ctrl */
+        "1:  lw      %0, 16(%1)\n"
+        "    andi    %0, %0, 1\n"       /* DMA_STATUS_BUSY */
+        "    bnez    %0, 1b\n"
+        : "=&r" (status)
+        : "r" (DMA), "r" (cmd)
+        : "memory");
+
+    return (DMA->ctrl & DMA_STATUS_ERROR) ? -1 : 0;
+}
+
+int dma_fill(void *dst, u8 value, u32 len)
+{
+    u8 *d = dst;
+
+    while (((u32)d & 0b11) && len) {
+        *d++ = value;
+        len--;
+    }
+
+    if (len >= 4) {
+        DMA->dst = (u32)d;
+        DMA->len = len & ~0b11U;
+        DMA->fill = value * 0x01010101U;
+        if (dma_run(DMA_CMD_FILL) != 0) {
+            return -1;
+        }
+        d += len & ~0b11U;
+        len &= 0b11;
+    }
+
+    while (len--) {
+        *d++ = value;
+    }
+
+    return 0;
+}
+
+int dma_copy(void *dst, const void *src, u32 len)
+{
+    u8 *d = dst;
+    const u8 *s = src;
+
+    /* Words can only be copied if both sides line up */
+    if ((((u32)d ^ (u32)s) & 0b11) == 0) {
+        while (((u32)d & 0b11) && len) {
+            *d++ = *s++;
+            len--;
+        }
+
+        if (len >= 4) {
+            DMA->src = (u32)s;
+            DMA->dst = (u32)d;
+            DMA->len = len & ~0b11U;
+            if (dma_run(DMA_CMD_COPY) != 0) {
+                return -1;
+            }
+            d += len & ~0b11U;
+            s += len & ~0b11U;
+            len &= 0b11;
+        }
+    }
+
+    while (len--) {
+        *d++ = *s++;
+    }
+
+    return 0;
+}
+
+int dma_uart_receive(void *dst, u32 len)
+{
+    DMA->dst = (u32)dst;
+    DMA->len = len;
+    return dma_run(DMA_CMD_UART_RX);
+}
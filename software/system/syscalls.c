@@ -1,20 +1,161 @@
+/*
+ * File:    syscalls.c
+ * Brief:   newlib system calls: a console on the UART and a heap in RAM
+ *
+ * Copyright (C) 2023 Nick Chan
+ * See the LICENSE file at the root of the project for licensing info.
+*/
 
-int _getpid(void)
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "memory_map.h"
+#include "console.h"
+
+#undef errno
+extern int errno;
+
+/* Console output waits here until the UART's TX FIFO has room, so writes
+ * only block once it fills. Must be a power of 2. */
+#define TX_BUFFER_SIZE  (256U)
+
+#define STDIN_FILENO    (0)
+#define STDOUT_FILENO   (1)
+#define STDERR_FILENO   (2)
+
+/* End of .bss, where the heap starts (see ram.ld) */
+extern char _ebss[];
+
+static u8 tx_buffer[TX_BUFFER_SIZE];
+static u32 tx_head;     /* Next byte to queue */
+static u32 tx_tail;     /* Next byte to send */
+
+static char *heap_end = _ebss;
+
+/* Send as many buffered bytes as the TX FIFO has room for. tx_free is read
+ * once per burst instead of polling tx_busy before every byte. */
+static void console_drain(void)
 {
-    return 1;
+    u32 room = UART->tx_free;
+
+    while (room-- && (tx_tail != tx_head)) {
+        UART->tx_data = tx_buffer[tx_tail++ % TX_BUFFER_SIZE];
+    }
 }
 
-int _kill(int, int)
+void console_flush(void)
 {
-    return -1;
+    while (tx_tail != tx_head) {
+        console_drain();
+    }
+    while (UART->tx_count) {}
 }
 
-void _exit(int)
+int _write(int file, char *p, int len)
 {
-    while (1) {}
+    if ((file != STDOUT_FILENO) && (file != STDERR_FILENO)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    for (int i = 0; i < len; i++) {
+        while (tx_head - tx_tail == TX_BUFFER_SIZE) {
+            console_drain();
+        }
+        tx_buffer[tx_head++ % TX_BUFFER_SIZE] = p[i];
+    }
+    console_drain();
+
+    return len;
 }
 
+/* Waits for at least one byte, then returns what has arrived up to len */
 int _read(int file, char *p, int len)
 {
-    
+    u32 count;
+
+    if (file != STDIN_FILENO) {
+        errno = EBADF;
+        return -1;
+    }
+    if (len <= 0) {
+        return 0;
+    }
+
+    /* Show any prompt before waiting for the reply */
+    console_flush();
+
+    while ((count = UART->rx_count) == 0) {}
+    if (count > (u32)len) {
+        count = len;
+    }
+    for (u32 i = 0; i < count; i++) {
+        p[i] = UART->rx_data;
+    }
+
+    return count;
+}
+
+/* The heap grows up from the end of .bss towards the stack */
+void *_sbrk(int incr)
+{
+    char *sp;
+    char *prev = heap_end;
+
+    __asm__ volatile ("mv %0, sp" : "=r" (sp));
+    if (heap_end + incr > sp) {
+        errno = ENOMEM;
+        return (void*)-1;
+    }
+
+    heap_end += incr;
+    return prev;
+}
+
+int _close(int file)
+{
+    (void)file;
+    return -1;
+}
+
+int _fstat(int file, struct stat *st)
+{
+    (void)file;
+    st->st_mode = S_IFCHR;
+    return 0;
+}
+
+int _isatty(int file)
+{
+    return (file == STDIN_FILENO) || (file == STDOUT_FILENO) || (file == STDERR_FILENO);
+}
+
+int _lseek(int file, int offset, int whence)
+{
+    (void)file;
+    (void)offset;
+    (void)whence;
+    return 0;
+}
+
+int _getpid(void)
+{
+    return 1;
+}
+
+int _kill(int pid, int sig)
+{
+    (void)pid;
+    (void)sig;
+    errno = EINVAL;
+    return -1;
+}
+
+/* Stops the emulator with status as its exit code. The SoC has no exit
+ * register, so it stays here. */
+void _exit(int status)
+{
+    console_flush();
+    EXIT_CODE = (u32)status;
+    while (1) {}
 }